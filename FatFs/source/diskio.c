@@ -21,6 +21,51 @@ uint8_t diskio_buffer_rx[ICEBLK_SECTOR_SIZE] __attribute__ ((aligned(64)));
 uint8_t diskio_buffer_tx[ICEBLK_SECTOR_SIZE] __attribute__ ((aligned(64)));
 
 
+/*-----------------------------------------------------------------------*/
+/* Split a transfer into requests IceBlk can handle                      */
+/*-----------------------------------------------------------------------*/
+/**
+ * FatFs passes multi-sector reads and writes straight through from the
+ * caller's buffer (e.g. the FTP server's zero-copy transfers), but IceBlk
+ * accepts at most max_req_len sectors per request.
+ */
+static DRESULT disk_transfer(int write, BYTE *buff, DWORD sector, UINT count)
+{
+	DRESULT res = RES_OK;
+
+	/* max_req_len is only known once IceBlk is initialized */
+	bsp_init_wait();
+
+	while ((count > 0) && (res == RES_OK)) {
+		UINT chunk = count;
+		if (chunk > IceblkDevInstance.max_req_len) {
+			chunk = IceblkDevInstance.max_req_len;
+		}
+
+		/* IceBlk copies through its own aligned buffer, so buff needs no special alignment */
+		int devres = iceblk_queue_request(&IceblkDevInstance, write, buff, chunk, sector);
+		switch (devres) {
+			case 0:
+				res = RES_OK;
+				break;
+			case 1:
+				res = RES_ERROR;
+				break;
+			case -1:
+				res = RES_NOTRDY;
+				break;
+		}
+
+		buff += chunk * ICEBLK_SECTOR_SIZE;
+		sector += chunk;
+		count -= chunk;
+	}
+
+	return res;
+}
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
 /*-----------------------------------------------------------------------*/
@@ -30,6 +75,7 @@ DSTATUS disk_status (
 )
 {
 	(void)pdrv; /* always zero in our case */
+	bsp_init_wait();
 	if (IceblkDevInstance.disk_present) {
 		return STA_OK;
 	} else {
@@ -67,25 +113,13 @@ DRESULT disk_read (
 )
 {
 	(void)pdrv; /* always zero in our case */
-	DRESULT res = RES_ERROR;
+	DRESULT res;
 	#if DEBUG_DISKIO
 	printf("disk_read: buff @ 0x%x, sector: %u, count: %u\r\n",
 		buff, sector, count);
 	#endif
 
-	/* Assuming the buffer is 64-bit aligned, we can pass it freely to IceBlk */
-	int devres = iceblk_queue_request(&IceblkDevInstance, ICEBLK_REQ_READ, buff, count, sector);
-	switch (devres) {
-		case 0:
-			res = RES_OK;
-			break;
-		case 1:
-			res = RES_ERROR;
-			break;
-		case -1:
-			res = RES_NOTRDY;
-			break;
-	}
+	res = disk_transfer(ICEBLK_REQ_READ, buff, sector, count);
 
 	return res;
 }
@@ -106,25 +140,13 @@ DRESULT disk_write (
 )
 {
 	(void)pdrv; /* always zero in our case */
-	DRESULT res = RES_ERROR;
+	DRESULT res;
 	#if DEBUG_DISKIO
 	printf("disk_write: buff @ 0x%x, sector: %u, count: %u\r\n",
 		buff, sector, count);
 	#endif
 
-	/* Assuming the buffer is 64-bit aligned, we can pass it freely to IceBlk */
-	int devres = iceblk_queue_request(&IceblkDevInstance, ICEBLK_REQ_WRITE, (BYTE*)buff, count, sector);
-	switch (devres) {
-		case 0:
-			res = RES_OK;
-			break;
-		case 1:
-			res = RES_ERROR;
-			break;
-		case -1:
-			res = RES_NOTRDY;
-			break;
-	}
+	res = disk_transfer(ICEBLK_REQ_WRITE, (BYTE*)buff, sector, count);
 
 	return res;
 }
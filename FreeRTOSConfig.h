@@ -167,6 +167,8 @@ to exclude the API function. */
 #define INCLUDE_xTimerPendFunctionCall 1
 #define INCLUDE_xTaskAbortDelay 1
 #define INCLUDE_xTaskGetHandle 1
+#define INCLUDE_xTaskGetCurrentTaskHandle 1
+#define INCLUDE_xTaskGetSchedulerState 1
 #define INCLUDE_xSemaphoreGetMutexHolder 1
 
 /* Normal assert() semantics without relying on the provision of an assert.h
@@ -180,6 +182,31 @@ header file. */
             ;                     \
     }
 
+/* In-memory trace of the kernel hooks, `make TRACE=1`, see bsp/trace.h */
+#ifndef configUSE_TRACE_RECORDER
+#define configUSE_TRACE_RECORDER 0
+#endif
+#if configUSE_TRACE_RECORDER
+#include "trace.h"
+#endif
+
+/* Sampling PC profiler on the tick, `make PROFILE=1`, see bsp/prof.h */
+#ifndef configUSE_PROFILER
+#define configUSE_PROFILER 0
+#endif
+
+/* Constant time allocator instead of heap_4, `make HEAP=tlsf`, see bsp/heap_tlsf.h */
+#ifndef configUSE_TLSF_HEAP
+#define configUSE_TLSF_HEAP 0
+#endif
+
+/* Kernel objects from storage reserved at link time, `make STATIC=1`, see bsp/rtos_static.h */
+#ifndef configSUPPORT_STATIC_ALLOCATION
+#define configSUPPORT_STATIC_ALLOCATION 0
+#endif
+/* Places that storage in the .rtos_static section, zeroed at boot */
+#define configSTATIC_STORAGE __attribute__((section(".rtos_static")))
+
 #ifdef BESSPIN_TOOL_SUITE
     #include "besspinFreeRTOSConfig.h"
 #endif
@@ -232,12 +232,8 @@ aborted. */
 #define ipconfigUDP_TIME_TO_LIVE		128
 #define ipconfigTCP_TIME_TO_LIVE		128 /* also defined in FreeRTOSIPConfigDefaults.h */
 
-/* USE_TCP: Use TCP and all its features */
-#ifdef NETBOOT
-    #define ipconfigUSE_TCP				0
-#else
-    #define ipconfigUSE_TCP             1
-#endif
+/* USE_TCP: Use TCP and all its features.  Netboot needs it for HTTP. */
+#define ipconfigUSE_TCP             1
 
 /* USE_WIN: Let TCP use windowing mechanism. */
 #define ipconfigUSE_TCP_WIN			( 1 )
@@ -246,8 +242,13 @@ aborted. */
 contain.  For normal Ethernet V2 frames the maximum MTU is 1500.  Setting a
 lower value can save RAM, depending on the buffer management scheme used.  If
 ipconfigCAN_FRAGMENT_OUTGOING_PACKETS is 1 then (ipconfigNETWORK_MTU - 28) must
-be divisible by 8. */
-#define ipconfigNETWORK_MTU		1200
+be divisible by 8.  Netboot uses full size frames, so that a TFTP block fills a
+frame (see TFTP_MAX_BLKSIZE). */
+#ifdef NETBOOT
+    #define ipconfigNETWORK_MTU		1500
+#else
+    #define ipconfigNETWORK_MTU		1200
+#endif
 
 /* If ipconfigREPLY_TO_INCOMING_PINGS is set to 1 then the IP stack will
 generate replies to incoming ICMP echo (ping) requests. */
@@ -299,6 +300,19 @@ maximum size.  Define the size of Rx buffer for TCP sockets. */
 /* Define the size of Tx buffer for TCP sockets. */
 #define ipconfigTCP_TX_BUFFER_LENGTH			( 1000 )
 
+/* The FTP data sockets get larger buffers and windows than the default, so that
+bulk uploads and downloads are not limited by the 1000-byte stream buffers above.
+The windows are expressed in segments. */
+#define ipconfigFTP_TX_BUFSIZE					( 16 * ipconfigTCP_MSS )
+#define ipconfigFTP_TX_WINSIZE					( 16 )
+#define ipconfigFTP_RX_BUFSIZE					( 16 * ipconfigTCP_MSS )
+#define ipconfigFTP_RX_WINSIZE					( 16 )
+
+/* Let the FTP server move file data between FatFs and the socket streams without
+copying it through its own file buffer. */
+#define ipconfigFTP_ZERO_COPY_ALIGNED_WRITES	( 1 )
+#define ipconfigFTP_TX_ZERO_COPY				( 1 )
+
 /* When using call-back handlers, the driver may check if the handler points to
 real program memory (RAM or flash) or just has a random non-zero value. */
 #define ipconfigIS_VALID_PROG_ADDRESS(x) ( (x) != NULL )
@@ -384,7 +398,16 @@ to 1 but a DNS server cannot be contacted.*/
 // #define ipconfigWATCHDOG_TIMER()			FreeRTOS_debug_printf( ("ipconfigWATCHDOG_TIMER\r\n"));
 // #define iptraceNETWORK_EVENT_RECEIVED(_X)	FreeRTOS_debug_printf( ("iptraceNETWORK_EVENT_RECEIVED: %i\r\n",_X));
 // #define iptraceSENDING_UDP_PACKET(_X)		FreeRTOS_debug_printf( ("iptraceSENDING_UDP_PACKET: addrs = %lx\r\n",_X));
+#if configUSE_TRACE_RECORDER
+/* Recorded into the kernel trace ring, see bsp/trace.h */
+#define iptraceNETWORK_INTERFACE_TRANSMIT() trace_record( TRACE_IP_TRANSMIT, 0 )
+#define iptraceNETWORK_INTERFACE_RECEIVE() trace_record( TRACE_IP_RECEIVE, 0 )
+#define iptraceNETWORK_EVENT_RECEIVED(_X) trace_record( TRACE_IP_EVENT, ( uint32_t ) ( _X ) )
+#define iptraceFAILED_TO_OBTAIN_NETWORK_BUFFER() \
+	do { trace_record( TRACE_IP_NO_BUFFER, 0 ); FreeRTOS_printf( ("iptraceFAILED_TO_OBTAIN_NETWORK_BUFFER\r\n")); } while( 0 )
+#else
 #define iptraceFAILED_TO_OBTAIN_NETWORK_BUFFER() FreeRTOS_printf( ("iptraceFAILED_TO_OBTAIN_NETWORK_BUFFER\r\n"));
+#endif
 // #define iptraceNETWORK_BUFFER_OBTAINED(_BUF) FreeRTOS_debug_printf( ("iptraceNETWORK_BUFFER_OBTAINED: %p (%p)\r\n", _BUF, _BUF->pucEthernetBuffer) );
 // #define iptraceNETWORK_BUFFER_RELEASED(_BUF) FreeRTOS_debug_printf( ("iptraceNETWORK_BUFFER_RELEASED: %p (%p)\r\n", _BUF, _BUF->pucEthernetBuffer) );
 
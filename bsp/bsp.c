@@ -1,5 +1,8 @@
 #include "bsp.h"
+#include "hrtimer.h"
 #include "plic_driver.h"
+#include "rtos_static.h"
+#include <stdio.h>
 
 #if BSP_USE_UART0 || BSP_USE_UART1
 #include "uart.h"
@@ -27,6 +30,152 @@ volatile uint64_t fromhost __attribute__((aligned(64)));
 
 plic_instance_t Plic;
 
+/* Overridden by the trace recorder */
+#ifndef traceISR_ENTER
+#define traceISR_ENTER(source_id)
+#endif
+#ifndef traceISR_EXIT
+#define traceISR_EXIT(source_id)
+#endif
+
+/* Set by handlers that woke a task of higher priority than the current one */
+static BaseType_t isr_yield_pending;
+
+void isr_notify_give(TaskHandle_t task)
+{
+    vTaskNotifyGiveFromISR(task, &isr_yield_pending);
+}
+
+BaseType_t *isr_task_woken(void)
+{
+    return &isr_yield_pending;
+}
+
+static uint64_t isr_claim_time;
+
+uint64_t isr_claim_cycles(void)
+{
+    return isr_claim_time;
+}
+
+/**
+ * Boot stages
+ */
+struct BootStage
+{
+    const char *name;
+    uint64_t cycles;
+};
+
+static struct BootStage boot_stages[BSP_BOOT_STAGES];
+static uint32_t boot_stage_count;
+
+void bsp_boot_stage(const char *name)
+{
+    uint64_t now = get_cycle_count();
+
+    taskENTER_CRITICAL();
+    if (boot_stage_count < BSP_BOOT_STAGES)
+    {
+        boot_stages[boot_stage_count].name = name;
+        boot_stages[boot_stage_count].cycles = now;
+        boot_stage_count++;
+    }
+    taskEXIT_CRITICAL();
+}
+
+/**
+ * Print `boot,<stage>,<us since reset>,<cycles in stage>` for every stage
+ * recorded so far.
+ */
+void bsp_boot_report(void)
+{
+    uint64_t last = 0;
+    uint32_t count = boot_stage_count;
+
+    printf("boot,hz,%lu\r\n", (unsigned long)configCPU_CLOCK_HZ);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        printf("boot,%s,%lu,%lu\r\n", boot_stages[i].name,
+               (unsigned long)cycles_to_us(boot_stages[i].cycles),
+               (unsigned long)(boot_stages[i].cycles - last));
+        last = boot_stages[i].cycles;
+    }
+}
+
+/**
+ * Peripherals that are not needed before the scheduler starts: initialized
+ * by prvSetupHardware(), or by bsp_init_task() with BSP_LAZY_INIT.
+ */
+static void bsp_init_deferred(void)
+{
+#if BSP_USE_UART1
+    PLIC_set_priority(&Plic, PLIC_SOURCE_UART1, PLIC_PRIORITY_UART1);
+    uart1_init();
+    bsp_boot_stage("uart1");
+#endif
+
+#if BSP_USE_ICEBLK
+    PLIC_set_priority(&Plic, PLIC_SOURCE_ICEBLK, PLIC_PRIORITY_ICEBLK);
+    iceblk_init();
+    bsp_boot_stage("iceblk");
+#endif
+
+#if BSP_USE_IIC0
+    PLIC_set_priority(&Plic, PLIC_SOURCE_IIC0, PLIC_PRIORITY_IIC0);
+    iic0_init();
+    bsp_boot_stage("iic0");
+#endif
+
+#if BSP_USE_SPI1
+    PLIC_set_priority(&Plic, PLIC_SOURCE_SPI1, PLIC_PRIORITY_SPI1);
+    spi1_init();
+    bsp_boot_stage("spi1");
+#endif
+}
+
+#if BSP_LAZY_INIT
+#define BSP_INIT_DONE (1 << 0)
+
+static EventGroupHandle_t bsp_init_events;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticEventGroup_t bsp_init_events_buffer;
+#endif
+static volatile BaseType_t bsp_init_done;
+
+/**
+ * Runs first once the scheduler starts, at the highest priority, so that
+ * the other tasks rarely have to wait in bsp_init_wait()
+ */
+static void bsp_init_task(void *params)
+{
+    (void)params;
+
+    bsp_boot_stage("scheduler");
+    bsp_init_deferred();
+    bsp_init_done = pdTRUE;
+    xEventGroupSetBits(bsp_init_events, BSP_INIT_DONE);
+    bsp_boot_stage("init done");
+#if BSP_BOOT_REPORT
+    bsp_boot_report();
+#endif
+    vTaskDelete(NULL);
+}
+
+/**
+ * Block until the deferred peripherals are initialized
+ */
+void bsp_init_wait(void)
+{
+    if (bsp_init_done)
+    {
+        return;
+    }
+    configASSERT(xTaskGetSchedulerState() == taskSCHEDULER_RUNNING);
+    xEventGroupWaitBits(bsp_init_events, BSP_INIT_DONE, pdFALSE, pdTRUE, portMAX_DELAY);
+}
+#endif /* BSP_LAZY_INIT */
+
 /**
  *  Prepare haredware to run the demo.
  */
@@ -34,16 +183,13 @@ void prvSetupHardware(void)
 {
     // Resets PLIC, threshold 0, nothing enabled
     PLIC_init(&Plic, PLIC_BASE_ADDR, PLIC_NUM_SOURCES, PLIC_NUM_PRIORITIES);
+    bsp_boot_stage("plic");
 
 // Set priorities & initialize peripherals
 #if BSP_USE_UART0
     PLIC_set_priority(&Plic, PLIC_SOURCE_UART0, PLIC_PRIORITY_UART0);
     uart0_init();
-#endif
-
-#if BSP_USE_UART1
-    PLIC_set_priority(&Plic, PLIC_SOURCE_UART1, PLIC_PRIORITY_UART1);
-    uart1_init();
+    bsp_boot_stage("uart0");
 #endif
 
 #if BSP_USE_ETHERNET
@@ -58,47 +204,70 @@ void prvSetupHardware(void)
     PLIC_set_priority(&Plic, PLIC_SOURCE_ICEETH_TX, PLIC_PRIORITY_ETH);
 #endif
 
-#if BSP_USE_ICEBLK
-    PLIC_set_priority(&Plic, PLIC_SOURCE_ICEBLK, PLIC_PRIORITY_ICEBLK);
-    iceblk_init();
-#endif
-
-#if BSP_USE_IIC0
-    PLIC_set_priority(&Plic, PLIC_SOURCE_IIC0, PLIC_PRIORITY_IIC0);
-    iic0_init();
-#endif
-
 #if BSP_USE_SPI0
 #error "BSP_USE_SPI0 should never be set! The onboard flash already uses this device"
 #endif
 
-#if BSP_USE_SPI1
-    PLIC_set_priority(&Plic, PLIC_SOURCE_SPI1, PLIC_PRIORITY_SPI1);
-    spi1_init();
-#endif
-
 #if BSP_USE_GPIO
     gpio_init();
+    bsp_boot_stage("gpio");
+#endif
+
+#if BSP_LAZY_INIT
+    bsp_init_events = RTOS_EVENT_GROUP_CREATE(&bsp_init_events_buffer);
+    configASSERT(bsp_init_events != NULL);
+    BaseType_t created = RTOS_TASK_CREATE(bsp_init_task, "BspInit", configMINIMAL_STACK_SIZE, NULL,
+                                          configMAX_PRIORITIES - 1, NULL);
+    configASSERT(created == pdPASS);
+    (void)created;
+#else
+    bsp_init_deferred();
+#if BSP_BOOT_REPORT
+    bsp_boot_report();
 #endif
+#endif /* BSP_LAZY_INIT */
 }
 
 /**
  * Define an external interrupt handler
  * cause = 0x8000000b == Machine external interrupt
+ *
+ * Serves every pending source before returning, highest priority first as
+ * the PLIC hands them out, so that interrupts arriving together share one
+ * trap entry and exit. Handlers run with interrupts disabled: the trap entry
+ * of the port is not reentrant, so lower priority handlers are not preempted.
  */
 void external_interrupt_handler(HANDLER_DATATYPE cause)
 {
     configASSERT(cause == MCAUSE_EXTERNAL_INTERRUPT);
 
-    plic_source source_id = PLIC_claim_interrupt(&Plic);
+    isr_yield_pending = pdFALSE;
 
-    if ((source_id >= 1) && (source_id < PLIC_NUM_INTERRUPTS))
+    plic_source source_id;
+    while ((source_id = PLIC_claim_interrupt(&Plic)) != 0)
     {
-        Plic.HandlerTable[source_id].Handler(Plic.HandlerTable[source_id].CallBackRef);
+        if (source_id < PLIC_NUM_INTERRUPTS)
+        {
+            isr_claim_time = get_cycle_count();
+            traceISR_ENTER(source_id);
+            Plic.HandlerTable[source_id].Handler(Plic.HandlerTable[source_id].CallBackRef);
+            traceISR_EXIT(source_id);
+            uint32_t cycles = (uint32_t)(get_cycle_count() - isr_claim_time);
+
+            plic_SourceStats *stats = &Plic.Stats[source_id];
+            stats->Count++;
+            if (cycles > stats->MaxCycles)
+            {
+                stats->MaxCycles = cycles;
+            }
+        }
+
+        // clear interrupt
+        PLIC_complete_interrupt(&Plic, source_id);
     }
 
-    // clear interrupt
-    PLIC_complete_interrupt(&Plic, source_id);
+    // Switch to a task woken by one of the handlers right away
+    portYIELD_FROM_ISR(isr_yield_pending);
 }
 
 #ifdef BIN_SOURCE_LMCO
@@ -67,6 +67,10 @@ extern plic_instance_t Plic;
 void prvSetupHardware(void);
 void external_interrupt_handler(HANDLER_DATATYPE cause);
 
+/* Implemented in main.c */
+uint64_t get_cycle_count(void);
+uint8_t isr_stack_utilization(void);
+
 #ifdef BIN_SOURCE_LMCO
     void exception_handler(HANDLER_DATATYPE mcause, HANDLER_DATATYPE mepc, HANDLER_DATATYPE mstatus);
 #endif /* BIN_SOURCE_LMCO */
@@ -270,6 +274,57 @@ void external_interrupt_handler(HANDLER_DATATYPE cause);
 #define sleep(_SECS) vTaskDelay(pdMS_TO_TICKS(_SECS * 1000));
 #define msleep(_MSECS) vTaskDelay(pdMS_TO_TICKS(_MSECS));
 
+/**
+ * Deferred wake-up of tasks from interrupt handlers.
+ * Handlers dispatched by external_interrupt_handler() wake their task with
+ * isr_notify_give(), or pass isr_task_woken() to other ...FromISR() calls.
+ * The context switch is then done once, on the way out of the handler,
+ * instead of at the next tick.
+ */
+void isr_notify_give(TaskHandle_t task);
+BaseType_t *isr_task_woken(void);
+
+/* Cycle count at which the source of the running handler was claimed */
+uint64_t isr_claim_cycles(void);
+
+/**
+ * Boot options
+ */
+/* Run the Xilinx driver self-tests of the UART, IIC and SPI at init, `make SELFTEST=0` skips them */
+#ifndef BSP_SELF_TEST
+#define BSP_SELF_TEST 1
+#endif
+
+/**
+ * Initialize UART1, IceBlk, IIC0 and SPI1 from a task once the scheduler
+ * runs instead of in prvSetupHardware(), `make LAZY_INIT=1`. The drivers
+ * call bsp_init_wait() before their first transfer, which blocks until that
+ * task is done; it must not be called before the scheduler starts.
+ */
+#ifndef BSP_LAZY_INIT
+#define BSP_LAZY_INIT 0
+#endif
+
+#if BSP_LAZY_INIT
+void bsp_init_wait(void);
+#else
+static inline void bsp_init_wait(void) {}
+#endif
+
+/**
+ * Boot stages, timestamped with mcycle. bsp_boot_stage() closes the stage
+ * running since the previous call (or reset) under `name`, bsp_boot_report()
+ * prints them as CSV. `make BOOT_REPORT=1` prints them once the peripherals
+ * are initialized.
+ */
+#ifndef BSP_BOOT_REPORT
+#define BSP_BOOT_REPORT 0
+#endif
+#define BSP_BOOT_STAGES 16
+
+void bsp_boot_stage(const char *name);
+void bsp_boot_report(void);
+
 /**
  * Icenet driver defines
  */
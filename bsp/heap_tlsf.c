@@ -0,0 +1,407 @@
+#include "heap_tlsf.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if (configSUPPORT_DYNAMIC_ALLOCATION == 0)
+#error This file must not be used if configSUPPORT_DYNAMIC_ALLOCATION is 0
+#endif
+
+#if portBYTE_ALIGNMENT == 16
+#define TLSF_ALIGN_LOG2 4
+#elif portBYTE_ALIGNMENT == 8
+#define TLSF_ALIGN_LOG2 3
+#else
+#error "heap_tlsf.c needs portBYTE_ALIGNMENT of 8 or 16"
+#endif
+
+#define TLSF_ALIGN ((size_t)1 << TLSF_ALIGN_LOG2)
+#define TLSF_ROUND_UP(x) (((x) + TLSF_ALIGN - 1) & ~(TLSF_ALIGN - 1))
+
+/* Class 0 covers the sizes below this linearly, one alignment unit apart */
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + TLSF_ALIGN_LOG2)
+#define TLSF_SMALL_BLOCK ((size_t)1 << TLSF_FL_SHIFT)
+
+#define TLSF_FREE ((size_t)1)
+
+_Static_assert((uint64_t)configTOTAL_HEAP_SIZE < (1ULL << (TLSF_FL_COUNT + TLSF_FL_SHIFT - 1)),
+               "configTOTAL_HEAP_SIZE needs more first level classes");
+
+/**
+ * Every block starts with its header. Sizes include the header and are
+ * multiples of TLSF_ALIGN, which leaves bit 0 for TLSF_FREE. The free list
+ * links are only valid while the block is free, in what is otherwise the
+ * payload.
+ */
+typedef struct tlsf_block
+{
+    struct tlsf_block *prev_phys;
+    size_t size;
+    struct tlsf_block *next_free;
+    struct tlsf_block *prev_free;
+} tlsf_block_t;
+
+#define TLSF_HEADER_SIZE TLSF_ROUND_UP(offsetof(tlsf_block_t, next_free))
+#define TLSF_MIN_BLOCK (TLSF_ROUND_UP(sizeof(tlsf_block_t)) + TLSF_ALIGN)
+
+#if (configAPPLICATION_ALLOCATED_HEAP == 1)
+extern uint8_t ucHeap[configTOTAL_HEAP_SIZE];
+#else
+static uint8_t ucHeap[configTOTAL_HEAP_SIZE];
+#endif
+
+static uint32_t fl_bitmap;
+static uint32_t sl_bitmap[TLSF_FL_COUNT];
+static tlsf_block_t *free_lists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+static bool heap_initialised;
+
+static size_t free_bytes;
+static size_t free_blocks;
+static size_t min_ever_free_bytes;
+static uint32_t allocations;
+static uint32_t frees;
+static uint32_t failures;
+static uint32_t class_allocations[TLSF_FL_COUNT];
+static uint32_t class_in_use[TLSF_FL_COUNT];
+static uint32_t class_free_blocks[TLSF_FL_COUNT];
+
+static inline int tlsf_fls(size_t x)
+{
+    return (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl((unsigned long)x);
+}
+
+static inline size_t block_size(const tlsf_block_t *block)
+{
+    return block->size & ~TLSF_FREE;
+}
+
+static inline bool block_is_free(const tlsf_block_t *block)
+{
+    return (block->size & TLSF_FREE) != 0;
+}
+
+static inline tlsf_block_t *block_next(const tlsf_block_t *block)
+{
+    return (tlsf_block_t *)(void *)((uint8_t *)block + block_size(block));
+}
+
+static void mapping_insert(size_t size, int *fl, int *sl)
+{
+    if (size < TLSF_SMALL_BLOCK)
+    {
+        *fl = 0;
+        *sl = (int)(size >> TLSF_ALIGN_LOG2);
+    }
+    else
+    {
+        int f = tlsf_fls(size);
+        *sl = (int)(size >> (f - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+        *fl = f - TLSF_FL_SHIFT + 1;
+    }
+}
+
+/* Round up to the next class, so that any block found there is large enough */
+static void mapping_search(size_t size, int *fl, int *sl)
+{
+    if (size >= TLSF_SMALL_BLOCK)
+    {
+        size += ((size_t)1 << (tlsf_fls(size) - TLSF_SL_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+static void insert_free(tlsf_block_t *block)
+{
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+
+    block->size |= TLSF_FREE;
+    block->prev_free = NULL;
+    block->next_free = free_lists[fl][sl];
+    if (block->next_free)
+    {
+        block->next_free->prev_free = block;
+    }
+    free_lists[fl][sl] = block;
+    fl_bitmap |= 1UL << fl;
+    sl_bitmap[fl] |= 1UL << sl;
+    free_blocks++;
+    class_free_blocks[fl]++;
+}
+
+static void remove_free(tlsf_block_t *block)
+{
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+
+    if (block->next_free)
+    {
+        block->next_free->prev_free = block->prev_free;
+    }
+    if (block->prev_free)
+    {
+        block->prev_free->next_free = block->next_free;
+    }
+    else
+    {
+        free_lists[fl][sl] = block->next_free;
+        if (!free_lists[fl][sl])
+        {
+            sl_bitmap[fl] &= ~(1UL << sl);
+            if (!sl_bitmap[fl])
+            {
+                fl_bitmap &= ~(1UL << fl);
+            }
+        }
+    }
+    block->size &= ~TLSF_FREE;
+    free_blocks--;
+    class_free_blocks[fl]--;
+}
+
+static tlsf_block_t *find_free(int fl, int sl)
+{
+    uint32_t sl_map = sl_bitmap[fl] & (~0UL << sl);
+    if (!sl_map)
+    {
+        uint32_t fl_map = fl + 1 < TLSF_FL_COUNT ? fl_bitmap & (~0UL << (fl + 1)) : 0;
+        if (!fl_map)
+        {
+            return NULL;
+        }
+        fl = __builtin_ctz(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    return free_lists[fl][__builtin_ctz(sl_map)];
+}
+
+/**
+ * One free block over the whole heap, followed by a header-only sentinel
+ * that is never free, so that every block has a physical successor.
+ */
+static void heap_init(void)
+{
+    uintptr_t start = TLSF_ROUND_UP((uintptr_t)ucHeap);
+    uintptr_t end = ((uintptr_t)ucHeap + configTOTAL_HEAP_SIZE) & ~(TLSF_ALIGN - 1);
+
+    tlsf_block_t *block = (tlsf_block_t *)start;
+    block->prev_phys = NULL;
+    block->size = end - start - TLSF_HEADER_SIZE;
+
+    tlsf_block_t *sentinel = block_next(block);
+    sentinel->prev_phys = block;
+    sentinel->size = TLSF_HEADER_SIZE;
+
+    insert_free(block);
+    free_bytes = block_size(block);
+    min_ever_free_bytes = free_bytes;
+    heap_initialised = true;
+}
+
+static int size_class(size_t size)
+{
+    int fl, sl;
+    mapping_insert(size, &fl, &sl);
+    return fl;
+}
+
+void *pvPortMalloc(size_t xWantedSize)
+{
+    void *pvReturn = NULL;
+
+    vTaskSuspendAll();
+    {
+        if (!heap_initialised)
+        {
+            heap_init();
+        }
+
+        size_t size = 0;
+        if (xWantedSize > 0 && xWantedSize < configTOTAL_HEAP_SIZE)
+        {
+            size = TLSF_ROUND_UP(xWantedSize + TLSF_HEADER_SIZE);
+            if (size < TLSF_MIN_BLOCK)
+            {
+                size = TLSF_MIN_BLOCK;
+            }
+        }
+
+        tlsf_block_t *block = NULL;
+        if (size)
+        {
+            int fl, sl;
+            mapping_search(size, &fl, &sl);
+            if (fl < TLSF_FL_COUNT)
+            {
+                block = find_free(fl, sl);
+            }
+            if (!block)
+            {
+                /* The size's own class may still hold a block that fits */
+                mapping_insert(size, &fl, &sl);
+                block = free_lists[fl][sl];
+                if (block && block_size(block) < size)
+                {
+                    block = NULL;
+                }
+            }
+        }
+
+        if (block)
+        {
+            remove_free(block);
+
+            /* Give back what is left, if it makes a block */
+            if (block_size(block) - size >= TLSF_MIN_BLOCK)
+            {
+                tlsf_block_t *rest = (tlsf_block_t *)(void *)((uint8_t *)block + size);
+                rest->prev_phys = block;
+                rest->size = block_size(block) - size;
+                block_next(rest)->prev_phys = rest;
+                block->size = size;
+                insert_free(rest);
+            }
+
+            free_bytes -= block_size(block);
+            if (free_bytes < min_ever_free_bytes)
+            {
+                min_ever_free_bytes = free_bytes;
+            }
+            allocations++;
+            int fl = size_class(block_size(block));
+            class_allocations[fl]++;
+            class_in_use[fl]++;
+            pvReturn = (uint8_t *)block + TLSF_HEADER_SIZE;
+        }
+        else if (xWantedSize > 0)
+        {
+            failures++;
+        }
+
+        traceMALLOC(pvReturn, xWantedSize);
+    }
+    (void)xTaskResumeAll();
+
+#if (configUSE_MALLOC_FAILED_HOOK == 1)
+    if (pvReturn == NULL)
+    {
+        extern void vApplicationMallocFailedHook(void);
+        vApplicationMallocFailedHook();
+    }
+#endif
+
+    configASSERT((((size_t)pvReturn) & (size_t)portBYTE_ALIGNMENT_MASK) == 0);
+    return pvReturn;
+}
+
+void vPortFree(void *pv)
+{
+    if (pv == NULL)
+    {
+        return;
+    }
+
+    tlsf_block_t *block = (tlsf_block_t *)(void *)((uint8_t *)pv - TLSF_HEADER_SIZE);
+    configASSERT(heap_initialised && !block_is_free(block));
+
+    vTaskSuspendAll();
+    {
+        size_t size = block_size(block);
+        free_bytes += size;
+        frees++;
+        class_in_use[size_class(size)]--;
+        traceFREE(pv, size);
+
+        tlsf_block_t *prev = block->prev_phys;
+        if (prev && block_is_free(prev))
+        {
+            remove_free(prev);
+            prev->size += size;
+            block = prev;
+            block_next(block)->prev_phys = block;
+        }
+
+        tlsf_block_t *next = block_next(block);
+        if (block_is_free(next))
+        {
+            remove_free(next);
+            block->size += block_size(next);
+            block_next(block)->prev_phys = block;
+        }
+
+        insert_free(block);
+    }
+    (void)xTaskResumeAll();
+}
+
+size_t xPortGetFreeHeapSize(void)
+{
+    return free_bytes;
+}
+
+size_t xPortGetMinimumEverFreeHeapSize(void)
+{
+    return min_ever_free_bytes;
+}
+
+void heap_get_stats(struct heap_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    vTaskSuspendAll();
+    {
+        stats->free_bytes = free_bytes;
+        stats->min_ever_free_bytes = min_ever_free_bytes;
+        stats->allocations = allocations;
+        stats->frees = frees;
+        stats->failures = failures;
+        stats->free_blocks = free_blocks;
+
+        /* The largest block is in the highest non-empty list */
+        size_t largest = 0;
+        if (fl_bitmap)
+        {
+            int fl = tlsf_fls(fl_bitmap);
+            int sl = tlsf_fls(sl_bitmap[fl]);
+            for (tlsf_block_t *block = free_lists[fl][sl]; block; block = block->next_free)
+            {
+                if (block_size(block) > largest)
+                {
+                    largest = block_size(block);
+                }
+            }
+        }
+        if (largest > TLSF_HEADER_SIZE)
+        {
+            stats->largest_free_block = largest - TLSF_HEADER_SIZE;
+        }
+        if (free_bytes)
+        {
+            stats->fragmentation_percent = (uint32_t)(100 - (uint64_t)largest * 100 / free_bytes);
+        }
+    }
+    (void)xTaskResumeAll();
+}
+
+size_t heap_get_class_stats(struct heap_class_stats *classes, size_t count)
+{
+    if (count > TLSF_FL_COUNT)
+    {
+        count = TLSF_FL_COUNT;
+    }
+
+    vTaskSuspendAll();
+    for (size_t fl = 0; fl < count; fl++)
+    {
+        classes[fl].min_size = fl ? (size_t)1 << (fl + TLSF_FL_SHIFT - 1) : 0;
+        classes[fl].allocations = class_allocations[fl];
+        classes[fl].in_use = class_in_use[fl];
+        classes[fl].free_blocks = class_free_blocks[fl];
+    }
+    (void)xTaskResumeAll();
+
+    return count;
+}
@@ -0,0 +1,53 @@
+#ifndef __HEAP_TLSF_H__
+#define __HEAP_TLSF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Two-level segregated fit (TLSF) implementation of pvPortMalloc() and
+ * vPortFree(), selected with `make HEAP=tlsf` in place of heap_4.
+ *
+ * Free blocks are kept in lists segregated by size: a first level per power
+ * of two, split into TLSF_SL_COUNT linear second level classes, with a bitmap
+ * of the non-empty lists at each level. Allocation and free are a few bit
+ * scans and list operations, whatever the number or arrangement of the free
+ * blocks, so their latency does not grow with uptime the way heap_4's
+ * first-fit walk does. Neighbouring free blocks are merged on free.
+ */
+
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+
+/* First level classes; class 0 holds blocks below 16 alignment units */
+#define TLSF_FL_COUNT 25
+
+struct heap_stats
+{
+    /* Bytes in free blocks, headers included, as xPortGetFreeHeapSize() */
+    size_t free_bytes;
+    size_t min_ever_free_bytes;
+    /* Largest request that can currently succeed */
+    size_t largest_free_block;
+    size_t free_blocks;
+    /* 0 when all the free space is one block */
+    uint32_t fragmentation_percent;
+    uint32_t allocations;
+    uint32_t frees;
+    uint32_t failures;
+};
+
+/* Blocks from min_size up to the next class's min_size */
+struct heap_class_stats
+{
+    size_t min_size;
+    uint32_t allocations;
+    uint32_t in_use;
+    uint32_t free_blocks;
+};
+
+void heap_get_stats(struct heap_stats *stats);
+/* Fills in up to TLSF_FL_COUNT classes, returns the number filled in */
+size_t heap_get_class_stats(struct heap_class_stats *classes, size_t count);
+
+#endif
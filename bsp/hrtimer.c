@@ -0,0 +1,80 @@
+#include "hrtimer.h"
+#include "bsp.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#define HRTIMER_TICK_US (1000000UL / configTICK_RATE_HZ)
+
+/**
+ * Split the conversion so that cycles * 10^9 cannot overflow: the remainder
+ * is below configCPU_CLOCK_HZ, which fits in 32 bits.
+ */
+static uint64_t cycles_to(uint64_t cycles, uint32_t per_second)
+{
+    uint64_t hz = configCPU_CLOCK_HZ;
+    return (cycles / hz) * per_second + (cycles % hz) * per_second / hz;
+}
+
+uint64_t clock_ns(void)
+{
+    return cycles_to(get_cycle_count(), 1000000000UL);
+}
+
+uint64_t clock_us(void)
+{
+    return cycles_to_us(get_cycle_count());
+}
+
+uint64_t cycles_to_us(uint64_t cycles)
+{
+    return cycles_to(cycles, 1000000UL);
+}
+
+void hrtimer_udelay(uint32_t us)
+{
+    uint64_t end = get_cycle_count() + (uint64_t)us * (configCPU_CLOCK_HZ / 1000000UL);
+    while (get_cycle_count() < end)
+        ;
+}
+
+void hrtimer_sleep_until(uint64_t deadline_us)
+{
+    for (;;)
+    {
+        uint64_t now = clock_us();
+        if (now >= deadline_us)
+        {
+            return;
+        }
+
+        uint64_t left = deadline_us - now;
+        if (left < HRTIMER_TICK_US || xTaskGetSchedulerState() != taskSCHEDULER_RUNNING)
+        {
+            hrtimer_udelay((uint32_t)left);
+            return;
+        }
+        /* vTaskDelay(n) returns after n - 1 to n tick periods, never later */
+        vTaskDelay((TickType_t)(left / HRTIMER_TICK_US));
+    }
+}
+
+void hrtimer_usleep(uint32_t us)
+{
+    hrtimer_sleep_until(clock_us() + us);
+}
+
+void hrtimer_usleep_coarse(uint32_t us)
+{
+    uint64_t deadline_us = clock_us() + us;
+
+    if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING)
+    {
+        hrtimer_udelay(us);
+        return;
+    }
+    while (clock_us() < deadline_us)
+    {
+        vTaskDelay(1);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef __HRTIMER_H__
+#define __HRTIMER_H__
+
+#include <stdint.h>
+
+/**
+ * 64-bit monotonic clock and sub-tick delays, derived from mcycle.
+ *
+ * The CLINT has one mtimecmp per hart and the port uses it for the tick, so
+ * there is no spare compare to wake a task between ticks. Deadlines are met
+ * by blocking for the whole ticks before them and spinning only for the rest,
+ * which is always less than a tick.
+ *
+ * Polling loops should not spin between polls: they use hrtimer_usleep_coarse(),
+ * which blocks until the first tick after the deadline, and compare
+ * clock_us() with their own deadline to time out.
+ */
+
+/* Time since reset, does not wrap in practice */
+uint64_t clock_ns(void);
+uint64_t clock_us(void);
+
+/* Convert an mcycle count, such as a get_cycle_count() timestamp */
+uint64_t cycles_to_us(uint64_t cycles);
+
+/* Busy wait; usable with interrupts disabled and before the scheduler runs */
+void hrtimer_udelay(uint32_t us);
+
+/* Sleep until clock_us() reaches deadline_us, or for `us` microseconds */
+void hrtimer_sleep_until(uint64_t deadline_us);
+void hrtimer_usleep(uint32_t us);
+
+/* Sleep for at least `us` microseconds, late by up to a tick, never spinning */
+void hrtimer_usleep_coarse(uint32_t us);
+
+#endif
@@ -1,19 +1,26 @@
 #include "iceblk.h"
 #include "task.h"
+#include "hrtimer.h"
 #include <string.h> /* for memcpy */
 
 // This driver has been adapted from the original Linux driver available here:
 // https://github.com/firesim/iceblk-driver/blob/master/iceblk.c
 
+#if ICEBLK_VERBOSE
+#define iceblk_log(...) printf(__VA_ARGS__)
+#else
+#define iceblk_log(...)
+#endif
+
 /* Driver instances*/
 IceblkDev IceblkDevInstance;
 
 void iceblk_init(void)
 {
-	printf("iceblk_init\r\n");
+	iceblk_log("iceblk_init\r\n");
 
 	IceblkDevInstance.BaseAddress = ICEBLK_BASEADDR;
-	IceblkDevInstance.mutex = xSemaphoreCreateMutex();
+	IceblkDevInstance.mutex = RTOS_MUTEX_CREATE(&IceblkDevInstance.mutex_buffer);
 	IceblkDevInstance.task_handle = NULL;
 
 	int err = iceblk_setup(&IceblkDevInstance);
@@ -24,17 +31,17 @@ void iceblk_init(void)
 	}
 	else
 	{
-		printf("iceblk_init: Device setup OK\n");
+		iceblk_log("iceblk_init: Device setup OK\n");
 		IceblkDevInstance.disk_present = 1;
 	}
 }
 
 int iceblk_setup(IceblkDev *port)
 {
-	printf("iceblk_setup\r\n");
+	iceblk_log("iceblk_setup\r\n");
 
 	configASSERT(PLIC_register_interrupt_handler(&Plic, PLIC_SOURCE_ICEBLK, (void *)iceblk_intr_handler, &IceblkDevInstance));
-	printf("iceblk irq handler registered\r\n");
+	iceblk_log("iceblk irq handler registered\r\n");
 
 	port->nsectors = ioread32(port->BaseAddress + ICEBLK_NSECTORS);
 
@@ -48,9 +55,9 @@ int iceblk_setup(IceblkDev *port)
 	port->max_req_len = ioread32(port->BaseAddress + ICEBLK_MAX_REQUEST_LENGTH);
 	port->qrunning = 1;
 
-	printf("Iceblk: disk loaded; "
-		   "%lu sectors, %lu tags, %lu max request length\n",
-		   (long unsigned int) port->nsectors, (long unsigned int) port->ntags, (long unsigned int) port->max_req_len);
+	iceblk_log("Iceblk: disk loaded; "
+			   "%lu sectors, %lu tags, %lu max request length\n",
+			   (long unsigned int) port->nsectors, (long unsigned int) port->ntags, (long unsigned int) port->max_req_len);
 
 	configASSERT(port->max_req_len <= ICEBLK_DEFAULT_MAX_REQUEST_LENGTH);
 
@@ -68,8 +75,7 @@ void iceblk_intr_handler(IceblkDev *port)
 	}
 
 	configASSERT(port->task_handle != NULL);
-	static BaseType_t askForContextSwitch = pdFALSE;
-	vTaskNotifyGiveFromISR(port->task_handle, &askForContextSwitch);
+	isr_notify_give(port->task_handle);
 }
 
 /**
@@ -88,6 +94,8 @@ int iceblk_queue_request(IceblkDev *port, int write, uint8_t *buffer, uint32_t l
 {
 	int returnval;
 
+	bsp_init_wait();
+
 	/* Assume we are writting/reading only one sector at a time */
 	configASSERT(len <= port->max_req_len);
 
@@ -121,7 +129,7 @@ int iceblk_queue_request(IceblkDev *port, int write, uint8_t *buffer, uint32_t l
 	taskEXIT_CRITICAL();
 
 	/* Short delay is necessary here */
-	msleep(1);
+	hrtimer_usleep_coarse(ICEBLK_REQUEST_DELAY_US);
 
 	/* wait for notification */
 	/* Note that we use ulTaskNotifyTake() here to reset the calling */
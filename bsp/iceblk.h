@@ -16,6 +16,7 @@
 #include "plic_driver.h"
 #include "bsp.h"
 #include "semphr.h"
+#include "rtos_static.h"
 
 
 #define ICEBLK_DEFAULT_MAX_REQUEST_LENGTH 16
@@ -36,10 +37,20 @@
 #define ICEBLK_REQ_WRITE 1
 
 #define ICEBLK_TRANSACTION_DELAY_MS 500
+/* Wait after queueing a request, before waiting for its completion */
+#define ICEBLK_REQUEST_DELAY_US 100
+
+/* Print the progress of iceblk_init(), errors are always printed */
+#ifndef ICEBLK_VERBOSE
+#define ICEBLK_VERBOSE 0
+#endif
 
 typedef struct IceblkDev {
     UINTPTR BaseAddress; /** HW Base Address **/
 	SemaphoreHandle_t mutex;  /* Mutex for queue acquisition */
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+	StaticSemaphore_t mutex_buffer;
+#endif
 	int qrunning; /* Is queue running? */
 	int disk_present; /* Is the disk present? */
 	uint32_t nsectors; /* Disk capacity */
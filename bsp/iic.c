@@ -42,7 +42,7 @@ struct IicDriver Iic1;
 __attribute__((unused)) static void iic_init(struct IicDriver *Iic, uint8_t device_id, uint8_t plic_source_id)
 {
     // Initialize struct
-    Iic->mutex = xSemaphoreCreateMutex();
+    Iic->mutex = RTOS_MUTEX_CREATE(&Iic->mutex_buffer);
     switch (device_id)
     {
 #if BSP_USE_IIC0
@@ -68,8 +68,10 @@ __attribute__((unused)) static void iic_init(struct IicDriver *Iic, uint8_t devi
     /* Initialize the XIic driver so that it's ready to use */
     configASSERT(XIic_Initialize(&Iic->Device, device_id) == XST_SUCCESS);
 
+#if BSP_SELF_TEST
     /* Perform a self-test to ensure that the hardware was built correctly */
     configASSERT(XIic_SelfTest(&Iic->Device) == XST_SUCCESS);
+#endif
 
     /*
 	 * Setup handler to process the asynchronous events which occur,
@@ -118,6 +120,7 @@ static void iic_stop(struct IicDriver *Iic, uint8_t plic_source_id)
 int iic_transmit(struct IicDriver *Iic, uint8_t addr, uint8_t *tx_data, uint8_t tx_len)
 {
     int returnval;
+    bsp_init_wait();
     configASSERT(Iic->mutex != NULL);
     configASSERT(xSemaphoreTake(Iic->mutex, portMAX_DELAY) == pdTRUE);
 
@@ -185,6 +188,7 @@ int iic_transmit(struct IicDriver *Iic, uint8_t addr, uint8_t *tx_data, uint8_t
 int iic_receive(struct IicDriver *Iic, uint8_t addr, uint8_t *rx_data, uint8_t rx_len)
 {
     int returnval;
+    bsp_init_wait();
     configASSERT(Iic->mutex != NULL);
     configASSERT(xSemaphoreTake(Iic->mutex, portMAX_DELAY) == pdTRUE);
 
@@ -267,8 +271,7 @@ static void RecvHandler(void *CallbackRef, int ByteCount)
     }
 
     configASSERT(Iic->task_handle != NULL);
-    static BaseType_t askForContextSwitch = pdFALSE;
-    vTaskNotifyGiveFromISR(Iic->task_handle, &askForContextSwitch);
+    isr_notify_give(Iic->task_handle);
 }
 
 /****************************************************************************/
@@ -292,8 +295,7 @@ static void SendHandler(void *CallbackRef, int Status)
 
     // Notify the task
     configASSERT(Iic->task_handle != NULL);
-    static BaseType_t askForContextSwitch = pdFALSE;
-    vTaskNotifyGiveFromISR(Iic->task_handle, &askForContextSwitch);
+    isr_notify_give(Iic->task_handle);
 }
 
 /*****************************************************************************/
@@ -319,8 +321,7 @@ static void StatusHandler(void *CallbackRef, int Status)
 
     // An error occured, notify the task
     configASSERT(Iic->task_handle != NULL);
-    static BaseType_t askForContextSwitch = pdFALSE;
-    vTaskNotifyGiveFromISR(Iic->task_handle, &askForContextSwitch);
+    isr_notify_give(Iic->task_handle);
 }
 
 #if BSP_USE_IIC0
@@ -329,6 +330,7 @@ static void StatusHandler(void *CallbackRef, int Status)
  */
 void iic0_master_reset(void)
 {
+    bsp_init_wait();
     iic_stop(&Iic0, PLIC_SOURCE_IIC0);
     vTaskDelay(pdMS_TO_TICKS(100));
     iic_init(&Iic0, XPAR_IIC_0_DEVICE_ID, PLIC_SOURCE_IIC0);
@@ -375,6 +377,7 @@ int iic1_receive(uint8_t addr, uint8_t *rx_data, uint8_t rx_len)
 void iic0_print_stats(void)
 {
     static XIicStats iic0stats;
+    bsp_init_wait();
     XIic_GetStats(&Iic0.Device, &iic0stats);
     printf("(iic0.TotalErrorCount) %i\r\n", Iic0.TotalErrorCount);
     printf("(iic0.Errors) %i\r\n", Iic0.Errors);
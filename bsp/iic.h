@@ -4,6 +4,7 @@
 #include "bsp.h"
 #include "xiic.h"
 #include "semphr.h"
+#include "rtos_static.h"
 
 #define IIC0_PRINT_STATS 0
 #define IIC_RESET_ERROR_THRESHOLD 3
@@ -18,6 +19,9 @@ struct IicDriver
     int trans_len;            /* Length of the transaction */
     SemaphoreHandle_t mutex;  /* Mutex for bus acquisition */
     TaskHandle_t task_handle; /* handle for task that initiated a transaction */
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    StaticSemaphore_t mutex_buffer;
+#endif
 };
 
 enum iic_error {
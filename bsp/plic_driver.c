@@ -28,11 +28,12 @@ void PLIC_init(
     this_plic->num_sources = num_sources;
     this_plic->num_priorities = num_priorities;
 
-    // Erase handler table
+    // Erase handler table and counters
     for (uint8_t idx = 0; idx < PLIC_NUM_INTERRUPTS; idx++)
     {
         this_plic->HandlerTable[idx].Handler = NULL;
     }
+    memset(this_plic->Stats, 0, sizeof(this_plic->Stats));
 
     // Disable all interrupts (don't assume that these registers are reset).
     volatile_memzero32((uint32_t *)(this_plic->base_addr +
@@ -143,4 +144,18 @@ void PLIC_unregister_interrupt_handler(plic_instance_t *this_plic, plic_source s
         PLIC_disable_interrupt(this_plic, source_id);
         this_plic->HandlerTable[source_id].Handler = NULL;
     }
-}
\ No newline at end of file
+}
+
+// Copy the dispatch counters of a source. They are written by the interrupt
+// handler, so the two fields may be from different dispatches.
+void PLIC_get_source_stats(plic_instance_t *this_plic, plic_source source_id, plic_SourceStats *stats)
+{
+    if ((source_id >= 1) && (source_id < PLIC_NUM_INTERRUPTS))
+    {
+        *stats = *(volatile plic_SourceStats *)&this_plic->Stats[source_id];
+    }
+    else
+    {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
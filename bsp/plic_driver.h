@@ -47,6 +47,13 @@ typedef struct
   void *CallBackRef;
 } plic_VectorTableEntry;
 
+/* Dispatch counters of one source, kept by the external interrupt handler */
+typedef struct
+{
+  uint32_t Count;     /* Times the handler ran */
+  uint32_t MaxCycles; /* Longest handler run, in mcycle ticks */
+} plic_SourceStats;
+
 typedef struct __plic_instance_t
 {
   uintptr_t base_addr;
@@ -54,6 +61,7 @@ typedef struct __plic_instance_t
   uint32_t num_sources;
   uint32_t num_priorities;
   plic_VectorTableEntry HandlerTable[PLIC_NUM_INTERRUPTS];
+  plic_SourceStats Stats[PLIC_NUM_INTERRUPTS];
 
 } plic_instance_t;
 
@@ -89,4 +97,6 @@ plic_source PLIC_register_interrupt_handler(plic_instance_t *this_plic, plic_sou
 
 void PLIC_unregister_interrupt_handler(plic_instance_t *this_plic, plic_source source_id);
 
+void PLIC_get_source_stats(plic_instance_t *this_plic, plic_source source_id, plic_SourceStats *stats);
+
 #endif
@@ -0,0 +1,213 @@
+#include "prof.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if (PROF_SLOTS & (PROF_SLOTS - 1)) != 0
+#error "PROF_SLOTS must be a power of two"
+#endif
+
+/* Slots looked at for a record before the sample is dropped */
+#define PROF_PROBES 8
+
+#ifndef PROF_MAX_TASKS
+#define PROF_MAX_TASKS 32
+#endif
+
+struct prof_record
+{
+    uintptr_t task;
+    uintptr_t pc;
+    uintptr_t ra;
+    uint32_t count;
+};
+
+static struct prof_record prof_table[PROF_SLOTS];
+static uint32_t prof_samples;
+static uint32_t prof_dropped;
+static volatile bool prof_running;
+
+/* Set by prof_freeze() until prof_dump() has run, which then resumes */
+static bool prof_frozen;
+static bool prof_resume;
+static TaskStatus_t prof_tasks[PROF_MAX_TASKS];
+static UBaseType_t prof_task_count;
+
+static inline uintptr_t prof_read_mepc(void)
+{
+    uintptr_t mepc;
+    __asm volatile("csrr %0, mepc" : "=r"(mepc));
+    return mepc;
+}
+
+void prof_tick(void)
+{
+    if (!prof_running)
+    {
+        return;
+    }
+
+    /**
+     * The tick interrupt has just saved the task's context and pointed the
+     * TCB's first member, pxTopOfStack, at it; x1 is the second word.
+     */
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    StackType_t *frame = *(StackType_t **)task;
+    uintptr_t pc = prof_read_mepc();
+    uintptr_t ra = (uintptr_t)frame[1];
+
+    uintptr_t key = pc ^ (ra * 31) ^ ((uintptr_t)task * 17);
+    uint32_t slot = ((uint32_t)key * 2654435761UL) >> 16;
+
+    prof_samples++;
+    for (int probe = 0; probe < PROF_PROBES; probe++)
+    {
+        struct prof_record *record = &prof_table[(slot + probe) & (PROF_SLOTS - 1)];
+        if (record->count == 0)
+        {
+            record->task = (uintptr_t)task;
+            record->pc = pc;
+            record->ra = ra;
+        }
+        else if (record->pc != pc || record->ra != ra || record->task != (uintptr_t)task)
+        {
+            continue;
+        }
+        record->count++;
+        return;
+    }
+    prof_dropped++;
+}
+
+void prof_start(void)
+{
+    taskENTER_CRITICAL();
+    if (prof_frozen)
+    {
+        prof_resume = true;
+    }
+    else
+    {
+        memset(prof_table, 0, sizeof(prof_table));
+        prof_samples = 0;
+        prof_dropped = 0;
+        prof_running = true;
+    }
+    taskEXIT_CRITICAL();
+}
+
+void prof_stop(void)
+{
+    taskENTER_CRITICAL();
+    if (prof_frozen)
+    {
+        prof_resume = false;
+    }
+    else
+    {
+        prof_running = false;
+    }
+    taskEXIT_CRITICAL();
+}
+
+#define PROF_LINE_MAX (32 + 3 * 2 * sizeof(uintptr_t) + configMAX_TASK_NAME_LEN)
+
+static int prof_emit(prof_write_fn write, void *ctx)
+{
+    char line[PROF_LINE_MAX];
+    int len;
+
+    len = snprintf(line, sizeof(line), "prof,begin,%lu,%lu,%lu\r\n",
+                   (unsigned long)configTICK_RATE_HZ, (unsigned long)prof_samples,
+                   (unsigned long)prof_dropped);
+    if (write(ctx, line, len))
+    {
+        return 1;
+    }
+
+    for (UBaseType_t i = 0; i < prof_task_count; i++)
+    {
+        len = snprintf(line, sizeof(line), "prof,task,%lx,%s\r\n",
+                       (unsigned long)(uintptr_t)prof_tasks[i].xHandle,
+                       prof_tasks[i].pcTaskName);
+        if (write(ctx, line, len))
+        {
+            return 1;
+        }
+    }
+
+    for (uint32_t slot = 0; slot < PROF_SLOTS; slot++)
+    {
+        const struct prof_record *record = &prof_table[slot];
+        if (record->count == 0)
+        {
+            continue;
+        }
+        len = snprintf(line, sizeof(line), "prof,sample,%lx,%lx,%lx,%lu\r\n",
+                       (unsigned long)record->task, (unsigned long)record->pc,
+                       (unsigned long)record->ra, (unsigned long)record->count);
+        if (write(ctx, line, len))
+        {
+            return 1;
+        }
+    }
+
+    return write(ctx, "prof,end\r\n", 10);
+}
+
+static int prof_count(void *ctx, const void *data, size_t len)
+{
+    (void)data;
+    *(size_t *)ctx += len;
+    return 0;
+}
+
+size_t prof_freeze(void)
+{
+    size_t size = 0;
+
+    taskENTER_CRITICAL();
+    bool freeze = !prof_frozen;
+    if (freeze)
+    {
+        prof_frozen = true;
+        prof_resume = prof_running;
+        prof_running = false;
+    }
+    taskEXIT_CRITICAL();
+
+    if (freeze)
+    {
+        prof_task_count = uxTaskGetSystemState(prof_tasks, PROF_MAX_TASKS, NULL);
+    }
+    prof_emit(prof_count, &size);
+    return size;
+}
+
+int prof_dump(prof_write_fn write, void *ctx)
+{
+    prof_freeze();
+    int err = prof_emit(write, ctx);
+
+    taskENTER_CRITICAL();
+    prof_running = prof_resume;
+    prof_frozen = false;
+    taskEXIT_CRITICAL();
+    return err;
+}
+
+static int prof_write_stdout(void *ctx, const void *data, size_t len)
+{
+    (void)ctx;
+    printf("%.*s", (int)len, (const char *)data);
+    return 0;
+}
+
+void prof_dump_uart(void)
+{
+    prof_dump(prof_write_stdout, NULL);
+}
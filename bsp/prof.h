@@ -0,0 +1,48 @@
+#ifndef __PROF_H__
+#define __PROF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Sampling PC profiler.
+ *
+ * Built with configUSE_PROFILER (`make PROFILE=1`), every tick interrupt
+ * samples the interrupted pc (mepc), the return address the interrupted code
+ * was holding and the task it belonged to, and counts each distinct triple in
+ * a fixed hash table. There is no spare mtimecmp, so the tick is also the
+ * sampling clock: configTICK_RATE_HZ samples per second.
+ *
+ * The dump is text, one line per record, which tools/prof.py symbolizes with
+ * the ELF, or $(PROG).asm, into flat profiles and folded stacks:
+ *   prof,begin,<sample hz>,<samples>,<dropped>
+ *   prof,task,<handle>,<name>
+ *   prof,sample,<handle>,<pc>,<ra>,<count>
+ *   prof,end
+ */
+
+/* Distinct (task, pc, ra) records kept; must be a power of two */
+#ifndef PROF_SLOTS
+#define PROF_SLOTS 4096
+#endif
+
+/* Called from vApplicationTickHook() */
+void prof_tick(void);
+
+/* Clear the table and sample from now on, or stop sampling */
+void prof_start(void);
+void prof_stop(void);
+
+/**
+ * Write the dump with `write`, which returns 0 on success. Sampling is paused
+ * from prof_freeze(), which returns the size of the dump, or the start of
+ * prof_dump(), until the dump is written. Must be called from a task.
+ */
+typedef int (*prof_write_fn)(void *ctx, const void *data, size_t len);
+size_t prof_freeze(void);
+int prof_dump(prof_write_fn write, void *ctx);
+
+/* Print the dump to stdout */
+void prof_dump_uart(void);
+
+#endif
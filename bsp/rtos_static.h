@@ -0,0 +1,78 @@
+#ifndef __RTOS_STATIC_H__
+#define __RTOS_STATIC_H__
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "stream_buffer.h"
+#include "event_groups.h"
+
+/**
+ * Kernel object creation that follows configSUPPORT_STATIC_ALLOCATION
+ * (`make STATIC=1`): the macros below take the arguments of xTaskCreate()
+ * and friends, and create the object from storage reserved at link time
+ * when static allocation is enabled, or from the heap otherwise.
+ *
+ * RTOS_TASK_CREATE() and RTOS_QUEUE_CREATE() reserve their storage at the
+ * call site, in the .rtos_static section, so each call site may only run
+ * once and the stack depth and queue sizes must be constants. Tasks created
+ * in a loop, or with a stack size known only at run time, keep using
+ * xTaskCreate(). The semaphore, stream buffer and event group macros use
+ * storage owned by the caller, typically a member of the driver instance,
+ * which is not referenced at all in a dynamic build.
+ *
+ * `make ram` lists the section along with every other static RAM consumer.
+ */
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+
+#define RTOS_TASK_CREATE(code, name, depth, params, priority, handle)                             \
+    ({                                                                                            \
+        static StackType_t _rtos_stack[(depth)] configSTATIC_STORAGE;                             \
+        static StaticTask_t _rtos_tcb configSTATIC_STORAGE;                                       \
+        TaskHandle_t *_rtos_handle = (handle);                                                    \
+        TaskHandle_t _rtos_task = xTaskCreateStatic((code), (name), (depth), (params), (priority), \
+                                                    _rtos_stack, &_rtos_tcb);                     \
+        if (_rtos_handle != NULL)                                                                 \
+        {                                                                                         \
+            *_rtos_handle = _rtos_task;                                                           \
+        }                                                                                         \
+        (BaseType_t)(_rtos_task != NULL ? pdPASS : errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY);        \
+    })
+
+#define RTOS_QUEUE_CREATE(length, item_size)                                       \
+    ({                                                                             \
+        static uint8_t _rtos_storage[(length) * (item_size)] configSTATIC_STORAGE; \
+        static StaticQueue_t _rtos_queue configSTATIC_STORAGE;                     \
+        xQueueCreateStatic((length), (item_size), _rtos_storage, &_rtos_queue);    \
+    })
+
+#define RTOS_MUTEX_CREATE(buffer) xSemaphoreCreateMutexStatic(buffer)
+
+#define RTOS_BINARY_SEMAPHORE_CREATE(buffer) xSemaphoreCreateBinaryStatic(buffer)
+
+/* `storage` holds at least size + 1 bytes */
+#define RTOS_STREAM_BUFFER_CREATE(size, trigger, storage, buffer) \
+    xStreamBufferCreateStatic((size), (trigger), (storage), (buffer))
+
+#define RTOS_EVENT_GROUP_CREATE(buffer) xEventGroupCreateStatic(buffer)
+
+#else
+
+#define RTOS_TASK_CREATE(code, name, depth, params, priority, handle) \
+    xTaskCreate((code), (name), (depth), (params), (priority), (handle))
+
+#define RTOS_QUEUE_CREATE(length, item_size) xQueueCreate((length), (item_size))
+
+#define RTOS_MUTEX_CREATE(buffer) xSemaphoreCreateMutex()
+
+#define RTOS_BINARY_SEMAPHORE_CREATE(buffer) xSemaphoreCreateBinary()
+
+#define RTOS_STREAM_BUFFER_CREATE(size, trigger, storage, buffer) xStreamBufferCreate((size), (trigger))
+
+#define RTOS_EVENT_GROUP_CREATE(buffer) xEventGroupCreate()
+
+#endif /* configSUPPORT_STATIC_ALLOCATION */
+
+#endif
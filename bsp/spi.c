@@ -101,7 +101,7 @@ int spi1_transceive(uint8_t slave_id, uint8_t *tx_buf, uint8_t *rx_buf, uint8_t
 __attribute__((unused)) static void spi_init(struct SpiDriver *Spi, uint8_t device_id, uint8_t plic_source_id)
 {
     // Initialize struct
-    Spi->mutex = xSemaphoreCreateMutex();
+    Spi->mutex = RTOS_MUTEX_CREATE(&Spi->mutex_buffer);
     switch (device_id)
     {
 #if BSP_USE_SPI0
@@ -128,8 +128,10 @@ __attribute__((unused)) static void spi_init(struct SpiDriver *Spi, uint8_t devi
     /* Initialize the XIic driver so that it's ready to use */
     configASSERT(XSpi_Initialize(&Spi->Device, device_id) == XST_SUCCESS);
 
+#if BSP_SELF_TEST
     /* Perform a self-test to ensure that the hardware was built correctly */
     configASSERT(XSpi_SelfTest(&Spi->Device) == XST_SUCCESS);
+#endif
 
 #if !XPAR_SPI_USE_POLLING_MODE /* Interrup mode */
     /* Setup SPI status handler to indicate that SpiStatusHandler
@@ -162,6 +164,7 @@ __attribute__((unused)) static void spi_init(struct SpiDriver *Spi, uint8_t devi
 __attribute__((unused)) static int spi_transfer(struct SpiDriver *Spi, uint8_t slave_id, uint8_t *tx_buf, uint8_t *rx_buf, uint8_t len)
 {
     int returnval;
+    bsp_init_wait();
     configASSERT(Spi->mutex != NULL);
     configASSERT(xSemaphoreTake(Spi->mutex, portMAX_DELAY) == pdTRUE);
 
@@ -247,6 +250,5 @@ static void SpiStatusHandler(void *CallBackRef, int StatusEvent, int ByteCount)
     }
 
     configASSERT(Spi->task_handle != NULL);
-    static BaseType_t askForContextSwitch = pdFALSE;
-    vTaskNotifyGiveFromISR(Spi->task_handle, &askForContextSwitch);
+    isr_notify_give(Spi->task_handle);
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "bsp.h"
 #include "xspi.h"
 #include "semphr.h"
+#include "rtos_static.h"
 
 
     /* Device driver for SPI peripheral */
@@ -16,6 +17,9 @@
         volatile int Errors;
         SemaphoreHandle_t mutex;  /* Mutex for bus acquisition */
         volatile TaskHandle_t task_handle; /* handle for task that initiated a transaction */
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+        StaticSemaphore_t mutex_buffer;
+#endif
     };
 
 #if BSP_USE_SPI0
@@ -0,0 +1,217 @@
+#include "trace.h"
+#include "bsp.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+#if (TRACE_EVENTS & (TRACE_EVENTS - 1)) != 0
+#error "TRACE_EVENTS must be a power of two"
+#endif
+
+static struct trace_event trace_ring[TRACE_EVENTS];
+/* Events recorded since trace_start(), the ring holds the last TRACE_EVENTS */
+static uint32_t trace_head;
+static bool trace_enabled = true;
+/* Set by trace_freeze() until trace_dump() has run, which then resumes */
+static bool trace_frozen;
+static bool trace_resume;
+static bool trace_restart;
+static uint32_t trace_frozen_tasks;
+
+static struct trace_task trace_tasks[TRACE_MAX_TASKS];
+static uint32_t trace_task_count;
+
+/**
+ * Mask interrupts without going through the kernel: the hooks run inside
+ * critical sections and interrupt handlers as well as in tasks.
+ */
+static inline unsigned long trace_lock(void)
+{
+    unsigned long mstatus;
+    __asm volatile("csrrci %0, mstatus, 8" : "=r"(mstatus) : : "memory");
+    return mstatus;
+}
+
+static inline void trace_unlock(unsigned long mstatus)
+{
+    __asm volatile("csrs mstatus, %0" : : "r"(mstatus & 8) : "memory");
+}
+
+void trace_record(uint32_t type, uint32_t arg)
+{
+    unsigned long flags = trace_lock();
+    if (trace_enabled)
+    {
+        struct trace_event *event = &trace_ring[trace_head++ & (TRACE_EVENTS - 1)];
+        event->cycles = get_cycle_count();
+        event->type = type;
+        event->arg = arg;
+    }
+    trace_unlock(flags);
+}
+
+void trace_task_name(uint32_t handle, const char *name)
+{
+    unsigned long flags = trace_lock();
+    uint32_t i;
+
+    /* A new task may reuse the TCB of a deleted one */
+    for (i = 0; i < trace_task_count; i++)
+    {
+        if (trace_tasks[i].handle == handle)
+        {
+            break;
+        }
+    }
+    if (i == trace_task_count)
+    {
+        if (trace_task_count == TRACE_MAX_TASKS)
+        {
+            trace_unlock(flags);
+            return;
+        }
+        trace_task_count++;
+    }
+    trace_tasks[i].handle = handle;
+    strncpy(trace_tasks[i].name, name, TRACE_TASK_NAME_LEN - 1);
+    trace_tasks[i].name[TRACE_TASK_NAME_LEN - 1] = '\0';
+    trace_unlock(flags);
+}
+
+void trace_start(void)
+{
+    unsigned long flags = trace_lock();
+    if (trace_frozen)
+    {
+        trace_resume = true;
+        trace_restart = true;
+    }
+    else
+    {
+        trace_head = 0;
+        trace_enabled = true;
+    }
+    trace_unlock(flags);
+}
+
+void trace_stop(void)
+{
+    unsigned long flags = trace_lock();
+    if (trace_frozen)
+    {
+        trace_resume = false;
+    }
+    else
+    {
+        trace_enabled = false;
+    }
+    trace_unlock(flags);
+}
+
+static uint32_t trace_count(void)
+{
+    return trace_head < TRACE_EVENTS ? trace_head : TRACE_EVENTS;
+}
+
+size_t trace_freeze(void)
+{
+    unsigned long flags = trace_lock();
+    if (!trace_frozen)
+    {
+        trace_frozen = true;
+        trace_resume = trace_enabled;
+        trace_restart = false;
+        trace_enabled = false;
+        trace_frozen_tasks = trace_task_count;
+    }
+    trace_unlock(flags);
+
+    return sizeof(struct trace_header) +
+           trace_frozen_tasks * sizeof(struct trace_task) +
+           trace_count() * sizeof(struct trace_event);
+}
+
+int trace_dump(trace_write_fn write, void *ctx)
+{
+    trace_freeze();
+
+    struct trace_header header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .event_size = sizeof(struct trace_event),
+        .cpu_hz = configCPU_CLOCK_HZ,
+        .tasks = trace_frozen_tasks,
+        .events = trace_count(),
+        .lost = trace_head - trace_count(),
+    };
+    /* The oldest event is at the head once the ring has wrapped */
+    uint32_t first = (trace_head - header.events) & (TRACE_EVENTS - 1);
+    uint32_t before_wrap = TRACE_EVENTS - first;
+    if (before_wrap > header.events)
+    {
+        before_wrap = header.events;
+    }
+
+    int err = write(ctx, &header, sizeof(header));
+    if (!err && header.tasks)
+    {
+        err = write(ctx, trace_tasks, header.tasks * sizeof(struct trace_task));
+    }
+    if (!err && before_wrap)
+    {
+        err = write(ctx, &trace_ring[first], before_wrap * sizeof(struct trace_event));
+    }
+    if (!err && header.events > before_wrap)
+    {
+        err = write(ctx, trace_ring, (header.events - before_wrap) * sizeof(struct trace_event));
+    }
+
+    unsigned long flags = trace_lock();
+    if (trace_restart)
+    {
+        trace_head = 0;
+    }
+    trace_enabled = trace_resume;
+    trace_frozen = false;
+    trace_unlock(flags);
+    return err;
+}
+
+#define TRACE_UART_LINE_BYTES 32
+
+static int trace_write_hex(void *ctx, const void *data, size_t len)
+{
+    size_t *column = ctx;
+    const uint8_t *bytes = data;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (*column == 0)
+        {
+            printf("trace,");
+        }
+        printf("%02x", bytes[i]);
+        if (++*column == TRACE_UART_LINE_BYTES)
+        {
+            printf("\r\n");
+            *column = 0;
+        }
+    }
+    return 0;
+}
+
+void trace_dump_uart(void)
+{
+    size_t column = 0;
+
+    printf("trace,begin,%lu\r\n", (unsigned long)trace_freeze());
+    trace_dump(trace_write_hex, &column);
+    if (column)
+    {
+        printf("\r\n");
+    }
+    printf("trace,end\r\n");
+}
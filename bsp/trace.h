@@ -0,0 +1,138 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/**
+ * In-memory kernel trace recorder.
+ *
+ * Built with configUSE_TRACE_RECORDER (`make TRACE=1`), the kernel trace
+ * hooks, the external interrupt handler and the FreeRTOS+TCP iptrace hooks
+ * record fixed size events, timestamped with mcycle, into a RAM ring. The
+ * ring is recording from reset and always keeps the latest TRACE_EVENTS
+ * events. It is read out with trace_dump(), as the image described below,
+ * which tools/trace2json.py turns into Chrome trace event JSON for Perfetto
+ * or chrome://tracing.
+ *
+ * Image layout, little endian:
+ *   struct trace_header
+ *   struct trace_task[header.tasks]
+ *   struct trace_event[header.events], oldest first
+ */
+
+#ifndef __ASSEMBLER__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Must be a power of two */
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 8192
+#endif
+
+/* Tasks created since reset whose names are kept */
+#ifndef TRACE_MAX_TASKS
+#define TRACE_MAX_TASKS 32
+#endif
+
+#define TRACE_MAGIC 0x52545246UL /* "FRTR" */
+#define TRACE_VERSION 1
+#define TRACE_TASK_NAME_LEN 16
+
+enum trace_event_type
+{
+    TRACE_TASK_SWITCHED_IN = 1,
+    TRACE_TASK_SWITCHED_OUT,
+    TRACE_TASK_CREATE,
+    TRACE_TASK_DELETE,
+    TRACE_TASK_DELAY,
+    TRACE_QUEUE_SEND,
+    TRACE_QUEUE_SEND_FROM_ISR,
+    TRACE_QUEUE_SEND_FAILED,
+    TRACE_QUEUE_RECEIVE,
+    TRACE_QUEUE_RECEIVE_FROM_ISR,
+    TRACE_QUEUE_RECEIVE_FAILED,
+    TRACE_QUEUE_BLOCK_ON_SEND,
+    TRACE_QUEUE_BLOCK_ON_RECEIVE,
+    TRACE_ISR_ENTER,
+    TRACE_ISR_EXIT,
+    TRACE_IP_TRANSMIT,
+    TRACE_IP_RECEIVE,
+    TRACE_IP_EVENT,
+    TRACE_IP_NO_BUFFER,
+};
+
+/* arg is a task or queue handle, a PLIC source or an IP event, by type */
+struct trace_event
+{
+    uint64_t cycles;
+    uint32_t type;
+    uint32_t arg;
+};
+
+struct trace_task
+{
+    uint32_t handle;
+    char name[TRACE_TASK_NAME_LEN];
+};
+
+struct trace_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t event_size;
+    uint32_t cpu_hz;
+    uint32_t tasks;
+    uint32_t events;
+    /* Overwritten before the dump */
+    uint32_t lost;
+};
+
+/* Record an event; callable from tasks, critical sections and interrupts */
+void trace_record(uint32_t type, uint32_t arg);
+void trace_task_name(uint32_t handle, const char *name);
+
+/* Clear the ring and record from now on, or stop recording */
+void trace_start(void);
+void trace_stop(void);
+
+/**
+ * Write the trace image with `write`, which returns 0 on success. Recording
+ * is paused from trace_freeze(), or the start of trace_dump(), until the
+ * image is written. Returns 0 if every write succeeded.
+ */
+typedef int (*trace_write_fn)(void *ctx, const void *data, size_t len);
+size_t trace_freeze(void);
+int trace_dump(trace_write_fn write, void *ctx);
+
+/* Print the image to stdout as hex lines, for tools/trace2json.py */
+void trace_dump_uart(void);
+
+#define TRACE_HANDLE(x) ((uint32_t)(uintptr_t)(x))
+
+/* Kernel hooks, expanded in tasks.c and queue.c */
+#define traceTASK_SWITCHED_IN() trace_record(TRACE_TASK_SWITCHED_IN, TRACE_HANDLE(pxCurrentTCB))
+#define traceTASK_SWITCHED_OUT() trace_record(TRACE_TASK_SWITCHED_OUT, TRACE_HANDLE(pxCurrentTCB))
+#define traceTASK_CREATE(pxNewTCB)                                        \
+    do                                                                    \
+    {                                                                     \
+        trace_task_name(TRACE_HANDLE(pxNewTCB), (pxNewTCB)->pcTaskName);  \
+        trace_record(TRACE_TASK_CREATE, TRACE_HANDLE(pxNewTCB));          \
+    } while (0)
+#define traceTASK_DELETE(pxTCB) trace_record(TRACE_TASK_DELETE, TRACE_HANDLE(pxTCB))
+#define traceTASK_DELAY() trace_record(TRACE_TASK_DELAY, TRACE_HANDLE(pxCurrentTCB))
+#define traceTASK_DELAY_UNTIL(xTimeToWake) trace_record(TRACE_TASK_DELAY, TRACE_HANDLE(pxCurrentTCB))
+#define traceQUEUE_SEND(pxQueue) trace_record(TRACE_QUEUE_SEND, TRACE_HANDLE(pxQueue))
+#define traceQUEUE_SEND_FROM_ISR(pxQueue) trace_record(TRACE_QUEUE_SEND_FROM_ISR, TRACE_HANDLE(pxQueue))
+#define traceQUEUE_SEND_FAILED(pxQueue) trace_record(TRACE_QUEUE_SEND_FAILED, TRACE_HANDLE(pxQueue))
+#define traceQUEUE_RECEIVE(pxQueue) trace_record(TRACE_QUEUE_RECEIVE, TRACE_HANDLE(pxQueue))
+#define traceQUEUE_RECEIVE_FROM_ISR(pxQueue) trace_record(TRACE_QUEUE_RECEIVE_FROM_ISR, TRACE_HANDLE(pxQueue))
+#define traceQUEUE_RECEIVE_FAILED(pxQueue) trace_record(TRACE_QUEUE_RECEIVE_FAILED, TRACE_HANDLE(pxQueue))
+#define traceBLOCKING_ON_QUEUE_SEND(pxQueue) trace_record(TRACE_QUEUE_BLOCK_ON_SEND, TRACE_HANDLE(pxQueue))
+#define traceBLOCKING_ON_QUEUE_RECEIVE(pxQueue) trace_record(TRACE_QUEUE_BLOCK_ON_RECEIVE, TRACE_HANDLE(pxQueue))
+
+/* Used by external_interrupt_handler() */
+#define traceISR_ENTER(source_id) trace_record(TRACE_ISR_ENTER, (source_id))
+#define traceISR_EXIT(source_id) trace_record(TRACE_ISR_EXIT, (source_id))
+
+#endif /* __ASSEMBLER__ */
+
+#endif
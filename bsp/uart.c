@@ -4,6 +4,8 @@
 
 #include "FreeRTOS.h"
 #include "semphr.h"
+#include "stream_buffer.h"
+#include "rtos_static.h"
 
 /* Xilinx driver includes. */
 #include "xuartns550.h"
@@ -16,6 +18,7 @@
 #define UART_TX_DELAY pdMS_TO_TICKS(500)
 #define UART_RX_DELAY pdMS_TO_TICKS(10000)
 #define UART_BUFFER_SIZE 254
+#define UART_FIFO_SIZE 16
 
 /*****************************************************************************/
 /* Structs */
@@ -35,6 +38,14 @@ struct UartDriver
     SemaphoreHandle_t rx_mutex; /* Mutex for RX transmissions */
     TaskHandle_t tx_task;       /* handle for task that called TX */
     TaskHandle_t rx_task;       /* handle for task that called RX */
+    uint8_t plic_source_id;
+    StreamBufferHandle_t rx_stream; /* RX data from the interrupt, if set */
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    StaticSemaphore_t tx_mutex_buffer;
+    StaticSemaphore_t rx_mutex_buffer;
+    StaticStreamBuffer_t rx_stream_buffer;
+    uint8_t rx_stream_storage[UART_RXSTREAM_MAX_SIZE + 1];
+#endif
 };
 
 /*****************************************************************************/
@@ -46,6 +57,13 @@ static uint8_t uart_txchar(struct UartDriver *Uart, uint8_t c);
 static int uart_rxbuffer(struct UartDriver *Uart, uint8_t *ptr, int len);
 static int uart_txbuffer(struct UartDriver *Uart, uint8_t *ptr, int len);
 static void uart_init(struct UartDriver *Uart, uint8_t device_id, uint8_t plic_source_id);
+static void uart_get_stats(struct UartDriver *Uart, struct UartStats *stats);
+static int uart_rxstream_init(struct UartDriver *Uart, size_t size);
+static int uart_rxwait(struct UartDriver *Uart, uint8_t *ptr, int len, TickType_t timeout);
+
+#if XPAR_UART_USE_POLLING_MODE
+static void uart_rxstream_handler(void *CallBackRef);
+#endif
 
 #if !XPAR_UART_USE_POLLING_MODE
 static void UartNs550StatusHandler(void *CallBackRef, u32 Event, unsigned int EventData);
@@ -114,6 +132,52 @@ int uart0_rxbuffer(char *ptr, int len)
 {
     return uart_rxbuffer(&Uart0, (uint8_t *)ptr, len);
 }
+
+/**
+ * Copy UART0 driver counters into `stats`
+ */
+void uart0_get_stats(struct UartStats *stats)
+{
+    uart_get_stats(&Uart0, stats);
+}
+
+/**
+ * Receive UART0 data from the RX interrupt into a stream buffer of `size`
+ * bytes, so that readers can block instead of polling. Returns 0 on success,
+ * the UART keeps being polled otherwise.
+ */
+int uart0_rxstream_init(size_t size)
+{
+    return uart_rxstream_init(&Uart0, size);
+}
+
+/**
+ * Receive at least one byte, waiting up to `timeout` ticks for it. Returns
+ * number of received bytes, 0 after a timeout.
+ */
+int uart0_rxwait(char *ptr, int len, TickType_t timeout)
+{
+    return uart_rxwait(&Uart0, (uint8_t *)ptr, len, timeout);
+}
+
+/**
+ * Enable or disable the TX empty interrupt. With the transmitter idle it is
+ * raised at once, which makes it a software triggered interrupt source. The
+ * caller registers the PLIC handler, which is only possible in polling mode.
+ */
+void uart0_txempty_irq(bool enable)
+{
+    uint32_t ier = XUartNs550_ReadReg(Uart0.Device.BaseAddress, XUN_IER_OFFSET);
+    if (enable)
+    {
+        ier |= XUN_IER_TX_EMPTY;
+    }
+    else
+    {
+        ier &= ~XUN_IER_TX_EMPTY;
+    }
+    XUartNs550_WriteReg(Uart0.Device.BaseAddress, XUN_IER_OFFSET, ier);
+}
 #endif /* BSP_USE_UART0 */
 
 #if BSP_USE_UART1
@@ -130,6 +194,7 @@ void uart1_init(void)
  */
 bool uart1_rxready(void)
 {
+    bsp_init_wait();
     return uart_rxready(&Uart1);
 }
 
@@ -138,6 +203,7 @@ bool uart1_rxready(void)
  */
 char uart1_rxchar(void)
 {
+    bsp_init_wait();
     return (char)uart_rxchar(&Uart1);
 }
 
@@ -148,6 +214,7 @@ char uart1_rxchar(void)
  */
 int uart1_txbuffer(char *ptr, int len)
 {
+    bsp_init_wait();
     return uart_txbuffer(&Uart1, (uint8_t *)ptr, len);
 }
 
@@ -156,6 +223,7 @@ int uart1_txbuffer(char *ptr, int len)
  */
 char uart1_txchar(char c)
 {
+    bsp_init_wait();
     return (char)uart_txchar(&Uart1, (uint8_t)c);
 }
 
@@ -164,8 +232,18 @@ char uart1_txchar(char c)
  */
 int uart1_rxbuffer(char *ptr, int len)
 {
+    bsp_init_wait();
     return uart_rxbuffer(&Uart1, (uint8_t *)ptr, len);
 }
+
+/**
+ * Copy UART1 driver counters into `stats`
+ */
+void uart1_get_stats(struct UartStats *stats)
+{
+    bsp_init_wait();
+    uart_get_stats(&Uart1, stats);
+}
 #endif /* BSP_USE_UART1 */
 
 /*****************************************************************************/
@@ -173,17 +251,34 @@ int uart1_rxbuffer(char *ptr, int len)
 
 static bool uart_rxready(struct UartDriver *Uart)
 {
+    if (Uart->rx_stream != NULL)
+    {
+        return !xStreamBufferIsEmpty(Uart->rx_stream);
+    }
     return (bool)XUartNs550_IsReceiveData(Uart->Device.BaseAddress);
 }
 
+/**
+ * Copy the driver counters. The counters are only written from the
+ * interrupt handler, so plain volatile reads are enough; no mutex is taken
+ * and an ongoing transaction is not disturbed.
+ */
+static void uart_get_stats(struct UartDriver *Uart, struct UartStats *stats)
+{
+    stats->TotalReceivedCount = Uart->TotalReceivedCount;
+    stats->TotalSentCount = Uart->TotalSentCount;
+    stats->TotalErrorCount = Uart->TotalErrorCount;
+    stats->Errors = Uart->Errors;
+}
+
 /**
  * Initialize UART peripheral
  */
 static void uart_init(struct UartDriver *Uart, uint8_t device_id, uint8_t plic_source_id)
 {
     // Initialize struct
-    Uart->tx_mutex = xSemaphoreCreateMutex();
-    Uart->rx_mutex = xSemaphoreCreateMutex();
+    Uart->tx_mutex = RTOS_MUTEX_CREATE(&Uart->tx_mutex_buffer);
+    Uart->rx_mutex = RTOS_MUTEX_CREATE(&Uart->rx_mutex_buffer);
     switch (device_id)
     {
 #if BSP_USE_UART0
@@ -204,15 +299,18 @@ static void uart_init(struct UartDriver *Uart, uint8_t device_id, uint8_t plic_s
 
     Uart->tx_task = NULL;
     Uart->rx_task = NULL;
+    Uart->plic_source_id = plic_source_id;
+    Uart->rx_stream = NULL;
 
     /* Initialize the UartNs550 driver so that it's ready to use */
     configASSERT(XUartNs550_Initialize(&Uart->Device, device_id) == XST_SUCCESS);
 
+#if BSP_SELF_TEST
     /* Perform a self-test to ensure that the hardware was built correctly */
     configASSERT(XUartNs550_SelfTest(&Uart->Device) == XST_SUCCESS);
+#endif
 
 #if XPAR_UART_USE_POLLING_MODE
-    (void)plic_source_id;
     uint16_t Options = XUN_OPTION_FIFOS_ENABLE | XUN_FIFO_TX_RESET | XUN_FIFO_RX_RESET;
 #else
     /* Setup interrupt system */
@@ -237,6 +335,12 @@ static void uart_init(struct UartDriver *Uart, uint8_t device_id, uint8_t plic_s
 static uint8_t uart_rxchar(struct UartDriver *Uart)
 {
 #if XPAR_UART_USE_POLLING_MODE
+    if (Uart->rx_stream != NULL)
+    {
+        uint8_t buf = 0;
+        uart_rxwait(Uart, &buf, 1, portMAX_DELAY);
+        return buf;
+    }
     return XUartNs550_RecvByte(Uart->Device.BaseAddress);
 #else
     uint8_t buf = 0;
@@ -275,7 +379,15 @@ static int uart_txbuffer(struct UartDriver *Uart, uint8_t *ptr, int len)
     int remaining = len;
     int sent = 0;
     while (remaining > 0) {
+        /* Send() arms the TX empty interrupt when the RX interrupt is on,
+         * nothing waits for it here */
+        taskENTER_CRITICAL();
         sent = XUartNs550_Send(&Uart->Device, &ptr[idx], remaining);
+        if (Uart->rx_stream != NULL)
+        {
+            XUartNs550_WriteReg(Uart->Device.BaseAddress, XUN_IER_OFFSET, XUN_IER_RX_DATA);
+        }
+        taskEXIT_CRITICAL();
         configASSERT(sent >= 0);
         remaining -= sent;
         idx += sent;
@@ -317,7 +429,14 @@ static int uart_rxbuffer(struct UartDriver *Uart, uint8_t *ptr, int len)
     configASSERT(xSemaphoreTake(Uart->rx_mutex, portMAX_DELAY) == pdTRUE);
 
 #if XPAR_UART_USE_POLLING_MODE
-    returnval = XUartNs550_Recv(&Uart->Device, ptr, len);;
+    if (Uart->rx_stream != NULL)
+    {
+        returnval = xStreamBufferReceive(Uart->rx_stream, ptr, len, 0);
+    }
+    else
+    {
+        returnval = XUartNs550_Recv(&Uart->Device, ptr, len);
+    }
 #else
     /* Get current task handle */
     Uart->rx_task = xTaskGetCurrentTaskHandle();
@@ -341,6 +460,113 @@ static int uart_rxbuffer(struct UartDriver *Uart, uint8_t *ptr, int len)
     return returnval;
 }
 
+/**
+ * Receive a buffer of data, waiting up to `timeout` ticks for the first byte.
+ * Without an RX stream the UART is polled every tick.
+ */
+static int uart_rxwait(struct UartDriver *Uart, uint8_t *ptr, int len, TickType_t timeout)
+{
+    if (Uart->rx_stream == NULL)
+    {
+        int n;
+        while ((n = uart_rxbuffer(Uart, ptr, len)) == 0 && timeout > 0)
+        {
+            vTaskDelay(1);
+            if (timeout != portMAX_DELAY)
+            {
+                timeout--;
+            }
+        }
+        return n;
+    }
+
+    configASSERT(Uart->rx_mutex != NULL);
+    configASSERT(xSemaphoreTake(Uart->rx_mutex, portMAX_DELAY) == pdTRUE);
+    int returnval = xStreamBufferReceive(Uart->rx_stream, ptr, len, timeout);
+    xSemaphoreGive(Uart->rx_mutex);
+    return returnval;
+}
+
+/**
+ * Switch RX to the interrupt driven stream buffer. Only available in polling
+ * mode, the interrupt driven driver already owns the PLIC source.
+ */
+static int uart_rxstream_init(struct UartDriver *Uart, size_t size)
+{
+#if XPAR_UART_USE_POLLING_MODE
+    if (Uart->rx_stream != NULL)
+    {
+        return 0;
+    }
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    if (size > UART_RXSTREAM_MAX_SIZE)
+    {
+        return 1;
+    }
+#endif
+    StreamBufferHandle_t stream = RTOS_STREAM_BUFFER_CREATE(size, 1, Uart->rx_stream_storage,
+                                                            &Uart->rx_stream_buffer);
+    if (stream == NULL)
+    {
+        return 1;
+    }
+
+    /* Hold off readers while RX switches over to the stream */
+    configASSERT(xSemaphoreTake(Uart->rx_mutex, portMAX_DELAY) == pdTRUE);
+    Uart->rx_stream = stream;
+    if (PLIC_register_interrupt_handler(&Plic, Uart->plic_source_id,
+                                        uart_rxstream_handler, Uart) == 0)
+    {
+        Uart->rx_stream = NULL;
+        xSemaphoreGive(Uart->rx_mutex);
+        vStreamBufferDelete(stream);
+        return 1;
+    }
+    XUartNs550_WriteReg(Uart->Device.BaseAddress, XUN_IER_OFFSET, XUN_IER_RX_DATA);
+    xSemaphoreGive(Uart->rx_mutex);
+    return 0;
+#else
+    (void)Uart;
+    (void)size;
+    return 1;
+#endif /* XPAR_UART_USE_POLLING_MODE */
+}
+
+#if XPAR_UART_USE_POLLING_MODE
+/**
+ * RX interrupt handler for the stream buffer. Drains the RX FIFO, bytes that
+ * do not fit into the stream are dropped and counted as errors.
+ */
+static void uart_rxstream_handler(void *CallBackRef)
+{
+    struct UartDriver *Uart = (struct UartDriver *)CallBackRef;
+    uint8_t buf[UART_FIFO_SIZE];
+    size_t len = 0;
+
+    /* The TX empty interrupt is armed by XUartNs550_Send(), drop it */
+    XUartNs550_WriteReg(Uart->Device.BaseAddress, XUN_IER_OFFSET, XUN_IER_RX_DATA);
+
+    while (XUartNs550_IsReceiveData(Uart->Device.BaseAddress))
+    {
+        buf[len++] = (uint8_t)XUartNs550_ReadReg(Uart->Device.BaseAddress, XUN_RBR_OFFSET);
+        if (len == sizeof(buf))
+        {
+            size_t sent = xStreamBufferSendFromISR(Uart->rx_stream, buf, len, isr_task_woken());
+            Uart->TotalReceivedCount += len;
+            Uart->TotalErrorCount += len - sent;
+            len = 0;
+        }
+    }
+    if (len > 0)
+    {
+        size_t sent = xStreamBufferSendFromISR(Uart->rx_stream, buf, len, isr_task_woken());
+        Uart->TotalReceivedCount += len;
+        Uart->TotalErrorCount += len - sent;
+    }
+}
+#endif /* XPAR_UART_USE_POLLING_MODE */
+
 #if !XPAR_UART_USE_POLLING_MODE
 /**
  * UART Interrupt handler. Handles RX, TX, Timeouts and Errors.
@@ -363,8 +589,7 @@ static void UartNs550StatusHandler(void *CallBackRef, u32 Event,
             if (Uart->tx_task != NULL)
             {
                 // call task handler only if it was registered
-                static BaseType_t askForContextSwitch = pdFALSE;
-                vTaskNotifyGiveFromISR(Uart->tx_task, &askForContextSwitch);
+                isr_notify_give(Uart->tx_task);
             }
         }
     }
@@ -382,8 +607,7 @@ static void UartNs550StatusHandler(void *CallBackRef, u32 Event,
             if (Uart->rx_task != NULL)
             {
                 // call task handler only if it was registered
-                static BaseType_t askForContextSwitch = pdFALSE;
-                vTaskNotifyGiveFromISR(Uart->rx_task, &askForContextSwitch);
+                isr_notify_give(Uart->rx_task);
             }
         }
     }
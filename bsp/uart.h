@@ -3,6 +3,21 @@
 
 #include "bsp.h"
 #include <stdbool.h>
+#include <stddef.h>
+
+/* Largest stream uart0_rxstream_init() accepts with configSUPPORT_STATIC_ALLOCATION */
+#ifndef UART_RXSTREAM_MAX_SIZE
+#define UART_RXSTREAM_MAX_SIZE 1024
+#endif
+
+/* Snapshot of the driver counters, filled without taking the driver mutexes */
+struct UartStats
+{
+    int TotalReceivedCount;
+    int TotalSentCount;
+    int TotalErrorCount;
+    uint8_t Errors;
+};
 
 #if BSP_USE_UART0
 bool uart0_rxready(void);
@@ -11,6 +26,10 @@ char uart0_txchar(char c);
 int uart0_rxbuffer(char *ptr, int len);
 int uart0_txbuffer(char *ptr, int len);
 void uart0_init(void);
+void uart0_get_stats(struct UartStats *stats);
+int uart0_rxstream_init(size_t size);
+int uart0_rxwait(char *ptr, int len, TickType_t timeout);
+void uart0_txempty_irq(bool enable);
 #endif
 
 #if BSP_USE_UART1
@@ -20,6 +39,7 @@ char uart1_txchar(char c);
 int uart1_rxbuffer(char *ptr, int len);
 int uart1_txbuffer(char *ptr, int len);
 void uart1_init(void);
+void uart1_get_stats(struct UartStats *stats);
 #endif
 
 #endif
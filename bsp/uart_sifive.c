@@ -32,18 +32,40 @@
 
 #include "FreeRTOS.h"
 #include "semphr.h"
+#include "stream_buffer.h"
+#include "rtos_static.h"
+
+#define UART_FIFO_SIZE 8
 
 SemaphoreHandle_t uart_tx_mutex; /* Mutex for TX transmissions */
 SemaphoreHandle_t uart_rx_mutex; /* Mutex for RX transmissions */
 volatile uint32_t *uart;
+static StreamBufferHandle_t uart_rx_stream; /* RX data from the interrupt, if set */
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticSemaphore_t uart_tx_mutex_buffer configSTATIC_STORAGE;
+static StaticSemaphore_t uart_rx_mutex_buffer configSTATIC_STORAGE;
+static StaticStreamBuffer_t uart_rx_stream_buffer configSTATIC_STORAGE;
+static uint8_t uart_rx_stream_storage[UART_RXSTREAM_MAX_SIZE + 1] configSTATIC_STORAGE;
+#endif
+
+static void uart_rxstream_handler(void *CallBackRef);
 
 bool uart0_rxready(void)
 {
+    if (uart_rx_stream != NULL)
+        return !xStreamBufferIsEmpty(uart_rx_stream);
     return true;
 }
 
 char uart0_rxchar(void)
 {
+    if (uart_rx_stream != NULL)
+    {
+        char c = 0;
+        uart0_rxwait(&c, 1, portMAX_DELAY);
+        return c;
+    }
     return (char)uart_getchar();
 }
 
@@ -58,15 +80,135 @@ int uart0_rxbuffer(char *ptr, int len)
     configASSERT(uart_rx_mutex != NULL);
     /* First acquire mutex */
     configASSERT(xSemaphoreTake(uart_rx_mutex, portMAX_DELAY) == pdTRUE);
-    for (int idx = 0; idx < len; idx++)
+    if (uart_rx_stream != NULL)
+    {
+        len = xStreamBufferReceive(uart_rx_stream, ptr, len, 0);
+    }
+    else
     {
-        ptr[idx] = uart_getchar();
+        for (int idx = 0; idx < len; idx++)
+        {
+            ptr[idx] = uart_getchar();
+        }
     }
     /* Release mutex and return */
     xSemaphoreGive(uart_rx_mutex);
     return len;
 }
 
+/**
+ * Receive at least one byte, waiting up to `timeout` ticks for it. Returns
+ * number of received bytes, 0 after a timeout. Without an RX stream the
+ * FIFO is polled every tick.
+ */
+int uart0_rxwait(char *ptr, int len, TickType_t timeout)
+{
+    int n = 0;
+    configASSERT(uart_rx_mutex != NULL);
+    configASSERT(xSemaphoreTake(uart_rx_mutex, portMAX_DELAY) == pdTRUE);
+    if (uart_rx_stream != NULL)
+    {
+        n = xStreamBufferReceive(uart_rx_stream, ptr, len, timeout);
+    }
+    else
+    {
+        for (;;)
+        {
+            int ch;
+            while (n < len && (ch = uart_getchar()) >= 0)
+            {
+                ptr[n++] = (char)ch;
+            }
+            if (n > 0 || timeout == 0)
+                break;
+            vTaskDelay(1);
+            if (timeout != portMAX_DELAY)
+                timeout--;
+        }
+    }
+    xSemaphoreGive(uart_rx_mutex);
+    return n;
+}
+
+/**
+ * Receive UART0 data from the RX watermark interrupt into a stream buffer of
+ * `size` bytes, so that readers can block instead of polling. Returns 0 on
+ * success, the UART keeps being polled otherwise.
+ */
+int uart0_rxstream_init(size_t size)
+{
+    if (uart_rx_stream != NULL)
+        return 0;
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    if (size > UART_RXSTREAM_MAX_SIZE)
+        return 1;
+#endif
+    StreamBufferHandle_t stream = RTOS_STREAM_BUFFER_CREATE(size, 1, uart_rx_stream_storage,
+                                                            &uart_rx_stream_buffer);
+    if (stream == NULL)
+        return 1;
+
+    /* Hold off readers while RX switches over to the stream */
+    configASSERT(xSemaphoreTake(uart_rx_mutex, portMAX_DELAY) == pdTRUE);
+    uart_rx_stream = stream;
+    if (PLIC_register_interrupt_handler(&Plic, PLIC_SOURCE_UART0,
+                                        uart_rxstream_handler, NULL) == 0)
+    {
+        uart_rx_stream = NULL;
+        xSemaphoreGive(uart_rx_mutex);
+        vStreamBufferDelete(stream);
+        return 1;
+    }
+    /* Watermark of 0: interrupt whenever the RX FIFO is not empty */
+    uart[UART_REG_RXCTRL] = UART_RXEN;
+    uart[UART_REG_IE] = UART_IE_RXWM;
+    xSemaphoreGive(uart_rx_mutex);
+    return 0;
+}
+
+/**
+ * Enable or disable the TX watermark interrupt, set to fire while the TX FIFO
+ * is empty. With the transmitter idle it is raised at once, which makes it a
+ * software triggered interrupt source; the caller registers the PLIC handler.
+ */
+void uart0_txempty_irq(bool enable)
+{
+    if (enable)
+    {
+        uart[UART_REG_TXCTRL] = UART_TXEN | UART_TXCNT(1);
+        uart[UART_REG_IE] |= UART_IE_TXWM;
+    }
+    else
+    {
+        uart[UART_REG_IE] &= ~UART_IE_TXWM;
+    }
+}
+
+/**
+ * RX watermark interrupt handler. Drains the RX FIFO into the stream buffer,
+ * bytes that do not fit are dropped.
+ */
+static void uart_rxstream_handler(void *CallBackRef)
+{
+    (void)CallBackRef;
+    char buf[UART_FIFO_SIZE];
+    size_t len = 0;
+    int ch;
+
+    while ((ch = uart_getchar()) >= 0)
+    {
+        buf[len++] = (char)ch;
+        if (len == sizeof(buf))
+        {
+            xStreamBufferSendFromISR(uart_rx_stream, buf, len, isr_task_woken());
+            len = 0;
+        }
+    }
+    if (len > 0)
+        xStreamBufferSendFromISR(uart_rx_stream, buf, len, isr_task_woken());
+}
+
 int uart0_txbuffer(char *ptr, int len)
 {
     configASSERT(uart_tx_mutex != NULL);
@@ -86,6 +228,14 @@ void uart0_init(void)
     uart_init();
 }
 
+/**
+ * The SiFive UART driver does not keep any counters
+ */
+void uart0_get_stats(struct UartStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
 void uart_putchar(uint8_t ch)
 {
 #ifdef __riscv_atomic
@@ -144,6 +294,6 @@ void uart_init()
     uart[UART_REG_DIV] = 27;
     uart[UART_REG_RXCTRL] = UART_RXEN;
 
-    uart_tx_mutex = xSemaphoreCreateMutex();
-    uart_rx_mutex = xSemaphoreCreateMutex();
+    uart_tx_mutex = RTOS_MUTEX_CREATE(&uart_tx_mutex_buffer);
+    uart_rx_mutex = RTOS_MUTEX_CREATE(&uart_rx_mutex_buffer);
 }
@@ -36,10 +36,15 @@ extern volatile uint32_t* uart;
 #define UART_REG_RXFIFO		1
 #define UART_REG_TXCTRL		2
 #define UART_REG_RXCTRL		3
+#define UART_REG_IE		4
+#define UART_REG_IP		5
 #define UART_REG_DIV		6
 
 #define UART_TXEN		 0x1
 #define UART_RXEN		 0x1
+#define UART_IE_TXWM		 0x1
+#define UART_IE_RXWM		 0x2
+#define UART_TXCNT(x)		 ((x) << 16)
 
 void uart_putchar(uint8_t ch);
 int uart_getchar(void);
@@ -63,6 +63,7 @@
 #include <string.h> // for memset
 #include <stdio.h> // for xaxi_debug_printf
 #include "bsp.h" // for "sleep"
+#include "hrtimer.h"
 /************************** Constant Definitions *****************************/
 
 /**************************** Type Definitions *******************************/
@@ -74,10 +75,8 @@
 *
 * This macro polls an address periodically until a condition is met or till the
 * timeout occurs.
-* The minimum timeout for calling this macro is 100us. If the timeout is less
-* than 100us, it still waits for 100us. Also the unit for the timeout is 100us.
-* If the timeout is not a multiple of 100us, it waits for a timeout of
-* the next usec value which is a multiple of 100us.
+* Between polls the task blocks until the next tick at least 100us later, and
+* the timeout is measured with clock_us(), so it may end up to a tick late.
 *
 * @param            IO_func - accessor function to read the register contents.
 *                   Depends on the register width.
@@ -94,21 +93,21 @@
 *****************************************************************************/
 #define Xil_poll_timeout(IO_func, ADDR, VALUE, COND, TIMEOUT_US) \
  ( {	  \
-	u64 timeout = TIMEOUT_US/100;    \
-	if(TIMEOUT_US%100!=0)	\
-		timeout++;   \
+	u64 deadline = clock_us() + (TIMEOUT_US);    \
+	int timedout = 0;   \
 	for(;;) { \
 		VALUE = IO_func(ADDR); \
 		if(COND) \
 			break; \
 		else {    \
-			msleep(1);  \
-			timeout--; \
-			if(timeout==0) \
-			break;  \
+			if(clock_us() >= deadline) { \
+				timedout = 1;  \
+				break;  \
+			}  \
+			hrtimer_usleep_coarse(100);  \
 		}  \
 	}    \
-	(timeout>0) ? 0 : -1;  \
+	timedout ? -1 : 0;  \
  }  )
 
 
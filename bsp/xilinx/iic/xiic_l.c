@@ -95,6 +95,7 @@
 /***************************** Include Files *******************************/
 
 #include "bsp.h"
+#include "hrtimer.h"
 #include "xil_types.h"
 #include "xil_assert.h"
 #include "xiic_l.h"
@@ -1083,13 +1084,13 @@ u32 XIic_CheckIsBusBusy(UINTPTR BaseAddress)
 *******************************************************************************/
 u32 XIic_WaitBusFree(UINTPTR BaseAddress)
 {
-	u32 BusyCount = 0;
+	u64 Deadline = clock_us() + 1000000;
 
 	while (XIic_CheckIsBusBusy(BaseAddress)) {
-		if (BusyCount++ > 10000) {
+		if (clock_us() >= Deadline) {
 			return XST_FAILURE;
 		}
-		msleep(0.1);
+		hrtimer_usleep_coarse(100);
 	}
 
 	return XST_SUCCESS;
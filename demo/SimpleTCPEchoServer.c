@@ -129,25 +129,78 @@ FreeRTOSConfig.h as it is a demo application constant. */
 static void prvConnectionListeningTask(void *pvParameters);
 
 /*
- * Created by the connection listening task to handle a single connection.
+ * Created by the connection listening task to handle a single connection, or
+ * with static allocation, created up front to handle one connection at a time.
  */
 static void prvServerConnectionInstance(void *pvParameters);
 
+/*
+ * Echoes data on a connected socket until the client closes it, then closes
+ * the socket.
+ */
+static void prvEchoConnection(Socket_t xConnectedSocket, uint8_t *pucRxBuffer);
+
 /*-----------------------------------------------------------*/
 
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+
+/* With static allocation a fixed set of connection tasks, each with its own
+receive buffer, is created up front instead of a task per connection.  The
+listening task passes them the connected sockets through a queue, where
+further connections wait until a connection task is free. */
+#ifndef tcpechoSTATIC_CONNECTIONS
+#define tcpechoSTATIC_CONNECTIONS 4
+#endif
+
+typedef struct
+{
+	StaticTask_t xTCB;
+	StackType_t uxStack[tcpechoSTACK_SIZE];
+	uint8_t ucRxBuffer[ipconfigTCP_MSS];
+} EchoConnection_t;
+
+static EchoConnection_t xConnections[tcpechoSTATIC_CONNECTIONS] configSTATIC_STORAGE;
+
+static QueueHandle_t xConnectionQueue = NULL;
+static StaticQueue_t xConnectionQueueBuffer configSTATIC_STORAGE;
+static uint8_t ucConnectionQueueStorage[tcpechoSTATIC_CONNECTIONS * sizeof(Socket_t)] configSTATIC_STORAGE;
+
+#else
+
 /* Stores the stack size passed into vStartSimpleTCPServerTasks() so it can be
 reused when the server listening task creates tasks to handle connections. */
 static uint16_t usUsedStackSize = 0;
 
+#endif /* configSUPPORT_STATIC_ALLOCATION */
+
 /*-----------------------------------------------------------*/
 void vStartSimpleTCPServerTasks(uint16_t usStackSize, UBaseType_t uxPriority)
 {
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+	static StaticTask_t xListenerTCB configSTATIC_STORAGE;
+	static StackType_t uxListenerStack[tcpechoSTACK_SIZE] configSTATIC_STORAGE;
+	BaseType_t x;
+
+	/* The stacks are tcpechoSTACK_SIZE words, whatever the caller asks for. */
+	configASSERT(usStackSize <= tcpechoSTACK_SIZE);
+
+	xConnectionQueue = xQueueCreateStatic(tcpechoSTATIC_CONNECTIONS, sizeof(Socket_t), ucConnectionQueueStorage, &xConnectionQueueBuffer);
+
+	for (x = 0; x < tcpechoSTATIC_CONNECTIONS; x++)
+	{
+		xTaskCreateStatic(prvServerConnectionInstance, "EchoServer", tcpechoSTACK_SIZE, &xConnections[x], tskIDLE_PRIORITY, xConnections[x].uxStack, &xConnections[x].xTCB);
+	}
+
+	/* Create the TCP echo server. */
+	xTaskCreateStatic(prvConnectionListeningTask, "ServerListener", tcpechoSTACK_SIZE, NULL, uxPriority + 1, uxListenerStack, &xListenerTCB);
+#else
 	/* Create the TCP echo server. */
 	xTaskCreate(prvConnectionListeningTask, "ServerListener", usStackSize, NULL, uxPriority + 1, NULL);
 
 	/* Remember the requested stack size so it can be re-used by the server
 	listening task when it creates tasks to handle connections. */
 	usUsedStackSize = usStackSize;
+#endif /* configSUPPORT_STATIC_ALLOCATION */
 }
 /*-----------------------------------------------------------*/
 
@@ -199,28 +252,62 @@ static void prvConnectionListeningTask(void *pvParameters)
 		xConnectedSocket = FreeRTOS_accept(xListeningSocket, &xClient, &xSize);
 		configASSERT(xConnectedSocket != FREERTOS_INVALID_SOCKET);
 
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+		/* Hand the connection to the next free connection task. */
+		xQueueSend(xConnectionQueue, &xConnectedSocket, portMAX_DELAY);
+#else
 		/* Spawn a task to handle the connection. */
 		xTaskCreate(prvServerConnectionInstance, "EchoServer", usUsedStackSize, (void *)xConnectedSocket, tskIDLE_PRIORITY, NULL);
+#endif
 	}
 }
 /*-----------------------------------------------------------*/
 
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+
 static void prvServerConnectionInstance(void *pvParameters)
 {
-	int32_t lBytes, lSent, lTotalSent;
+	EchoConnection_t *pxConnection = (EchoConnection_t *)pvParameters;
 	Socket_t xConnectedSocket;
-	static const TickType_t xReceiveTimeOut = pdMS_TO_TICKS(5000);
-	static const TickType_t xSendTimeOut = pdMS_TO_TICKS(5000);
-	TickType_t xTimeOnShutdown;
-	uint8_t *pucRxBuffer;
 
-	xConnectedSocket = (Socket_t)pvParameters;
+	for (;;)
+	{
+		if (xQueueReceive(xConnectionQueue, &xConnectedSocket, portMAX_DELAY) == pdPASS)
+		{
+			prvEchoConnection(xConnectedSocket, pxConnection->ucRxBuffer);
+		}
+	}
+}
+
+#else
+
+static void prvServerConnectionInstance(void *pvParameters)
+{
+	uint8_t *pucRxBuffer;
 
 	/* Attempt to create the buffer used to receive the string to be echoed
 	back.  This could be avoided using a zero copy interface that just returned
 	the same buffer. */
 	pucRxBuffer = (uint8_t *)pvPortMalloc(ipconfigTCP_MSS);
 
+	prvEchoConnection((Socket_t)pvParameters, pucRxBuffer);
+
+	/* Finished with the buffer, the task. */
+	vPortFree(pucRxBuffer);
+
+	vTaskDelete(NULL);
+}
+
+#endif /* configSUPPORT_STATIC_ALLOCATION */
+/*-----------------------------------------------------------*/
+
+static void prvEchoConnection(Socket_t xConnectedSocket, uint8_t *pucRxBuffer)
+{
+	int32_t lBytes, lSent, lTotalSent;
+	static const TickType_t xReceiveTimeOut = pdMS_TO_TICKS(5000);
+	static const TickType_t xSendTimeOut = pdMS_TO_TICKS(5000);
+	TickType_t xTimeOnShutdown;
+
 	if (pucRxBuffer != NULL)
 	{
 		FreeRTOS_setsockopt(xConnectedSocket, 0, FREERTOS_SO_RCVTIMEO, &xReceiveTimeOut, sizeof(xReceiveTimeOut));
@@ -276,11 +363,8 @@ static void prvServerConnectionInstance(void *pvParameters)
 		}
 	} while ((xTaskGetTickCount() - xTimeOnShutdown) < tcpechoSHUTDOWN_DELAY);
 
-	/* Finished with the socket, buffer, the task. */
-	vPortFree(pucRxBuffer);
+	/* Finished with the socket. */
 	FreeRTOS_closesocket(xConnectedSocket);
-
-	vTaskDelete(NULL);
 }
 /*-----------------------------------------------------------*/
 
@@ -70,6 +70,12 @@
 #ifndef SIMPLE_TCP_ECHO_SERVER_H
 #define SIMPLE_TCP_ECHO_SERVER_H
 
+/* Stack size of the listening and connection tasks, in words.  The static
+build sizes its task stacks with this, so callers pass it as usStackSize. */
+#ifndef tcpechoSTACK_SIZE
+#define tcpechoSTACK_SIZE (configMINIMAL_STACK_SIZE * 10)
+#endif
+
 void vStartSimpleTCPServerTasks(uint16_t usStackSize, UBaseType_t uxPriority);
 BaseType_t xAreTCPEchoServersStillRunning(void);
 
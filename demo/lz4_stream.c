@@ -0,0 +1,436 @@
+/*
+ * Streaming decoder for the LZ4 frame format
+ *
+ * See https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md and
+ * lz4_Block_format.md.  Skippable frames are skipped and concatenated frames
+ * are decoded one after another.  Checksums are not verified, and frames that
+ * need a dictionary are rejected.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+#include "lz4_stream.h"
+
+#define LZ4_MAGIC               0x184D2204UL
+#define LZ4_SKIPPABLE_MAGIC     0x184D2A50UL
+#define LZ4_SKIPPABLE_MASK      0xFFFFFFF0UL
+
+#define LZ4_FLG_VERSION_MASK     0xC0
+#define LZ4_FLG_VERSION          0x40
+#define LZ4_FLG_BLOCK_CHECKSUM   0x10
+#define LZ4_FLG_CONTENT_SIZE     0x08
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FLG_RESERVED         0x02
+#define LZ4_FLG_DICT_ID          0x01
+#define LZ4_BD_RESERVED          0x8F
+
+#define LZ4_BLOCK_UNCOMPRESSED  0x80000000UL
+#define LZ4_MIN_MATCH           4
+#define LZ4_HISTORY_MASK        (LZ4_HISTORY_SIZE - 1)
+
+enum lz4_state
+{
+	/* Gathered into field */
+	LZ4_S_MAGIC,
+	LZ4_S_SKIP_SIZE,
+	LZ4_S_DESCRIPTOR,
+	LZ4_S_HEADER,
+	LZ4_S_BLOCK_SIZE,
+	LZ4_S_OFFSET,
+	LZ4_S_BLOCK_CHECKSUM,
+	LZ4_S_CONTENT_CHECKSUM,
+	/* Byte at a time, or runs */
+	LZ4_S_SKIP,
+	LZ4_S_BLOCK_RAW,
+	LZ4_S_TOKEN,
+	LZ4_S_LITLEN,
+	LZ4_S_LITERALS,
+	LZ4_S_MATCHLEN,
+	LZ4_S_ERROR
+};
+
+static uint32_t lz4_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+	       (uint32_t)p[3] << 24;
+}
+
+static void lz4_expect(struct lz4_stream *stream, uint8_t state, uint8_t len)
+{
+	stream->state = state;
+	stream->fieldlen = 0;
+	stream->fieldneed = len;
+}
+
+bool lz4_stream_is_frame(const void *data)
+{
+	return lz4_le32(data) == LZ4_MAGIC;
+}
+
+int lz4_stream_init(struct lz4_stream *stream, lz4_output_type output,
+                    void *ctx)
+{
+	memset(stream, 0, sizeof(*stream));
+	stream->output = output;
+	stream->ctx = ctx;
+	stream->history = pvPortMalloc(LZ4_HISTORY_SIZE);
+	if (!stream->history)
+	{
+		printf("Error: LZ4: cannot allocate history\r\n");
+		return 1;
+	}
+	lz4_expect(stream, LZ4_S_MAGIC, 4);
+	return 0;
+}
+
+void lz4_stream_free(struct lz4_stream *stream)
+{
+	vPortFree(stream->history);
+	stream->history = NULL;
+}
+
+/* Hand everything decoded since the last flush to the output. */
+static int lz4_flush(struct lz4_stream *stream)
+{
+	size_t len = stream->total - stream->flushed;
+	if (!len)
+		return 0;
+
+	int err = stream->output(stream->ctx, stream->flushed,
+	                         stream->history + (stream->flushed & LZ4_HISTORY_MASK),
+	                         len);
+	stream->flushed = stream->total;
+	return err;
+}
+
+/*
+ * The history is flushed each time it wraps, so what has not been flushed is
+ * always contiguous.
+ */
+static int lz4_put(struct lz4_stream *stream, const uint8_t *data, size_t len)
+{
+	while (len)
+	{
+		size_t dst = stream->total & LZ4_HISTORY_MASK;
+		size_t n = LZ4_HISTORY_SIZE - dst;
+		if (n > len)
+			n = len;
+
+		memcpy(stream->history + dst, data, n);
+		stream->total += n;
+		data += n;
+		len -= n;
+		if (!(stream->total & LZ4_HISTORY_MASK) && lz4_flush(stream))
+			return 1;
+	}
+	return 0;
+}
+
+static int lz4_match(struct lz4_stream *stream)
+{
+	size_t offset = stream->offset;
+	size_t len = stream->matchlen + LZ4_MIN_MATCH;
+
+	while (len)
+	{
+		size_t dst = stream->total & LZ4_HISTORY_MASK;
+		size_t src = (stream->total - offset) & LZ4_HISTORY_MASK;
+		size_t n = len;
+		if (n > LZ4_HISTORY_SIZE - dst)
+			n = LZ4_HISTORY_SIZE - dst;
+		if (n > LZ4_HISTORY_SIZE - src)
+			n = LZ4_HISTORY_SIZE - src;
+
+		char *d = stream->history + dst;
+		const char *s = stream->history + src;
+		if (src > dst || offset >= n)
+		{
+			/* Every byte read is older than every byte written */
+			memmove(d, s, n);
+		}
+		else
+		{
+			/* Overlapping: repeats the last offset bytes */
+			for (size_t i = 0; i < n; ++i)
+				d[i] = s[i];
+		}
+		stream->total += n;
+		len -= n;
+		if (!(stream->total & LZ4_HISTORY_MASK) && lz4_flush(stream))
+			return 1;
+	}
+	return 0;
+}
+
+static void lz4_block_end(struct lz4_stream *stream)
+{
+	if (stream->flags & LZ4_FLG_BLOCK_CHECKSUM)
+		lz4_expect(stream, LZ4_S_BLOCK_CHECKSUM, 4);
+	else
+		lz4_expect(stream, LZ4_S_BLOCK_SIZE, 4);
+}
+
+/* The last sequence of a block has only literals. */
+static void lz4_literals_done(struct lz4_stream *stream)
+{
+	if (!stream->remaining)
+		lz4_block_end(stream);
+	else
+		lz4_expect(stream, LZ4_S_OFFSET, 2);
+}
+
+static int lz4_match_done(struct lz4_stream *stream)
+{
+	if (lz4_match(stream))
+		return 1;
+	if (!stream->remaining)
+		lz4_block_end(stream);
+	else
+		stream->state = LZ4_S_TOKEN;
+	return 0;
+}
+
+/* Act on a complete fixed size field. */
+static int lz4_field(struct lz4_stream *stream)
+{
+	const uint8_t *field = stream->field;
+	uint32_t value;
+
+	switch (stream->state)
+	{
+	case LZ4_S_MAGIC:
+		value = lz4_le32(field);
+		if (value == LZ4_MAGIC)
+		{
+			lz4_expect(stream, LZ4_S_DESCRIPTOR, 2);
+		}
+		else if ((value & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC)
+		{
+			lz4_expect(stream, LZ4_S_SKIP_SIZE, 4);
+		}
+		else
+		{
+			printf("Error: LZ4: bad frame magic 0x%08lx\r\n",
+			       (unsigned long)value);
+			return 1;
+		}
+		return 0;
+	case LZ4_S_SKIP_SIZE:
+		stream->remaining = lz4_le32(field);
+		if (stream->remaining)
+			stream->state = LZ4_S_SKIP;
+		else
+			lz4_expect(stream, LZ4_S_MAGIC, 4);
+		return 0;
+	case LZ4_S_DESCRIPTOR:
+	{
+		uint8_t flg = field[0];
+		uint8_t bd = field[1];
+		if ((flg & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION ||
+		    (flg & LZ4_FLG_RESERVED) || (bd & LZ4_BD_RESERVED) ||
+		    (bd >> 4) < 4)
+		{
+			printf("Error: LZ4: bad frame descriptor %02x %02x\r\n", flg, bd);
+			return 1;
+		}
+		if (flg & LZ4_FLG_DICT_ID)
+		{
+			printf("Error: LZ4: frames with a dictionary are not supported\r\n");
+			return 1;
+		}
+		stream->flags = flg;
+		/* 64 KiB, 256 KiB, 1 MiB or 4 MiB */
+		stream->blockmax = 1UL << (8 + 2 * (bd >> 4));
+		/* Content size, if present, and the header checksum */
+		lz4_expect(stream, LZ4_S_HEADER,
+		           (flg & LZ4_FLG_CONTENT_SIZE ? 8 : 0) + 1);
+		return 0;
+	}
+	case LZ4_S_HEADER:
+		stream->framestart = stream->total;
+		lz4_expect(stream, LZ4_S_BLOCK_SIZE, 4);
+		return 0;
+	case LZ4_S_BLOCK_SIZE:
+		value = lz4_le32(field);
+		if (!value)
+		{
+			/* EndMark */
+			if (stream->flags & LZ4_FLG_CONTENT_CHECKSUM)
+				lz4_expect(stream, LZ4_S_CONTENT_CHECKSUM, 4);
+			else
+				lz4_expect(stream, LZ4_S_MAGIC, 4);
+			return 0;
+		}
+		stream->remaining = value & ~LZ4_BLOCK_UNCOMPRESSED;
+		if (stream->remaining > stream->blockmax)
+		{
+			printf("Error: LZ4: block of %lu bytes exceeds maximum\r\n",
+			       (unsigned long)stream->remaining);
+			return 1;
+		}
+		stream->state = value & LZ4_BLOCK_UNCOMPRESSED ?
+		                LZ4_S_BLOCK_RAW : LZ4_S_TOKEN;
+		return 0;
+	case LZ4_S_OFFSET:
+		stream->offset = field[0] | field[1] << 8;
+		if (!stream->offset ||
+		    stream->offset > stream->total - stream->framestart)
+		{
+			printf("Error: LZ4: bad match offset %u\r\n", stream->offset);
+			return 1;
+		}
+		if (stream->matchlen == 15)
+		{
+			stream->state = LZ4_S_MATCHLEN;
+			return 0;
+		}
+		return lz4_match_done(stream);
+	case LZ4_S_BLOCK_CHECKSUM:
+		lz4_expect(stream, LZ4_S_BLOCK_SIZE, 4);
+		return 0;
+	case LZ4_S_CONTENT_CHECKSUM:
+		lz4_expect(stream, LZ4_S_MAGIC, 4);
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+int lz4_stream_write(struct lz4_stream *stream, const uint8_t *data,
+                     size_t len)
+{
+	while (len)
+	{
+		size_t n;
+		uint8_t b;
+
+		switch (stream->state)
+		{
+		case LZ4_S_SKIP:
+			n = len < stream->remaining ? len : stream->remaining;
+			stream->remaining -= n;
+			data += n;
+			len -= n;
+			if (!stream->remaining)
+				lz4_expect(stream, LZ4_S_MAGIC, 4);
+			continue;
+		case LZ4_S_BLOCK_RAW:
+			n = len < stream->remaining ? len : stream->remaining;
+			if (lz4_put(stream, data, n))
+				goto error;
+			stream->remaining -= n;
+			data += n;
+			len -= n;
+			if (!stream->remaining)
+				lz4_block_end(stream);
+			continue;
+		case LZ4_S_ERROR:
+			return 1;
+		default:
+			break;
+		}
+
+		/* Everything else inside a block must fit in it */
+		if (stream->state >= LZ4_S_TOKEN || stream->state == LZ4_S_OFFSET)
+		{
+			if (!stream->remaining)
+			{
+				printf("Error: LZ4: sequence runs past end of block\r\n");
+				goto error;
+			}
+		}
+
+		switch (stream->state)
+		{
+		case LZ4_S_TOKEN:
+			b = *data++;
+			--len;
+			--stream->remaining;
+			stream->litlen = b >> 4;
+			stream->matchlen = b & 15;
+			if (stream->litlen == 15)
+			{
+				stream->state = LZ4_S_LITLEN;
+				continue;
+			}
+			stream->state = LZ4_S_LITERALS;
+			if (!stream->litlen)
+				lz4_literals_done(stream);
+			continue;
+		case LZ4_S_LITLEN:
+			b = *data++;
+			--len;
+			--stream->remaining;
+			stream->litlen += b;
+			if (b != 255)
+				stream->state = LZ4_S_LITERALS;
+			continue;
+		case LZ4_S_LITERALS:
+			n = len < stream->litlen ? len : stream->litlen;
+			if (n > stream->remaining)
+				n = stream->remaining;
+			if (lz4_put(stream, data, n))
+				goto error;
+			stream->litlen -= n;
+			stream->remaining -= n;
+			data += n;
+			len -= n;
+			if (!stream->litlen)
+				lz4_literals_done(stream);
+			continue;
+		case LZ4_S_MATCHLEN:
+			b = *data++;
+			--len;
+			--stream->remaining;
+			stream->matchlen += b;
+			if (b == 255)
+				continue;
+			if (lz4_match_done(stream))
+				goto error;
+			continue;
+		default:
+			break;
+		}
+
+		/* Fixed size fields */
+		n = stream->fieldneed - stream->fieldlen;
+		if (n > len)
+			n = len;
+		if (stream->state == LZ4_S_OFFSET)
+		{
+			if (n > stream->remaining)
+				n = stream->remaining;
+			stream->remaining -= n;
+		}
+		memcpy(stream->field + stream->fieldlen, data, n);
+		stream->fieldlen += n;
+		data += n;
+		len -= n;
+		if (stream->fieldlen == stream->fieldneed && lz4_field(stream))
+			goto error;
+	}
+
+	if (lz4_flush(stream))
+		goto error;
+	return 0;
+
+error:
+	stream->state = LZ4_S_ERROR;
+	return 1;
+}
+
+int lz4_stream_finish(struct lz4_stream *stream)
+{
+	if (stream->state == LZ4_S_ERROR)
+		return 1;
+	if (lz4_flush(stream))
+		return 1;
+	if (stream->state != LZ4_S_MAGIC || stream->fieldlen)
+	{
+		printf("Error: LZ4: input ends inside a frame\r\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Streaming decoder for the LZ4 frame format
+ *
+ * Input may be split at any byte.  Decoded data is kept in a 64 KiB history
+ * ring, which is all that LZ4 matches can refer back to, and handed to the
+ * output callback in contiguous pieces, in order.
+ */
+#ifndef LZ4_STREAM_H
+#define LZ4_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZ4_HISTORY_SIZE 65536
+
+/* Called with decoded data and its offset in the decoded stream */
+typedef int (*lz4_output_type)(void *ctx, size_t off, const char *data,
+                               size_t len);
+
+struct lz4_stream
+{
+	lz4_output_type output;
+	void *ctx;
+	char *history;
+	/* Bytes decoded, and handed to output */
+	size_t total;
+	size_t flushed;
+	size_t framestart;
+	/* Bytes left in the current block, or to skip */
+	uint32_t remaining;
+	uint32_t blockmax;
+	uint32_t litlen;
+	uint32_t matchlen;
+	uint16_t offset;
+	uint8_t state;
+	uint8_t flags;
+	/* Fixed size fields are gathered here */
+	uint8_t field[16];
+	uint8_t fieldlen;
+	uint8_t fieldneed;
+};
+
+/* True if data (at least 4 bytes) starts an LZ4 frame */
+bool lz4_stream_is_frame(const void *data);
+
+int lz4_stream_init(struct lz4_stream *stream, lz4_output_type output,
+                    void *ctx);
+void lz4_stream_free(struct lz4_stream *stream);
+
+/* Returns 0, or non-zero on corrupt input or if output failed */
+int lz4_stream_write(struct lz4_stream *stream, const uint8_t *data,
+                     size_t len);
+
+/* Returns 0 if the input ended at the end of a frame */
+int lz4_stream_finish(struct lz4_stream *stream);
+
+#endif /* LZ4_STREAM_H */
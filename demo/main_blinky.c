@@ -71,6 +71,7 @@
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "rtos_static.h"
 #include "queue.h"
 #include "uart.h"
 #include "iic.h"
@@ -123,19 +124,19 @@ static QueueHandle_t xQueue = NULL;
 void main_blinky(void)
 {
 	/* Create the queue. */
-	xQueue = xQueueCreate(mainQUEUE_LENGTH, sizeof(uint32_t));
+	xQueue = RTOS_QUEUE_CREATE(mainQUEUE_LENGTH, sizeof(uint32_t));
 	configASSERT(xQueue != NULL);
 
 	/* Start the two tasks as described in the comments at the top of this
 		file. */
-	xTaskCreate(prvQueueReceiveTask,			 /* The function that implements the task. */
-				"Rx",							 /* The text name assigned to the task - for debug only as it is not used by the kernel. */
-				configMINIMAL_STACK_SIZE * 2U,   /* The size of the stack to allocate to the task. */
-				NULL,							 /* The parameter passed to the task - not used in this case. */
-				mainQUEUE_RECEIVE_TASK_PRIORITY, /* The priority assigned to the task. */
-				NULL);							 /* The task handle is not required, so NULL is passed. */
-
-	xTaskCreate(prvQueueSendTask, "TX", configMINIMAL_STACK_SIZE * 2U, NULL, mainQUEUE_SEND_TASK_PRIORITY, NULL);
+	RTOS_TASK_CREATE(prvQueueReceiveTask,			 /* The function that implements the task. */
+					 "Rx",							 /* The text name assigned to the task - for debug only as it is not used by the kernel. */
+					 configMINIMAL_STACK_SIZE * 2U,   /* The size of the stack to allocate to the task. */
+					 NULL,							 /* The parameter passed to the task - not used in this case. */
+					 mainQUEUE_RECEIVE_TASK_PRIORITY, /* The priority assigned to the task. */
+					 NULL);							 /* The task handle is not required, so NULL is passed. */
+
+	RTOS_TASK_CREATE(prvQueueSendTask, "TX", configMINIMAL_STACK_SIZE * 2U, NULL, mainQUEUE_SEND_TASK_PRIORITY, NULL);
 }
 /*-----------------------------------------------------------*/
 
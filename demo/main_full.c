@@ -67,6 +67,7 @@
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "rtos_static.h"
 #include "timers.h"
 #include "semphr.h"
 
@@ -193,17 +194,17 @@ void main_full(void)
 	/* Create the register check tasks, as described at the top of this	file.
 	Use xTaskCreateStatic() to create a task using only statically allocated
 	memory. */
-	xTaskCreate(prvRegTestTaskEntry1,																								 /* The function that implements the task. */
-				"Reg1",																												 /* The name of the task. */
-				mainREG_TEST_STACK_SIZE_WORDS,																						 /* Size of stack to allocate for the task - in words not bytes!. */
-				mainREG_TEST_TASK_1_PARAMETER,																						 /* Parameter passed into the task. */
-				tskIDLE_PRIORITY,																									 /* Priority of the task. */
-				NULL);																												 /* Can be used to pass out a handle to the created task. */
-	xTaskCreate(prvRegTestTaskEntry2, "Reg2", mainREG_TEST_STACK_SIZE_WORDS, mainREG_TEST_TASK_2_PARAMETER, tskIDLE_PRIORITY, NULL); // Both fail with ebreak
+	RTOS_TASK_CREATE(prvRegTestTaskEntry1,																								 /* The function that implements the task. */
+					 "Reg1",																												 /* The name of the task. */
+					 mainREG_TEST_STACK_SIZE_WORDS,																						 /* Size of stack to allocate for the task - in words not bytes!. */
+					 mainREG_TEST_TASK_1_PARAMETER,																						 /* Parameter passed into the task. */
+					 tskIDLE_PRIORITY,																									 /* Priority of the task. */
+					 NULL);																												 /* Can be used to pass out a handle to the created task. */
+	RTOS_TASK_CREATE(prvRegTestTaskEntry2, "Reg2", mainREG_TEST_STACK_SIZE_WORDS, mainREG_TEST_TASK_2_PARAMETER, tskIDLE_PRIORITY, NULL); // Both fail with ebreak
 
 	/* Create the task that performs the 'check' functionality,	as described at
 	the top of this file. */
-	xTaskCreate(prvCheckTask, "Check", mainCHECK_TASK_STACK_SIZE_WORDS, NULL, mainCHECK_TASK_PRIORITY, NULL);
+	RTOS_TASK_CREATE(prvCheckTask, "Check", mainCHECK_TASK_STACK_SIZE_WORDS, NULL, mainCHECK_TASK_PRIORITY, NULL);
 
 	/* The set of tasks created by the following function call have to be
 	created last as they keep account of the number of tasks they expect to see
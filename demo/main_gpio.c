@@ -38,6 +38,7 @@
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "rtos_static.h"
 #include "queue.h"
 
 /* Demo includes. */
@@ -66,9 +67,9 @@ static void vTestLED(void *pvParameters);
 void main_gpio(void)
 {
     /* Create GPIO test */
-    xTaskCreate(vTestGPIO_output, "GPIO Output Test", 1000, NULL, 0, NULL);
-    xTaskCreate(vTestGPIO_input, "GPIO Input Test", 1000, NULL, 0, NULL);
-    xTaskCreate(vTestLED, "LED Test", 1000, NULL, 0, NULL);
+    RTOS_TASK_CREATE(vTestGPIO_output, "GPIO Output Test", 1000, NULL, 0, NULL);
+    RTOS_TASK_CREATE(vTestGPIO_input, "GPIO Input Test", 1000, NULL, 0, NULL);
+    RTOS_TASK_CREATE(vTestLED, "LED Test", 1000, NULL, 0, NULL);
 }
 /*-----------------------------------------------------------*/
 
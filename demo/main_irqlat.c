@@ -0,0 +1,213 @@
+/*
+ * main_irqlat() measures interrupt and wake-up latency on the mcycle counter.
+ *
+ * The UART0 TX empty interrupt is the software triggered source: enabled
+ * while the transmitter is idle, it is raised at once, under QEMU as well as
+ * on hardware.  A low priority task timestamps the trigger, and each
+ * iteration records, relative to it, when
+ *   claim    - external_interrupt_handler() claimed the source,
+ *   callback - the PLIC handler started,
+ *   wake     - the waiting task, of higher priority, ran.
+ * The "deferred" pass wakes the task with isr_notify_give(), which switches to
+ * it on the way out of the interrupt; the "tick" pass wakes it without asking
+ * for the switch, so that it waits for the next tick, for comparison.
+ *
+ * Results are printed as CSV, in CPU cycles:
+ *   irqlat,hz,<configCPU_CLOCK_HZ>
+ *   irqlat,<pass>,<stage>,<count>,<min>,<mean>,<p99>,<max>
+ *   irqlat,done
+ */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "rtos_static.h"
+
+/* Bsp includes. */
+#include "bsp.h"
+#include "plic_driver.h"
+#include "uart.h"
+
+#ifndef IRQLAT_ITERATIONS
+#define IRQLAT_ITERATIONS 1000000UL
+#endif
+/* Every iteration of the tick pass waits for a tick */
+#ifndef IRQLAT_TICK_ITERATIONS
+#define IRQLAT_TICK_ITERATIONS 1000UL
+#endif
+
+/* Samples above the last bucket are counted in it */
+#define IRQLAT_BUCKET_CYCLES 4
+#define IRQLAT_BUCKETS 2048
+
+enum irqlat_stage
+{
+	IRQLAT_CLAIM,
+	IRQLAT_CALLBACK,
+	IRQLAT_WAKE,
+	IRQLAT_STAGES
+};
+
+static const char *const pcStageNames[IRQLAT_STAGES] = { "claim", "callback", "wake" };
+
+struct irqlat_hist
+{
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t buckets[IRQLAT_BUCKETS];
+};
+
+void main_irqlat(void);
+
+static void prvTriggerTask(void *pvParameters);
+static void prvWaitTask(void *pvParameters);
+static void prvIrqHandler(void *CallBackRef);
+
+static struct irqlat_hist xHists[IRQLAT_STAGES];
+static TaskHandle_t xWaitTask;
+static volatile bool xDeferredYield;
+static volatile bool xDone;
+static volatile uint64_t ullTrigger;
+static volatile uint64_t ullClaim;
+static volatile uint64_t ullCallback;
+
+/*-----------------------------------------------------------*/
+
+void main_irqlat(void)
+{
+	configASSERT(PLIC_register_interrupt_handler(&Plic, PLIC_SOURCE_UART0,
+		prvIrqHandler, NULL) != 0);
+	uart0_txempty_irq(false);
+
+	RTOS_TASK_CREATE(prvWaitTask, "IrqLat wait", configMINIMAL_STACK_SIZE * 4, NULL, tskIDLE_PRIORITY + 2, &xWaitTask);
+	RTOS_TASK_CREATE(prvTriggerTask, "IrqLat trigger", configMINIMAL_STACK_SIZE * 4, NULL, tskIDLE_PRIORITY + 1, NULL);
+}
+/*-----------------------------------------------------------*/
+
+static void prvIrqHandler(void *CallBackRef)
+{
+	uint64_t ullNow = get_cycle_count();
+
+	(void)CallBackRef;
+	uart0_txempty_irq(false);
+	ullClaim = isr_claim_cycles();
+	ullCallback = ullNow;
+
+	if (xDeferredYield)
+	{
+		isr_notify_give(xWaitTask);
+	}
+	else
+	{
+		BaseType_t xIgnored = pdFALSE;
+		vTaskNotifyGiveFromISR(xWaitTask, &xIgnored);
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvRecord(struct irqlat_hist *pxHist, uint64_t ullCycles)
+{
+	uint32_t ulCycles = ullCycles > UINT32_MAX ? UINT32_MAX : (uint32_t)ullCycles;
+	uint32_t ulBucket = ulCycles / IRQLAT_BUCKET_CYCLES;
+
+	if (ulBucket >= IRQLAT_BUCKETS)
+	{
+		ulBucket = IRQLAT_BUCKETS - 1;
+	}
+	pxHist->buckets[ulBucket]++;
+	pxHist->sum += ulCycles;
+	if (pxHist->count == 0 || ulCycles < pxHist->min)
+	{
+		pxHist->min = ulCycles;
+	}
+	if (ulCycles > pxHist->max)
+	{
+		pxHist->max = ulCycles;
+	}
+	pxHist->count++;
+}
+/*-----------------------------------------------------------*/
+
+static void prvWaitTask(void *pvParameters)
+{
+	(void)pvParameters;
+
+	for (;;)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		uint64_t ullWake = get_cycle_count();
+
+		prvRecord(&xHists[IRQLAT_CLAIM], ullClaim - ullTrigger);
+		prvRecord(&xHists[IRQLAT_CALLBACK], ullCallback - ullTrigger);
+		prvRecord(&xHists[IRQLAT_WAKE], ullWake - ullTrigger);
+		xDone = true;
+	}
+}
+/*-----------------------------------------------------------*/
+
+/* Upper bound of the bucket that holds the 99th percentile */
+static uint32_t prvPercentile99(const struct irqlat_hist *pxHist)
+{
+	uint32_t ulTarget = (uint32_t)(((uint64_t)pxHist->count * 99 + 99) / 100);
+	uint32_t ulSeen = 0;
+
+	for (uint32_t ulBucket = 0; ulBucket < IRQLAT_BUCKETS - 1; ulBucket++)
+	{
+		ulSeen += pxHist->buckets[ulBucket];
+		if (ulSeen >= ulTarget)
+		{
+			uint32_t ulBound = (ulBucket + 1) * IRQLAT_BUCKET_CYCLES - 1;
+			return ulBound < pxHist->max ? ulBound : pxHist->max;
+		}
+	}
+	return pxHist->max;
+}
+/*-----------------------------------------------------------*/
+
+static void prvRunPass(const char *pcPass, bool xDeferred, uint32_t ulIterations)
+{
+	memset(xHists, 0, sizeof(xHists));
+	xDeferredYield = xDeferred;
+
+	/* Let the console drain, the trigger needs an idle transmitter */
+	vTaskDelay(pdMS_TO_TICKS(100));
+
+	for (uint32_t ulIteration = 0; ulIteration < ulIterations; ulIteration++)
+	{
+		xDone = false;
+		ullTrigger = get_cycle_count();
+		uart0_txempty_irq(true);
+		while (!xDone)
+		{
+		}
+	}
+
+	for (int stage = 0; stage < IRQLAT_STAGES; stage++)
+	{
+		const struct irqlat_hist *pxHist = &xHists[stage];
+		printf("irqlat,%s,%s,%lu,%lu,%lu,%lu,%lu\r\n", pcPass, pcStageNames[stage],
+			   (unsigned long)pxHist->count, (unsigned long)pxHist->min,
+			   (unsigned long)(pxHist->count ? pxHist->sum / pxHist->count : 0),
+			   (unsigned long)prvPercentile99(pxHist), (unsigned long)pxHist->max);
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvTriggerTask(void *pvParameters)
+{
+	(void)pvParameters;
+
+	printf("irqlat,hz,%lu\r\n", (unsigned long)configCPU_CLOCK_HZ);
+	prvRunPass("deferred", true, IRQLAT_ITERATIONS);
+	prvRunPass("tick", false, IRQLAT_TICK_ITERATIONS);
+	printf("irqlat,done\r\n");
+
+	vTaskDelete(NULL);
+}
@@ -0,0 +1,438 @@
+/*
+ * main_kbench() measures the cost of the kernel primitives on the mcycle
+ * counter, to size tasks and to catch regressions of the port.
+ *
+ * Three passes, each op timed KBENCH_ITERATIONS times:
+ *   task     - the call itself, made by one task with nobody to wake: queue
+ *              send/receive, semaphore and mutex give/take, notify give/take
+ *              on itself, stream buffer send/receive, event group set/wait,
+ *              and a yield with no other ready task of its priority.
+ *   switch   - from just before the call in a low priority task to the
+ *              return to a higher priority task blocked on the primitive,
+ *              and between two tasks of the same priority yielding in turn.
+ *   isr      - the same wake-ups from an interrupt handler, from the trigger
+ *              of the interrupt to the return to the task; "fromisr" is the
+ *              ...FromISR() call alone. The interrupt is the UART0 TX empty
+ *              one, as in main_irqlat, so it runs under QEMU too. Event group
+ *              bits set from an interrupt go through the timer task.
+ *
+ * Results are printed as CSV, in CPU cycles, each sample including the
+ * "overhead,mcycle" cost of reading the counter:
+ *   kbench,hz,<configCPU_CLOCK_HZ>
+ *   kbench,<pass>,<op>,<count>,<min>,<mean>,<max>
+ *   kbench,done
+ * The tick interrupt lands in some samples, and shows in the max.
+ */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "stream_buffer.h"
+#include "event_groups.h"
+#include "rtos_static.h"
+
+/* Bsp includes. */
+#include "bsp.h"
+#include "plic_driver.h"
+#include "uart.h"
+
+#ifndef KBENCH_ITERATIONS
+#define KBENCH_ITERATIONS 10000UL
+#endif
+
+#define KBENCH_QUEUE_LENGTH 4
+#define KBENCH_STREAM_BYTES 16
+#define KBENCH_STREAM_SIZE (KBENCH_STREAM_BYTES * 4)
+#define KBENCH_EVENT_BIT (1 << 0)
+
+/* Priorities of the benchmark task, and of the task it wakes */
+#define KBENCH_PRIORITY (tskIDLE_PRIORITY + 1)
+#define KBENCH_WAIT_PRIORITY (tskIDLE_PRIORITY + 2)
+
+struct kbench_stat
+{
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+};
+
+enum kbench_op
+{
+	KBENCH_YIELD,
+	KBENCH_QUEUE_SEND,
+	KBENCH_QUEUE_RECEIVE,
+	KBENCH_SEM_GIVE,
+	KBENCH_SEM_TAKE,
+	KBENCH_MUTEX_TAKE,
+	KBENCH_MUTEX_GIVE,
+	KBENCH_NOTIFY_GIVE,
+	KBENCH_NOTIFY_TAKE,
+	KBENCH_STREAM_SEND,
+	KBENCH_STREAM_RECEIVE,
+	KBENCH_EVENT_SET,
+	KBENCH_EVENT_WAIT,
+	KBENCH_OPS
+};
+
+static const char *const pcOpNames[KBENCH_OPS] = {
+	"yield", "queue_send", "queue_receive", "sem_give", "sem_take", "mutex_take", "mutex_give",
+	"notify_give", "notify_take", "stream_send", "stream_receive", "event_set", "event_wait"
+};
+
+/* Primitives the wait task blocks on */
+enum kbench_signal
+{
+	KBENCH_NOTIFY,
+	KBENCH_QUEUE,
+	KBENCH_SEMAPHORE,
+	KBENCH_STREAM,
+	KBENCH_EVENT,
+	KBENCH_SIGNALS
+};
+
+static const char *const pcSignalNames[KBENCH_SIGNALS] = { "notify", "queue", "semaphore", "stream", "event" };
+
+#define KBENCH_TIME(pxStat, op)                                   \
+	do                                                            \
+	{                                                             \
+		uint64_t ullBefore = get_cycle_count();                   \
+		op;                                                       \
+		prvRecord((pxStat), get_cycle_count() - ullBefore);       \
+	} while (0)
+
+void main_kbench(void);
+
+static void prvBenchTask(void *pvParameters);
+static void prvWaitTask(void *pvParameters);
+static void prvYieldTask(void *pvParameters);
+static void prvIrqHandler(void *CallBackRef);
+
+static TaskHandle_t xWaitTask;
+static TaskHandle_t xYieldTask;
+
+static QueueHandle_t xQueue;
+static SemaphoreHandle_t xSemaphore;
+static SemaphoreHandle_t xMutex;
+static StreamBufferHandle_t xStream;
+static EventGroupHandle_t xEvents;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticSemaphore_t xSemaphoreBuffer configSTATIC_STORAGE;
+static StaticSemaphore_t xMutexBuffer configSTATIC_STORAGE;
+static uint8_t ucStreamStorage[KBENCH_STREAM_SIZE + 1] configSTATIC_STORAGE;
+static StaticStreamBuffer_t xStreamBuffer configSTATIC_STORAGE;
+static StaticEventGroup_t xEventsBuffer configSTATIC_STORAGE;
+#endif
+
+/* Primitive the wait task blocks on, and where it records its wake-ups */
+static volatile enum kbench_signal eWaitOn = KBENCH_NOTIFY;
+static struct kbench_stat *volatile pxWake;
+static struct kbench_stat xWake;
+static struct kbench_stat xFromIsr;
+static struct kbench_stat xYield;
+
+static volatile bool xDone;
+static volatile uint64_t ullStart;
+static uint32_t ulItem;
+static uint8_t ucItem[KBENCH_STREAM_BYTES];
+
+/*-----------------------------------------------------------*/
+
+void main_kbench(void)
+{
+	xQueue = RTOS_QUEUE_CREATE(KBENCH_QUEUE_LENGTH, sizeof(uint32_t));
+	xSemaphore = RTOS_BINARY_SEMAPHORE_CREATE(&xSemaphoreBuffer);
+	xMutex = RTOS_MUTEX_CREATE(&xMutexBuffer);
+	xStream = RTOS_STREAM_BUFFER_CREATE(KBENCH_STREAM_SIZE, 1, ucStreamStorage, &xStreamBuffer);
+	xEvents = RTOS_EVENT_GROUP_CREATE(&xEventsBuffer);
+	configASSERT(xQueue != NULL && xSemaphore != NULL && xMutex != NULL && xStream != NULL && xEvents != NULL);
+
+	configASSERT(PLIC_register_interrupt_handler(&Plic, PLIC_SOURCE_UART0,
+		prvIrqHandler, NULL) != 0);
+	uart0_txempty_irq(false);
+
+	RTOS_TASK_CREATE(prvWaitTask, "KBench wait", configMINIMAL_STACK_SIZE * 4, NULL, KBENCH_WAIT_PRIORITY, &xWaitTask);
+	RTOS_TASK_CREATE(prvYieldTask, "KBench yield", configMINIMAL_STACK_SIZE * 4, NULL, KBENCH_PRIORITY, &xYieldTask);
+	RTOS_TASK_CREATE(prvBenchTask, "KBench", configMINIMAL_STACK_SIZE * 4, NULL, KBENCH_PRIORITY, NULL);
+}
+/*-----------------------------------------------------------*/
+
+static void prvRecord(struct kbench_stat *pxStat, uint64_t ullCycles)
+{
+	uint32_t ulCycles = ullCycles > UINT32_MAX ? UINT32_MAX : (uint32_t)ullCycles;
+
+	pxStat->sum += ulCycles;
+	if (pxStat->count == 0 || ulCycles < pxStat->min)
+	{
+		pxStat->min = ulCycles;
+	}
+	if (ulCycles > pxStat->max)
+	{
+		pxStat->max = ulCycles;
+	}
+	pxStat->count++;
+}
+/*-----------------------------------------------------------*/
+
+static void prvPrint(const char *pcPass, const char *pcOp, const struct kbench_stat *pxStat)
+{
+	printf("kbench,%s,%s,%lu,%lu,%lu,%lu\r\n", pcPass, pcOp,
+		   (unsigned long)pxStat->count, (unsigned long)pxStat->min,
+		   (unsigned long)(pxStat->count ? pxStat->sum / pxStat->count : 0),
+		   (unsigned long)pxStat->max);
+}
+/*-----------------------------------------------------------*/
+
+static void prvIrqHandler(void *CallBackRef)
+{
+	uint64_t ullBefore;
+
+	(void)CallBackRef;
+	uart0_txempty_irq(false);
+
+	ullBefore = get_cycle_count();
+	switch (eWaitOn)
+	{
+	case KBENCH_NOTIFY:
+		isr_notify_give(xWaitTask);
+		break;
+	case KBENCH_QUEUE:
+		xQueueSendFromISR(xQueue, &ulItem, isr_task_woken());
+		break;
+	case KBENCH_SEMAPHORE:
+		xSemaphoreGiveFromISR(xSemaphore, isr_task_woken());
+		break;
+	case KBENCH_STREAM:
+		xStreamBufferSendFromISR(xStream, ucItem, sizeof(ucItem), isr_task_woken());
+		break;
+	case KBENCH_EVENT:
+		xEventGroupSetBitsFromISR(xEvents, KBENCH_EVENT_BIT, isr_task_woken());
+		break;
+	default:
+		break;
+	}
+	prvRecord(&xFromIsr, get_cycle_count() - ullBefore);
+}
+/*-----------------------------------------------------------*/
+
+/* Wake the wait task from the benchmark task */
+static void prvSignal(enum kbench_signal eSignal)
+{
+	switch (eSignal)
+	{
+	case KBENCH_NOTIFY:
+		xTaskNotifyGive(xWaitTask);
+		break;
+	case KBENCH_QUEUE:
+		xQueueSend(xQueue, &ulItem, 0);
+		break;
+	case KBENCH_SEMAPHORE:
+		xSemaphoreGive(xSemaphore);
+		break;
+	case KBENCH_STREAM:
+		xStreamBufferSend(xStream, ucItem, sizeof(ucItem), 0);
+		break;
+	case KBENCH_EVENT:
+		xEventGroupSetBits(xEvents, KBENCH_EVENT_BIT);
+		break;
+	default:
+		break;
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvWaitTask(void *pvParameters)
+{
+	uint32_t ulReceived;
+	uint8_t ucReceived[KBENCH_STREAM_BYTES];
+
+	(void)pvParameters;
+
+	for (;;)
+	{
+		switch (eWaitOn)
+		{
+		case KBENCH_NOTIFY:
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			break;
+		case KBENCH_QUEUE:
+			xQueueReceive(xQueue, &ulReceived, portMAX_DELAY);
+			break;
+		case KBENCH_SEMAPHORE:
+			xSemaphoreTake(xSemaphore, portMAX_DELAY);
+			break;
+		case KBENCH_STREAM:
+			xStreamBufferReceive(xStream, ucReceived, sizeof(ucReceived), portMAX_DELAY);
+			break;
+		case KBENCH_EVENT:
+			xEventGroupWaitBits(xEvents, KBENCH_EVENT_BIT, pdTRUE, pdTRUE, portMAX_DELAY);
+			break;
+		default:
+			break;
+		}
+		uint64_t ullWake = get_cycle_count();
+
+		if (pxWake != NULL)
+		{
+			prvRecord(pxWake, ullWake - ullStart);
+		}
+		xDone = true;
+	}
+}
+/*-----------------------------------------------------------*/
+
+/* Make the wait task block on `eSignal`, waking it from the previous primitive */
+static void prvWaitOn(enum kbench_signal eSignal)
+{
+	enum kbench_signal eOld = eWaitOn;
+
+	pxWake = NULL;
+	if (eSignal == eOld)
+	{
+		return;
+	}
+	eWaitOn = eSignal;
+	xDone = false;
+	prvSignal(eOld);
+	while (!xDone)
+	{
+	}
+}
+/*-----------------------------------------------------------*/
+
+/* Yields in turn with the benchmark task, one round per notification */
+static void prvYieldTask(void *pvParameters)
+{
+	(void)pvParameters;
+
+	for (;;)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		for (uint32_t ulIteration = 0; ulIteration < KBENCH_ITERATIONS; ulIteration++)
+		{
+			prvRecord(&xYield, get_cycle_count() - ullStart);
+			ullStart = get_cycle_count();
+			taskYIELD();
+		}
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvTaskPass(void)
+{
+	static struct kbench_stat xStats[KBENCH_OPS];
+	struct kbench_stat xOverhead;
+	TaskHandle_t xSelf = xTaskGetCurrentTaskHandle();
+	uint32_t ulReceived;
+	uint8_t ucReceived[KBENCH_STREAM_BYTES];
+
+	memset(&xOverhead, 0, sizeof(xOverhead));
+	memset(xStats, 0, sizeof(xStats));
+
+	/* The wait task blocks on its notification, which nothing here gives */
+	prvWaitOn(KBENCH_NOTIFY);
+
+	for (uint32_t ulIteration = 0; ulIteration < KBENCH_ITERATIONS; ulIteration++)
+	{
+		KBENCH_TIME(&xOverhead, (void)0);
+		KBENCH_TIME(&xStats[KBENCH_YIELD], taskYIELD());
+		KBENCH_TIME(&xStats[KBENCH_QUEUE_SEND], xQueueSend(xQueue, &ulItem, 0));
+		KBENCH_TIME(&xStats[KBENCH_QUEUE_RECEIVE], xQueueReceive(xQueue, &ulReceived, 0));
+		KBENCH_TIME(&xStats[KBENCH_SEM_GIVE], xSemaphoreGive(xSemaphore));
+		KBENCH_TIME(&xStats[KBENCH_SEM_TAKE], xSemaphoreTake(xSemaphore, 0));
+		KBENCH_TIME(&xStats[KBENCH_MUTEX_TAKE], xSemaphoreTake(xMutex, 0));
+		KBENCH_TIME(&xStats[KBENCH_MUTEX_GIVE], xSemaphoreGive(xMutex));
+		KBENCH_TIME(&xStats[KBENCH_NOTIFY_GIVE], xTaskNotifyGive(xSelf));
+		KBENCH_TIME(&xStats[KBENCH_NOTIFY_TAKE], ulTaskNotifyTake(pdTRUE, 0));
+		KBENCH_TIME(&xStats[KBENCH_STREAM_SEND], xStreamBufferSend(xStream, ucItem, sizeof(ucItem), 0));
+		KBENCH_TIME(&xStats[KBENCH_STREAM_RECEIVE], xStreamBufferReceive(xStream, ucReceived, sizeof(ucReceived), 0));
+		KBENCH_TIME(&xStats[KBENCH_EVENT_SET], xEventGroupSetBits(xEvents, KBENCH_EVENT_BIT));
+		KBENCH_TIME(&xStats[KBENCH_EVENT_WAIT], xEventGroupWaitBits(xEvents, KBENCH_EVENT_BIT, pdTRUE, pdTRUE, 0));
+	}
+
+	prvPrint("overhead", "mcycle", &xOverhead);
+	for (int op = 0; op < KBENCH_OPS; op++)
+	{
+		prvPrint("task", pcOpNames[op], &xStats[op]);
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvSwitchPass(void)
+{
+	memset(&xYield, 0, sizeof(xYield));
+	xTaskNotifyGive(xYieldTask);
+	for (uint32_t ulIteration = 0; ulIteration < KBENCH_ITERATIONS; ulIteration++)
+	{
+		ullStart = get_cycle_count();
+		taskYIELD();
+		prvRecord(&xYield, get_cycle_count() - ullStart);
+	}
+	prvPrint("switch", "yield", &xYield);
+
+	for (int signal = 0; signal < KBENCH_SIGNALS; signal++)
+	{
+		prvWaitOn((enum kbench_signal)signal);
+		memset(&xWake, 0, sizeof(xWake));
+		pxWake = &xWake;
+
+		for (uint32_t ulIteration = 0; ulIteration < KBENCH_ITERATIONS; ulIteration++)
+		{
+			xDone = false;
+			ullStart = get_cycle_count();
+			prvSignal((enum kbench_signal)signal);
+			while (!xDone)
+			{
+			}
+		}
+		prvPrint("switch", pcSignalNames[signal], &xWake);
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvIsrPass(void)
+{
+	for (int signal = 0; signal < KBENCH_SIGNALS; signal++)
+	{
+		prvWaitOn((enum kbench_signal)signal);
+		memset(&xWake, 0, sizeof(xWake));
+		memset(&xFromIsr, 0, sizeof(xFromIsr));
+		pxWake = &xWake;
+
+		/* Let the console drain, the trigger needs an idle transmitter */
+		vTaskDelay(pdMS_TO_TICKS(100));
+
+		for (uint32_t ulIteration = 0; ulIteration < KBENCH_ITERATIONS; ulIteration++)
+		{
+			xDone = false;
+			ullStart = get_cycle_count();
+			uart0_txempty_irq(true);
+			while (!xDone)
+			{
+			}
+		}
+		prvPrint("isr", pcSignalNames[signal], &xWake);
+		prvPrint("fromisr", pcSignalNames[signal], &xFromIsr);
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvBenchTask(void *pvParameters)
+{
+	(void)pvParameters;
+
+	printf("kbench,hz,%lu\r\n", (unsigned long)configCPU_CLOCK_HZ);
+	prvTaskPass();
+	prvSwitchPass();
+	prvIsrPass();
+	printf("kbench,done\r\n");
+
+	vTaskDelete(NULL);
+}
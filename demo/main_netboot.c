@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <time.h>
 #include <elf.h>
@@ -11,14 +12,41 @@
 /* FreeRTOS  includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "rtos_static.h"
 
 /* IP stack includes. */
 #include "FreeRTOS_IP.h"
 #include "FreeRTOS_Sockets.h"
+#include "FreeRTOS_DNS.h"
 #include "NetworkInterface.h"
 
 /* Application includes */
 #include "uart.h"
+#include "lz4_stream.h"
+#include "netboot_dhcp.h"
+#if configUSE_PROFILER
+#include "prof.h"
+#endif
+
+/* wolfcrypt includes */
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/wolfcrypt/sha256.h>
+#if BSP_USE_ICENET
+#include "icenet.h"
+#endif
+
+/* Image cache on the FatFs volume (the IceBlk disk on AWS) */
+#ifndef NETBOOT_CACHE
+#define NETBOOT_CACHE 0
+#endif
+#if NETBOOT_CACHE
+#include "netboot_cache.h"
+#endif
+
+/* Get an address by DHCP before the shell starts */
+#ifndef NETBOOT_DHCP
+#define NETBOOT_DHCP 0
+#endif
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -49,29 +77,128 @@ typedef XCONCAT3(Elf, __riscv_xlen, _Phdr) Elf_Phdr;
 #define TFTP_OP_ERROR 5
 #define TFTP_OP_OACK  6
 
-#define TFTP_MAX_BLKSIZE  1024
-#define TFTP_MAX_WINSIZE  16
-#define TFTP_MAX_RETRIES  5
-#define TFTP_MAX_RECVSIZE (sizeof(struct tftp_data) + TFTP_MAX_WINSIZE
-#define TFTP_TIMEOUT_MS   5000
+#define TFTP_ERR_NOT_FOUND 1
+#define TFTP_ERR_OPTIONS   8
+
+/* prvFetch() result when the server does not have the file */
+#define FETCH_NOT_FOUND 2
+/* The file still matches the copy described by the fetch_check */
+#define FETCH_NOT_MODIFIED 3
+
+/*
+ * The largest block that fits in one frame: the MTU less the IP, UDP and TFTP
+ * headers.  The window size is negotiated per transfer (see xTftpWinsize) and
+ * limited by the size of the reassembly bitmap.
+ */
+#define TFTP_MAX_BLKSIZE  (ipconfigNETWORK_MTU - 20 - 8 - 4)
+#define TFTP_MIN_WINSIZE  4
+#define TFTP_INIT_WINSIZE 64
+#define TFTP_MAX_WINSIZE  512
+#define TFTP_MAX_RETRIES  10
+#define TFTP_MIN_TIMEOUT_MS 20
+#define TFTP_MAX_TIMEOUT_MS 1000
+/* Halve the window for the next transfer when more than 1 in this many
+   windows had a loss. */
+#define TFTP_LOSS_WINDOWS 32
+/* A multicast client that is not the master only listens, and gives up after
+   this many timeouts in a row without data. */
+#define TFTP_MCAST_RETRIES 30
+
+/*
+ * Data received out of order is held here until it can be hashed or
+ * decompressed in order
+ */
+#define IMAGE_RING_SIZE (1024 * 1024)
+#if TFTP_MAX_WINSIZE * TFTP_MAX_BLKSIZE > IMAGE_RING_SIZE
+#error "IMAGE_RING_SIZE must hold a whole TFTP window"
+#endif
+
+#define HTTP_PORT 80
+#define HTTP_HOST_MAX 64
+#define HTTP_HEADER_MAX 2048
+#define HTTP_TIMEOUT_MS 5000
+#define HTTP_ETAG_MAX 128
+/* Windows are in segments; the buffer holds two, so the sender never waits
+   while a window is being processed */
+#define HTTP_RX_WINSIZE 44
+#define HTTP_RX_BUFSIZE (2 * HTTP_RX_WINSIZE * ipconfigTCP_MSS)
+#if HTTP_RX_BUFSIZE > IMAGE_RING_SIZE
+#error "IMAGE_RING_SIZE must hold a whole HTTP receive buffer"
+#endif
+
+/* Largest .sha256 file or manifest */
+#define SHA256_FILE_MAX 4096
+
+/* Bytes read from the cache at a time */
+#define CACHE_READ_SIZE (64 * 1024)
+
+/* Typed ahead, or pasted, input the shell has not read yet */
+#define SHELL_RX_STREAM_SIZE 1024
+
+/*
+ * Receives each DATA block with its offset in the file, and how much of the
+ * file has been received without holes so far.  Blocks may arrive out of order
+ * and more than once.
+ */
+typedef int (*tftp_sink_type)(void *ctx, size_t off, const char *data,
+                              size_t len, size_t avail);
+
+/*
+ * Cheap freshness check of a copy already held: TFTP compares the size with
+ * the tsize option and HTTP sends the entity tag in If-None-Match (or, with
+ * no tag, compares Content-Length).  The fetch then stops with
+ * FETCH_NOT_MODIFIED before any data if the copy is current.  A check on the
+ * size alone misses a rebuilt file of the same size, so it is flagged in
+ * sizeonly; only a manifest digest is a reliable check.
+ */
+struct fetch_check
+{
+	/* Whether there is a copy to check */
+	bool have;
+	size_t size;
+	const char *etag;
+	/* Entity tag of the file sent, from the HTTP response */
+	char newetag[HTTP_ETAG_MAX];
+	/* Set when the copy was found current from its size only */
+	bool sizeonly;
+};
 
 struct tftp_client_state
 {
 	Socket_t sock;
 	struct freertos_sockaddr dstaddr;
 	socklen_t dstaddrlen;
-	char *winbuf;
+	tftp_sink_type sink;
+	void *sinkctx;
+	struct fetch_check *check;
+	/* RFC 2090 group the server multicasts DATA to, and a set with both */
+	Socket_t group;
+	SocketSet_t set;
+	/* File offset of block winstart */
+	size_t winpos;
 	void *recvpacket;
-	uint16_t winprev;
 	uint16_t winstart;
 	uint16_t winsize;
-	uint16_t winbits;
 	uint16_t blksize;
 	uint16_t lastblock;
 	uint16_t lastsize;
+	/* Blocks received in the window, bit n is block winstart + n */
+	uint32_t winbits[TFTP_MAX_WINSIZE / 32];
+	/* Round trip estimate and timeout, in microseconds */
+	uint32_t srtt;
+	uint32_t rttvar;
+	uint32_t rto;
+	uint32_t acktime;
+	uint32_t windows;
+	uint32_t losses;
 	uint8_t retries;
+	uint8_t started : 1;
 	uint8_t havetid : 1;
 	uint8_t pastrrq : 1;
+	uint8_t havelast : 1;
+	uint8_t timing : 1;
+	uint8_t multicast : 1;
+	uint8_t master : 1;
 };
 
 struct tftp_header
@@ -119,6 +246,58 @@ struct load_command
 	size_t zerosz;
 };
 
+struct mem_range
+{
+	char *start;
+	char *end;
+};
+
+struct elf_stream
+{
+	const char *name;
+	char *staging;
+	/* Bytes of the staging area in use */
+	size_t stagesize;
+	/* All data before this file offset is in the staging area */
+	size_t early;
+	Elf_Ehdr *ehdr;
+	/* NULL until the program headers have been received and checked */
+	Elf_Phdr *phdrs;
+	size_t entry;
+	bool needentry;
+};
+
+enum image_format
+{
+	IMAGE_UNKNOWN,
+	IMAGE_ELF,
+	IMAGE_LZ4
+};
+
+/* A file as received: an ELF file, or one compressed with LZ4 */
+struct image_stream
+{
+	struct elf_stream *elf;
+	enum image_format format;
+	/* Received data, by file offset modulo IMAGE_RING_SIZE */
+	char *ring;
+	size_t ringend;
+	/* Bytes of the file hashed and decompressed */
+	size_t consumed;
+	struct lz4_stream lz4;
+	/* SHA-256 of the file as sent, when verifying or caching it */
+	bool hash;
+	bool verify;
+	Sha256 sha;
+	uint8_t digest[SHA256_DIGEST_SIZE];
+#if NETBOOT_CACHE
+	/* Where to cache the file, opened when the first bytes arrive */
+	struct netboot_cache_file *cache;
+	const char *cachesource;
+	const char *cacheetag;
+#endif
+};
+
 /* Must be in .data; startup code writes to it early before zeroing BSS! */
 __attribute__((section(".data")))
 size_t xDtbAddr;
@@ -143,10 +322,44 @@ configNETWORK_INTERFACE_TO_USE definition for information on how to configure
 the real network connection to use. */
 const uint8_t ucMACAddress[6] = {configMAC_ADDR0, configMAC_ADDR1, configMAC_ADDR2, configMAC_ADDR3, configMAC_ADDR4, configMAC_ADDR5};
 
+/* Ask for RFC 2090 multicast TFTP transfers (boot -M) */
+static bool xTftpMulticast;
+
 void main_netboot(void);
 static void prvShellTask(void *pvParameters);
-static void prvLoadAndBoot(int n, char **names, char **bufs, bool halt);
-static int prvTftpReceive(const char *host, uint16_t port, const char *name, char *buf, size_t *size);
+static void prvElfStreamInit(struct elf_stream *stream, const char *name,
+		char *staging, bool needentry);
+static int prvElfStreamWrite(void *ctx, size_t off, const char *data,
+		size_t len, size_t avail);
+static BaseType_t prvElfStreamFinish(struct elf_stream *stream, size_t size);
+static void prvImageInit(struct image_stream *image, struct elf_stream *elf,
+		const uint8_t *digest);
+static void prvImageFree(struct image_stream *image);
+static int prvImageWrite(void *ctx, size_t off, const char *data, size_t len,
+		size_t avail);
+static BaseType_t prvImageFinish(struct image_stream *image, size_t size);
+static int prvReceiveImage(const char *host, uint16_t port, const char *name,
+		struct elf_stream *stream, char *staging, bool needentry,
+		const uint8_t *digest, struct fetch_check *check);
+#if NETBOOT_CACHE
+static int prvGetCachedImage(const char *host, uint16_t port,
+		const char *name, struct elf_stream *stream, char *staging,
+		bool needentry, const uint8_t *digest);
+#endif
+static bool prvFindDigest(const char *text, const char *name, bool anyname,
+		uint8_t *digest);
+static int prvGetChecksumFile(const char *host, uint16_t port,
+		const char *name, char **text);
+static void prvLoadAndBoot(int n, struct elf_stream *streams, char *scratch, bool halt);
+static bool prvIsHttpUrl(const char *name);
+static int prvFetch(const char *host, uint16_t port, const char *name,
+                    tftp_sink_type sink, void *ctx, size_t *size,
+                    struct fetch_check *check);
+static int prvHttpReceive(const char *url, tftp_sink_type sink, void *ctx,
+                          size_t *size, struct fetch_check *check);
+static int prvTftpReceive(const char *host, uint16_t port, const char *name,
+                          tftp_sink_type sink, void *ctx, size_t *size,
+                          struct fetch_check *check);
 
 void main_netboot(void)
 {
@@ -174,7 +387,8 @@ void vApplicationIPNetworkEventHook(eIPCallbackEvent_t eNetworkEvent)
 	{
 		if (xTasksAlreadyCreated == pdFALSE)
 		{
-			xTaskCreate(prvShellTask, "Shell", configMINIMAL_STACK_SIZE * 10, NULL, tskIDLE_PRIORITY + 1, NULL);
+			bsp_boot_stage("network up");
+			RTOS_TASK_CREATE(prvShellTask, "Shell", configMINIMAL_STACK_SIZE * 10, NULL, tskIDLE_PRIORITY + 1, NULL);
 
 			xTasksAlreadyCreated = pdTRUE;
 		}
@@ -183,12 +397,64 @@ void vApplicationIPNetworkEventHook(eIPCallbackEvent_t eNetworkEvent)
 
 /* Shell implementation */
 
+/*
+ * Look up the expected SHA-256 of name, in the manifest if there is one, or
+ * else in name.sha256 on the server.  Without either, the file is not
+ * verified.  Returns false on error.
+ */
+static bool prvGetDigest(const char *host, uint16_t port, const char *manifest,
+		const char *sums, const char *name, uint8_t *digest, bool *verify)
+{
+	*verify = false;
+
+	if (manifest)
+	{
+		if (!prvFindDigest(sums, name, false, digest))
+		{
+			printf("Error: %s: not in %s\r\n", name, manifest);
+			return false;
+		}
+		*verify = true;
+		return true;
+	}
+
+	size_t namelen = strlen(name);
+	char *sumname = pvPortMalloc(namelen + sizeof(".sha256"));
+	char *text;
+	if (!sumname)
+		return false;
+	memcpy(sumname, name, namelen);
+	memcpy(sumname + namelen, ".sha256", sizeof(".sha256"));
+
+	int err = prvGetChecksumFile(host, port, sumname, &text);
+	if (err == FETCH_NOT_FOUND)
+	{
+		printf("No %s, not verifying %s\r\n", sumname, name);
+		vPortFree(sumname);
+		return true;
+	}
+	if (err)
+	{
+		vPortFree(sumname);
+		return false;
+	}
+
+	*verify = prvFindDigest(text, name, true, digest);
+	if (!*verify)
+		printf("Error: %s: no SHA-256 for %s\r\n", sumname, name);
+	vPortFree(text);
+	vPortFree(sumname);
+	return *verify;
+}
+
 static void prvShellCommandBoot(int argc, char **argv)
 {
-	char *bufs[2];
+	struct elf_stream streams[2];
 	size_t argi = 1;
 	bool halt = false;
+	bool usecache = false;
         unsigned long port = 69;
+	const char *manifest = NULL;
 
 	if ((size_t)argc > argi && strcmp(argv[argi], "-h") == 0)
 	{
@@ -196,6 +462,19 @@ static void prvShellCommandBoot(int argc, char **argv)
 		++argi;
 	}
 
+	if ((size_t)argc > argi && strcmp(argv[argi], "-c") == 0)
+	{
+		usecache = true;
+		++argi;
+	}
+
+	xTftpMulticast = false;
+	if ((size_t)argc > argi && strcmp(argv[argi], "-M") == 0)
+	{
+		xTftpMulticast = true;
+		++argi;
+	}
+
         if ((size_t)argc > argi && strcmp(argv[argi], "-p") == 0)
         {
 		++argi;
@@ -217,35 +496,84 @@ static void prvShellCommandBoot(int argc, char **argv)
 		}
         }
 
-	if ((size_t)argc < argi + 2)
+	if ((size_t)argc > argi && strcmp(argv[argi], "-m") == 0)
+	{
+		++argi;
+		if ((size_t)argc > argi)
+			manifest = argv[argi++];
+	}
+
+	/* Either a TFTP host and file names, or URLs */
+	const char *host = NULL;
+	if ((size_t)argc > argi && !prvIsHttpUrl(argv[argi]))
+		host = argv[argi++];
+
+	if ((size_t)argc < argi + 1)
 	{
 		printf("Error: too few arguments\r\n");
-		printf("Usage: boot [-h] [-p <port>] <host> <file> [file]\r\n");
+		printf("Usage: boot [-h] [-c] [-M] [-p <port>] [-m <manifest>] <host> <file> [file]\r\n");
+		printf("       boot [-h] [-c] [-m <manifest>] <url> [url]\r\n");
 		return;
 	}
 
-	if ((size_t)argc > argi + 1 + ARRAY_SIZE(bufs))
+	if ((size_t)argc > argi + ARRAY_SIZE(streams))
 	{
 		printf("Error: too many arguments\r\n");
-		printf("Usage: boot [-h] [-p <port>] <host> <file> [file]\r\n");
+		printf("Usage: boot [-h] [-c] [-M] [-p <port>] [-m <manifest>] <host> <file> [file]\r\n");
+		printf("       boot [-h] [-c] [-m <manifest>] <url> [url]\r\n");
 		return;
 	}
 
-	const char *host = argv[argi];
+#if !NETBOOT_CACHE
+	if (usecache)
+		printf("No image cache in this build, ignoring -c\r\n");
+#endif
+
+	char *sums = NULL;
+	if (manifest)
+	{
+		printf("Requesting %s\r\n", manifest);
+		int err = prvGetChecksumFile(host, port, manifest, &sums);
+		if (err == FETCH_NOT_FOUND)
+			printf("Failed to receive: %s: file not found\r\n", manifest);
+		if (err)
+			return;
+	}
+
 	char *staging = (char *)(uintptr_t)STAGING_ADDR;
-	for (int i = argi + 1; i < argc; ++i)
+	for (int i = argi; i < argc; ++i)
 	{
-		size_t size;
-		printf("Requesting %s\r\n", argv[i]);
-		if (prvTftpReceive(host, port, argv[i], staging, &size))
+		struct elf_stream *stream = &streams[i - argi];
+		uint8_t digest[SHA256_DIGEST_SIZE];
+		bool verify;
+		int err;
+
+		if (!prvGetDigest(host, port, manifest, sums, argv[i], digest, &verify))
+		{
+			vPortFree(sums);
+			return;
+		}
+
+#if NETBOOT_CACHE
+		if (usecache)
+			err = prvGetCachedImage(host, port, argv[i], stream, staging,
+			                        i == (int)argi, verify ? digest : NULL);
+		else
+#endif
+			err = prvReceiveImage(host, port, argv[i], stream, staging,
+			                      i == (int)argi, verify ? digest : NULL, NULL);
+		if (err)
+		{
+			vPortFree(sums);
 			return;
+		}
 
-		bufs[i - argi - 1] = staging;
-		staging += size + (-size % STAGING_BUFS_ALIGN);
+		staging += stream->stagesize + (-stream->stagesize % STAGING_BUFS_ALIGN);
 	}
+	vPortFree(sums);
 
 	printf("Booting\r\n");
-	prvLoadAndBoot(argc - argi - 1, argv + argi + 1, bufs, halt);
+	prvLoadAndBoot(argc - argi, streams, staging, halt);
 }
 
 static void prvShellCommandHelp(int argc, char **argv)
@@ -254,11 +582,32 @@ static void prvShellCommandHelp(int argc, char **argv)
 	(void)argv;
 
 	printf("Supported commands:\r\n");
-	printf("    boot [-h] [-p <port>] <host> <file> [file]\r\n");
-	printf("                              Load and boot the given file(s) via TFTP\r\n");
+	printf("    boot [-h] [-c] [-M] [-p <port>] [-m <manifest>] <host> <file> [file]\r\n");
+	printf("    boot [-h] [-c] [-m <manifest>] <url> [url]\r\n");
+	printf("                              Load and boot the given file(s) via TFTP,\r\n");
+	printf("                              or via HTTP for http:// URLs\r\n");
+	printf("                              With -c, boots from the disk cache if\r\n");
+	printf("                              the server's file has not changed\r\n");
+	printf("                              (by digest with -m, else by ETag, else\r\n");
+	printf("                              by size only, which is not reliable)\r\n");
+	printf("                              With -M, asks for RFC 2090 multicast TFTP\r\n");
+	printf("                              (the group must be a broadcast address)\r\n");
 	printf("                              Optionally halts just before jumping\r\n");
+	printf("    dhcp                      Replace the static address with a DHCP\r\n");
+	printf("                              lease, asking for the last one first\r\n");
 	printf("    help                      Display this message\r\n");
 	printf("    ifconfig                  Display network config\r\n");
+	printf("    stages                    Display the boot stages, in us since\r\n");
+	printf("                              reset and cycles spent in each\r\n");
+#if configUSE_TRACE_RECORDER
+	printf("    trace start|stop|dump     Restart or stop the kernel trace, or\r\n");
+	printf("                              print it for tools/trace2json.py\r\n");
+#endif
+#if configUSE_PROFILER
+	printf("    prof start|stop|dump      Start or stop sampling the pc on each\r\n");
+	printf("                              tick, or print the samples for\r\n");
+	printf("                              tools/prof.py\r\n");
+#endif
 }
 
 static void prvShellCommandIfconfig(int argc, char **argv)
@@ -287,6 +636,97 @@ static void prvShellCommandIfconfig(int argc, char **argv)
 	printf("DNS Server Address: %s\r\n", cBuffer);
 }
 
+/*
+ * Replace the static address with a DHCP lease.  With the cache, the last
+ * lease is kept on the disk and asked for again first.
+ */
+static int prvDhcp(void)
+{
+	struct netboot_dhcp_lease previous, lease;
+	bool haveprevious = false;
+	char cBuffer[16];
+
+#if NETBOOT_CACHE
+	haveprevious = netboot_cache_load("LEASE", &previous,
+	                                  sizeof(previous)) == 0;
+#endif
+	if (netboot_dhcp(ucMACAddress, haveprevious ? &previous : NULL, &lease))
+	{
+		printf("DHCP failed, keeping the static address\r\n");
+		return 1;
+	}
+	netboot_dhcp_apply(&lease);
+
+	FreeRTOS_inet_ntoa(lease.address, cBuffer);
+	printf("DHCP: %s, leased for %lu s\r\n", cBuffer,
+	       (unsigned long)lease.duration);
+#if NETBOOT_CACHE
+	if (!haveprevious || memcmp(&previous, &lease, sizeof(lease)) != 0)
+		netboot_cache_store("LEASE", &lease, sizeof(lease));
+#endif
+	return 0;
+}
+
+static void prvShellCommandDhcp(int argc, char **argv)
+{
+	if (argc > 1)
+	{
+		printf("Error: unexpected argument: %s\r\n", argv[1]);
+		printf("Usage: %s\r\n", argv[0]);
+		return;
+	}
+
+	prvDhcp();
+}
+
+#if configUSE_TRACE_RECORDER
+static void prvShellCommandTrace(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		printf("Usage: %s start|stop|dump\r\n", argv[0]);
+		return;
+	}
+
+	if (!strcmp(argv[1], "start"))
+		trace_start();
+	else if (!strcmp(argv[1], "stop"))
+		trace_stop();
+	else if (!strcmp(argv[1], "dump"))
+		trace_dump_uart();
+	else
+		printf("Error: unknown trace command: %s\r\n", argv[1]);
+}
+#endif
+
+#if configUSE_PROFILER
+static void prvShellCommandProf(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		printf("Usage: %s start|stop|dump\r\n", argv[0]);
+		return;
+	}
+
+	if (!strcmp(argv[1], "start"))
+		prof_start();
+	else if (!strcmp(argv[1], "stop"))
+		prof_stop();
+	else if (!strcmp(argv[1], "dump"))
+		prof_dump_uart();
+	else
+		printf("Error: unknown prof command: %s\r\n", argv[1]);
+}
+#endif
+
+static void prvShellCommandStages(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	bsp_boot_report();
+}
+
 struct
 {
 	const char *name;
@@ -294,8 +734,16 @@ struct
 } xShellCommands[] =
 {
 	{ "boot", prvShellCommandBoot },
+	{ "dhcp", prvShellCommandDhcp },
 	{ "help", prvShellCommandHelp },
 	{ "ifconfig", prvShellCommandIfconfig },
+#if configUSE_PROFILER
+	{ "prof", prvShellCommandProf },
+#endif
+	{ "stages", prvShellCommandStages },
+#if configUSE_TRACE_RECORDER
+	{ "trace", prvShellCommandTrace },
+#endif
 };
 
 static void prvShellCommand(char *command)
@@ -359,15 +807,18 @@ static void prvShellTask(void *pvParameters)
 	int len = 0;
 	bool overflow = false;
 	bool nonprintable = false;
+	/* Sleep until the UART interrupt has input; polls if there is none */
+	if (uart0_rxstream_init(SHELL_RX_STREAM_SIZE) != 0)
+		printf("Shell input is polled\r\n");
+#if NETBOOT_DHCP
+	prvDhcp();
+#endif
 	prvShellPrompt();
 	for (;;)
 	{
-		int n = uart0_rxbuffer(buf + len, sizeof(buf)-1-len);
-		if (n == 0)
-		{
-			msleep(1);
+		int n = uart0_rxwait(buf + len, sizeof(buf)-1-len, portMAX_DELAY);
+		if (n <= 0)
 			continue;
-		}
 		buf[len + n] = 0;
 		char *command = buf;
 		for (int i = 0; i < n; ++i)
@@ -471,14 +922,113 @@ static void prvShellTask(void *pvParameters)
 
 /* ELF loader */
 
-static BaseType_t prvGetLoadCommands(struct load_command **commands,
-		char *name, char *buf, size_t *pentry)
+/*
+ * Segments are written straight to their load address as the file arrives,
+ * except where they overlap memory the loader is still using; those parts are
+ * kept in the staging area, at their offset in the file, and copied into place
+ * by the trampoline once the network is down.  Everything received before the
+ * program headers are known is staged too, and placed when the file is
+ * complete.
+ */
+extern char __text_start[];
+extern char _end[];
+extern char __uncached_start[];
+extern char __uncached_end[];
+
+static struct mem_range xReservedRanges[3];
+static size_t xNumReservedRanges;
+
+static void prvGetReservedRanges(void)
+{
+	size_t n = 0;
+
+	/* Code, data, stacks and heap */
+	xReservedRanges[n].start = __text_start;
+	xReservedRanges[n++].end = _end;
+	xReservedRanges[n].start = __uncached_start;
+	xReservedRanges[n++].end = __uncached_end;
+#if BSP_USE_ICENET
+	/* DMA rings at a fixed address */
+	xReservedRanges[n].start = (char *)TxFrameBufRef;
+	xReservedRanges[n++].end = (char *)RxFrameBufRef + CONFIG_ICENET_RING_SIZE * 0x600;
+#endif
+	xNumReservedRanges = n;
+}
+
+/*
+ * Length of the leading part of [dst, dst + len) that is either all reserved
+ * or all free; *reserved says which.
+ */
+static size_t prvElfSplit(const char *dst, size_t len, bool *reserved)
+{
+	*reserved = false;
+	for (size_t i = 0; i < xNumReservedRanges; ++i)
+	{
+		const struct mem_range *range = &xReservedRanges[i];
+		if (dst >= range->start && dst < range->end)
+		{
+			*reserved = true;
+			if ((size_t)(range->end - dst) < len)
+				len = range->end - dst;
+		}
+		else if (dst < range->start && (size_t)(range->start - dst) < len)
+		{
+			len = range->start - dst;
+		}
+	}
+	return len;
+}
+
+static void prvElfStage(struct elf_stream *stream, size_t off,
+		const char *data, size_t len)
+{
+	if (stream->staging + off != data)
+		memcpy(stream->staging + off, data, len);
+	if (off + len > stream->stagesize)
+		stream->stagesize = off + len;
+}
+
+/* Write file data for [dst, dst + len), staging the reserved parts. */
+static void prvElfPlace(struct elf_stream *stream, char *dst, size_t off,
+		const char *data, size_t len)
+{
+	while (len)
+	{
+		bool reserved;
+		size_t n = prvElfSplit(dst, len, &reserved);
+		if (reserved)
+			prvElfStage(stream, off, data, n);
+		else
+			memcpy(dst, data, n);
+		dst += n;
+		off += n;
+		data += n;
+		len -= n;
+	}
+}
+
+/* Zero [dst, dst + len), except for the reserved parts. */
+static void prvElfZero(char *dst, size_t len)
+{
+	while (len)
+	{
+		bool reserved;
+		size_t n = prvElfSplit(dst, len, &reserved);
+		if (!reserved)
+			memset(dst, 0, n);
+		dst += n;
+		len -= n;
+	}
+}
+
+static BaseType_t prvElfCheckHeader(struct elf_stream *stream)
 {
-	Elf_Ehdr *ehdr = (Elf_Ehdr *)(uintptr_t)buf;
+	const char *name = stream->name;
+	Elf_Ehdr *ehdr = stream->ehdr;
 	if (ehdr->e_ident[EI_MAG0] != ELFMAG0 ||
 	    ehdr->e_ident[EI_MAG1] != ELFMAG1 ||
 	    ehdr->e_ident[EI_MAG2] != ELFMAG2 ||
-	    ehdr->e_ident[EI_MAG2] != ELFMAG2)
+	    ehdr->e_ident[EI_MAG3] != ELFMAG3)
 	{
 		printf("Error: %s: not an ELF file\r\n", name);
 		return 1;
@@ -514,8 +1064,8 @@ static BaseType_t prvGetLoadCommands(struct load_command **commands,
 
 	if (ehdr->e_machine != EM_RISCV)
 	{
-		printf("Error: %s: wrong ELF version: %d\r\n", name,
-		       ehdr->e_ident[EI_VERSION]);
+		printf("Error: %s: wrong ELF machine: %d\r\n", name,
+		       ehdr->e_machine);
 		return 1;
 	}
 
@@ -526,15 +1076,23 @@ static BaseType_t prvGetLoadCommands(struct load_command **commands,
 		return 1;
 	}
 
-	Elf_Phdr *phdrs = (Elf_Phdr *)(uintptr_t)(buf + ehdr->e_phoff);
+	return 0;
+}
+
+static BaseType_t prvElfCheckSegments(struct elf_stream *stream)
+{
+	const char *name = stream->name;
+	Elf_Ehdr *ehdr = stream->ehdr;
+	Elf_Phdr *phdrs = stream->phdrs;
 	size_t entry = 0;
-	for (int i = ehdr->e_phnum - 1; i >= 0; --i)
+	for (int i = 0; i < ehdr->e_phnum; ++i)
 	{
 		if (phdrs[i].p_type != PT_LOAD)
 			continue;
 
 		if (phdrs[i].p_paddr < 0x80000000 ||
-		    phdrs[i].p_paddr + phdrs[i].p_memsz > 0xE0000000)
+		    phdrs[i].p_paddr + phdrs[i].p_memsz > 0xE0000000 ||
+		    phdrs[i].p_filesz > phdrs[i].p_memsz)
 		{
 			printf("Error: %s: PT_LOAD segment %d not in bounds"
 			       " (0x%08lx - 0x%08lx)\r\n", name, i,
@@ -543,162 +1101,1356 @@ static BaseType_t prvGetLoadCommands(struct load_command **commands,
 			return 1;
 		}
 
-		--*commands;
-		(*commands)->src = buf + phdrs[i].p_offset;
-		(*commands)->dst = (char *)(uintptr_t)phdrs[i].p_paddr;
-		(*commands)->copysz = phdrs[i].p_filesz;
-		(*commands)->zerosz = phdrs[i].p_memsz - phdrs[i].p_filesz;
-
 		if (ehdr->e_entry >= phdrs[i].p_vaddr &&
 		    ehdr->e_entry < phdrs[i].p_vaddr + phdrs[i].p_memsz)
 			entry = phdrs[i].p_paddr + (ehdr->e_entry - phdrs[i].p_vaddr);
 	}
 
-	if (pentry)
+	if (stream->needentry && !entry)
 	{
-		if (!entry)
-		{
-			printf("Error: %s: entry point %08lx not in any segments\r\n",
-			       name, (unsigned long)ehdr->e_entry);
-			return 1;
-		}
-
-		*pentry = entry;
+		printf("Error: %s: entry point %08lx not in any segments\r\n",
+		       name, (unsigned long)ehdr->e_entry);
+		return 1;
 	}
+	stream->entry = entry;
 
 	return 0;
 }
 
-static void prvLoadAndBoot(int n, char **names, char **bufs, bool halt)
+/* Check the headers once the first avail bytes of the file are staged. */
+static BaseType_t prvElfStreamParse(struct elf_stream *stream, size_t avail)
 {
-	extern size_t xDtbAddr;
-	struct load_command *commands =
-		(struct load_command *)(uintptr_t)STAGING_ADDR;
-	--commands;
-	commands->src = NULL;
-	commands->dst = NULL;
-	commands->copysz = 0;
-	commands->zerosz = 0;
-
-	size_t entry;
-	for (int i = n - 1; i >= 0; --i)
+	if (!stream->ehdr)
 	{
-		size_t *pentry = i == 0 ? &entry : NULL;
-		if (prvGetLoadCommands(&commands, names[i], bufs[i], pentry))
-			return;
+		if (avail < sizeof(Elf_Ehdr))
+			return 0;
+		stream->ehdr = (Elf_Ehdr *)(uintptr_t)stream->staging;
+		if (prvElfCheckHeader(stream))
+			return 1;
 	}
 
-	printf("Taking down network interface\r\n");
-	xNetworkInterfaceDestroy();
+	if (avail < stream->ehdr->e_phoff +
+	            (size_t)stream->ehdr->e_phnum * sizeof(Elf_Phdr))
+		return 0;
+	stream->phdrs = (Elf_Phdr *)(uintptr_t)(stream->staging + stream->ehdr->e_phoff);
+	if (prvElfCheckSegments(stream))
+	{
+		stream->phdrs = NULL;
+		return 1;
+	}
 
-	size_t load_trampoline_size =
-		netboot_load_trampoline_end - netboot_load_trampoline_start;
-	netboot_load_trampoline_type load_trampoline =
-		(netboot_load_trampoline_type)((uintptr_t)commands - load_trampoline_size);
-	memcpy((char *)load_trampoline, netboot_load_trampoline_start,
-	       load_trampoline_size);
-	__asm__ __volatile__ ("fence.i" ::: "memory");
-	load_trampoline(0, xDtbAddr, 0, commands, entry, halt);
+	return 0;
 }
 
-/* TFTP implementation */
-
-static void prvTftpTerminate(struct tftp_client_state *state, uint16_t code, char *message)
+static void prvElfStreamInit(struct elf_stream *stream, const char *name,
+		char *staging, bool needentry)
 {
-	if (state->recvpacket)
-	{
-		FreeRTOS_ReleaseUDPPayloadBuffer(state->recvpacket);
-		state->recvpacket = NULL;
-	}
-
-	size_t mlen = strlen(message);
-	size_t plen = sizeof(struct tftp_error) + mlen + 1;
-	struct tftp_error *packet = pvPortMalloc(plen);
-	memset(packet, 0, sizeof(*packet));
-	packet->header.op = FreeRTOS_htons(TFTP_OP_ERROR);
-	packet->code = FreeRTOS_htons(code);
-	strcpy(packet->message, message);
-	FreeRTOS_sendto(state->sock, packet, plen, 0, &state->dstaddr,
-	                state->dstaddrlen);
-	vPortFree(packet);
-	FreeRTOS_closesocket(state->sock);
+	memset(stream, 0, sizeof(*stream));
+	stream->name = name;
+	stream->staging = staging;
+	stream->needentry = needentry;
+	prvGetReservedRanges();
 }
 
-static int prvTftpRrq(struct tftp_client_state *state, const char *name)
+/* TFTP sink */
+static int prvElfStreamWrite(void *ctx, size_t off, const char *data,
+		size_t len, size_t avail)
 {
-	size_t namelen = strlen(name) + 1;
-	const char *mode = "octet";
-	size_t modelen = strlen(mode) + 1;
-	static const char options[] = "blksize\0" XSTR(TFTP_MAX_BLKSIZE) "\0"
-	                              "windowsize\0" XSTR(TFTP_MAX_WINSIZE);
-	size_t optionslen = state->winsize ? 0 : sizeof(options);
-	size_t plen = sizeof(struct tftp_xrq) + namelen + modelen + optionslen;
+	struct elf_stream *stream = ctx;
 
-	if (state->retries == TFTP_MAX_RETRIES)
+	if (!stream->phdrs)
 	{
-		printf("Failed to receive: RRQ retry limit exceeded\r\n");
-		prvTftpTerminate(state, 0, "Retry limit exceeded");
-		return 1;
+		prvElfStage(stream, off, data, len);
+		if (off + len > stream->early)
+			stream->early = off + len;
+		return prvElfStreamParse(stream, avail);
 	}
-	else
+
+	/* Resent data from before the headers were known is staged with the rest */
+	if (off < stream->early)
 	{
-		++state->retries;
+		size_t n = stream->early - off < len ? stream->early - off : len;
+		prvElfStage(stream, off, data, n);
+		off += n;
+		data += n;
+		len -= n;
 	}
 
-	struct tftp_xrq *packet = pvPortMalloc(plen);
-	memset(packet, 0, sizeof(*packet));
-	packet->header.op = FreeRTOS_htons(TFTP_OP_RRQ);
-	char *buf = packet->request;
-	memcpy(buf, name, namelen);
-	buf += namelen;
-	memcpy(buf, mode, modelen);
-	buf += modelen;
-	memcpy(buf, options, optionslen);
-
-	long err;
-	err = FreeRTOS_sendto(state->sock, packet, plen, 0, &state->dstaddr,
-	                      state->dstaddrlen);
-	vPortFree(packet);
-	if (err != (long)plen)
+	for (int i = 0; len && i < stream->ehdr->e_phnum; ++i)
 	{
-		printf("Failed to send RRQ: FreeRTOS_sendto returned %ld != %ld\r\n",
-		       err, (unsigned long)plen);
-		return 1;
+		Elf_Phdr *phdr = &stream->phdrs[i];
+		if (phdr->p_type != PT_LOAD)
+			continue;
+
+		size_t start = off > phdr->p_offset ? off : phdr->p_offset;
+		size_t end = off + len < phdr->p_offset + phdr->p_filesz ?
+		             off + len : phdr->p_offset + phdr->p_filesz;
+		if (start >= end)
+			continue;
+
+		prvElfPlace(stream,
+		            (char *)(uintptr_t)(phdr->p_paddr + (start - phdr->p_offset)),
+		            start, data + (start - off), end - start);
 	}
 
 	return 0;
 }
 
-static int prvTftpAck(struct tftp_client_state *state)
+/* Place what was staged early and zero the BSS, once the file is complete. */
+static BaseType_t prvElfStreamFinish(struct elf_stream *stream, size_t size)
 {
-	uint16_t winlast = state->winstart - 1;
-	for (uint16_t bits = state->winbits; bits & 1; bits >>= 1)
-		++winlast;
-
-	if (winlast != state->winstart - 1)
-	{
-		uint16_t numack = winlast - state->winstart + 1;
-		state->winbits = 0;
-		state->winstart += numack;
-		state->winbuf += (numack - 1) * state->blksize;
-		if (winlast == state->lastblock)
-			state->winbuf += state->lastsize;
-		else
-			state->winbuf += state->blksize;
-		state->retries = 0;
-	}
-	else if (state->retries == TFTP_MAX_RETRIES)
+	if (!stream->phdrs)
 	{
-		printf("Failed to receive: ACK retry limit exceeded\r\n");
-		prvTftpTerminate(state, 0, "Retry limit exceeded");
-		return 1;
+		if (prvElfStreamParse(stream, size))
+			return 1;
+		if (!stream->phdrs)
+		{
+			printf("Error: %s: truncated ELF headers\r\n", stream->name);
+			return 1;
+		}
 	}
-	else
+
+	for (int i = 0; i < stream->ehdr->e_phnum; ++i)
 	{
-		++state->retries;
-	}
+		Elf_Phdr *phdr = &stream->phdrs[i];
+		if (phdr->p_type != PT_LOAD)
+			continue;
 
-	size_t plen = sizeof(struct tftp_ack);
+		if (phdr->p_offset + phdr->p_filesz > size)
+		{
+			printf("Error: %s: PT_LOAD segment %d beyond end of file\r\n",
+			       stream->name, i);
+			return 1;
+		}
+
+		char *dst = (char *)(uintptr_t)phdr->p_paddr;
+		if (phdr->p_offset < stream->early)
+		{
+			size_t n = stream->early - phdr->p_offset;
+			if (n > phdr->p_filesz)
+				n = phdr->p_filesz;
+			prvElfPlace(stream, dst, phdr->p_offset,
+			            stream->staging + phdr->p_offset, n);
+		}
+		prvElfZero(dst + phdr->p_filesz, phdr->p_memsz - phdr->p_filesz);
+	}
+
+	return 0;
+}
+
+/* Add commands for the parts of segments that overlap reserved memory. */
+static struct load_command *prvElfCommands(struct elf_stream *stream,
+		struct load_command *commands)
+{
+	for (int i = 0; i < stream->ehdr->e_phnum; ++i)
+	{
+		Elf_Phdr *phdr = &stream->phdrs[i];
+		if (phdr->p_type != PT_LOAD)
+			continue;
+
+		char *seg = (char *)(uintptr_t)phdr->p_paddr;
+		char *segfile = seg + phdr->p_filesz;
+		char *segend = seg + phdr->p_memsz;
+		for (size_t j = 0; j < xNumReservedRanges; ++j)
+		{
+			const struct mem_range *range = &xReservedRanges[j];
+			char *start = seg > range->start ? seg : range->start;
+			char *end = segend < range->end ? segend : range->end;
+			if (start >= end)
+				continue;
+
+			commands->dst = start;
+			if (start < segfile)
+			{
+				commands->src = stream->staging + phdr->p_offset + (start - seg);
+				commands->copysz = (end < segfile ? end : segfile) - start;
+			}
+			else
+			{
+				/* Only zeroing, but src must not terminate the list */
+				commands->src = stream->staging;
+				commands->copysz = 0;
+			}
+			commands->zerosz = end - start - commands->copysz;
+			++commands;
+		}
+	}
+
+	return commands;
+}
+
+/*
+ * The trampoline and the load commands go in scratch, just past the staged
+ * files.
+ */
+static void prvLoadAndBoot(int n, struct elf_stream *streams, char *scratch,
+		bool halt)
+{
+	extern size_t xDtbAddr;
+	size_t load_trampoline_size =
+		netboot_load_trampoline_end - netboot_load_trampoline_start;
+	netboot_load_trampoline_type load_trampoline =
+		(netboot_load_trampoline_type)(uintptr_t)scratch;
+	struct load_command *commands =
+		(struct load_command *)(uintptr_t)(scratch + load_trampoline_size +
+		                                   (-load_trampoline_size % STAGING_BUFS_ALIGN));
+
+	struct load_command *command = commands;
+	for (int i = 0; i < n; ++i)
+		command = prvElfCommands(&streams[i], command);
+	command->src = NULL;
+	command->dst = NULL;
+	command->copysz = 0;
+	command->zerosz = 0;
+
+	printf("Taking down network interface\r\n");
+	xNetworkInterfaceDestroy();
+
+	memcpy((char *)load_trampoline, netboot_load_trampoline_start,
+	       load_trampoline_size);
+	__asm__ __volatile__ ("fence.i" ::: "memory");
+	load_trampoline(0, xDtbAddr, 0, commands, streams[0].entry, halt);
+}
+
+/* Received images */
+
+/* Time spent hashing the file being received, for the progress report */
+static bool xImageHashing;
+static uint32_t xImageHashUs;
+
+#if NETBOOT_CACHE
+/* Too big for the shell task's stack */
+static struct netboot_cache_entry xCacheEntry;
+static struct netboot_cache_file xCacheFile;
+static struct fetch_check xCacheCheck;
+static char xCacheSource[NETBOOT_CACHE_SOURCE_MAX];
+#endif
+
+static void prvImageInit(struct image_stream *image, struct elf_stream *elf,
+		const uint8_t *digest)
+{
+	memset(image, 0, sizeof(*image));
+	image->elf = elf;
+	xImageHashing = digest != NULL;
+	xImageHashUs = 0;
+	if (digest)
+	{
+		image->hash = true;
+		image->verify = true;
+		memcpy(image->digest, digest, sizeof(image->digest));
+		wc_InitSha256(&image->sha);
+	}
+}
+
+#if NETBOOT_CACHE
+/*
+ * Also write the file to the cache as it is received, with its SHA-256 and
+ * the entity tag that etag will hold by the end of the transfer.
+ */
+static void prvImageCache(struct image_stream *image,
+		struct netboot_cache_file *cache, const char *source,
+		const char *etag)
+{
+	image->cache = cache;
+	image->cachesource = source;
+	image->cacheetag = etag;
+	cache->open = false;
+	if (!image->hash)
+	{
+		image->hash = true;
+		xImageHashing = true;
+		wc_InitSha256(&image->sha);
+	}
+}
+
+/* Caching is given up on errors; the boot goes on without it. */
+static void prvImageCacheWrite(struct image_stream *image, const char *data,
+		size_t len)
+{
+	if (!image->cache->open &&
+	    (image->consumed != 0 ||
+	     netboot_cache_create(image->cache, image->cachesource)))
+	{
+		image->cache = NULL;
+		return;
+	}
+
+	if (netboot_cache_write(image->cache, data, len))
+	{
+		netboot_cache_abort(image->cache);
+		image->cache = NULL;
+	}
+}
+#endif
+
+static void prvImageFree(struct image_stream *image)
+{
+	vPortFree(image->ring);
+	image->ring = NULL;
+	if (image->format == IMAGE_LZ4)
+		lz4_stream_free(&image->lz4);
+#if NETBOOT_CACHE
+	if (image->cache)
+	{
+		netboot_cache_abort(image->cache);
+		image->cache = NULL;
+	}
+#endif
+}
+
+static int prvImageOutput(void *ctx, size_t off, const char *data, size_t len)
+{
+	return prvElfStreamWrite(ctx, off, data, len, off + len);
+}
+
+/* Store a block in the ring, by its offset in the file. */
+static int prvImageStore(struct image_stream *image, size_t off,
+		const char *data, size_t len)
+{
+	if (off < image->consumed)
+	{
+		size_t n = image->consumed - off < len ? image->consumed - off : len;
+		off += n;
+		data += n;
+		len -= n;
+	}
+	if (off + len - image->consumed > IMAGE_RING_SIZE)
+	{
+		printf("Error: %s: TFTP window exceeds reorder buffer\r\n",
+		       image->elf->name);
+		return 1;
+	}
+
+	if (!image->ring)
+	{
+		image->ring = pvPortMalloc(IMAGE_RING_SIZE);
+		if (!image->ring)
+		{
+			printf("Error: cannot allocate reorder buffer\r\n");
+			return 1;
+		}
+	}
+
+	while (len)
+	{
+		size_t pos = off % IMAGE_RING_SIZE;
+		size_t n = IMAGE_RING_SIZE - pos < len ? IMAGE_RING_SIZE - pos : len;
+		memcpy(image->ring + pos, data, n);
+		off += n;
+		data += n;
+		len -= n;
+	}
+	if (off > image->ringend)
+		image->ringend = off;
+
+	return 0;
+}
+
+/* Hash, and decompress, the next bytes of the file in order. */
+static int prvImageConsume(struct image_stream *image, const char *data,
+		size_t len)
+{
+	if (image->hash)
+	{
+		uint32_t tstart = port_get_current_mtime();
+		wc_Sha256Update(&image->sha, (const byte *)data, len);
+		xImageHashUs += port_get_current_mtime() - tstart;
+	}
+#if NETBOOT_CACHE
+	if (image->cache)
+		prvImageCacheWrite(image, data, len);
+#endif
+
+	if (image->format == IMAGE_LZ4 &&
+	    lz4_stream_write(&image->lz4, (const uint8_t *)data, len))
+		return 1;
+
+	image->consumed += len;
+	return 0;
+}
+
+/* Decide what the file is, once its first bytes are in the ring. */
+static int prvImageDetect(struct image_stream *image, size_t avail)
+{
+	if (lz4_stream_is_frame(image->ring))
+	{
+		printf("Decompressing LZ4 image\r\n");
+		if (lz4_stream_init(&image->lz4, prvImageOutput, image->elf))
+			return 1;
+		image->format = IMAGE_LZ4;
+		return 0;
+	}
+
+	/*
+	 * Pass on everything held so far; holes are written again when their
+	 * blocks arrive.
+	 */
+	image->format = IMAGE_ELF;
+	return prvElfStreamWrite(image->elf, 0, image->ring, image->ringend,
+	                         avail);
+}
+
+/*
+ * TFTP sink: uncompressed files go straight to the ELF loader.  The hash and
+ * the decompressor need the file in order: the next block is used where it
+ * is, and blocks after a loss are held in the ring until the gap is filled.
+ */
+static int prvImageWrite(void *ctx, size_t off, const char *data, size_t len,
+		size_t avail)
+{
+	struct image_stream *image = ctx;
+
+	if (image->format == IMAGE_ELF)
+	{
+		if (prvElfStreamWrite(image->elf, off, data, len, avail))
+			return 1;
+		if (!image->hash)
+			return 0;
+	}
+
+	if (image->format != IMAGE_UNKNOWN &&
+	    off <= image->consumed && off + len > image->consumed)
+	{
+		size_t skip = image->consumed - off;
+		if (prvImageConsume(image, data + skip, len - skip))
+			return 1;
+	}
+	else if (off + len > image->consumed)
+	{
+		if (prvImageStore(image, off, data, len))
+			return 1;
+	}
+
+	if (image->format == IMAGE_UNKNOWN)
+	{
+		if (avail < 4)
+			return 0;
+		if (prvImageDetect(image, avail))
+			return 1;
+		if (image->format == IMAGE_ELF && !image->hash)
+		{
+			vPortFree(image->ring);
+			image->ring = NULL;
+			return 0;
+		}
+	}
+
+	while (image->consumed < avail)
+	{
+		size_t pos = image->consumed % IMAGE_RING_SIZE;
+		size_t n = avail - image->consumed;
+		if (n > IMAGE_RING_SIZE - pos)
+			n = IMAGE_RING_SIZE - pos;
+		if (prvImageConsume(image, image->ring + pos, n))
+			return 1;
+	}
+
+	return 0;
+}
+
+static BaseType_t prvImageFinish(struct image_stream *image, size_t size)
+{
+	BaseType_t err = 0;
+
+	switch (image->format)
+	{
+	case IMAGE_UNKNOWN:
+		printf("Error: %s: file too short\r\n", image->elf->name);
+		err = 1;
+		break;
+	case IMAGE_ELF:
+		err = prvElfStreamFinish(image->elf, size);
+		break;
+	case IMAGE_LZ4:
+		err = lz4_stream_finish(&image->lz4);
+		if (!err)
+		{
+			printf("Decompressed %lu bytes to %lu\r\n", (unsigned long)size,
+			       (unsigned long)image->lz4.total);
+			err = prvElfStreamFinish(image->elf, image->lz4.total);
+		}
+		break;
+	}
+
+	if (!err && image->hash)
+	{
+		uint8_t digest[SHA256_DIGEST_SIZE];
+		wc_Sha256Final(&image->sha, digest);
+		if (image->verify &&
+		    (image->consumed != size ||
+		     memcmp(digest, image->digest, sizeof(digest)) != 0))
+		{
+			printf("Error: %s: SHA-256 mismatch\r\n", image->elf->name);
+			err = 1;
+		}
+		else if (image->verify)
+		{
+			printf("SHA-256 verified (%u ms hashing)\r\n",
+			       (unsigned int)(xImageHashUs / 1000));
+		}
+
+#if NETBOOT_CACHE
+		if (!err && image->cache && image->cache->open &&
+		    image->consumed == size)
+		{
+			struct netboot_cache_entry *entry = &image->cache->entry;
+			entry->size = size;
+			memcpy(entry->digest, digest, sizeof(entry->digest));
+			strncpy(entry->etag, image->cacheetag, sizeof(entry->etag) - 1);
+			if (!netboot_cache_commit(image->cache))
+				printf("Cached %s\r\n", image->elf->name);
+			image->cache = NULL;
+		}
+#endif
+	}
+	xImageHashing = false;
+
+	prvImageFree(image);
+	return err;
+}
+
+/*
+ * Receive name into stream, checking it against digest if there is one.
+ * With check, the file is also cached, unless check finds the copy already
+ * in the cache is current.
+ */
+static int prvReceiveImage(const char *host, uint16_t port, const char *name,
+		struct elf_stream *stream, char *staging, bool needentry,
+		const uint8_t *digest, struct fetch_check *check)
+{
+	struct image_stream image;
+	size_t size;
+
+	printf("Requesting %s\r\n", name);
+	prvElfStreamInit(stream, name, staging, needentry);
+	prvImageInit(&image, stream, digest);
+#if NETBOOT_CACHE
+	if (check)
+		prvImageCache(&image, &xCacheFile, xCacheSource, check->newetag);
+#endif
+
+	int err = prvFetch(host, port, name, prvImageWrite, &image, &size, check);
+	if (err == FETCH_NOT_FOUND)
+		printf("Failed to receive: %s: file not found\r\n", name);
+	if (err)
+	{
+		prvImageFree(&image);
+		return err;
+	}
+	return prvImageFinish(&image, size) ? 1 : 0;
+}
+
+#if NETBOOT_CACHE
+/* Image cache */
+
+/* Feed the cached copy in xCacheEntry to image, as if it was arriving. */
+static int prvCacheLoad(struct image_stream *image)
+{
+	char *buf = pvPortMalloc(CACHE_READ_SIZE);
+	if (!buf)
+	{
+		printf("Error: cannot allocate cache read buffer\r\n");
+		return 1;
+	}
+	if (netboot_cache_open(&xCacheFile, &xCacheEntry))
+	{
+		vPortFree(buf);
+		return 1;
+	}
+
+	uint32_t tstart = port_get_current_mtime();
+	size_t off = 0;
+	int err;
+	for (;;)
+	{
+		size_t n;
+		err = netboot_cache_read(&xCacheFile, buf, CACHE_READ_SIZE, &n);
+		if (err || n == 0)
+			break;
+		err = prvImageWrite(image, off, buf, n, off + n);
+		if (err)
+			break;
+		off += n;
+	}
+	netboot_cache_close(&xCacheFile);
+	vPortFree(buf);
+
+	if (!err && off != xCacheEntry.size)
+	{
+		printf("Error: cached %s is truncated\r\n", image->elf->name);
+		err = 1;
+	}
+	if (err)
+	{
+		prvImageFree(image);
+		return 1;
+	}
+
+	uint32_t us = port_get_current_mtime() - tstart;
+	printf("Read %lu bytes from the cache in %u ms\r\n", (unsigned long)off,
+	       (unsigned int)(us / 1000));
+	return prvImageFinish(image, off) ? 1 : 0;
+}
+
+/*
+ * Boot from the cached copy of name if it is still current: when the
+ * expected SHA-256 is known it decides, otherwise the fetch's freshness
+ * check asks the server.  Anything else is received and cached.
+ */
+static int prvGetCachedImage(const char *host, uint16_t port,
+		const char *name, struct elf_stream *stream, char *staging,
+		bool needentry, const uint8_t *digest)
+{
+	int len;
+	if (prvIsHttpUrl(name))
+		len = snprintf(xCacheSource, sizeof(xCacheSource), "%s", name);
+	else if (host)
+		len = snprintf(xCacheSource, sizeof(xCacheSource), "tftp://%s:%u/%s",
+		               host, (unsigned int)port, name);
+	else
+		len = -1;
+	if (len < 0 || (size_t)len >= sizeof(xCacheSource))
+		return prvReceiveImage(host, port, name, stream, staging, needentry,
+		                       digest, NULL);
+
+	memset(&xCacheCheck, 0, sizeof(xCacheCheck));
+	bool current = false;
+	if (!netboot_cache_lookup(xCacheSource, &xCacheEntry))
+	{
+		if (digest)
+		{
+			current = !memcmp(xCacheEntry.digest, digest,
+			                  sizeof(xCacheEntry.digest));
+			if (!current)
+				printf("Cached copy of %s is out of date\r\n", name);
+		}
+		else
+		{
+			xCacheCheck.have = true;
+			xCacheCheck.size = xCacheEntry.size;
+			xCacheCheck.etag = xCacheEntry.etag;
+		}
+	}
+
+	if (!current)
+	{
+		int err = prvReceiveImage(host, port, name, stream, staging,
+		                          needentry, digest, &xCacheCheck);
+		if (err != FETCH_NOT_MODIFIED)
+			return err;
+		printf("%s has not changed\r\n", name);
+		if (xCacheCheck.sizeonly)
+			printf("Warning: only the size of %s was checked, a rebuilt file "
+			       "of the same size boots stale; use -m for a digest\r\n",
+			       name);
+	}
+
+	struct image_stream image;
+	printf("Loading %s from the cache\r\n", name);
+	prvElfStreamInit(stream, name, staging, needentry);
+	/* Without a manifest digest, check the one stored with the copy */
+	prvImageInit(&image, stream, digest ? digest : xCacheEntry.digest);
+	if (!prvCacheLoad(&image))
+		return 0;
+
+	printf("Dropping cached copy of %s\r\n", name);
+	netboot_cache_remove(xCacheSource);
+	memset(&xCacheCheck, 0, sizeof(xCacheCheck));
+	return prvReceiveImage(host, port, name, stream, staging, needentry,
+	                       digest, &xCacheCheck);
+}
+#endif
+
+/* Checksum files */
+
+struct buffer_sink
+{
+	char *buf;
+	size_t size;
+};
+
+static int prvBufferWrite(void *ctx, size_t off, const char *data, size_t len,
+		size_t avail)
+{
+	struct buffer_sink *sink = ctx;
+	(void)avail;
+
+	if (off + len >= sink->size)
+	{
+		printf("Error: checksum file too large\r\n");
+		return 1;
+	}
+	memcpy(sink->buf + off, data, len);
+	return 0;
+}
+
+static int prvHexDigit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static const char *prvBaseName(const char *path, size_t len, size_t *baselen)
+{
+	size_t start = len;
+	while (start && path[start - 1] != '/')
+		--start;
+	*baselen = len - start;
+	return path + start;
+}
+
+/*
+ * Find the digest for name in sha256sum output: lines of 64 hex digits, then
+ * a space and an optional '*', then the file name.  Names match if they are
+ * equal or have the same last component.  With anyname, a file with a single
+ * line matches whatever it names.
+ */
+static bool prvFindDigest(const char *text, const char *name, bool anyname,
+		uint8_t *digest)
+{
+	size_t namebaselen;
+	const char *namebase = prvBaseName(name, strlen(name), &namebaselen);
+	uint8_t found[SHA256_DIGEST_SIZE];
+	int lines = 0;
+
+	while (*text)
+	{
+		const char *eol = strchr(text, '\n');
+		if (!eol)
+			eol = text + strlen(text);
+
+		size_t i;
+		for (i = 0; i < 2 * SHA256_DIGEST_SIZE; ++i)
+		{
+			int hi = prvHexDigit(text[i]);
+			if (hi < 0)
+				break;
+			if (i % 2)
+				found[i / 2] = (uint8_t)(found[i / 2] << 4 | hi);
+			else
+				found[i / 2] = (uint8_t)hi;
+		}
+
+		if (i == 2 * SHA256_DIGEST_SIZE && (text[i] == ' ' || text[i] == '\t'))
+		{
+			const char *entry = text + i;
+			while (*entry == ' ' || *entry == '\t' || *entry == '*')
+				++entry;
+			size_t entrylen = eol - entry;
+			if (entrylen && entry[entrylen - 1] == '\r')
+				--entrylen;
+
+			size_t entrybaselen;
+			const char *entrybase = prvBaseName(entry, entrylen, &entrybaselen);
+			if ((entrylen == strlen(name) && !memcmp(entry, name, entrylen)) ||
+			    (entrybaselen == namebaselen &&
+			     !memcmp(entrybase, namebase, namebaselen)))
+			{
+				memcpy(digest, found, sizeof(found));
+				return true;
+			}
+			if (!lines++)
+				memcpy(digest, found, sizeof(found));
+		}
+
+		text = *eol ? eol + 1 : eol;
+	}
+
+	return anyname && lines == 1;
+}
+
+/*
+ * Fetch a checksum file into a new buffer.  Returns FETCH_NOT_FOUND if the
+ * server does not have it.
+ */
+static int prvGetChecksumFile(const char *host, uint16_t port,
+		const char *name, char **text)
+{
+	struct buffer_sink sink;
+	size_t size;
+
+	sink.size = SHA256_FILE_MAX;
+	sink.buf = pvPortMalloc(sink.size);
+	if (!sink.buf)
+	{
+		printf("Error: cannot allocate checksum buffer\r\n");
+		return 1;
+	}
+
+	int err = prvFetch(host, port, name, prvBufferWrite, &sink, &size, NULL);
+	if (err)
+	{
+		vPortFree(sink.buf);
+		return err;
+	}
+
+	sink.buf[size] = '\0';
+	*text = sink.buf;
+	return 0;
+}
+
+/* Progress reports */
+
+static void prvReportProgress(size_t bytes, uint32_t us)
+{
+	size_t scaledbytes = bytes;
+	const char *units = "B";
+	if (scaledbytes > 1024*1024)
+	{
+		scaledbytes >>= 20;
+		units = "MiB";
+	}
+	else if (scaledbytes > 1024)
+	{
+		scaledbytes >>= 10;
+		units = "KiB";
+	}
+
+	printf("Received %lu %s so far in %us",
+	       (unsigned long)scaledbytes, units, (unsigned int)(us / 1000000));
+	if (xImageHashing)
+		printf(" (SHA-256: %u ms)", (unsigned int)(xImageHashUs / 1000));
+	printf("\r\n");
+}
+
+/* Transports */
+
+static bool prvIsHttpUrl(const char *name)
+{
+	return strncmp(name, "http://", 7) == 0;
+}
+
+/* Fetch name by TFTP from host, or by HTTP if it is a URL. */
+static int prvFetch(const char *host, uint16_t port, const char *name,
+                    tftp_sink_type sink, void *ctx, size_t *size,
+                    struct fetch_check *check)
+{
+	if (prvIsHttpUrl(name))
+		return prvHttpReceive(name, sink, ctx, size, check);
+
+	if (!host)
+	{
+		printf("Error: %s: not an http:// URL\r\n", name);
+		return 1;
+	}
+	return prvTftpReceive(host, port, name, sink, ctx, size, check);
+}
+
+/* HTTP implementation */
+
+static int prvHttpSend(Socket_t sock, const char *buf, size_t len)
+{
+	while (len)
+	{
+		BaseType_t sent = FreeRTOS_send(sock, buf, len, 0);
+		if (sent <= 0)
+		{
+			printf("Failed to send request: FreeRTOS_send returned %ld\r\n",
+			       (long)sent);
+			return 1;
+		}
+		buf += sent;
+		len -= sent;
+	}
+	return 0;
+}
+
+/*
+ * Check the status line and find Content-Length in a complete response
+ * header.  *length is left alone if there is none.  With check, the ETag is
+ * kept and FETCH_NOT_MODIFIED returned if the copy checked is current.
+ */
+static int prvHttpParseHeader(const char *url, char *header, size_t *length,
+                              struct fetch_check *check)
+{
+	unsigned int status;
+	if (sscanf(header, "HTTP/%*u.%*u %u", &status) != 1)
+	{
+		printf("Failed to receive: %s: bad HTTP response\r\n", url);
+		return 1;
+	}
+	if (status == 404)
+		return FETCH_NOT_FOUND;
+	if (status == 304 && check && check->have)
+		return FETCH_NOT_MODIFIED;
+	if (status != 200)
+	{
+		char *eol = strchr(header, '\r');
+		if (eol)
+			*eol = '\0';
+		printf("Failed to receive: %s: %s\r\n", url, header);
+		return 1;
+	}
+
+	for (char *line = strchr(header, '\n'); line; line = strchr(line, '\n'))
+	{
+		++line;
+		if (!strncasecmp(line, "Content-Length:", 15))
+			*length = strtoul(line + 15, NULL, 10);
+		else if (!strncasecmp(line, "Transfer-Encoding:", 18))
+		{
+			printf("Failed to receive: %s: unsupported transfer encoding\r\n",
+			       url);
+			return 1;
+		}
+		else if (check && !strncasecmp(line, "ETag:", 5))
+		{
+			const char *etag = line + 5 + strspn(line + 5, " \t");
+			size_t etaglen = strcspn(etag, "\r\n");
+			if (etaglen < sizeof(check->newetag))
+			{
+				memcpy(check->newetag, etag, etaglen);
+				check->newetag[etaglen] = '\0';
+			}
+		}
+	}
+
+	/* Servers that ignore If-None-Match, or send no ETag at all */
+	if (check && check->have)
+	{
+		if (check->etag && *check->etag)
+		{
+			if (!strcmp(check->newetag, check->etag))
+				return FETCH_NOT_MODIFIED;
+		}
+		else if (!*check->newetag && *length == check->size)
+		{
+			check->sizeonly = true;
+			return FETCH_NOT_MODIFIED;
+		}
+	}
+	return 0;
+}
+
+static int prvHttpReceive(const char *url, tftp_sink_type sink, void *ctx,
+                          size_t *size, struct fetch_check *check)
+{
+	/* http://host[:port][/path] */
+	const char *hoststart = url + 7;
+	size_t hostlen = strcspn(hoststart, ":/");
+	const char *path = hoststart + hostlen;
+	unsigned long port = HTTP_PORT;
+	if (*path == ':')
+	{
+		char *end;
+		port = strtoul(path + 1, &end, 10);
+		if (port == 0 || port > UINT16_MAX || (*end && *end != '/'))
+		{
+			printf("Error: %s: bad port\r\n", url);
+			return 1;
+		}
+		path = end;
+	}
+	if (!*path)
+		path = "/";
+	if (hostlen == 0 || hostlen >= HTTP_HOST_MAX)
+	{
+		printf("Error: %s: bad host\r\n", url);
+		return 1;
+	}
+	char host[HTTP_HOST_MAX];
+	memcpy(host, hoststart, hostlen);
+	host[hostlen] = '\0';
+
+	struct freertos_sockaddr addr;
+	addr.sin_addr = FreeRTOS_inet_addr(host);
+#if ipconfigUSE_DNS
+	if (!addr.sin_addr)
+		addr.sin_addr = FreeRTOS_gethostbyname(host);
+#endif
+	if (!addr.sin_addr)
+	{
+		printf("Cannot resolve %s\r\n", host);
+		return 1;
+	}
+	addr.sin_port = FreeRTOS_htons(port);
+
+	Socket_t sock = FreeRTOS_socket(FREERTOS_AF_INET, FREERTOS_SOCK_STREAM,
+	                                FREERTOS_IPPROTO_TCP);
+	if (sock == FREERTOS_INVALID_SOCKET)
+	{
+		printf("Failed to create socket\r\n");
+		return 1;
+	}
+
+	TickType_t timeout = pdMS_TO_TICKS(HTTP_TIMEOUT_MS);
+	FreeRTOS_setsockopt(sock, 0, FREERTOS_SO_RCVTIMEO, &timeout, sizeof(timeout));
+	FreeRTOS_setsockopt(sock, 0, FREERTOS_SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	/* Large receive buffer and window; the request is the only thing sent */
+	WinProperties_t winprops;
+	memset(&winprops, 0, sizeof(winprops));
+	winprops.lTxBufSize = 2 * ipconfigTCP_MSS;
+	winprops.lTxWinSize = 1;
+	winprops.lRxBufSize = HTTP_RX_BUFSIZE;
+	winprops.lRxWinSize = HTTP_RX_WINSIZE;
+	FreeRTOS_setsockopt(sock, 0, FREERTOS_SO_WIN_PROPERTIES, &winprops,
+	                    sizeof(winprops));
+
+	int err = 1;
+	char *header = NULL;
+	BaseType_t ret = FreeRTOS_connect(sock, &addr, sizeof(addr));
+	if (ret != 0)
+	{
+		printf("Failed to connect to %s: %ld\r\n", host, (long)ret);
+		goto out;
+	}
+
+	/* HTTP/1.0, so that the body is neither chunked nor kept alive */
+	header = pvPortMalloc(HTTP_HEADER_MAX);
+	if (!header)
+	{
+		printf("Error: cannot allocate HTTP header buffer\r\n");
+		goto out;
+	}
+	const char *etag = "";
+	if (check && check->have && check->etag && *check->etag)
+		etag = check->etag;
+	int reqlen = snprintf(header, HTTP_HEADER_MAX,
+	                      "GET %s HTTP/1.0\r\nHost: %s\r\n"
+	                      "User-Agent: GFEBoot\r\n%s%s%s\r\n", path, host,
+	                      *etag ? "If-None-Match: " : "", etag,
+	                      *etag ? "\r\n" : "");
+	if (reqlen < 0 || reqlen >= HTTP_HEADER_MAX)
+	{
+		printf("Error: %s: URL too long\r\n", url);
+		goto out;
+	}
+	if (prvHttpSend(sock, header, reqlen))
+		goto out;
+
+	/* Read up to the end of the response header */
+	size_t headerlen = 0;
+	char *body = NULL;
+	while (!body)
+	{
+		if (headerlen == HTTP_HEADER_MAX - 1)
+		{
+			printf("Failed to receive: %s: response header too long\r\n", url);
+			goto out;
+		}
+		BaseType_t n = FreeRTOS_recv(sock, header + headerlen,
+		                             HTTP_HEADER_MAX - 1 - headerlen, 0);
+		if (n <= 0)
+		{
+			printf("Failed to receive: %s: no response (%ld)\r\n", url,
+			       (long)n);
+			goto out;
+		}
+		headerlen += n;
+		header[headerlen] = '\0';
+		body = strstr(header, "\r\n\r\n");
+	}
+	body += 4;
+	/* The header parser must not run into body bytes that came with it */
+	body[-2] = '\0';
+
+	size_t length = SIZE_MAX;
+	err = prvHttpParseHeader(url, header, &length, check);
+	if (err)
+		goto out;
+	err = 1;
+
+	printf("Transfer started (HTTP, window %u segments)\r\n",
+	       (unsigned int)HTTP_RX_WINSIZE);
+
+	/* Whatever of the body came with the header */
+	size_t off = header + headerlen - body;
+	if (off && sink(ctx, 0, body, off, off))
+		goto out;
+
+	uint32_t tstart = port_get_current_mtime();
+	uint32_t tprev = tstart;
+	while (off < length)
+	{
+		/* Zero copy: the sink reads straight from the socket's stream */
+		uint8_t *data;
+		BaseType_t n = FreeRTOS_recv(sock, &data, length - off,
+		                             FREERTOS_ZERO_COPY);
+		uint32_t tcur = port_get_current_mtime();
+		if (tcur - tprev > 5000000)
+		{
+			prvReportProgress(off, tcur - tstart);
+			tprev = tcur;
+		}
+
+		if (n == -pdFREERTOS_ERRNO_ENOTCONN && length == SIZE_MAX)
+			break;
+		if (n <= 0)
+		{
+			printf("Failed to receive: %s: FreeRTOS_recv returned %ld after %lu bytes\r\n",
+			       url, (long)n, (unsigned long)off);
+			goto out;
+		}
+		/* Zero copy returns all that is contiguous in the stream */
+		if ((size_t)n > length - off)
+			n = length - off;
+
+		int sinkerr = sink(ctx, off, (const char *)data, n, off + n);
+		/* Release the data from the stream */
+		FreeRTOS_recv(sock, NULL, n, 0);
+		if (sinkerr)
+			goto out;
+		off += n;
+	}
+
+	uint32_t us = port_get_current_mtime() - tstart;
+	printf("Finished receiving %lu bytes in %u ms\r\n", (unsigned long)off,
+	       (unsigned int)(us / 1000));
+	*size = off;
+	err = 0;
+
+out:
+	vPortFree(header);
+	FreeRTOS_shutdown(sock, FREERTOS_SHUT_RDWR);
+	FreeRTOS_closesocket(sock);
+	return err;
+}
+
+/* TFTP implementation */
+
+/* Window size to request; adapted to the loss seen by previous transfers. */
+static uint16_t xTftpWinsize = TFTP_INIT_WINSIZE;
+
+static void prvTftpBitSet(struct tftp_client_state *state, uint16_t off)
+{
+	state->winbits[off / 32] |= 1UL << (off % 32);
+}
+
+static bool prvTftpBitsEmpty(const struct tftp_client_state *state)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(state->winbits); ++i)
+	{
+		if (state->winbits[i])
+			return false;
+	}
+	return true;
+}
+
+/* Number of blocks received in sequence from the start of the window. */
+static uint16_t prvTftpBitsContiguous(const struct tftp_client_state *state)
+{
+	uint16_t n = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(state->winbits); ++i)
+	{
+		if (state->winbits[i] != 0xffffffffUL)
+			return n + __builtin_ctz(~state->winbits[i]);
+		n += 32;
+	}
+	return n;
+}
+
+/*
+ * Move the window on by n blocks.  Blocks already received beyond the new
+ * start (after a loss) are kept.
+ */
+static void prvTftpBitsShift(struct tftp_client_state *state, uint16_t n)
+{
+	const size_t words = ARRAY_SIZE(state->winbits);
+	size_t wshift = n / 32;
+	unsigned int bshift = n % 32;
+
+	for (size_t i = 0; i < words; ++i)
+	{
+		uint32_t lo = i + wshift < words ? state->winbits[i + wshift] : 0;
+		uint32_t hi = i + wshift + 1 < words ? state->winbits[i + wshift + 1] : 0;
+		state->winbits[i] = bshift ? (lo >> bshift) | (hi << (32 - bshift)) : lo;
+	}
+}
+
+/* Number of bytes in the first n blocks of the window. */
+static size_t prvTftpWindowBytes(const struct tftp_client_state *state, uint16_t n)
+{
+	uint16_t lastoff = state->lastblock - state->winstart;
+	if (state->havelast && lastoff < n)
+		return (size_t)lastoff * state->blksize + state->lastsize;
+	return (size_t)n * state->blksize;
+}
+
+/* Number of blocks in the current window, less if it holds the last block. */
+static uint16_t prvTftpWindowBlocks(const struct tftp_client_state *state)
+{
+	uint16_t lastoff = state->lastblock - state->winstart;
+	if (state->havelast && lastoff < state->winsize)
+		return lastoff + 1;
+	return state->winsize;
+}
+
+static void prvTftpSetTimeout(struct tftp_client_state *state, uint32_t rto)
+{
+	if (rto < TFTP_MIN_TIMEOUT_MS * 1000)
+		rto = TFTP_MIN_TIMEOUT_MS * 1000;
+	if (rto > TFTP_MAX_TIMEOUT_MS * 1000)
+		rto = TFTP_MAX_TIMEOUT_MS * 1000;
+	if (rto == state->rto)
+		return;
+	state->rto = rto;
+
+	TickType_t timeout = pdMS_TO_TICKS(rto / 1000);
+	if (timeout == 0)
+		timeout = 1;
+	FreeRTOS_setsockopt(state->sock, 0, FREERTOS_SO_RCVTIMEO, (void *)&timeout,
+	                    sizeof(timeout));
+}
+
+/*
+ * Update the round trip estimate with the time from an ACK to the first DATA of
+ * the next window (RFC 6298 weights).
+ */
+static void prvTftpRttSample(struct tftp_client_state *state, uint32_t tcur)
+{
+	uint32_t rtt = tcur - state->acktime;
+	state->timing = 0;
+
+	if (state->srtt == 0)
+	{
+		state->srtt = rtt;
+		state->rttvar = rtt / 2;
+	}
+	else
+	{
+		uint32_t err = rtt > state->srtt ? rtt - state->srtt : state->srtt - rtt;
+		state->rttvar = state->rttvar - state->rttvar / 4 + err / 4;
+		state->srtt = state->srtt - state->srtt / 8 + rtt / 8;
+	}
+	prvTftpSetTimeout(state, state->srtt + 4 * state->rttvar);
+}
+
+static void prvTftpClose(struct tftp_client_state *state)
+{
+	FreeRTOS_closesocket(state->sock);
+	if (state->multicast)
+	{
+		FreeRTOS_closesocket(state->group);
+		FreeRTOS_DeleteSocketSet(state->set);
+	}
+}
+
+static void prvTftpTerminate(struct tftp_client_state *state, uint16_t code, char *message)
+{
+	if (state->recvpacket)
+	{
+		FreeRTOS_ReleaseUDPPayloadBuffer(state->recvpacket);
+		state->recvpacket = NULL;
+	}
+
+	size_t mlen = strlen(message);
+	size_t plen = sizeof(struct tftp_error) + mlen + 1;
+	struct tftp_error *packet = pvPortMalloc(plen);
+	memset(packet, 0, sizeof(*packet));
+	packet->header.op = FreeRTOS_htons(TFTP_OP_ERROR);
+	packet->code = FreeRTOS_htons(code);
+	strcpy(packet->message, message);
+	FreeRTOS_sendto(state->sock, packet, plen, 0, &state->dstaddr,
+	                state->dstaddrlen);
+	vPortFree(packet);
+	prvTftpClose(state);
+}
+
+static int prvTftpRrq(struct tftp_client_state *state, const char *name)
+{
+	size_t namelen = strlen(name) + 1;
+	const char *mode = "octet";
+	size_t modelen = strlen(mode) + 1;
+	char options[64];
+	size_t optionslen = 0;
+
+	if (!state->winsize)
+	{
+		/* snprintf() stops at the embedded NULs, so add each part */
+		optionslen += sprintf(options + optionslen, "blksize") + 1;
+		optionslen += sprintf(options + optionslen, "%u", (unsigned int)TFTP_MAX_BLKSIZE) + 1;
+		optionslen += sprintf(options + optionslen, "windowsize") + 1;
+		optionslen += sprintf(options + optionslen, "%u", (unsigned int)xTftpWinsize) + 1;
+		/* Ask for the size, to compare with the copy being checked */
+		if (state->check && state->check->have)
+		{
+			optionslen += sprintf(options + optionslen, "tsize") + 1;
+			optionslen += sprintf(options + optionslen, "0") + 1;
+		}
+		if (xTftpMulticast)
+		{
+			optionslen += sprintf(options + optionslen, "multicast") + 1;
+			options[optionslen++] = '\0';
+		}
+	}
+	size_t plen = sizeof(struct tftp_xrq) + namelen + modelen + optionslen;
+
+	if (state->retries == TFTP_MAX_RETRIES)
+	{
+		printf("Failed to receive: RRQ retry limit exceeded\r\n");
+		prvTftpTerminate(state, 0, "Retry limit exceeded");
+		return 1;
+	}
+	else
+	{
+		++state->retries;
+	}
+
+	struct tftp_xrq *packet = pvPortMalloc(plen);
+	memset(packet, 0, sizeof(*packet));
+	packet->header.op = FreeRTOS_htons(TFTP_OP_RRQ);
+	char *buf = packet->request;
+	memcpy(buf, name, namelen);
+	buf += namelen;
+	memcpy(buf, mode, modelen);
+	buf += modelen;
+	memcpy(buf, options, optionslen);
+
+	long err;
+	err = FreeRTOS_sendto(state->sock, packet, plen, 0, &state->dstaddr,
+	                      state->dstaddrlen);
+	vPortFree(packet);
+	state->acktime = port_get_current_mtime();
+	state->timing = state->retries == 1;
+	if (err != (long)plen)
+	{
+		printf("Failed to send RRQ: FreeRTOS_sendto returned %ld != %ld\r\n",
+		       err, (unsigned long)plen);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int prvTftpAck(struct tftp_client_state *state)
+{
+	uint16_t numack = prvTftpBitsContiguous(state);
+	uint16_t winlast = state->winstart + numack - 1;
+
+	if (numack)
+	{
+		state->winpos += prvTftpWindowBytes(state, numack);
+		prvTftpBitsShift(state, numack);
+		state->winstart += numack;
+		state->retries = 0;
+		++state->windows;
+		/* Karn: only time ACKs that are not retransmissions */
+		state->timing = 1;
+	}
+	else if (state->retries == TFTP_MAX_RETRIES)
+	{
+		printf("Failed to receive: ACK retry limit exceeded\r\n");
+		prvTftpTerminate(state, 0, "Retry limit exceeded");
+		return 1;
+	}
+	else
+	{
+		++state->retries;
+		state->timing = 0;
+	}
+	state->acktime = port_get_current_mtime();
+
+	/* Only the master client of a multicast transfer ACKs */
+	if (state->multicast && !state->master)
+		return 0;
+
+	size_t plen = sizeof(struct tftp_ack);
 	struct tftp_ack packet;
 	memset(&packet, 0, plen);
 	packet.header.op = FreeRTOS_htons(TFTP_OP_ACK);
@@ -717,10 +2469,197 @@ static int prvTftpAck(struct tftp_client_state *state)
 	return 0;
 }
 
-static int prvTftpReceive(const char *host, uint16_t port, const char *name, char *buf, size_t *size)
+/*
+ * Parse the RFC 2090 multicast option, "addr,port,mc".  Only the first OACK
+ * has to give the address and port; *addr is 0 if they are left out.
+ */
+static int prvTftpParseMulticast(const char *val, uint32_t *addr,
+		uint16_t *port, bool *master)
+{
+	const char *comma = strchr(val, ',');
+	const char *comma2 = comma ? strchr(comma + 1, ',') : NULL;
+	if (!comma2 || (comma2[1] != '0' && comma2[1] != '1') || comma2[2])
+		return 1;
+	*master = comma2[1] == '1';
+
+	*addr = 0;
+	*port = 0;
+	if (comma == val && comma2 == comma + 1)
+		return 0;
+
+	char buf[16];
+	size_t len = comma - val;
+	if (len >= sizeof(buf))
+		return 1;
+	memcpy(buf, val, len);
+	buf[len] = '\0';
+	*addr = FreeRTOS_inet_addr(buf);
+
+	char *end;
+	unsigned long p = strtoul(comma + 1, &end, 10);
+	if (!*addr || end != comma2 || p == 0 || p > UINT16_MAX)
+		return 1;
+	*port = p;
+	return 0;
+}
+
+/*
+ * Listen on the group the server multicasts to.  FreeRTOS+TCP only passes up
+ * IP broadcasts, not multicasts, so the server has to be set up to use the
+ * subnet (or the limited) broadcast address as its group.
+ */
+static int prvTftpJoin(struct tftp_client_state *state, uint32_t addr,
+		uint16_t port)
+{
+	uint32_t ip, mask, gateway, dns;
+	char buf[16];
+
+	FreeRTOS_GetAddressConfiguration(&ip, &mask, &gateway, &dns);
+	if (addr != 0xffffffffUL && addr != (ip | ~mask))
+	{
+		FreeRTOS_inet_ntoa(addr, buf);
+		printf("Failed to receive: multicast group %s is not a broadcast address\r\n",
+		       buf);
+		return 1;
+	}
+
+	state->group = FreeRTOS_socket(FREERTOS_AF_INET, FREERTOS_SOCK_DGRAM,
+	                               FREERTOS_IPPROTO_UDP);
+	if (state->group == FREERTOS_INVALID_SOCKET)
+	{
+		printf("Failed to create socket\r\n");
+		return 1;
+	}
+	state->set = FreeRTOS_CreateSocketSet();
+	if (!state->set)
+	{
+		printf("Failed to create socket set\r\n");
+		FreeRTOS_closesocket(state->group);
+		return 1;
+	}
+
+	struct freertos_sockaddr groupaddr;
+	memset(&groupaddr, 0, sizeof(groupaddr));
+	groupaddr.sin_port = FreeRTOS_htons(port);
+	if (FreeRTOS_bind(state->group, &groupaddr, sizeof(groupaddr)) != 0)
+	{
+		printf("Failed to receive: cannot bind multicast port %u\r\n",
+		       (unsigned int)port);
+		FreeRTOS_closesocket(state->group);
+		FreeRTOS_DeleteSocketSet(state->set);
+		return 1;
+	}
+	FreeRTOS_FD_SET(state->sock, state->set, eSELECT_READ);
+	FreeRTOS_FD_SET(state->group, state->set, eSELECT_READ);
+
+	state->multicast = 1;
+	FreeRTOS_inet_ntoa(addr, buf);
+	printf("Joined multicast group %s port %u\r\n", buf, (unsigned int)port);
+	return 0;
+}
+
+/*
+ * Receive from the server or, during a multicast transfer, from the group.
+ * Returns as FreeRTOS_recvfrom() does.
+ */
+static long prvTftpRecv(struct tftp_client_state *state, void *packet,
+		struct freertos_sockaddr *srcaddr, socklen_t *srcaddrlen)
+{
+	if (!state->multicast)
+		return FreeRTOS_recvfrom(state->sock, packet, 0, FREERTOS_ZERO_COPY,
+		                         srcaddr, srcaddrlen);
+
+	TickType_t timeout = pdMS_TO_TICKS(state->rto / 1000);
+	if (timeout == 0)
+		timeout = 1;
+	if (FreeRTOS_select(state->set, timeout) == 0)
+		return -pdFREERTOS_ERRNO_EWOULDBLOCK;
+
+	long n = FreeRTOS_recvfrom(state->sock, packet, 0,
+	                           FREERTOS_ZERO_COPY | FREERTOS_MSG_DONTWAIT,
+	                           srcaddr, srcaddrlen);
+	if (n == -pdFREERTOS_ERRNO_EWOULDBLOCK)
+		n = FreeRTOS_recvfrom(state->group, packet, 0,
+		                      FREERTOS_ZERO_COPY | FREERTOS_MSG_DONTWAIT,
+		                      srcaddr, srcaddrlen);
+	return n;
+}
+
+/*
+ * Blocks of a window that are taken.  A multicast client keeps everything up
+ * to the size of the bitmap, whoever asked for it; what it misses it asks for
+ * when it becomes the master.
+ */
+static uint16_t prvTftpReach(const struct tftp_client_state *state)
+{
+	return state->multicast ? TFTP_MAX_WINSIZE : state->winsize;
+}
+
+/*
+ * Later OACKs of a multicast transfer say who the master is.  A new master
+ * ACKs the last block it has in order, and the server goes on from there.
+ */
+static int prvTftpMulticastOack(struct tftp_client_state *state, char *opt,
+		const char *end)
+{
+	while (opt < end)
+	{
+		char *val = opt + strlen(opt) + 1;
+		if (val >= end)
+			break;
+		if (!strcmp(opt, "multicast"))
+		{
+			uint32_t addr;
+			uint16_t port;
+			bool master;
+			if (prvTftpParseMulticast(val, &addr, &port, &master))
+			{
+				printf("Failed to receive: OACK option %s has bad value %s\r\n",
+				       opt, val);
+				prvTftpTerminate(state, 0, "Option has bad value");
+				return 1;
+			}
+			if (!master)
+			{
+				state->master = 0;
+				return 0;
+			}
+			if (!state->master)
+			{
+				state->master = 1;
+				state->retries = 0;
+			}
+			return prvTftpAck(state);
+		}
+		opt = val + strlen(val) + 1;
+	}
+	return 0;
+}
+
+/* Pick the window size to ask for next time, from the loss seen in this one. */
+static void prvTftpAdaptWinsize(const struct tftp_client_state *state)
+{
+	if (state->losses * TFTP_LOSS_WINDOWS > state->windows)
+	{
+		if (xTftpWinsize / 2 >= TFTP_MIN_WINSIZE)
+			xTftpWinsize /= 2;
+	}
+	else if (state->losses == 0 && state->winsize == xTftpWinsize)
+	{
+		if (xTftpWinsize * 2 <= TFTP_MAX_WINSIZE)
+			xTftpWinsize *= 2;
+	}
+}
+
+static int prvTftpReceive(const char *host, uint16_t port, const char *name,
+                          tftp_sink_type sink, void *ctx, size_t *size,
+                          struct fetch_check *check)
 {
 	struct tftp_client_state state;
 	memset(&state, 0, sizeof(state));
+	state.sink = sink;
+	state.sinkctx = ctx;
+	state.check = check;
 
 	state.dstaddr.sin_addr = FreeRTOS_inet_addr(host);
 	if (!state.dstaddr.sin_addr)
@@ -740,10 +2679,10 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 	}
 
 	BaseType_t timeout = pdMS_TO_TICKS(1000);
-	FreeRTOS_setsockopt(state.sock, 0, FREERTOS_SO_RCVTIMEO, (void *)&timeout,
-	                    sizeof(BaseType_t));
 	FreeRTOS_setsockopt(state.sock, 0, FREERTOS_SO_SNDTIMEO, (void *)&timeout,
 	                    sizeof(BaseType_t));
+	/* Until there is an RTT sample */
+	prvTftpSetTimeout(&state, TFTP_MAX_TIMEOUT_MS * 1000);
 
 	/* First DATA is block 1. */
 	state.winstart = 1;
@@ -764,30 +2703,13 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 		} *upacket;
 		struct freertos_sockaddr srcaddr;
 		socklen_t srcaddrlen = sizeof(srcaddr);
-		long fromlen = FreeRTOS_recvfrom(state.sock, &upacket, 0,
-		                                 FREERTOS_ZERO_COPY, &srcaddr,
-		                                 &srcaddrlen);
-		if (state.winbuf)
+		long fromlen = prvTftpRecv(&state, &upacket, &srcaddr, &srcaddrlen);
+		uint32_t tcur = port_get_current_mtime();
+		if (state.started)
 		{
-			uint32_t tcur = port_get_current_mtime();
 			if (tcur - tprev > 5000000)
 			{
-				size_t scaledbytes = (size_t)(state.winbuf - buf);
-				const char *units = "B";
-				if (scaledbytes > 1024*1024)
-				{
-					scaledbytes >>= 20;
-					units = "MiB";
-				}
-				else if (scaledbytes > 1024)
-				{
-					scaledbytes >>= 10;
-					units = "KiB";
-				}
-
-				printf("Received %lu %s so far in %us\r\n",
-				       (unsigned long)scaledbytes, units,
-				       (unsigned int)((tcur - tstart) / 1000000));
+				prvReportProgress(state.winpos, tcur - tstart);
 				tprev = tcur;
 			}
 		}
@@ -800,8 +2722,19 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 				prvTftpTerminate(&state, 0, "Error in FreeRTOS_recvfrom");
 				return 1;
 			}
-			/* Timed out */
-			if (!state.pastrrq)
+			/* Timed out: back off, the estimate was too low */
+			prvTftpSetTimeout(&state, state.rto * 2);
+			if (state.multicast && !state.master)
+			{
+				/* Another client is master; wait, but not forever */
+				if (++state.retries > TFTP_MCAST_RETRIES)
+				{
+					printf("Failed to receive: no data from multicast group\r\n");
+					prvTftpTerminate(&state, 0, "No data");
+					return 1;
+				}
+			}
+			else if (!state.pastrrq)
 			{
 				/* Still trying to initiate a request */
 				if (prvTftpRrq(&state, name))
@@ -809,6 +2742,7 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 			}
 			else
 			{
+				++state.losses;
 				if (prvTftpAck(&state))
 					return 1;
 			}
@@ -846,7 +2780,9 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 			return 1;
 		}
 
-		buf[fromlen] = '\0';
+		/* Terminate strings in the packet (the union has room for this) */
+		if (fromlen <= (long)(sizeof(upacket->buf) - 1))
+			upacket->buf[fromlen] = '\0';
 		switch (FreeRTOS_ntohs(upacket->header.op))
 		{
 		case TFTP_OP_ERROR:
@@ -857,6 +2793,13 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 				prvTftpTerminate(&state, 0, "Error packet too short");
 				return 1;
 			}
+			if (FreeRTOS_ntohs(upacket->error.code) == TFTP_ERR_NOT_FOUND)
+			{
+				/* Reported by the caller */
+				FreeRTOS_ReleaseUDPPayloadBuffer(upacket);
+				prvTftpClose(&state);
+				return FETCH_NOT_FOUND;
+			}
 			if (!state.winsize)
 			{
 				/* Old servers might reject RRQ with options; try without */
@@ -872,17 +2815,28 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 			}
 			printf("Failed to receive: server code %d: %s\r\n",
 			       FreeRTOS_ntohs(upacket->error.code), upacket->error.message);
+			FreeRTOS_ReleaseUDPPayloadBuffer(upacket);
+			prvTftpClose(&state);
 			return 1;
 		default:
 			/* Ignore unknown packets for forwards compatibility */
 			break;
 		case TFTP_OP_OACK:
 		{
+			/* During a multicast transfer, OACKs hand out the master role */
+			if (state.multicast)
+			{
+				if (prvTftpMulticastOack(&state, upacket->oack.data,
+				                         upacket->buf + fromlen))
+					return 1;
+				break;
+			}
+
 			/*
 			 * Ignore if we've received data packets already; OACK never sent
 			 * after DATA
 			 */
-			if (state.winbuf)
+			if (state.started)
 				break;
 
 			if (state.winsize)
@@ -890,11 +2844,22 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 				/* Duplicate; retry ACK */
 				if (prvTftpAck(&state))
 					return 1;
+				break;
 			}
 
+			/* The RRQ to OACK time is the first RTT sample */
+			if (state.timing)
+				prvTftpRttSample(&state, tcur);
+
 			/* Default values in case server drops our options */
 			uint16_t winsize = 1;
 			uint16_t blksize = 512;
+			bool havetsize = false;
+			size_t tsize = 0;
+			bool havemcast = false;
+			bool mcmaster = false;
+			uint32_t mcaddr = 0;
+			uint16_t mcport = 0;
 			/* Parse options from server */
 			char *opt = upacket->oack.data;
 			while (opt < upacket->buf + fromlen)
@@ -935,6 +2900,22 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 					if (blksize < 8)
 						goto bad_val;
 				}
+				else if (!strcmp(opt, "tsize"))
+				{
+					char *end;
+					errno = 0;
+					tsize = strtoul(val, &end, 10);
+					if (*end || errno)
+						goto bad_val;
+					havetsize = true;
+				}
+				else if (!strcmp(opt, "multicast"))
+				{
+					if (prvTftpParseMulticast(val, &mcaddr, &mcport, &mcmaster) ||
+					    !mcaddr)
+						goto bad_val;
+					havemcast = true;
+				}
 				opt = val + strlen(val) + 1;
 				continue;
 			bad_val:
@@ -944,12 +2925,29 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 				return 1;
 			}
 
+			if (havetsize && state.check && state.check->have &&
+			    tsize == state.check->size)
+			{
+				prvTftpTerminate(&state, TFTP_ERR_OPTIONS, "Copy is current");
+				state.check->sizeonly = true;
+				return FETCH_NOT_MODIFIED;
+			}
+
+			if (havemcast)
+			{
+				if (prvTftpJoin(&state, mcaddr, mcport))
+				{
+					prvTftpTerminate(&state, TFTP_ERR_OPTIONS,
+					                 "Cannot join multicast group");
+					return 1;
+				}
+				state.master = mcmaster;
+			}
+
 			/* OACK is in its own window at the start */
 			state.winsize = 1;
 			state.winstart = 0;
-			state.winbits = 1;
-			state.lastblock = 0;
-			state.lastsize = 0;
+			prvTftpBitSet(&state, 0);
 			state.retries = 0;
 			if (prvTftpAck(&state))
 				return 1;
@@ -957,6 +2955,7 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 			state.pastrrq = 1;
 			state.winsize = winsize;
 			state.blksize = blksize;
+			state.windows = 0;
 			break;
 		}
 		case TFTP_OP_DATA:
@@ -972,10 +2971,11 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 			uint16_t block = FreeRTOS_ntohs(upacket->data.block);
 			uint16_t winoff = block - state.winstart;
 
-			if ((winoff < state.winsize || (winoff == 0 && !state.winsize)) &&
-			    !state.winbuf)
+			if ((winoff < prvTftpReach(&state) ||
+			     (winoff == 0 && !state.winsize)) &&
+			    !state.started)
 			{
-				state.winbuf = buf;
+				state.started = 1;
 				state.pastrrq = 1;
 				if (!state.winsize)
 				{
@@ -983,9 +2983,10 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 					state.winsize = 1;
 					state.blksize = 512;
 				}
-				printf("Transfer started (window size: %u, block size: %d)\r\n",
-				       state.winsize, state.blksize);
-				tstart = tprev = port_get_current_mtime();
+				printf("Transfer started (window size: %u, block size: %d%s)\r\n",
+				       state.winsize, state.blksize,
+				       state.multicast ? ", multicast" : "");
+				tstart = tprev = tcur;
 			}
 
 			/*
@@ -993,15 +2994,22 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 			 * yet seen any for this window, re-send the ACK as our previous one
 			 * probably got lost.
 			 */
-			if (winoff == 0xffff && !state.winbits)
+			if (winoff == 0xffff && prvTftpBitsEmpty(&state))
 			{
 				if (prvTftpAck(&state))
 					return 1;
 			}
 			/* Otherwise, ignore packets outside this window */
-			if (winoff >= state.winsize)
+			if (winoff >= prvTftpReach(&state))
 				break;
 
+			/*
+			 * The first block of a window completes the round trip of the ACK
+			 * that opened it.
+			 */
+			if (state.timing && winoff == 0)
+				prvTftpRttSample(&state, tcur);
+
 			uint16_t blksize = fromlen - sizeof(upacket->data);
 			if (blksize > state.blksize)
 			{
@@ -1011,54 +3019,88 @@ static int prvTftpReceive(const char *host, uint16_t port, const char *name, cha
 				return 1;
 			}
 
-			memcpy(state.winbuf + winoff * state.blksize,
-			       upacket->data.data, blksize);
-
-			uint16_t lastoff = state.lastblock - state.winstart;
-			if (winoff > lastoff || lastoff >= state.winsize)
+			/* A short block is the last one of the file */
+			if (blksize < state.blksize)
 			{
+				state.havelast = 1;
 				state.lastblock = block;
 				state.lastsize = blksize;
 			}
 
-			/* If this is the final packet, truncate this window. */
-			if (state.lastsize < state.blksize)
-				state.winsize = winoff + 1;
+			prvTftpBitSet(&state, winoff);
+			uint16_t winblocks = prvTftpWindowBlocks(&state);
+			uint16_t received = prvTftpBitsContiguous(&state);
+
+			if (state.sink(state.sinkctx,
+			               state.winpos + (size_t)winoff * state.blksize,
+			               upacket->data.data, blksize,
+			               state.winpos + prvTftpWindowBytes(&state, received)))
+			{
+				prvTftpTerminate(&state, 0, "Cannot load file");
+				return 1;
+			}
 
-			state.winbits |= 1 << winoff;
+			bool done = false;
+			if (state.multicast && !state.master)
+			{
+				/* Listening: move on past whatever has arrived in order */
+				done = state.havelast &&
+				       (uint16_t)(state.lastblock - state.winstart) < received;
+				if (received && prvTftpAck(&state))
+					return 1;
+			}
 			/* Check if we've seen the whole of the window */
-			if (state.winbits == (0xffff >> (16 - state.winsize)))
+			else if (received >= winblocks)
 			{
+				done = state.havelast &&
+				       (uint16_t)(state.lastblock - state.winstart) < received;
+
 				/* ACK the whole window */
 				if (prvTftpAck(&state))
 					return 1;
+			}
+			else if (winoff == winblocks - 1)
+			{
+				/*
+				 * The end of the window arrived but a block before it did not:
+				 * ACK what we have now, rather than after a timeout, so the
+				 * server resends from the first missing block.
+				 */
+				++state.losses;
+				if (prvTftpAck(&state))
+					return 1;
+			}
 
-				/* Check if we're done */
-				if (state.lastsize < state.blksize)
-				{
-					FreeRTOS_ReleaseUDPPayloadBuffer(upacket);
-					FreeRTOS_closesocket(state.sock);
-					*size = state.winbuf - buf;
-
-					uint32_t tcur = port_get_current_mtime();
-					size_t scaledbytes = *size;
-					const char *units = "B";
-					if (scaledbytes > 1024*1024)
-					{
-						scaledbytes >>= 20;
-						units = "MiB";
-					}
-					else if (scaledbytes > 1024)
-					{
-						scaledbytes >>= 10;
-						units = "KiB";
-					}
+			/* Check if we're done */
+			if (done)
+			{
+				FreeRTOS_ReleaseUDPPayloadBuffer(upacket);
+				prvTftpClose(&state);
+				*size = state.winpos;
 
-					printf("Finished receiving %lu %s in %us\r\n",
-					       (unsigned long)scaledbytes, units,
-					       (unsigned int)((tcur - tstart) / 1000000));
-					return 0;
+				size_t scaledbytes = *size;
+				const char *units = "B";
+				if (scaledbytes > 1024*1024)
+				{
+					scaledbytes >>= 20;
+					units = "MiB";
+				}
+				else if (scaledbytes > 1024)
+				{
+					scaledbytes >>= 10;
+					units = "KiB";
 				}
+
+				printf("Finished receiving %lu %s in %us "
+				       "(%lu windows, %lu lost, rtt %lu us)\r\n",
+				       (unsigned long)scaledbytes, units,
+				       (unsigned int)((tcur - tstart) / 1000000),
+				       (unsigned long)state.windows,
+				       (unsigned long)state.losses,
+				       (unsigned long)state.srtt);
+				if (!state.multicast)
+					prvTftpAdaptWinsize(&state);
+				return 0;
 			}
 		}
 		}
@@ -34,6 +34,7 @@
 /* FreeRTOS  includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "rtos_static.h"
 
 /* IP stack includes. */
 #include "FreeRTOS_IP.h"
@@ -47,6 +48,15 @@
 /* Peek-poke stuff */
 #include "peekpoke.h"
 
+#if( mainCREATE_FTP_SERVER == 1 )
+	/* The FTP server serves the IceBlk disk through FatFs */
+	#include "ff.h"
+#endif
+
+#if( mainCREATE_NTP_CLIENT_TASK == 1 ) || ( mainCREATE_NTP_SERVER_TASK == 1 )
+	#include "NTPDemo.h"
+#endif
+
 /* Simple UDP client and server task parameters. */
 #define mainSIMPLE_UDP_CLIENT_SERVER_TASK_PRIORITY (tskIDLE_PRIORITY)
 #define mainSIMPLE_UDP_CLIENT_SERVER_PORT (5005UL)
@@ -57,9 +67,16 @@
 #define mainECHO_CLIENT_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
 
 /* Echo server task parameters. */
-#define mainECHO_SERVER_TASK_STACK_SIZE (configMINIMAL_STACK_SIZE * 10)
+#define mainECHO_SERVER_TASK_STACK_SIZE tcpechoSTACK_SIZE
 #define mainECHO_SERVER_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
 
+/* NTP client task parameters.  The priority is just below the IP task, so that
+   answers are time stamped as soon as they arrive. */
+#define mainNTP_CLIENT_TASK_STACK_SIZE (configMINIMAL_STACK_SIZE * 2)
+#define mainNTP_CLIENT_TASK_PRIORITY (ipconfigIP_TASK_PRIORITY - 1)
+#define mainNTP_SERVER_TASK_STACK_SIZE (configMINIMAL_STACK_SIZE)
+#define mainNTP_SERVER_TASK_PRIORITY (ipconfigIP_TASK_PRIORITY - 1)
+
 /* Define a name that will be used for LLMNR and NBNS searches. */
 #define mainHOST_NAME "RTOSDemo"
 #define mainDEVICE_NICK_NAME "fpga_demo"
@@ -176,7 +193,7 @@ void main_peekpoke(void)
 	   priority, and sets itself to mainTCP_SERVER_TASK_PRIORITY after the file
 	   system has initialised. */
 	FreeRTOS_debug_printf(("xTaskCreate\r\n"));
-	xTaskCreate( prvServerWorkTask, "SvrWork", mainTCP_SERVER_STACK_SIZE, NULL, tskIDLE_PRIORITY, &xServerWorkTaskHandle );
+	RTOS_TASK_CREATE( prvServerWorkTask, "SvrWork", mainTCP_SERVER_STACK_SIZE, NULL, tskIDLE_PRIORITY, &xServerWorkTaskHandle );
 }
 /*-----------------------------------------------------------*/
 static void prvServerWorkTask( void *pvParameters )
@@ -230,6 +247,21 @@ static void prvServerWorkTask( void *pvParameters )
 
 	FreeRTOS_debug_printf(("prvServerWorkTask\r\n"));
 
+#if( mainCREATE_FTP_SERVER == 1 )
+	{
+	static FATFS xFatFs;
+	FRESULT xResult;
+
+		/* Mount now, so that a missing or unformatted disk shows up in the log
+		   rather than on the first FTP command. */
+		xResult = f_mount( &xFatFs, "", 1 );
+		if( xResult != FR_OK )
+		{
+			FreeRTOS_printf( ( "f_mount failed: FRESULT %d\r\n", ( int ) xResult ) );
+		}
+	}
+#endif
+
 	/* The priority of this task can be raised now the disk has been
 	   initialised. */
 	vTaskPrioritySet( NULL, mainECHO_SERVER_TASK_PRIORITY );
@@ -304,6 +336,18 @@ void vApplicationIPNetworkEventHook(eIPCallbackEvent_t eNetworkEvent)
 			}
 #endif
 
+#if (mainCREATE_NTP_CLIENT_TASK == 1)
+			{
+				vStartNTPTask(mainNTP_CLIENT_TASK_STACK_SIZE, mainNTP_CLIENT_TASK_PRIORITY);
+			}
+#endif
+
+#if (mainCREATE_NTP_SERVER_TASK == 1)
+			{
+				vStartNTPServerTask(mainNTP_SERVER_TASK_STACK_SIZE, mainNTP_SERVER_TASK_PRIORITY);
+			}
+#endif
+
 			xTasksAlreadyCreated = pdTRUE;
 		}
 
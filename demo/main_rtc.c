@@ -33,6 +33,7 @@
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "rtos_static.h"
 
 // Drivers
 #include "iic.h"
@@ -87,7 +88,7 @@ static void prvIicTestTask0(void *pvParameters);
 
 void main_rtc(void)
 {
-	xTaskCreate(prvIicTestTask0, "prvIicTestTask0", configMINIMAL_STACK_SIZE * 2U, NULL, tskIDLE_PRIORITY + 1, NULL);
+	RTOS_TASK_CREATE(prvIicTestTask0, "prvIicTestTask0", configMINIMAL_STACK_SIZE * 2U, NULL, tskIDLE_PRIORITY + 1, NULL);
 }
 /*-----------------------------------------------------------*/
 
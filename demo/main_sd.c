@@ -33,6 +33,7 @@
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "rtos_static.h"
 #include "bsp.h"
 
 void main_sd(void);
@@ -56,7 +57,7 @@ void print_array(char *name, uint8_t *buf, size_t len)
 
 void main_sd(void)
 {
-    xTaskCreate(prvSdTestTask0, "prvSdTestTask0", configMINIMAL_STACK_SIZE * 10U, NULL, tskIDLE_PRIORITY + 1, NULL);
+    RTOS_TASK_CREATE(prvSdTestTask0, "prvSdTestTask0", configMINIMAL_STACK_SIZE * 10U, NULL, tskIDLE_PRIORITY + 1, NULL);
 }
 
 
@@ -92,7 +92,7 @@
 #define mainECHO_CLIENT_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
 
 /* Echo server task parameters. */
-#define mainECHO_SERVER_TASK_STACK_SIZE (configMINIMAL_STACK_SIZE * 10)
+#define mainECHO_SERVER_TASK_STACK_SIZE tcpechoSTACK_SIZE
 #define mainECHO_SERVER_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
 
 /* Define a name that will be used for LLMNR and NBNS searches. */
@@ -38,6 +38,7 @@
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "rtos_static.h"
 #include "queue.h"
 
 /* Demo includes. */
@@ -56,8 +57,8 @@ static void vTestUART1Rx(void *pvParameters);
 void main_uart(void)
 {
     /* Create GPIO test */
-    xTaskCreate(vTestUART1Tx, "UART1 Tx Test", 1000, NULL, tskIDLE_PRIORITY, NULL);
-    xTaskCreate(vTestUART1Rx, "UART1 Rx Test", 1000, NULL, tskIDLE_PRIORITY+1, NULL);
+    RTOS_TASK_CREATE(vTestUART1Tx, "UART1 Tx Test", 1000, NULL, tskIDLE_PRIORITY, NULL);
+    RTOS_TASK_CREATE(vTestUART1Rx, "UART1 Rx Test", 1000, NULL, tskIDLE_PRIORITY+1, NULL);
 }
 /*-----------------------------------------------------------*/
 
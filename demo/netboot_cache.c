@@ -0,0 +1,282 @@
+/*
+ * Cache of netboot images on the FatFs volume
+ *
+ * The volume only has 8.3 names, so files are named by an FNV-1a hash of the
+ * source; the source kept in the entry tells colliding images apart.
+ * Failures are reported here and only ever cost the cache, never the boot.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+#include "netboot_cache.h"
+
+#define NETBOOT_CACHE_MAGIC 0x3143424EUL /* "NBC1" */
+#define NETBOOT_CACHE_DIR "NBCACHE"
+/* NBCACHE/XXXXXXXX.IMG */
+#define NETBOOT_CACHE_PATH_MAX 24
+
+static FATFS cache_fs;
+static bool cache_mounted;
+
+static int cache_mount(void)
+{
+	if (cache_mounted)
+		return 0;
+
+	FRESULT res = f_mount(&cache_fs, "", 1);
+	if (res != FR_OK)
+	{
+		printf("Image cache unavailable: f_mount failed: FRESULT %d\r\n",
+		       (int)res);
+		return 1;
+	}
+	res = f_mkdir(NETBOOT_CACHE_DIR);
+	if (res != FR_OK && res != FR_EXIST)
+	{
+		printf("Image cache unavailable: f_mkdir failed: FRESULT %d\r\n",
+		       (int)res);
+		return 1;
+	}
+
+	cache_mounted = true;
+	return 0;
+}
+
+static void cache_path(char *path, const char *source, const char *ext)
+{
+	uint32_t hash = 2166136261UL;
+	while (*source)
+	{
+		hash ^= (uint8_t)*source++;
+		hash *= 16777619UL;
+	}
+	snprintf(path, NETBOOT_CACHE_PATH_MAX, NETBOOT_CACHE_DIR "/%08lX.%s",
+	         (unsigned long)hash, ext);
+}
+
+int netboot_cache_lookup(const char *source, struct netboot_cache_entry *entry)
+{
+	char path[NETBOOT_CACHE_PATH_MAX];
+	FIL fil;
+	UINT n;
+	FILINFO info;
+
+	if (cache_mount())
+		return 1;
+
+	cache_path(path, source, "TAG");
+	if (f_open(&fil, path, FA_READ) != FR_OK)
+		return 1;
+	FRESULT res = f_read(&fil, entry, sizeof(*entry), &n);
+	f_close(&fil);
+	if (res != FR_OK || n != sizeof(*entry) ||
+	    entry->magic != NETBOOT_CACHE_MAGIC)
+		return 1;
+
+	entry->source[NETBOOT_CACHE_SOURCE_MAX - 1] = '\0';
+	entry->etag[NETBOOT_CACHE_ETAG_MAX - 1] = '\0';
+	if (strcmp(entry->source, source) != 0)
+		return 1;
+
+	cache_path(path, source, "IMG");
+	if (f_stat(path, &info) != FR_OK || info.fsize != entry->size)
+		return 1;
+
+	return 0;
+}
+
+int netboot_cache_create(struct netboot_cache_file *file, const char *source)
+{
+	char path[NETBOOT_CACHE_PATH_MAX];
+
+	file->open = false;
+	if (strlen(source) >= NETBOOT_CACHE_SOURCE_MAX)
+	{
+		printf("Not caching %s: name too long\r\n", source);
+		return 1;
+	}
+	if (cache_mount())
+		return 1;
+
+	memset(&file->entry, 0, sizeof(file->entry));
+	file->entry.magic = NETBOOT_CACHE_MAGIC;
+	strcpy(file->entry.source, source);
+
+	/* The old copy stops being valid before it is overwritten */
+	cache_path(path, source, "TAG");
+	f_unlink(path);
+
+	cache_path(path, source, "IMG");
+	FRESULT res = f_open(&file->fil, path, FA_CREATE_ALWAYS | FA_WRITE);
+	if (res != FR_OK)
+	{
+		printf("Not caching %s: f_open failed: FRESULT %d\r\n", source,
+		       (int)res);
+		return 1;
+	}
+
+	file->open = true;
+	return 0;
+}
+
+int netboot_cache_write(struct netboot_cache_file *file, const void *data,
+                        size_t len)
+{
+	UINT n;
+	FRESULT res = f_write(&file->fil, data, len, &n);
+	if (res != FR_OK || n != len)
+	{
+		printf("Not caching %s: f_write failed: FRESULT %d\r\n",
+		       file->entry.source, (int)res);
+		return 1;
+	}
+	return 0;
+}
+
+int netboot_cache_commit(struct netboot_cache_file *file)
+{
+	char path[NETBOOT_CACHE_PATH_MAX];
+	FIL fil;
+	UINT n;
+
+	file->open = false;
+	FRESULT res = f_close(&file->fil);
+	if (res == FR_OK)
+	{
+		cache_path(path, file->entry.source, "TAG");
+		res = f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE);
+		if (res == FR_OK)
+		{
+			res = f_write(&fil, &file->entry, sizeof(file->entry), &n);
+			if (res == FR_OK && n != sizeof(file->entry))
+				res = FR_DENIED;
+			FRESULT closeres = f_close(&fil);
+			if (res == FR_OK)
+				res = closeres;
+		}
+	}
+
+	if (res != FR_OK)
+	{
+		printf("Not caching %s: FRESULT %d\r\n", file->entry.source,
+		       (int)res);
+		netboot_cache_remove(file->entry.source);
+		return 1;
+	}
+	return 0;
+}
+
+void netboot_cache_abort(struct netboot_cache_file *file)
+{
+	char path[NETBOOT_CACHE_PATH_MAX];
+
+	if (!file->open)
+		return;
+	file->open = false;
+	f_close(&file->fil);
+	cache_path(path, file->entry.source, "IMG");
+	f_unlink(path);
+}
+
+int netboot_cache_open(struct netboot_cache_file *file,
+                       const struct netboot_cache_entry *entry)
+{
+	char path[NETBOOT_CACHE_PATH_MAX];
+
+	file->entry = *entry;
+	cache_path(path, entry->source, "IMG");
+	FRESULT res = f_open(&file->fil, path, FA_READ);
+	if (res != FR_OK)
+	{
+		printf("Cannot read cached %s: f_open failed: FRESULT %d\r\n",
+		       entry->source, (int)res);
+		file->open = false;
+		return 1;
+	}
+	file->open = true;
+	return 0;
+}
+
+int netboot_cache_read(struct netboot_cache_file *file, void *buf, size_t len,
+                       size_t *n)
+{
+	UINT br;
+	FRESULT res = f_read(&file->fil, buf, len, &br);
+	if (res != FR_OK)
+	{
+		printf("Cannot read cached %s: f_read failed: FRESULT %d\r\n",
+		       file->entry.source, (int)res);
+		return 1;
+	}
+	*n = br;
+	return 0;
+}
+
+void netboot_cache_close(struct netboot_cache_file *file)
+{
+	if (file->open)
+		f_close(&file->fil);
+	file->open = false;
+}
+
+void netboot_cache_remove(const char *source)
+{
+	char path[NETBOOT_CACHE_PATH_MAX];
+
+	if (cache_mount())
+		return;
+	cache_path(path, source, "TAG");
+	f_unlink(path);
+	cache_path(path, source, "IMG");
+	f_unlink(path);
+}
+
+int netboot_cache_load(const char *name, void *data, size_t len)
+{
+	char path[NETBOOT_CACHE_PATH_MAX];
+	FIL fil;
+	UINT n;
+
+	if (cache_mount())
+		return 1;
+
+	snprintf(path, sizeof(path), NETBOOT_CACHE_DIR "/%s.DAT", name);
+	if (f_open(&fil, path, FA_READ) != FR_OK)
+		return 1;
+	FRESULT res = f_read(&fil, data, len, &n);
+	if (res == FR_OK && f_size(&fil) != len)
+		res = FR_INVALID_OBJECT;
+	f_close(&fil);
+	return res != FR_OK || n != len;
+}
+
+int netboot_cache_store(const char *name, const void *data, size_t len)
+{
+	char path[NETBOOT_CACHE_PATH_MAX];
+	FIL fil;
+	UINT n;
+
+	if (cache_mount())
+		return 1;
+
+	snprintf(path, sizeof(path), NETBOOT_CACHE_DIR "/%s.DAT", name);
+	FRESULT res = f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE);
+	if (res == FR_OK)
+	{
+		res = f_write(&fil, data, len, &n);
+		if (res == FR_OK && n != len)
+			res = FR_DENIED;
+		FRESULT closeres = f_close(&fil);
+		if (res == FR_OK)
+			res = closeres;
+	}
+	if (res != FR_OK)
+	{
+		printf("Cannot save %s: FRESULT %d\r\n", path, (int)res);
+		f_unlink(path);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * Cache of netboot images on the FatFs volume
+ *
+ * Each image is kept as it was received, in NBCACHE/XXXXXXXX.IMG, named by a
+ * hash of where it came from.  Its entry, in the .TAG file next to it, records
+ * that source, the size, the SHA-256 and the HTTP entity tag.  An entry is
+ * removed before its image is rewritten and only written back once the image
+ * is complete, so a copy with an entry is always a whole one.
+ */
+#ifndef NETBOOT_CACHE_H
+#define NETBOOT_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ff.h"
+
+#define NETBOOT_CACHE_SOURCE_MAX 256
+#define NETBOOT_CACHE_ETAG_MAX 128
+#define NETBOOT_CACHE_DIGEST_SIZE 32
+
+struct netboot_cache_entry
+{
+	uint32_t magic;
+	uint32_t size;
+	uint8_t digest[NETBOOT_CACHE_DIGEST_SIZE];
+	/* URL the image was fetched from */
+	char source[NETBOOT_CACHE_SOURCE_MAX];
+	/* Empty unless the HTTP server sent one */
+	char etag[NETBOOT_CACHE_ETAG_MAX];
+};
+
+/* An image being written to, or read from, the cache */
+struct netboot_cache_file
+{
+	FIL fil;
+	struct netboot_cache_entry entry;
+	bool open;
+};
+
+/* Returns 0, and fills in entry, if there is a cached copy of source */
+int netboot_cache_lookup(const char *source, struct netboot_cache_entry *entry);
+
+/*
+ * Replace the cached copy of source.  The caller fills in file->entry's size,
+ * digest and etag before committing.
+ */
+int netboot_cache_create(struct netboot_cache_file *file, const char *source);
+int netboot_cache_write(struct netboot_cache_file *file, const void *data,
+                        size_t len);
+int netboot_cache_commit(struct netboot_cache_file *file);
+void netboot_cache_abort(struct netboot_cache_file *file);
+
+/* Read a cached copy found by netboot_cache_lookup() */
+int netboot_cache_open(struct netboot_cache_file *file,
+                       const struct netboot_cache_entry *entry);
+int netboot_cache_read(struct netboot_cache_file *file, void *buf, size_t len,
+                       size_t *n);
+void netboot_cache_close(struct netboot_cache_file *file);
+
+/* Drop the cached copy of source, if any */
+void netboot_cache_remove(const char *source);
+
+/*
+ * Small records kept next to the images, in NBCACHE/<name>.DAT; name must fit
+ * in 8 characters.  load returns 0 only if the record is exactly len bytes.
+ */
+int netboot_cache_load(const char *name, void *data, size_t len);
+int netboot_cache_store(const char *name, const void *data, size_t len);
+
+#endif /* NETBOOT_CACHE_H */
@@ -0,0 +1,367 @@
+/*
+ * Minimal DHCP client for netboot
+ *
+ * Only what booting needs: one lease, asked for as fast as the server allows.
+ * It is never renewed; the booted image does its own network setup.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "FreeRTOS_IP.h"
+#include "FreeRTOS_Sockets.h"
+#include "FreeRTOS_ARP.h"
+
+#include "netboot_dhcp.h"
+
+#define NETBOOT_DHCP_MAGIC 0x3144424EUL /* "NBD1" */
+
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+#define DHCP_COOKIE 0x63825363UL
+
+#define BOOTP_REQUEST   1
+#define BOOTP_REPLY     2
+#define BOOTP_ETHERNET  1
+#define BOOTP_BROADCAST 0x8000
+
+#define DHCP_DISCOVER 1
+#define DHCP_OFFER    2
+#define DHCP_REQUEST  3
+#define DHCP_ACK      5
+#define DHCP_NAK      6
+
+#define DHCP_OPT_PAD          0
+#define DHCP_OPT_NETMASK      1
+#define DHCP_OPT_ROUTER       3
+#define DHCP_OPT_DNS          6
+#define DHCP_OPT_REQUESTED_IP 50
+#define DHCP_OPT_LEASE_TIME   51
+#define DHCP_OPT_MESSAGE_TYPE 53
+#define DHCP_OPT_SERVER_ID    54
+#define DHCP_OPT_PARAMS       55
+#define DHCP_OPT_RAPID_COMMIT 80
+#define DHCP_OPT_END          255
+
+/* Fills a 576 byte IP datagram, the least every server accepts */
+#define DHCP_OPTIONS_SIZE 308
+
+/* Wait for the first answer; doubled on every retransmission */
+#define DHCP_TIMEOUT_MS 250
+#define DHCP_RETRIES 4
+/* A server that does not know the previous lease stays silent */
+#define DHCP_REBOOT_RETRIES 2
+
+struct dhcp_message
+{
+	uint8_t op;
+	uint8_t htype;
+	uint8_t hlen;
+	uint8_t hops;
+	uint32_t xid;
+	uint16_t secs;
+	uint16_t flags;
+	uint32_t ciaddr;
+	uint32_t yiaddr;
+	uint32_t siaddr;
+	uint32_t giaddr;
+	uint8_t chaddr[16];
+	uint8_t sname[64];
+	uint8_t file[128];
+	uint32_t cookie;
+	uint8_t options[DHCP_OPTIONS_SIZE];
+} __attribute__((packed));
+
+/* What a reply says */
+struct dhcp_reply
+{
+	uint8_t type;
+	bool rapid;
+	uint32_t address;
+	uint32_t netmask;
+	uint32_t gateway;
+	uint32_t dns;
+	uint32_t server;
+	uint32_t duration;
+};
+
+struct dhcp_client
+{
+	Socket_t sock;
+	const uint8_t *mac;
+	uint32_t xid;
+	/* Type of the last message sent */
+	uint8_t type;
+	struct dhcp_message tx;
+	struct dhcp_message rx;
+};
+
+static struct dhcp_client dhcp_client;
+
+/* Returns where the next option goes */
+static size_t dhcp_start(struct dhcp_client *client, uint8_t type)
+{
+	struct dhcp_message *msg = &client->tx;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->op = BOOTP_REQUEST;
+	msg->htype = BOOTP_ETHERNET;
+	msg->hlen = 6;
+	msg->xid = client->xid;
+	/* There is no address to unicast the answer to yet */
+	msg->flags = FreeRTOS_htons(BOOTP_BROADCAST);
+	memcpy(msg->chaddr, client->mac, 6);
+	msg->cookie = FreeRTOS_htonl(DHCP_COOKIE);
+
+	client->type = type;
+	msg->options[0] = DHCP_OPT_MESSAGE_TYPE;
+	msg->options[1] = 1;
+	msg->options[2] = type;
+	return 3;
+}
+
+static size_t dhcp_put_address(struct dhcp_client *client, size_t off,
+                               uint8_t code, uint32_t addr)
+{
+	client->tx.options[off] = code;
+	client->tx.options[off + 1] = 4;
+	memcpy(&client->tx.options[off + 2], &addr, 4);
+	return off + 6;
+}
+
+/* Returns the size of the message */
+static size_t dhcp_finish(struct dhcp_client *client, size_t off)
+{
+	static const uint8_t params[] =
+	{
+		DHCP_OPT_PARAMS, 4,
+		DHCP_OPT_NETMASK, DHCP_OPT_ROUTER, DHCP_OPT_DNS, DHCP_OPT_LEASE_TIME,
+	};
+
+	memcpy(&client->tx.options[off], params, sizeof(params));
+	off += sizeof(params);
+	client->tx.options[off++] = DHCP_OPT_END;
+	return offsetof(struct dhcp_message, options) + off;
+}
+
+static uint32_t dhcp_get_address(const uint8_t *data, uint8_t len)
+{
+	uint32_t addr = 0;
+	if (len >= 4)
+		memcpy(&addr, data, 4);
+	return addr;
+}
+
+/* Returns 0 if the message in client->rx is a reply to us */
+static int dhcp_parse(struct dhcp_client *client, size_t len,
+                      struct dhcp_reply *reply)
+{
+	const struct dhcp_message *msg = &client->rx;
+	const size_t start = offsetof(struct dhcp_message, options);
+
+	if (len < start || msg->op != BOOTP_REPLY || msg->xid != client->xid ||
+	    msg->cookie != FreeRTOS_htonl(DHCP_COOKIE) ||
+	    memcmp(msg->chaddr, client->mac, 6) != 0)
+		return 1;
+
+	memset(reply, 0, sizeof(*reply));
+	reply->address = msg->yiaddr;
+
+	const uint8_t *opt = msg->options;
+	const uint8_t *end = opt + (len - start);
+	while (opt < end && *opt != DHCP_OPT_END)
+	{
+		uint8_t code = *opt++;
+		if (code == DHCP_OPT_PAD)
+			continue;
+		if (opt == end || *opt > end - opt - 1)
+			return 1;
+		uint8_t optlen = *opt++;
+
+		switch (code)
+		{
+		case DHCP_OPT_MESSAGE_TYPE:
+			if (optlen >= 1)
+				reply->type = opt[0];
+			break;
+		case DHCP_OPT_NETMASK:
+			reply->netmask = dhcp_get_address(opt, optlen);
+			break;
+		/* The first router and DNS server are used */
+		case DHCP_OPT_ROUTER:
+			reply->gateway = dhcp_get_address(opt, optlen);
+			break;
+		case DHCP_OPT_DNS:
+			reply->dns = dhcp_get_address(opt, optlen);
+			break;
+		case DHCP_OPT_SERVER_ID:
+			reply->server = dhcp_get_address(opt, optlen);
+			break;
+		case DHCP_OPT_LEASE_TIME:
+			reply->duration = FreeRTOS_ntohl(dhcp_get_address(opt, optlen));
+			break;
+		case DHCP_OPT_RAPID_COMMIT:
+			reply->rapid = true;
+			break;
+		}
+		opt += optlen;
+	}
+
+	return reply->type ? 0 : 1;
+}
+
+/*
+ * Send the message in client->tx until a reply of one of the accepted types
+ * arrives.  Returns 0, and fills in reply, if one did.
+ */
+static int dhcp_exchange(struct dhcp_client *client, size_t size,
+                         uint32_t accept, int retries, struct dhcp_reply *reply)
+{
+	struct freertos_sockaddr addr;
+	TickType_t wait = pdMS_TO_TICKS(DHCP_TIMEOUT_MS);
+
+	addr.sin_addr = 0xffffffffUL;
+	addr.sin_port = FreeRTOS_htons(DHCP_SERVER_PORT);
+
+	for (int attempt = 0; attempt < retries; ++attempt, wait *= 2)
+	{
+		if (FreeRTOS_sendto(client->sock, &client->tx, size, 0, &addr,
+		                    sizeof(addr)) <= 0)
+			continue;
+
+		TimeOut_t timeout;
+		TickType_t remaining = wait;
+		vTaskSetTimeOutState(&timeout);
+		while (xTaskCheckForTimeOut(&timeout, &remaining) == pdFALSE)
+		{
+			struct freertos_sockaddr from;
+			uint32_t fromlen = sizeof(from);
+
+			FreeRTOS_setsockopt(client->sock, 0, FREERTOS_SO_RCVTIMEO,
+			                    &remaining, sizeof(remaining));
+			int32_t n = FreeRTOS_recvfrom(client->sock, &client->rx,
+			                              sizeof(client->rx), 0, &from,
+			                              &fromlen);
+			if (n <= 0 || dhcp_parse(client, n, reply) != 0 ||
+			    reply->type >= 32 || !(accept & (1UL << reply->type)))
+				continue;
+			/* Without rapid commit, a DISCOVER is only ever offered */
+			if (client->type == DHCP_DISCOVER && reply->type == DHCP_ACK &&
+			    !reply->rapid)
+				continue;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int dhcp_request(struct dhcp_client *client, uint32_t address,
+                        uint32_t server, int retries, struct dhcp_reply *reply)
+{
+	size_t off = dhcp_start(client, DHCP_REQUEST);
+	off = dhcp_put_address(client, off, DHCP_OPT_REQUESTED_IP, address);
+	if (server)
+		off = dhcp_put_address(client, off, DHCP_OPT_SERVER_ID, server);
+
+	if (dhcp_exchange(client, dhcp_finish(client, off),
+	                  (1UL << DHCP_ACK) | (1UL << DHCP_NAK), retries, reply))
+		return 1;
+	return reply->type == DHCP_ACK ? 0 : 1;
+}
+
+static int dhcp_discover(struct dhcp_client *client, struct dhcp_reply *reply)
+{
+	size_t off = dhcp_start(client, DHCP_DISCOVER);
+	client->tx.options[off++] = DHCP_OPT_RAPID_COMMIT;
+	client->tx.options[off++] = 0;
+
+	if (dhcp_exchange(client, dhcp_finish(client, off),
+	                  (1UL << DHCP_OFFER) | (1UL << DHCP_ACK), DHCP_RETRIES,
+	                  reply))
+		return 1;
+	if (reply->type == DHCP_ACK)
+		return 0;
+
+	/* Take the first offer */
+	return dhcp_request(client, reply->address, reply->server, DHCP_RETRIES,
+	                    reply);
+}
+
+int netboot_dhcp(const uint8_t *mac, const struct netboot_dhcp_lease *previous,
+                 struct netboot_dhcp_lease *lease)
+{
+	struct dhcp_client *client = &dhcp_client;
+	struct dhcp_reply reply;
+	uint32_t address, netmask, gateway, dns;
+	int err = 1;
+
+	client->sock = FreeRTOS_socket(FREERTOS_AF_INET, FREERTOS_SOCK_DGRAM,
+	                               FREERTOS_IPPROTO_UDP);
+	if (client->sock == FREERTOS_INVALID_SOCKET)
+	{
+		printf("DHCP: failed to create socket\r\n");
+		return 1;
+	}
+	struct freertos_sockaddr bindaddr;
+	memset(&bindaddr, 0, sizeof(bindaddr));
+	bindaddr.sin_port = FreeRTOS_htons(DHCP_CLIENT_PORT);
+	if (FreeRTOS_bind(client->sock, &bindaddr, sizeof(bindaddr)) != 0)
+	{
+		printf("DHCP: cannot bind port %u\r\n", DHCP_CLIENT_PORT);
+		FreeRTOS_closesocket(client->sock);
+		return 1;
+	}
+
+	client->mac = mac;
+	client->xid = ipconfigRAND32();
+
+	/* Requests go out from 0.0.0.0 until there is a lease */
+	FreeRTOS_GetAddressConfiguration(&address, &netmask, &gateway, &dns);
+	FreeRTOS_SetIPAddress(0);
+
+	if (previous && netboot_dhcp_valid(previous, mac))
+		err = dhcp_request(client, previous->address, 0,
+		                   DHCP_REBOOT_RETRIES, &reply);
+	if (err)
+		err = dhcp_discover(client, &reply);
+
+	FreeRTOS_closesocket(client->sock);
+
+	if (err)
+	{
+		FreeRTOS_SetIPAddress(address);
+		return 1;
+	}
+
+	memset(lease, 0, sizeof(*lease));
+	lease->magic = NETBOOT_DHCP_MAGIC;
+	memcpy(lease->mac, mac, sizeof(lease->mac));
+	lease->address = reply.address;
+	/* Keep the static settings for what the server leaves out */
+	lease->netmask = reply.netmask ? reply.netmask : netmask;
+	lease->gateway = reply.gateway ? reply.gateway : gateway;
+	lease->dns = reply.dns ? reply.dns : dns;
+	lease->server = reply.server;
+	lease->duration = reply.duration;
+	return 0;
+}
+
+bool netboot_dhcp_valid(const struct netboot_dhcp_lease *lease,
+                        const uint8_t *mac)
+{
+	return lease->magic == NETBOOT_DHCP_MAGIC &&
+	       memcmp(lease->mac, mac, sizeof(lease->mac)) == 0 &&
+	       lease->address != 0;
+}
+
+void netboot_dhcp_apply(const struct netboot_dhcp_lease *lease)
+{
+	FreeRTOS_SetAddressConfiguration(&lease->address, &lease->netmask,
+	                                 &lease->gateway, &lease->dns);
+	/* Tell the network who has the address now, instead of probing for it */
+	FreeRTOS_OutputARPRequest(lease->address);
+}
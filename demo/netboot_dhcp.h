@@ -0,0 +1,46 @@
+/*
+ * Minimal DHCP client for netboot
+ *
+ * The stack is built with ipconfigUSE_DHCP 0 and comes up on the static
+ * address at once; this client then replaces that configuration.  It asks for
+ * rapid commit (RFC 4039), so that a server which supports it answers the
+ * DISCOVER with an ACK straight away.  Given the previous lease, it first asks
+ * for that address again with a single REQUEST (INIT-REBOOT, RFC 2131 3.2).
+ * The address is announced with a gratuitous ARP instead of being probed.
+ */
+#ifndef NETBOOT_DHCP_H
+#define NETBOOT_DHCP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Addresses are in network byte order, as FreeRTOS+TCP keeps them */
+struct netboot_dhcp_lease
+{
+	uint32_t magic;
+	uint8_t mac[6];
+	uint32_t address;
+	uint32_t netmask;
+	uint32_t gateway;
+	uint32_t dns;
+	uint32_t server;
+	/* Seconds, as granted */
+	uint32_t duration;
+};
+
+/*
+ * Get a lease for mac, asking for previous first if it is not NULL.  The
+ * stack's address is cleared while this runs and restored on failure.
+ * Returns 0, and fills in lease, on success.
+ */
+int netboot_dhcp(const uint8_t *mac, const struct netboot_dhcp_lease *previous,
+                 struct netboot_dhcp_lease *lease);
+
+/* True if lease was filled in by netboot_dhcp() for mac */
+bool netboot_dhcp_valid(const struct netboot_dhcp_lease *lease,
+                        const uint8_t *mac);
+
+/* Configure the stack with lease and announce it with a gratuitous ARP */
+void netboot_dhcp_apply(const struct netboot_dhcp_lease *lease);
+
+#endif /* NETBOOT_DHCP_H */
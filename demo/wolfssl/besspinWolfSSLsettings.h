@@ -0,0 +1,15 @@
+/*
+ * wolfSSL settings for main_netboot, which only uses wolfcrypt's SHA-256.
+ * main_besspin takes its settings from the BESSPIN tool suite instead.
+ */
+#ifndef BESSPIN_WOLFSSL_SETTINGS_H
+#define BESSPIN_WOLFSSL_SETTINGS_H
+
+#define FREERTOS
+#define SINGLE_THREADED
+#define WOLFCRYPT_ONLY
+#define NO_FILESYSTEM
+#define NO_WOLFSSL_MEMORY
+#define NO_ERROR_STRINGS
+
+#endif /* BESSPIN_WOLFSSL_SETTINGS_H */
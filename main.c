@@ -36,6 +36,11 @@
 
 /* Bsp includes. */
 #include "bsp.h"
+#include "hrtimer.h"
+#include "rtos_static.h"
+#if configUSE_PROFILER
+#include "prof.h"
+#endif
 
 /******************************************************************************
  * This project provides test applications for Galois P1 SSITH processor.
@@ -75,6 +80,14 @@ extern void main_besspin(void);
 #undef configGENERATE_RUN_TIME_STATS
 #pragma message "Demo type 13: Netboot"
 extern void main_netboot(void);
+#elif mainDEMO_TYPE == 14
+#undef configGENERATE_RUN_TIME_STATS
+#pragma message "Demo type 14: Interrupt latency benchmark"
+extern void main_irqlat(void);
+#elif mainDEMO_TYPE == 15
+#undef configGENERATE_RUN_TIME_STATS
+#pragma message "Demo type 15: Kernel primitives benchmark"
+extern void main_kbench(void);
 
 #else
 #error "Unsupported demo type"
@@ -87,9 +100,6 @@ void vApplicationIdleHook(void);
 void vApplicationStackOverflowHook(TaskHandle_t pxTask, char *pcTaskName);
 void vApplicationTickHook(void);
 
-/* Returns the current value of mcycle register*/
-uint64_t get_cycle_count(void);
-
 #if configGENERATE_RUN_TIME_STATS
 /* Buffer and a task for displaying runtime stats */
 char statsBuffer[4096];
@@ -132,17 +142,13 @@ uint64_t get_cycle_count(void)
 }
 
 /**
- * Use `mcycle` counter to get usec resolution.
- * On RV32 only, reads of the mcycle CSR return the low 32 bits,
- * while reads of the mcycleh CSR return bits 63–32 of the corresponding
- * counter.
- * We convert the 64-bit read into usec. The counter overflows in roughly an hour
- * and 20 minutes. Probably not a big issue though.
- * At 50HMz clock rate, 1 us = 50 ticks
+ * Microseconds since reset, for the run time stats, which keep 32-bit
+ * counters. This wraps after about 71 minutes: take differences only, or
+ * use the 64-bit clock_us() from hrtimer.h.
  */
 uint32_t port_get_current_mtime(void)
 {
-	return (uint32_t)(get_cycle_count() / (configCPU_CLOCK_HZ / 1000000));
+	return (uint32_t)clock_us();
 }
 
 /**
@@ -196,14 +202,22 @@ int main(void)
 	{
 		main_netboot();
 	}
+#elif mainDEMO_TYPE == 14
+	{
+		main_irqlat();
+	}
+#elif mainDEMO_TYPE == 15
+	{
+		main_kbench();
+	}
 #endif
 
 #if configGENERATE_RUN_TIME_STATS
-	xTaskCreate(prvStatsTask, "prvStatsTask", configMINIMAL_STACK_SIZE * 20, NULL, tskIDLE_PRIORITY, NULL);
+	RTOS_TASK_CREATE(prvStatsTask, "prvStatsTask", configMINIMAL_STACK_SIZE * 20, NULL, tskIDLE_PRIORITY, NULL);
 #endif
 
 #if USE_LED_BLINK_TASK
-	xTaskCreate(vTestLED, "LED Test", 1000, NULL, 0, NULL);
+	RTOS_TASK_CREATE(vTestLED, "LED Test", 1000, NULL, 0, NULL);
 #endif
 
 	/* If all is well, the scheduler will now be running, and the following
@@ -218,15 +232,13 @@ int main(void)
 }
 /*-----------------------------------------------------------*/
 
-#if configGENERATE_RUN_TIME_STATS
-
 // Returns percentage utilization of the ISR stack
 #include "portmacro.h"
 extern const StackType_t xISRStackTop;
 extern const uint32_t _stack_end[];
 const StackType_t xISRStackEnd = ( StackType_t ) _stack_end;
 
-static uint8_t prvIsrStackUtilization(void)
+uint8_t isr_stack_utilization(void)
 {
 	uint8_t percent = 0;
 	uint32_t idx;
@@ -245,6 +257,8 @@ static uint8_t prvIsrStackUtilization(void)
 	return percent;
 }
 
+#if configGENERATE_RUN_TIME_STATS
+
 static void prvStatsTask(void *pvParameters)
 {
 	(void)pvParameters;
@@ -255,7 +269,17 @@ static void prvStatsTask(void *pvParameters)
 	{
 		vTaskGetRunTimeStats(statsBuffer);
 		printf("prvStatsTask: xPortGetFreeHeapSize() = %u\r\n", xPortGetFreeHeapSize());
-		printf("prvStatsTask: prvIsrStackUtilization() = %u\r\n", prvIsrStackUtilization());
+		printf("prvStatsTask: isr_stack_utilization() = %u\r\n", isr_stack_utilization());
+		for (plic_source source = 1; source < PLIC_NUM_INTERRUPTS; source++)
+		{
+			plic_SourceStats irq;
+			PLIC_get_source_stats(&Plic, source, &irq);
+			if (irq.Count != 0)
+			{
+				printf("prvStatsTask: PLIC source %u: %u interrupts, max %u cycles\r\n",
+					   (unsigned)source, (unsigned)irq.Count, (unsigned)irq.MaxCycles);
+			}
+		}
 		printf("prvStatsTask: Run-time stats\r\nTask\t\tAbsTime\t\t%%time\tStackHighWaterMark\r\n");
 		printf("%s\r\n", statsBuffer);
 		vTaskDelay(pdMS_TO_TICKS(10000));
@@ -315,6 +339,10 @@ void vApplicationStackOverflowHook(TaskHandle_t pxTask, char *pcTaskName)
 
 void vApplicationTickHook(void)
 {
+#if configUSE_PROFILER
+	prof_tick();
+#endif
+
 /* The tests in the full demo expect some interaction with interrupts. */
 #if (mainDEMO_TYPE == 2)
 	{
@@ -323,6 +351,33 @@ void vApplicationTickHook(void)
 	}
 #endif
 }
+/*-----------------------------------------------------------*/
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+/* The scheduler takes the idle and timer task storage from these when it starts */
+void vApplicationGetIdleTaskMemory(StaticTask_t **ppxIdleTaskTCBBuffer, StackType_t **ppxIdleTaskStackBuffer,
+								   uint32_t *pulIdleTaskStackSize)
+{
+	static StaticTask_t xIdleTaskTCB configSTATIC_STORAGE;
+	static StackType_t uxIdleTaskStack[configMINIMAL_STACK_SIZE] configSTATIC_STORAGE;
+
+	*ppxIdleTaskTCBBuffer = &xIdleTaskTCB;
+	*ppxIdleTaskStackBuffer = uxIdleTaskStack;
+	*pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+/*-----------------------------------------------------------*/
+
+void vApplicationGetTimerTaskMemory(StaticTask_t **ppxTimerTaskTCBBuffer, StackType_t **ppxTimerTaskStackBuffer,
+									uint32_t *pulTimerTaskStackSize)
+{
+	static StaticTask_t xTimerTaskTCB configSTATIC_STORAGE;
+	static StackType_t uxTimerTaskStack[configTIMER_TASK_STACK_DEPTH] configSTATIC_STORAGE;
+
+	*ppxTimerTaskTCBBuffer = &xTimerTaskTCB;
+	*ppxTimerTaskStackBuffer = uxTimerTaskStack;
+	*pulTimerTaskStackSize = configTIMER_TASK_STACK_DEPTH;
+}
+#endif /* configSUPPORT_STATIC_ALLOCATION */
 
 #if USE_LED_BLINK_TASK
 void vTestLED(void *pvParameters)
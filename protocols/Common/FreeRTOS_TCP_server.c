@@ -79,8 +79,52 @@
 #endif
 
 
+#if( configSUPPORT_STATIC_ALLOCATION == 1 )
+	/* With static allocation the server and its clients come from storage
+	reserved at link time instead of the heap.  There is one server, listening
+	on up to ipconfigTCP_SERVER_STATIC_PORTS ports.  A client arriving while all
+	ipconfigTCP_SERVER_STATIC_CLIENTS slots are taken is closed, as it is when
+	the heap is exhausted.  Clients are only created and deleted from the task
+	calling FreeRTOS_TCPServerWork(). */
+	#ifndef ipconfigTCP_SERVER_STATIC_PORTS
+		#define ipconfigTCP_SERVER_STATIC_PORTS			4
+	#endif
+	#ifndef ipconfigTCP_SERVER_STATIC_CLIENTS
+		#define ipconfigTCP_SERVER_STATIC_CLIENTS		8
+	#endif
+	/* Including the terminating zero. */
+	#ifndef ipconfigTCP_SERVER_STATIC_ROOT_LENGTH
+		#define ipconfigTCP_SERVER_STATIC_ROOT_LENGTH	64
+	#endif
+
+	typedef union
+	{
+		TCPClient_t xClient;
+		#if( ipconfigUSE_HTTP != 0 )
+			HTTPClient_t xHTTPClient;
+		#endif
+		#if( ipconfigUSE_FTP != 0 )
+			FTPClient_t xFTPClient;
+		#endif
+	} StaticTCPClient_t;
+
+	static union
+	{
+		TCPServer_t xServer;
+		uint8_t ucBytes[ sizeof( TCPServer_t ) + ( ipconfigTCP_SERVER_STATIC_PORTS - 1 ) * sizeof( ( ( TCPServer_t * ) 0 )->xServers[ 0 ] ) ];
+	} xStaticServer configSTATIC_STORAGE;
+	static BaseType_t xStaticServerCreated = pdFALSE;
+	static char pcStaticRootDirs[ ipconfigTCP_SERVER_STATIC_PORTS ][ ipconfigTCP_SERVER_STATIC_ROOT_LENGTH ] configSTATIC_STORAGE;
+
+	static StaticTCPClient_t xStaticClients[ ipconfigTCP_SERVER_STATIC_CLIENTS ] configSTATIC_STORAGE;
+	static BaseType_t xStaticClientInUse[ ipconfigTCP_SERVER_STATIC_CLIENTS ] configSTATIC_STORAGE;
+
+	static TCPClient_t *prvAllocateClient( BaseType_t xSize );
+	static void prvFreeClient( TCPClient_t *pxClient );
+#endif /* configSUPPORT_STATIC_ALLOCATION */
+
 static void prvReceiveNewClient( TCPServer_t *pxServer, BaseType_t xIndex, Socket_t xNexSocket );
-static char *strnew( const char *pcString );
+static char *strnew( BaseType_t xIndex, const char *pcString );
 /* Remove slashes at the end of a path. */
 static void prvRemoveSlash( char *pcDir );
 
@@ -99,7 +143,20 @@ TCPServer_t *FreeRTOS_CreateTCPServer( const struct xSERVER_CONFIG *pxConfigs, B
 
 		xSize = sizeof( *pxServer ) - sizeof( pxServer->xServers ) + xCount * sizeof( pxServer->xServers[ 0 ] );
 
-		pxServer = ( TCPServer_t * ) pvPortMallocLarge( xSize );
+#if( configSUPPORT_STATIC_ALLOCATION == 1 )
+		{
+			pxServer = NULL;
+			if( ( xStaticServerCreated == pdFALSE ) && ( xCount <= ipconfigTCP_SERVER_STATIC_PORTS ) )
+			{
+				pxServer = &( xStaticServer.xServer );
+				xStaticServerCreated = pdTRUE;
+			}
+		}
+#else
+		{
+			pxServer = ( TCPServer_t * ) pvPortMallocLarge( xSize );
+		}
+#endif /* configSUPPORT_STATIC_ALLOCATION */
 		if( pxServer != NULL )
 		{
 			struct freertos_sockaddr xAddress;
@@ -155,8 +212,11 @@ TCPServer_t *FreeRTOS_CreateTCPServer( const struct xSERVER_CONFIG *pxConfigs, B
 						FreeRTOS_FD_SET( xSocket, xSocketSet, eSELECT_READ|eSELECT_EXCEPT );
 						pxServer->xServers[ xIndex ].xSocket = xSocket;
 						pxServer->xServers[ xIndex ].eType = pxConfigs[ xIndex ].eType;
-						pxServer->xServers[ xIndex ].pcRootDir = strnew( pxConfigs[ xIndex ].pcRootDir );
-						prvRemoveSlash( ( char * ) pxServer->xServers[ xIndex ].pcRootDir );
+						pxServer->xServers[ xIndex ].pcRootDir = strnew( xIndex, pxConfigs[ xIndex ].pcRootDir );
+						if( pxServer->xServers[ xIndex ].pcRootDir != NULL )
+						{
+							prvRemoveSlash( ( char * ) pxServer->xServers[ xIndex ].pcRootDir );
+						}
 					}
 				}
 			}
@@ -214,7 +274,11 @@ static void prvReceiveNewClient( TCPServer_t *pxServer, BaseType_t xIndex, Socke
 	/* Malloc enough space for a new HTTP-client */
 	if( xSize )
 	{
+#if( configSUPPORT_STATIC_ALLOCATION == 1 )
+		pxClient = prvAllocateClient( xSize );
+#else
 		pxClient = ( TCPClient_t* ) pvPortMallocLarge( xSize );
+#endif
 	}
 
 	if( pxClient != NULL )
@@ -296,7 +360,11 @@ void FreeRTOS_TCPServerWork( TCPServer_t *pxServer, TickType_t xBlockingTime )
 				pxThis->fDeleteFunction( pxThis );
 			}
 			/* Free the space */
+#if( configSUPPORT_STATIC_ALLOCATION == 1 )
+			prvFreeClient( pxThis );
+#else
 			vPortFreeLarge( pxThis );
+#endif
 		}
 		else
 		{
@@ -306,13 +374,32 @@ void FreeRTOS_TCPServerWork( TCPServer_t *pxServer, TickType_t xBlockingTime )
 }
 /*-----------------------------------------------------------*/
 
-static char *strnew( const char *pcString )
+static char *strnew( BaseType_t xIndex, const char *pcString )
 {
 	BaseType_t xLength;
 	char *pxBuffer;
 
 	xLength = strlen( pcString ) + 1;
-	pxBuffer = ( char * ) pvPortMalloc( xLength );
+#if( configSUPPORT_STATIC_ALLOCATION == 1 )
+	{
+		/* The copy is kept in the slot of the server's port xIndex.  A path
+		that does not fit is refused rather than truncated. */
+		configASSERT( xLength <= ipconfigTCP_SERVER_STATIC_ROOT_LENGTH );
+		if( xLength <= ipconfigTCP_SERVER_STATIC_ROOT_LENGTH )
+		{
+			pxBuffer = pcStaticRootDirs[ xIndex ];
+		}
+		else
+		{
+			pxBuffer = NULL;
+		}
+	}
+#else
+	{
+		( void ) xIndex;
+		pxBuffer = ( char * ) pvPortMalloc( xLength );
+	}
+#endif /* configSUPPORT_STATIC_ALLOCATION */
 	if( pxBuffer != NULL )
 	{
 		memcpy( pxBuffer, pcString, xLength );
@@ -322,6 +409,38 @@ static char *strnew( const char *pcString )
 }
 /*-----------------------------------------------------------*/
 
+#if( configSUPPORT_STATIC_ALLOCATION == 1 )
+
+	static TCPClient_t *prvAllocateClient( BaseType_t xSize )
+	{
+	BaseType_t xSlot;
+
+		configASSERT( xSize <= ( BaseType_t ) sizeof( StaticTCPClient_t ) );
+
+		for( xSlot = 0; xSlot < ipconfigTCP_SERVER_STATIC_CLIENTS; xSlot++ )
+		{
+			if( xStaticClientInUse[ xSlot ] == pdFALSE )
+			{
+				xStaticClientInUse[ xSlot ] = pdTRUE;
+				return &( xStaticClients[ xSlot ].xClient );
+			}
+		}
+
+		return NULL;
+	}
+	/*-----------------------------------------------------------*/
+
+	static void prvFreeClient( TCPClient_t *pxClient )
+	{
+	BaseType_t xSlot = ( StaticTCPClient_t * ) pxClient - xStaticClients;
+
+		configASSERT( ( xSlot >= 0 ) && ( xSlot < ipconfigTCP_SERVER_STATIC_CLIENTS ) );
+		xStaticClientInUse[ xSlot ] = pdFALSE;
+	}
+	/*-----------------------------------------------------------*/
+
+#endif /* configSUPPORT_STATIC_ALLOCATION */
+
 static void prvRemoveSlash( char *pcDir )
 {
 	BaseType_t xLength = strlen( pcDir );
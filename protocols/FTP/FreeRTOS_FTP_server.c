@@ -107,6 +107,10 @@
 #define ftpASCII_CR	13
 #define ftpASCII_LF 10
 
+/* Initial size of the text buffer of a directory listing, it doubles when
+needed. */
+#define ftpLIST_INITIAL_SIZE	4096u
+
 #if defined( FTP_WRITES_ALIGNED ) || defined( ipconfigFTP_WRITES_ALIGNED )
 	#error Name change : please rename the define to the new name 'ipconfigFTP_ZERO_COPY_ALIGNED_WRITES'
 #endif
@@ -120,6 +124,32 @@
 	#define ipconfigFTP_ZERO_COPY_ALIGNED_WRITES			0
 #endif
 
+/*
+ * ipconfigFTP_TX_ZERO_COPY : if non-zero, f_read() will copy file data directly
+ * into the TX stream of the data socket.
+ */
+#ifndef ipconfigFTP_TX_ZERO_COPY
+	#define ipconfigFTP_TX_ZERO_COPY						0
+#endif
+
+/*
+ * ipconfigFTP_TX_BUFSIZE / ipconfigFTP_RX_BUFSIZE : the size in bytes of the
+ * stream buffers of a data socket.  When not defined, the window sizes (which
+ * are expressed in segments) default to the number of segments that fit in
+ * each buffer.
+ */
+#if( ipconfigFTP_TX_BUFSIZE > 0 )
+	#ifndef ipconfigFTP_RX_BUFSIZE
+		#define ipconfigFTP_RX_BUFSIZE						ipconfigFTP_TX_BUFSIZE
+	#endif
+	#ifndef ipconfigFTP_TX_WINSIZE
+		#define ipconfigFTP_TX_WINSIZE						( ipconfigFTP_TX_BUFSIZE / ipconfigTCP_MSS )
+	#endif
+	#ifndef ipconfigFTP_RX_WINSIZE
+		#define ipconfigFTP_RX_WINSIZE						( ipconfigFTP_RX_BUFSIZE / ipconfigTCP_MSS )
+	#endif
+#endif
+
 /*
  * This module only has 2 public functions:
  */
@@ -237,10 +267,45 @@ static BaseType_t prvMakeRemoveDir( FTPClient_t *pxClient, const char *pcDirecto
 
 /*
  * LIST: Send a directory listing in Unix style.
+ * NLST: Send the names only (xNamesOnly = pdTRUE).
  */
-static BaseType_t prvListSendPrep( FTPClient_t *pxClient );
+static BaseType_t prvListSendPrep( FTPClient_t *pxClient, BaseType_t xNamesOnly );
 static BaseType_t prvListSendWork( FTPClient_t *pxClient );
 
+/*
+ * Read directory entries and format them into the listing text, until at
+ * least 'uxWanted' bytes are waiting to be sent or the directory is done.
+ */
+static void prvListReadEntries( FTPClient_t *pxClient, size_t uxWanted );
+
+/*
+ * Append text to a listing, growing its buffer as needed.
+ */
+static BaseType_t prvListAppend( FTPList_t *pxList, const char *pcText, BaseType_t xLength );
+
+/*
+ * Find an up-to-date cached listing of a directory.
+ */
+static FTPList_t *prvListCacheLookup( FTPClient_t *pxClient, const char *pcPath, BaseType_t xNamesOnly );
+
+/*
+ * Get a new (empty) listing: a cache slot if one is available, otherwise the
+ * client's private listing.
+ */
+static FTPList_t *prvListStart( FTPClient_t *pxClient, const char *pcPath, BaseType_t xNamesOnly );
+
+/*
+ * Stop using the client's listing, and free it if it won't be sent again.
+ */
+static void prvListRelease( FTPClient_t *pxClient );
+static void prvListFree( FTPList_t *pxList );
+
+/*
+ * Called after a file or directory was created, changed or removed: all cached
+ * listings become outdated.
+ */
+static void prvFileSystemChanged( FTPClient_t *pxClient );
+
 /*
  * RETR: Send a file to the FTP client.
  */
@@ -256,7 +321,17 @@ static BaseType_t prvStoreFileWork( FTPClient_t *pxClient );
 /*
  * Print/format a single directory entry in Unix style.
  */
-static BaseType_t prvGetFileInfoStat( FF_DirEnt_t *pxEntry, char *pcLine, BaseType_t xMaxLength );
+static BaseType_t prvGetFileInfoStat( const FILINFO *pxEntry, char *pcLine, BaseType_t xMaxLength );
+
+/*
+ * Translate a FatFs result code into one of the pdFREERTOS_ERRNO_ values.
+ */
+static int prvFResultToErrno( FRESULT xResult );
+
+/*
+ * Returns pdTRUE if pcPath can be opened as a directory.
+ */
+static BaseType_t prvDirectoryExists( const char *pcPath );
 
 /*
  * Send a reply to a socket, either the command- or the data-socket.
@@ -399,8 +474,13 @@ BaseType_t xRc;
 
 static void prvTransferCloseDir( FTPClient_t *pxClient )
 {
-	/* Nothing to close for +FAT. */
-	( void ) pxClient;
+	if( pxClient->bits1.bDirIsOpen != pdFALSE_UNSIGNED )
+	{
+		f_closedir( &( pxClient->xDir ) );
+		pxClient->bits1.bDirIsOpen = pdFALSE_UNSIGNED;
+	}
+	prvListRelease( pxClient );
+	pxClient->bits1.bDirHasEntry = pdFALSE_UNSIGNED;
 }
 /*-----------------------------------------------------------*/
 
@@ -408,7 +488,7 @@ void vFTPClientDelete( TCPClient_t *pxTCPClient )
 {
 FTPClient_t *pxClient = ( FTPClient_t * ) pxTCPClient;
 
-	/* Close any directory-listing-handles (not used by +FAT ). */
+	/* Close any directory-listing-handles. */
 	prvTransferCloseDir( pxClient );
 	/* Close the data-socket. */
 	prvTransferCloseSocket( pxClient );
@@ -766,6 +846,7 @@ BaseType_t xResult = 0;
 			pxClient->bits.bLoggedIn = pdFALSE_UNSIGNED;
 			break;
 		case ECMD_LIST:
+		case ECMD_NLST:
 		case ECMD_RETR:
 		case ECMD_STOR:
 			if( ( pxClient->xTransferSocket == FREERTOS_NO_SOCKET ) &&
@@ -792,7 +873,8 @@ BaseType_t xResult = 0;
 				switch( pxFTPCommand->ucCommandType )
 				{
 				case ECMD_LIST:
-					prvListSendPrep( pxClient );
+				case ECMD_NLST:
+					prvListSendPrep( pxClient, pxFTPCommand->ucCommandType == ECMD_NLST );
 					break;
 				case ECMD_RETR:
 					prvRetrieveFilePrep( pxClient, pcRestCommand );
@@ -824,11 +906,10 @@ BaseType_t xResult = 0;
 			{
 				static const char pcFeatAnswer[] =
 					"211-Features:\x0a"
-					/* The MDTM command is only allowed when
-					there is support for date&time. */
-				#if( ffconfigTIME_SUPPORT != 0 )
+					/* FatFs keeps a time stamp for every entry,
+					although it is a fixed date when FF_FS_NORTC
+					is set. */
 					" MDTM\x0a"
-				#endif
 					" REST STREAM\x0a"
 					" SIZE\x0d\x0a"
 					"211 End\x0d\x0a";
@@ -1123,6 +1204,7 @@ static void prvTransferCloseSocket( FTPClient_t *pxClient )
 	}
 	pxClient->bits1.bIsListen = pdFALSE_UNSIGNED;
 	pxClient->bits1.bDirHasEntry = pdFALSE_UNSIGNED;
+	prvTransferCloseDir( pxClient );
 	pxClient->bits1.bClientConnected = pdFALSE_UNSIGNED;
 	pxClient->bits1.bHadError = pdFALSE_UNSIGNED;
 }
@@ -1132,8 +1214,9 @@ static void prvTransferCloseFile( FTPClient_t *pxClient )
 {
 	if( pxClient->pxWriteHandle != NULL )
 	{
-		ff_fclose( pxClient->pxWriteHandle );
+		f_close( pxClient->pxWriteHandle );
 		pxClient->pxWriteHandle = NULL;
+		prvFileSystemChanged( pxClient );
 		#if( ipconfigFTP_HAS_RECEIVED_HOOK != 0 )
 		{
 			vApplicationFTPReceivedHook( pxClient->pcFileName, pxClient->ulRecvBytes, pxClient );
@@ -1143,7 +1226,7 @@ static void prvTransferCloseFile( FTPClient_t *pxClient )
 	}
 	if( pxClient->pxReadHandle != NULL )
 	{
-		ff_fclose( pxClient->pxReadHandle );
+		f_close( pxClient->pxReadHandle );
 		pxClient->pxReadHandle = NULL;
 	}
 	/* These two field are only used for logging / file-statistics */
@@ -1319,9 +1402,10 @@ UBaseType_t uxResult;
 static BaseType_t prvStoreFilePrep( FTPClient_t *pxClient, char *pcFileName )
 {
 BaseType_t xResult;
-FF_FILE *pxNewHandle;
+FIL *pxNewHandle;
+FRESULT xFResult;
 size_t uxFileSize = 0ul;
-int iErrorNo;
+int iErrorNo = 0;
 
 	/* Close previous handle (if any) and reset file transfer parameters. */
 	prvTransferCloseFile( pxClient );
@@ -1333,25 +1417,26 @@ int iErrorNo;
 	if( pxClient->ulRestartOffset != 0 )
 	{
 	size_t uxOffset = pxClient->ulRestartOffset;
-	int32_t lRc;
+	FRESULT xSeekResult;
 
 		pxClient->ulRestartOffset = 0ul; /* Only use 1 time. */
-		pxNewHandle = ff_fopen( pxClient->pcFileName, "ab" );
+		xFResult = f_open( &( pxClient->xFile ), pxClient->pcFileName, FA_WRITE | FA_OPEN_ALWAYS );
 
-		if( pxNewHandle != NULL )
+		if( xFResult == FR_OK )
 		{
-			uxFileSize = pxNewHandle->ulFileSize;
+			pxNewHandle = &( pxClient->xFile );
+			uxFileSize = ( size_t ) f_size( pxNewHandle );
 
 			if( uxOffset <= uxFileSize )
 			{
-				lRc = ff_fseek( pxNewHandle, uxOffset, FF_SEEK_SET );
+				xSeekResult = f_lseek( pxNewHandle, ( FSIZE_t ) uxOffset );
 			}
 			else
 			{
 				/* Won't even try to seek after EOF */
-				lRc = -pdFREERTOS_ERRNO_EINVAL;
+				xSeekResult = FR_INVALID_PARAMETER;
 			}
-			if( lRc != 0 )
+			if( xSeekResult != FR_OK )
 			{
 			BaseType_t xLength;
 
@@ -1365,19 +1450,30 @@ int iErrorNo;
 				FreeRTOS_printf( ( "ftp::storeFile: create %s: Seek %u length %u\n",
 					pxClient->pcFileName, ( unsigned ) uxOffset, ( unsigned ) uxFileSize ) );
 
-				ff_fclose( pxNewHandle );
+				f_close( pxNewHandle );
 				pxNewHandle = NULL;
 			}
 		}
+		else
+		{
+			iErrorNo = prvFResultToErrno( xFResult );
+		}
 	}
 	else
 	{
-		pxNewHandle = ff_fopen( pxClient->pcFileName, "wb" );
+		xFResult = f_open( &( pxClient->xFile ), pxClient->pcFileName, FA_WRITE | FA_CREATE_ALWAYS );
+		if( xFResult == FR_OK )
+		{
+			pxNewHandle = &( pxClient->xFile );
+		}
+		else
+		{
+			iErrorNo = prvFResultToErrno( xFResult );
+		}
 	}
 
 	if( pxNewHandle == NULL )
 	{
-		iErrorNo = stdioGET_ERRNO();
 		if( iErrorNo == pdFREERTOS_ERRNO_ENOSPC )
 		{
 			prvSendReply( pxClient->xSocket, REPL_552, 0 );
@@ -1413,6 +1509,8 @@ int iErrorNo;
 		}
 
 		pxClient->pxWriteHandle = pxNewHandle;
+		/* The file has been created or truncated. */
+		prvFileSystemChanged( pxClient );
 
 		/* To get some statistics about the performance. */
 		pxClient->xStartTime = xTaskGetTickCount( );
@@ -1428,7 +1526,8 @@ int iErrorNo;
 
 	static BaseType_t prvStoreFileWork( FTPClient_t *pxClient )
 	{
-	BaseType_t xRc, xWritten;
+	BaseType_t xRc;
+	UINT uxWritten;
 
 		/* Read from the data socket until all has been read or until a negative value
 		is returned. */
@@ -1444,9 +1543,12 @@ int iErrorNo;
 				break;
 			}
 			pxClient->ulRecvBytes += xRc;
-			xWritten = ff_fwrite( pcBuffer, 1, xRc, pxClient->pxWriteHandle );
+			if( f_write( pxClient->pxWriteHandle, pcBuffer, ( UINT ) xRc, &uxWritten ) != FR_OK )
+			{
+				uxWritten = 0u;
+			}
 			FreeRTOS_recv( pxClient->xTransferSocket, ( void * ) NULL, xRc, 0 );
-			if( xWritten != xRc )
+			if( uxWritten != ( UINT ) xRc )
 			{
 				xRc = -1;
 				/* bHadError: a transfer got aborted because of an error. */
@@ -1461,7 +1563,8 @@ int iErrorNo;
 
 	static BaseType_t prvStoreFileWork( FTPClient_t *pxClient )
 	{
-	BaseType_t xRc, xWritten;
+	BaseType_t xRc;
+	UINT uxWritten;
 
 		/* Read from the data socket until all has been read or until a negative
 		value is returned. */
@@ -1526,12 +1629,17 @@ int iErrorNo;
 			}
 			pxClient->ulRecvBytes += xRc;
 
-			xWritten = ff_fwrite( pcBuffer, 1, xRc, pxClient->pxWriteHandle );
+			/* As long as the file pointer stays sector-aligned, FatFs passes
+			whole sectors straight from the socket's RX stream to disk_write(). */
+			if( f_write( pxClient->pxWriteHandle, pcBuffer, ( UINT ) xRc, &uxWritten ) != FR_OK )
+			{
+				uxWritten = 0u;
+			}
 			if( pcBuffer != pcFILE_BUFFER )
 			{
 				FreeRTOS_recv( pxClient->xTransferSocket, ( void * ) NULL, xRc, 0 );
 			}
-			if( xWritten != xRc )
+			if( uxWritten != ( UINT ) xRc )
 			{
 				xRc = -1;
 				/* bHadError: a transfer got aborted because of an error. */
@@ -1560,42 +1668,44 @@ static BaseType_t prvRetrieveFilePrep( FTPClient_t *pxClient, char *pcFileName )
 {
 BaseType_t xResult = pdTRUE;
 size_t uxFileSize;
+FRESULT xFResult;
 
 	/* Close previous handle (if any) and reset file transfer parameters */
 	prvTransferCloseFile( pxClient );
 
 	xMakeAbsolute( pxClient, pxClient->pcFileName, sizeof( pxClient->pcFileName ), pcFileName );
 
-	pxClient->pxReadHandle = ff_fopen( pxClient->pcFileName, "rb" );
-	if( pxClient->pxReadHandle == NULL )
+	xFResult = f_open( &( pxClient->xFile ), pxClient->pcFileName, FA_READ );
+	if( xFResult != FR_OK )
 	{
 		/* "Requested file action not taken". */
 		prvSendReply( pxClient->xSocket, REPL_450, 0 );
-		FreeRTOS_printf( ("prvRetrieveFilePrep: open %s: %s\n", pxClient->pcFileName, ( const char * ) strerror( stdioGET_ERRNO() ) ) );
+		FreeRTOS_printf( ("prvRetrieveFilePrep: open %s: %s\n", pxClient->pcFileName, ( const char * ) strerror( prvFResultToErrno( xFResult ) ) ) );
 		uxFileSize = 0ul;
 		xResult = pdFALSE;
 	}
 	else
 	{
-		uxFileSize = pxClient->pxReadHandle->ulFileSize;
+		pxClient->pxReadHandle = &( pxClient->xFile );
+		uxFileSize = ( size_t ) f_size( pxClient->pxReadHandle );
 		pxClient->uxBytesLeft = uxFileSize;
 		if( pxClient->ulRestartOffset != 0ul )
 		{
 		size_t uxOffset = pxClient->ulRestartOffset;
-		int32_t iRc;
+		FRESULT xSeekResult;
 
 			/* Only use 1 time. */
 			pxClient->ulRestartOffset = 0;
 
 			if( uxOffset < uxFileSize )
 			{
-				iRc = ff_fseek( pxClient->pxReadHandle, uxOffset, FF_SEEK_SET );
+				xSeekResult = f_lseek( pxClient->pxReadHandle, ( FSIZE_t ) uxOffset );
 			}
 			else
 			{
-				iRc = -pdFREERTOS_ERRNO_EINVAL;
+				xSeekResult = FR_INVALID_PARAMETER;
 			}
-			if( iRc != 0 )
+			if( xSeekResult != FR_OK )
 			{
 			BaseType_t xLength;
 
@@ -1608,13 +1718,13 @@ size_t uxFileSize;
 				FreeRTOS_printf( ( "prvRetrieveFilePrep: create %s: Seek %u length %u\n",
 					pxClient->pcFileName, ( unsigned ) uxOffset, ( unsigned ) uxFileSize ) );
 
-				ff_fclose( pxClient->pxReadHandle );
+				f_close( pxClient->pxReadHandle );
 				pxClient->pxReadHandle = NULL;
 				xResult = pdFALSE;
 			}
 			else
 			{
-				pxClient->uxBytesLeft = uxFileSize - pxClient->ulRestartOffset;
+				pxClient->uxBytesLeft = uxFileSize - uxOffset;
 			}
 		}
 	}
@@ -1658,7 +1768,8 @@ size_t uxFileSize;
 static BaseType_t prvRetrieveFileWork( FTPClient_t *pxClient )
 {
 size_t uxSpace;
-size_t uxCount, uxItemsRead;
+size_t uxCount;
+UINT uxItemsRead;
 BaseType_t xRc = 0;
 BaseType_t xSetEvent = pdFALSE;
 
@@ -1694,7 +1805,10 @@ BaseType_t xSetEvent = pdFALSE;
 			{
 				uxCount = sizeof( pcFILE_BUFFER );
 			}
-			uxItemsRead = ff_fread( pcFILE_BUFFER, 1, uxCount, pxClient->pxReadHandle );
+			if( f_read( pxClient->pxReadHandle, pcFILE_BUFFER, ( UINT ) uxCount, &uxItemsRead ) != FR_OK )
+			{
+				uxItemsRead = 0u;
+			}
 			if( uxItemsRead != uxCount )
 			{
 				FreeRTOS_printf( ( "prvRetrieveFileWork: Got %u Expected %u\n", ( unsigned )uxItemsRead, ( unsigned ) uxCount ) );
@@ -1749,7 +1863,12 @@ BaseType_t xSetEvent = pdFALSE;
 				break;
 			}
 
-			uxItemsRead = ff_fread( pcBuffer, 1, uxCount, pxClient->pxReadHandle );
+			/* Whole sectors at a sector-aligned file position are read by
+			FatFs directly into pcBuffer, without passing its sector cache. */
+			if( f_read( pxClient->pxReadHandle, pcBuffer, ( UINT ) uxCount, &uxItemsRead ) != FR_OK )
+			{
+				uxItemsRead = 0u;
+			}
 
 			if( uxCount != uxItemsRead )
 			{
@@ -1828,11 +1947,11 @@ BaseType_t xSetEvent = pdFALSE;
  #    #   #   #    #   #
 ####### #####  ####   ####
 */
-/* Prepare sending a directory LIST */
-static BaseType_t prvListSendPrep( FTPClient_t *pxClient )
+/* Prepare sending a directory LIST or NLST */
+static BaseType_t prvListSendPrep( FTPClient_t *pxClient, BaseType_t xNamesOnly )
 {
-BaseType_t xFindResult;
-int iErrorNo;
+FTPList_t *pxList;
+FRESULT xFResult;
 
 	if( pxClient->bits1.bIsListen != pdFALSE_UNSIGNED )
 	{
@@ -1857,21 +1976,37 @@ int iErrorNo;
 	pxClient->xDirCount = 0;
 	xMakeAbsolute( pxClient, pcNEW_DIR, sizeof( pcNEW_DIR ), pxClient->pcCurrentDir );
 
-	xFindResult = ff_findfirst( pcNEW_DIR, &pxClient->xFindData );
-
-	pxClient->bits1.bDirHasEntry = ( xFindResult >= 0 );
+	/* A previous LIST may have been aborted. */
+	prvTransferCloseDir( pxClient );
 
-	iErrorNo = stdioGET_ERRNO();
-	if( ( xFindResult < 0 ) && ( iErrorNo == pdFREERTOS_ERRNO_ENMFILE ) )
+	pxList = prvListCacheLookup( pxClient, pcNEW_DIR, xNamesOnly );
+	if( pxList != NULL )
 	{
-		FreeRTOS_printf( ("prvListSendPrep: Empty directory? (%s)\n", pxClient->pcCurrentDir ) );
-		prvSendReply( pxClient->xTransferSocket, "total 0\r\n", 0 );
-		pxClient->xDirCount++;
+		/* Nothing has changed since this listing was made: send it again
+		without reading the directory. */
+		pxList->uxUsers++;
+		pxList->xLastUsed = xTaskGetTickCount( );
+	}
+	else
+	{
+		xFResult = f_opendir( &( pxClient->xDir ), pcNEW_DIR );
+		if( xFResult == FR_OK )
+		{
+			pxClient->bits1.bDirIsOpen = pdTRUE_UNSIGNED;
+			pxList = prvListStart( pxClient, pcNEW_DIR, xNamesOnly );
+		}
+		else
+		{
+			FreeRTOS_printf( ( "prvListSendPrep: %s: FRESULT %d\n", pcNEW_DIR, ( int ) xFResult ) );
+			prvSendReply( pxClient->xSocket, REPL_451, 0 );
+		}
 	}
-	else if( xFindResult < 0 )
+
+	if( pxList != NULL )
 	{
-		FreeRTOS_printf( ( "prvListSendPrep: rc = %ld iErrorNo = %d\n", xFindResult, iErrorNo ) );
-		prvSendReply( pxClient->xSocket, REPL_451, 0 );
+		pxClient->pxList = pxList;
+		pxClient->uxListOffset = 0u;
+		pxClient->bits1.bDirHasEntry = pdTRUE_UNSIGNED;
 	}
 	pxClient->pcClientAck[ 0 ] = '\0';
 
@@ -1879,96 +2014,370 @@ int iErrorNo;
 }
 /*-----------------------------------------------------------*/
 
-#define	MAX_DIR_LIST_ENTRY_SIZE		256
-
 static BaseType_t prvListSendWork( FTPClient_t *pxClient )
 {
-BaseType_t xTxSpace;
-
-	while( pxClient->bits1.bClientConnected != pdFALSE_UNSIGNED )
+	while( ( pxClient->bits1.bClientConnected != pdFALSE_UNSIGNED ) && ( pxClient->pxList != NULL ) )
 	{
-	char *pcWritePtr = pcCOMMAND_BUFFER;
-	BaseType_t xWriteLength;
+	FTPList_t *pxList = pxClient->pxList;
+	BaseType_t xTxSpace, xLastChunk;
+	size_t uxCount;
 
 		xTxSpace = FreeRTOS_tx_space( pxClient->xTransferSocket );
 
-		if( xTxSpace > ( BaseType_t ) sizeof( pcCOMMAND_BUFFER ) )
+		if( xTxSpace <= 0 )
+		{
+			break;
+		}
+
+		if( ( pxList->ucKeep == pdFALSE ) && ( pxClient->uxListOffset != 0u ) )
 		{
-			xTxSpace = sizeof( pcCOMMAND_BUFFER );
+			/* This text will not be sent again, drop the part that has been
+			sent already. */
+			pxList->uxLength -= pxClient->uxListOffset;
+			memmove( pxList->pcText, pxList->pcText + pxClient->uxListOffset, pxList->uxLength );
+			pxClient->uxListOffset = 0u;
 		}
 
-		while( ( xTxSpace >= MAX_DIR_LIST_ENTRY_SIZE ) && ( pxClient->bits1.bDirHasEntry != pdFALSE_UNSIGNED ) )
+		/* Read and format entries until there is enough to fill the TX stream,
+		so that the listing goes out in large sends. */
+		prvListReadEntries( pxClient, ( size_t ) xTxSpace );
+
+		uxCount = FreeRTOS_min_uint32( pxList->uxLength - pxClient->uxListOffset, ( uint32_t ) xTxSpace );
+		xLastChunk = ( pxClient->bits1.bDirIsOpen == pdFALSE_UNSIGNED ) &&
+			( ( pxClient->uxListOffset + uxCount ) == pxList->uxLength );
+
+		if( xLastChunk != pdFALSE )
 		{
-		BaseType_t xLength, xEndOfDir;
-		int32_t iRc;
-		int iErrorNo;
+		uint32_t ulTotalCount;
+		uint32_t ulPercentage;
+		DWORD ulFreeClusters;
+		FATFS *pxFatFs;
 
-			xLength = prvGetFileInfoStat( &( pxClient->xFindData.xDirectoryEntry ), pcWritePtr, xTxSpace );
+			pxClient->xDirCount = pxList->xEntryCount;
 
-			pxClient->xDirCount++;
-			pcWritePtr += xLength;
-			xTxSpace -= xLength;
+			/* Count the volume size in KB, and the percentage of free clusters. */
+			if( ( f_getfree( "", &ulFreeClusters, &pxFatFs ) == FR_OK ) && ( pxFatFs->n_fatent > 2 ) )
+			{
+				ulTotalCount = ( uint32_t ) ( ( ( uint64_t ) ( pxFatFs->n_fatent - 2 ) * pxFatFs->csize * FF_MAX_SS ) / 1024 );
+				ulPercentage = ( uint32_t ) ( ( 100ULL * ulFreeClusters + ( pxFatFs->n_fatent - 2 ) / 2 ) / ( pxFatFs->n_fatent - 2 ) );
+			}
+			else
+			{
+				ulTotalCount = 0;
+				ulPercentage = 0;
+			}
 
-			iRc = ff_findnext( &pxClient->xFindData );
-			iErrorNo = stdioGET_ERRNO();
+			/* Prepare the ACK which will be sent when all data has been sent.
+			Only LIST sends the long format. */
+			if( pxClient->bits1.bHadError == pdFALSE_UNSIGNED )
+			{
+				snprintf( pxClient->pcClientAck, sizeof( pxClient->pcClientAck ),
+					"%s"
+					"226-%ld matches total\r\n"
+					"226 Total %lu KB (%lu %% free)\r\n",
+					( pxList->ucNamesOnly != pdFALSE ) ? "" : "226-Options: -l\r\n",
+					pxClient->xDirCount, ulTotalCount, ulPercentage );
+			}
+			else
+			{
+				snprintf( pxClient->pcClientAck, sizeof( pxClient->pcClientAck ), "%s", REPL_451 );
+			}
 
-			xEndOfDir = ( iRc < 0 ) && ( iErrorNo == pdFREERTOS_ERRNO_ENMFILE );
+			if( uxCount != 0u )
+			{
+			BaseType_t xTrueValue = 1;
 
-			pxClient->bits1.bDirHasEntry = ( xEndOfDir == pdFALSE ) && ( iRc >= 0 );
+				FreeRTOS_setsockopt( pxClient->xTransferSocket, 0, FREERTOS_SO_CLOSE_AFTER_SEND, ( void * ) &xTrueValue, sizeof( xTrueValue ) );
+			}
+			else
+			{
+				FreeRTOS_shutdown( pxClient->xTransferSocket, FREERTOS_SHUT_RDWR );
+			}
+		}
 
-			if( ( iRc < 0 ) && ( xEndOfDir == pdFALSE ) )
+		if( uxCount != 0u )
+		{
+		BaseType_t xRc;
+
+			xRc = FreeRTOS_send( pxClient->xTransferSocket, pxList->pcText + pxClient->uxListOffset, uxCount, 0 );
+			if( xRc <= 0 )
 			{
-				FreeRTOS_printf( ("prvListSendWork: %s (rc %08x)\n",
-					( const char * ) strerror( iErrorNo ),
-					( unsigned )iRc ) );
+				break;
 			}
+			pxClient->uxListOffset += ( size_t ) xRc;
 		}
-		xWriteLength = ( BaseType_t ) ( pcWritePtr - pcCOMMAND_BUFFER );
 
-		if( xWriteLength == 0 )
+		if( xLastChunk != pdFALSE )
 		{
+			prvSendReply( pxClient->xSocket, pxClient->pcClientAck, 0 );
+			prvTransferCloseDir( pxClient );
 			break;
 		}
 
-		if( pxClient->bits1.bDirHasEntry == pdFALSE_UNSIGNED )
+		if( uxCount == 0u )
 		{
-		uint32_t ulTotalCount;
-		uint32_t ulFreeCount;
-		uint32_t ulPercentage;
+			break;
+		}
+	}	/* while( pxClient->bits1.bClientConnected )  */
+
+	return 0;
+}
+/*-----------------------------------------------------------*/
+
+static void prvListReadEntries( FTPClient_t *pxClient, size_t uxWanted )
+{
+FTPList_t *pxList = pxClient->pxList;
+
+	while( ( pxClient->bits1.bDirIsOpen != pdFALSE_UNSIGNED ) &&
+		( ( pxList->uxLength - pxClient->uxListOffset ) < uxWanted ) )
+	{
+	FRESULT xFResult;
+	BaseType_t xLength = 0;
 
-			ulTotalCount = 1;
-			ulFreeCount = ff_diskfree( pxClient->pcCurrentDir, &ulTotalCount );
-			ulPercentage = ( uint32_t ) ( ( 100ULL * ulFreeCount + ulTotalCount / 2 ) / ulTotalCount );
+		xFResult = f_readdir( &( pxClient->xDir ), &( pxClient->xFileInfo ) );
 
-			/* Prepare the ACK which will be sent when all data has been sent. */
-			snprintf( pxClient->pcClientAck, sizeof( pxClient->pcClientAck ),
-				"226-Options: -l\r\n"
-				"226-%ld matches total\r\n"
-				"226 Total %lu KB (%lu %% free)\r\n",
-				pxClient->xDirCount, ulTotalCount /1024, ulPercentage );
+		/* f_readdir() returns an empty name at the end of the directory. */
+		if( ( xFResult != FR_OK ) || ( pxClient->xFileInfo.fname[ 0 ] == '\0' ) )
+		{
+			if( xFResult != FR_OK )
+			{
+				FreeRTOS_printf( ("prvListReadEntries: %s (FRESULT %d)\n",
+					( const char * ) strerror( prvFResultToErrno( xFResult ) ),
+					( int ) xFResult ) );
+				pxClient->bits1.bHadError = pdTRUE_UNSIGNED;
+			}
+			else if( ( pxList->xEntryCount == 0 ) && ( pxList->ucNamesOnly == pdFALSE ) )
+			{
+				FreeRTOS_printf( ("prvListReadEntries: Empty directory? (%s)\n", pxClient->pcCurrentDir ) );
+				xLength = snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ), "total 0\r\n" );
+				prvListAppend( pxList, pcCOMMAND_BUFFER, xLength );
+			}
+			f_closedir( &( pxClient->xDir ) );
+			pxClient->bits1.bDirIsOpen = pdFALSE_UNSIGNED;
+			pxList->ucComplete = ( xFResult == FR_OK ) && ( pxList->ucKeep != pdFALSE );
+			break;
 		}
 
-		if( xWriteLength )
+		if( pxList->ucNamesOnly != pdFALSE )
+		{
+			xLength = snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ), "%s\r\n", pxClient->xFileInfo.fname );
+		}
+		else
 		{
-			if( pxClient->bits1.bDirHasEntry == pdFALSE_UNSIGNED )
+			xLength = prvGetFileInfoStat( &( pxClient->xFileInfo ), pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ) );
+		}
+
+		if( ( pxList->ucKeep != pdFALSE ) && ( ( pxList->uxLength + ( size_t ) xLength ) > ( size_t ) ipconfigFTP_LIST_CACHE_MAX_SIZE ) )
+		{
+			/* Too large to cache: from now on the text is dropped once sent. */
+			pxList->ucKeep = pdFALSE;
+		}
+
+		if( prvListAppend( pxList, pcCOMMAND_BUFFER, xLength ) == pdFALSE )
+		{
+			FreeRTOS_printf( ("prvListReadEntries: out of memory after %ld entries\n", pxList->xEntryCount ) );
+			pxClient->bits1.bHadError = pdTRUE_UNSIGNED;
+			f_closedir( &( pxClient->xDir ) );
+			pxClient->bits1.bDirIsOpen = pdFALSE_UNSIGNED;
+			break;
+		}
+		pxList->xEntryCount++;
+	}
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvListAppend( FTPList_t *pxList, const char *pcText, BaseType_t xLength )
+{
+size_t uxNeeded = pxList->uxLength + ( size_t ) xLength;
+
+	if( uxNeeded > pxList->uxSize )
+	{
+	size_t uxNewSize = ( pxList->uxSize != 0u ) ? pxList->uxSize : ftpLIST_INITIAL_SIZE;
+	char *pcNewText;
+
+		while( uxNewSize < uxNeeded )
+		{
+			uxNewSize *= 2u;
+		}
+		pcNewText = ( char * ) pvPortMalloc( uxNewSize );
+		if( pcNewText == NULL )
+		{
+			return pdFALSE;
+		}
+		if( pxList->pcText != NULL )
+		{
+			memcpy( pcNewText, pxList->pcText, pxList->uxLength );
+			vPortFree( pxList->pcText );
+		}
+		pxList->pcText = pcNewText;
+		pxList->uxSize = uxNewSize;
+	}
+	memcpy( pxList->pcText + pxList->uxLength, pcText, ( size_t ) xLength );
+	pxList->uxLength = uxNeeded;
+
+	return pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+static FTPList_t *prvListCacheLookup( FTPClient_t *pxClient, const char *pcPath, BaseType_t xNamesOnly )
+{
+FTPList_t *pxResult = NULL;
+
+	#if( ipconfigFTP_LIST_CACHE_COUNT > 0 )
+	{
+	TCPServer_t *pxServer = pxClient->pxParent;
+	BaseType_t x;
+
+		for( x = 0; x < ipconfigFTP_LIST_CACHE_COUNT; x++ )
+		{
+		FTPList_t *pxList = &( pxServer->xListCache[ x ] );
+
+			if( ( pxList->ucComplete != pdFALSE ) &&
+				( pxList->ulModCount == pxServer->ulModCount ) &&
+				( pxList->ucNamesOnly == ( uint8_t ) xNamesOnly ) &&
+				( strcmp( pxList->pcPath, pcPath ) == 0 ) )
 			{
-			BaseType_t xTrueValue = 1;
+				pxResult = pxList;
+				break;
+			}
+		}
+	}
+	#else
+	{
+		( void ) pxClient;
+		( void ) pcPath;
+		( void ) xNamesOnly;
+	}
+	#endif /* ipconfigFTP_LIST_CACHE_COUNT */
 
-				FreeRTOS_setsockopt( pxClient->xTransferSocket, 0, FREERTOS_SO_CLOSE_AFTER_SEND, ( void * ) &xTrueValue, sizeof( xTrueValue ) );
+	return pxResult;
+}
+/*-----------------------------------------------------------*/
+
+static FTPList_t *prvListStart( FTPClient_t *pxClient, const char *pcPath, BaseType_t xNamesOnly )
+{
+FTPList_t *pxResult = NULL;
+TickType_t xNow = xTaskGetTickCount( );
+
+	#if( ipconfigFTP_LIST_CACHE_COUNT > 0 )
+	{
+	TCPServer_t *pxServer = pxClient->pxParent;
+	TickType_t xAge, xOldest = 0u;
+	BaseType_t x;
+
+		/* Take a free slot, or else the least recently used one that no other
+		client is sending from. */
+		for( x = 0; x < ipconfigFTP_LIST_CACHE_COUNT; x++ )
+		{
+		FTPList_t *pxList = &( pxServer->xListCache[ x ] );
+
+			if( pxList->uxUsers != 0u )
+			{
+				continue;
 			}
+			xAge = ( pxList->pcPath == NULL ) ? portMAX_DELAY : ( xNow - pxList->xLastUsed );
+			if( ( pxResult == NULL ) || ( xAge > xOldest ) )
+			{
+				pxResult = pxList;
+				xOldest = xAge;
+			}
+		}
+
+		if( pxResult != NULL )
+		{
+		size_t uxPathLength = strlen( pcPath ) + 1u;
 
-			prvSendReply( pxClient->xTransferSocket, pcCOMMAND_BUFFER, xWriteLength );
+			prvListFree( pxResult );
+			pxResult->pcPath = ( char * ) pvPortMalloc( uxPathLength );
+			if( pxResult->pcPath != NULL )
+			{
+				memcpy( pxResult->pcPath, pcPath, uxPathLength );
+				pxResult->ucKeep = pdTRUE;
+			}
+			else
+			{
+				pxResult = NULL;
+			}
 		}
+	}
+	#else
+	{
+		( void ) pcPath;
+	}
+	#endif /* ipconfigFTP_LIST_CACHE_COUNT */
+
+	if( pxResult == NULL )
+	{
+		/* Not cached, the text is freed once it has been sent. */
+		pxResult = &( pxClient->xPrivateList );
+		prvListFree( pxResult );
+		pxResult->ucKeep = pdFALSE;
+	}
+
+	pxResult->ulModCount = pxClient->pxParent->ulModCount;
+	pxResult->xLastUsed = xNow;
+	pxResult->xEntryCount = 0;
+	pxResult->ucNamesOnly = ( uint8_t ) xNamesOnly;
+	pxResult->ucComplete = pdFALSE;
+	pxResult->uxUsers = 1u;
+
+	return pxResult;
+}
+/*-----------------------------------------------------------*/
+
+static void prvListRelease( FTPClient_t *pxClient )
+{
+FTPList_t *pxList = pxClient->pxList;
 
-		if( pxClient->bits1.bDirHasEntry == pdFALSE_UNSIGNED )
+	if( pxList != NULL )
+	{
+		pxClient->pxList = NULL;
+		pxClient->uxListOffset = 0u;
+		pxList->uxUsers--;
+
+		if( ( pxList->uxUsers == 0u ) &&
+			( ( pxList->ucComplete == pdFALSE ) || ( pxList->ulModCount != pxClient->pxParent->ulModCount ) ) )
 		{
-			prvSendReply( pxClient->xSocket, pxClient->pcClientAck, 0 );
-			break;
+			/* An aborted, private or outdated listing will not be sent again. */
+			prvListFree( pxList );
 		}
+	}
+}
+/*-----------------------------------------------------------*/
 
-	}	/* while( pxClient->bits1.bClientConnected )  */
+static void prvListFree( FTPList_t *pxList )
+{
+	if( pxList->pcText != NULL )
+	{
+		vPortFree( pxList->pcText );
+	}
+	if( pxList->pcPath != NULL )
+	{
+		vPortFree( pxList->pcPath );
+	}
+	memset( pxList, '\0', sizeof( *pxList ) );
+}
+/*-----------------------------------------------------------*/
 
-	return 0;
+static void prvFileSystemChanged( FTPClient_t *pxClient )
+{
+	/* Cached listings made before this moment are outdated. */
+	pxClient->pxParent->ulModCount++;
+
+	#if( ipconfigFTP_LIST_CACHE_COUNT > 0 )
+	{
+	BaseType_t x;
+
+		/* Release their memory now, unless a client is still sending one. */
+		for( x = 0; x < ipconfigFTP_LIST_CACHE_COUNT; x++ )
+		{
+			if( pxClient->pxParent->xListCache[ x ].uxUsers == 0u )
+			{
+				prvListFree( &( pxClient->pxParent->xListCache[ x ] ) );
+			}
+		}
+	}
+	#endif /* ipconfigFTP_LIST_CACHE_COUNT */
 }
 /*-----------------------------------------------------------*/
 
@@ -1983,7 +2392,7 @@ static const char pcMonthList[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
 };
 /*-----------------------------------------------------------*/
 
-static BaseType_t prvGetFileInfoStat( FF_DirEnt_t *pxEntry, char *pcLine, BaseType_t xMaxLength )
+static BaseType_t prvGetFileInfoStat( const FILINFO *pxEntry, char *pcLine, BaseType_t xMaxLength )
 {
 	char date[ 16 ];
 	char mode[ 11 ]	= "----------";
@@ -1999,53 +2408,36 @@ static BaseType_t prvGetFileInfoStat( FF_DirEnt_t *pxEntry, char *pcLine, BaseTy
  * -rw-rw-r--   1 freertos FreeRTOS+FAT 11100621 Sep 01 00:16 05.  D-Chill - Mistake (feat. Katy Blue).mp3
  */
 
-	#if ( ffconfigTIME_SUPPORT == 1 )
-		const FF_SystemTime_t *pxCreateTime = &( pxEntry->xCreateTime );
-	#else
-	#warning Do not use this.
-		FF_SystemTime_t xCreateTime;
-		const FF_SystemTime_t *pxCreateTime = &xCreateTime;
-	#endif
-	size_t ulSize = ( size_t )pxEntry->ulFileSize;
-	const char *pcFileName = pxEntry->pcFileName;
+	/* FAT date: bits 15-9 year since 1980, 8-5 month, 4-0 day.
+	FAT time: bits 15-11 hour, 10-5 minute. */
+	BaseType_t xMonth = ( pxEntry->fdate >> 5 ) & 0x0F;
+	BaseType_t xDay = pxEntry->fdate & 0x1F;
+	BaseType_t xHour = ( pxEntry->ftime >> 11 ) & 0x1F;
+	BaseType_t xMinute = ( pxEntry->ftime >> 5 ) & 0x3F;
+	size_t ulSize = ( size_t )pxEntry->fsize;
+	const char *pcFileName = pxEntry->fname;
 
-	mode[ 0 ] = ( ( pxEntry->ucAttrib & FF_FAT_ATTR_DIR ) != 0 ) ? 'd' : '-';
-	#if( ffconfigDEV_SUPPORT != 0 )
-	{
-		if( ( pxEntry->ucAttrib & FF_FAT_ATTR_DIR ) == 0 )
-		{
-			switch( pxEntry->ucIsDeviceDir )
-			{
-			case FF_DEV_CHAR_DEV:
-				mode[ 0 ] = 'c';
-				break;
-			case FF_DEV_BLOCK_DEV:
-				mode[ 0 ] = 'b';
-				break;
-			}
-		}
-	}
-	#endif /* ffconfigDEV_SUPPORT != 0 */
+	mode[ 0 ] = ( ( pxEntry->fattrib & AM_DIR ) != 0 ) ? 'd' : '-';
 
 	mode[ 1 ] = 'r';	/* Owner. */
-	mode[ 2 ] = ( ( pxEntry->ucAttrib & FF_FAT_ATTR_READONLY ) != 0 ) ? '-' : 'w';
+	mode[ 2 ] = ( ( pxEntry->fattrib & AM_RDO ) != 0 ) ? '-' : 'w';
 	mode[ 3 ] = '-';	/* x for executable. */
 
 	mode[ 4 ] = 'r';	/* group. */
-	mode[ 5 ] = ( ( pxEntry->ucAttrib & FF_FAT_ATTR_READONLY ) != 0 ) ? '-' : 'w';
+	mode[ 5 ] = ( ( pxEntry->fattrib & AM_RDO ) != 0 ) ? '-' : 'w';
 	mode[ 6 ] = '-';	/* x for executable. */
 
 	mode[ 7 ] = 'r';	/* world. */
 	mode[ 8 ] = '-';
 	mode[ 9 ] = '-';	/* x for executable. */
 
-	if( pxCreateTime->Month && pxCreateTime->Day )
+	if( xMonth && xDay )
 	{
 		snprintf( date, sizeof( date ), "%-3.3s %02d %02d:%02d",
-			pcMonthAbbrev( pxCreateTime->Month ),
-			pxCreateTime->Day,
-			pxCreateTime->Hour,
-			pxCreateTime->Minute );
+			pcMonthAbbrev( xMonth ),
+			( int ) xDay,
+			( int ) xHour,
+			( int ) xMinute );
 	}
 	else
 	{
@@ -2070,7 +2462,7 @@ static BaseType_t prvGetFileInfoStat( FF_DirEnt_t *pxEntry, char *pcLine, BaseTy
 static BaseType_t prvChangeDir( FTPClient_t *pxClient, char *pcDirectory )
 {
 BaseType_t xResult;
-BaseType_t xIsRootDir, xLength, xValid;
+BaseType_t xLength, xValid;
 BaseType_t xIsDotDir = 0;
 
 	if( pcDirectory[ 0 ] == '.' )
@@ -2124,17 +2516,10 @@ BaseType_t xIsDotDir = 0;
 		}
 	}
 
-	xIsRootDir = ( pcFILE_BUFFER[ 0 ] == '/' ) && ( pcFILE_BUFFER[ 1 ] == '\0' );
 	xMakeAbsolute( pxClient, pcNEW_DIR, sizeof( pcNEW_DIR ), pcFILE_BUFFER );
 
-	if( ( ( xIsRootDir == pdFALSE ) || ( FF_FS_Count() == 0 ) ) &&	( ff_finddir( pcNEW_DIR ) == pdFALSE ) )
-	{
-		xValid = pdFALSE;
-	}
-	else
-	{
-		xValid = pdTRUE;
-	}
+	/* f_opendir() also accepts the root directory of the volume. */
+	xValid = prvDirectoryExists( pcNEW_DIR );
 
 	if( xValid == pdFALSE )
 	{
@@ -2175,24 +2560,24 @@ BaseType_t xIsDotDir = 0;
 static BaseType_t prvRenameFrom( FTPClient_t *pxClient, const char *pcFileName )
 {
 const char *myReply;
-FF_FILE *fh;
+FILINFO xInfo;
+FRESULT xFResult;
 
 	xMakeAbsolute( pxClient, pxClient->pcFileName, sizeof( pxClient->pcFileName ), pcFileName );
 
 	myReply = NULL;
 
-	fh = ff_fopen( pxClient->pcFileName, "rb" );
+	xFResult = f_stat( pxClient->pcFileName, &xInfo );
 
-	if( fh != NULL )
+	if( ( xFResult == FR_OK ) && ( ( xInfo.fattrib & AM_DIR ) == 0 ) )
 	{
-		ff_fclose( fh );
 		/* REPL_350; "350 Requested file action pending further information." */
 		snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ),
 			"350 Rename '%s' ...\r\n", pxClient->pcFileName );
 		myReply = pcCOMMAND_BUFFER;
 		pxClient->bits.bInRename = pdTRUE_UNSIGNED;
 	}
-	else if( stdioGET_ERRNO() == pdFREERTOS_ERRNO_EISDIR )
+	else if( xFResult == FR_OK )
 	{
 		snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ),
 			"350 Rename directory '%s' ...\r\n", pxClient->pcFileName );
@@ -2201,7 +2586,7 @@ FF_FILE *fh;
 	}
 	else
 	{
-		FreeRTOS_printf( ("ftp::renameFrom[%s]\n%s\n", pxClient->pcFileName, strerror( stdioGET_ERRNO() ) ) );
+		FreeRTOS_printf( ("ftp::renameFrom[%s]\n%s\n", pxClient->pcFileName, strerror( prvFResultToErrno( xFResult ) ) ) );
 		myReply = REPL_451;		/* "451 Requested action aborted. Local error in processing." */
 	}
 	if( myReply )
@@ -2231,23 +2616,14 @@ int iResult;
 
 	xMakeAbsolute( pxClient, pcNEW_DIR, sizeof( pcNEW_DIR ), pcFileName );
 
-	/* FreeRTOS+FAT rename has an extra parameter: "remove target if already
-	exists". */
-	iResult = ff_rename( pxClient->pcFileName, pcNEW_DIR, pdFALSE );
-
-	if( iResult < 0 )
-	{
-		iResult = stdioGET_ERRNO();
-	}
-	else
-	{
-		iResult = 0;
-	}
+	/* f_rename() fails with FR_EXIST if the target already exists. */
+	iResult = prvFResultToErrno( f_rename( pxClient->pcFileName, pcNEW_DIR ) );
 
 	switch( iResult )
 	{
 	case 0:
 		FreeRTOS_printf( ( "ftp::renameTo[%s,%s]: Ok\n", pxClient->pcFileName, pcNEW_DIR ) );
+		prvFileSystemChanged( pxClient );
 		snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ),
 			"250 Rename successful to '%s'\r\n", pcNEW_DIR );
 		myReply = pcCOMMAND_BUFFER;
@@ -2259,7 +2635,7 @@ int iResult;
 			"450 Already exists '%s'\r\n", pcNEW_DIR );
 		myReply = pcCOMMAND_BUFFER;
 		break;
-	case pdFREERTOS_ERRNO_EIO:	/* FF_ERR_FILE_COULD_NOT_CREATE_DIRENT */
+	case pdFREERTOS_ERRNO_EIO:	/* FR_DISK_ERR / FR_INT_ERR */
 		/* if dirent creation failed (fatal error!).
 		"553 Requested action not taken.\r\n" */
 		FreeRTOS_printf( ("ftp::renameTo[%s,%s]: Error creating DirEnt\n",
@@ -2276,7 +2652,7 @@ int iResult;
 		break;
 	default:
 		FreeRTOS_printf( ("ftp::renameTo[%s,%s]: %s\n", pxClient->pcFileName, pcNEW_DIR,
-			(const char*)strerror( stdioGET_ERRNO() ) ) );
+			(const char*)strerror( iResult ) ) );
 		myReply = REPL_451;	/* "451 Requested action aborted. Local error in processing." */
 		break;
 	}
@@ -2320,32 +2696,52 @@ static BaseType_t prvSiteCmd( FTPClient_t *pxClient, char *pcRestCommand )
 static BaseType_t prvDeleteFile( FTPClient_t *pxClient, char *pcFileName )
 {
 BaseType_t xResult, xLength;
-int32_t iRc;
+FILINFO xInfo;
+FRESULT xFResult;
 int iErrorNo;
 
 	/* DELE: Delete a file. */
 	xMakeAbsolute( pxClient, pxClient->pcFileName, sizeof( pxClient->pcFileName ), pcFileName );
 
-	iRc = ff_remove( pxClient->pcFileName );
+	/* f_unlink() would also remove an empty directory, DELE should not. */
+	xFResult = f_stat( pxClient->pcFileName, &xInfo );
+	if( xFResult == FR_OK )
+	{
+		if( ( xInfo.fattrib & AM_DIR ) != 0 )
+		{
+			xFResult = FR_DENIED;
+			iErrorNo = pdFREERTOS_ERRNO_EISDIR;
+		}
+		else
+		{
+			xFResult = f_unlink( pxClient->pcFileName );
+			iErrorNo = prvFResultToErrno( xFResult );
+		}
+	}
+	else
+	{
+		iErrorNo = prvFResultToErrno( xFResult );
+	}
 
-	if (iRc >= 0 )
+	if( xFResult == FR_OK )
 	{
 		xLength = snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ),
 			"250 File \"%s\" removed\r\n", pxClient->pcFileName );
 		xResult = pdTRUE;
+		prvFileSystemChanged( pxClient );
 	}
 	else
 	{
 		const char *errMsg = "other error";
 
-		iErrorNo = stdioGET_ERRNO();
 		switch( iErrorNo )
-		{																		/*_RB_ What do these negative numbers relate to? */
-			case pdFREERTOS_ERRNO_ENOENT:	errMsg = "No such file"; break;		/* -31	File was not found. */
-			case pdFREERTOS_ERRNO_EALREADY:	errMsg = "File still open"; break;	/* -30	File is in use. */
-			case pdFREERTOS_ERRNO_EISDIR:	errMsg = "Is a dir"; break;			/* -32	Tried to FF_Open() a Directory. */
-			case pdFREERTOS_ERRNO_EROFS:	errMsg = "Read-only"; break;		/* -33	Tried to FF_Open() a file marked read only. */
-			case pdFREERTOS_ERRNO_ENOTDIR:	errMsg = "Invalid path"; break;		/* -34	The path of the file was not found. */
+		{
+			case pdFREERTOS_ERRNO_ENOENT:	errMsg = "No such file"; break;		/* FR_NO_FILE */
+			case pdFREERTOS_ERRNO_EALREADY:	errMsg = "File still open"; break;	/* FR_LOCKED */
+			case pdFREERTOS_ERRNO_EISDIR:	errMsg = "Is a dir"; break;
+			case pdFREERTOS_ERRNO_EACCES:	errMsg = "Read-only"; break;		/* FR_DENIED */
+			case pdFREERTOS_ERRNO_EROFS:	errMsg = "Read-only"; break;		/* FR_WRITE_PROTECTED */
+			case pdFREERTOS_ERRNO_ENOTDIR:	errMsg = "Invalid path"; break;		/* FR_NO_PATH */
 		}
 		FreeRTOS_printf( ( "ftp::delFile: '%s' because %s\n",
 			pxClient->pcFileName, strerror( iErrorNo ) ) );
@@ -2388,41 +2784,30 @@ char *pcPtr;
 
 	if( ( pcPtr != NULL ) && ( pcPtr[ 1 ] != '\0' ) )
 	{
-		FF_Stat_t xStatBuf;
-		int32_t iRc = ff_stat( pxClient->pcFileName, &xStatBuf );
-		if (iRc < 0 )
+		FILINFO xInfo;
+		FRESULT xFResult = f_stat( pxClient->pcFileName, &xInfo );
+		if( xFResult != FR_OK )
 			FreeRTOS_printf( ("In %s: %s\n", pxClient->pcFileName,
-				( const char* )strerror( stdioGET_ERRNO() ) ) );
+				( const char* )strerror( prvFResultToErrno( xFResult ) ) ) );
 
-		if( iRc == 0 )
+		if( xFResult == FR_OK )
 		{
 		BaseType_t xLength;
 			/* "YYYYMMDDhhmmss" */
 			if( xSendDate != pdFALSE )
 			{
-				#if( ffconfigTIME_SUPPORT != 0 )
-				{
-					FF_TimeStruct_t tmStruct;
-					time_t secs = xStatBuf.st_mtime;
-					FreeRTOS_gmtime_r( &secs, &tmStruct );
-
-					xLength = snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ), "213 %04u%02u%02u%02u%02u%02u\r\n",
-						tmStruct.tm_year + 1900,
-						tmStruct.tm_mon+1,
-						tmStruct.tm_mday,
-						tmStruct.tm_hour,
-						tmStruct.tm_min,
-						tmStruct.tm_sec );
-				}
-				#else
-				{
-					xLength = snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ), "213 19700101000000\r\n",
-				}
-				#endif
+				/* FAT stores local time with a 2-second resolution. */
+				xLength = snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ), "213 %04u%02u%02u%02u%02u%02u\r\n",
+					( unsigned ) ( ( xInfo.fdate >> 9 ) + 1980 ),
+					( unsigned ) ( ( xInfo.fdate >> 5 ) & 0x0F ),
+					( unsigned ) ( xInfo.fdate & 0x1F ),
+					( unsigned ) ( xInfo.ftime >> 11 ),
+					( unsigned ) ( ( xInfo.ftime >> 5 ) & 0x3F ),
+					( unsigned ) ( ( xInfo.ftime & 0x1F ) * 2 ) );
 			}
 			else
 			{
-				xLength = snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ), "213 %lu\r\n", xStatBuf.st_size );
+				xLength = snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ), "213 %lu\r\n", ( unsigned long ) xInfo.fsize );
 			}
 			prvSendReply( pxClient->xSocket, pcCOMMAND_BUFFER, xLength );
 			xResult = pdTRUE;
@@ -2458,8 +2843,8 @@ static BaseType_t prvMakeRemoveDir( FTPClient_t *pxClient, const char *pcDirecto
 {
 BaseType_t xResult;
 BaseType_t xLength;
-int32_t iRc;
-int iErrorNo;
+FRESULT xFResult;
+int iErrorNo = 0;
 
 	/* MKD: Make / create a directory (xDoRemove = 0)
 	RMD: Remove a directory (xDoRemove = 1) */
@@ -2467,26 +2852,41 @@ int iErrorNo;
 
 	if( xDoRemove )
 	{
-		iRc = ff_rmdir( pxClient->pcFileName );
+	FILINFO xInfo;
+
+		/* f_unlink() removes files as well, RMD should only remove
+		directories. */
+		xFResult = f_stat( pxClient->pcFileName, &xInfo );
+		if( ( xFResult == FR_OK ) && ( ( xInfo.fattrib & AM_DIR ) == 0 ) )
+		{
+			xFResult = FR_NO_PATH;
+		}
+		else if( xFResult == FR_OK )
+		{
+			xFResult = f_unlink( pxClient->pcFileName );
+			if( xFResult == FR_DENIED )
+			{
+				/* Either read-only or not empty, assume the latter. */
+				iErrorNo = pdFREERTOS_ERRNO_ENOTEMPTY;
+			}
+		}
 	}
 	else
 	{
-		#if( ffconfigMKDIR_RECURSIVE != 0 )
-		{
-			iRc = ff_mkdir( pxClient->pcFileName, pdFALSE );
-		}
-		#else
+		xFResult = f_mkdir( pxClient->pcFileName );
+		if( xFResult == FR_DENIED )
 		{
-			iRc = ff_mkdir( pxClient->pcFileName );
+			/* No free cluster or the parent directory is full. */
+			iErrorNo = pdFREERTOS_ERRNO_ENOSPC;
 		}
-		#endif /* ffconfigMKDIR_RECURSIVE */
 	}
 	xResult = pdTRUE;
 
-	if( iRc >= 0 )
+	if( xFResult == FR_OK )
 	{
 		xLength = snprintf( pcCOMMAND_BUFFER, sizeof( pcCOMMAND_BUFFER ), "257 \"%s\" directory %s\r\n",
 			pxClient->pcFileName, xDoRemove ? "removed" : "created" );
+		prvFileSystemChanged( pxClient );
 	}
 	else
 	{
@@ -2494,13 +2894,16 @@ int iErrorNo;
 	BaseType_t xFTPCode = 521;
 
 		xResult = pdFALSE;
-		iErrorNo = stdioGET_ERRNO();
+		if( iErrorNo == 0 )
+		{
+			iErrorNo = prvFResultToErrno( xFResult );
+		}
 		switch( iErrorNo )
 		{
 			case pdFREERTOS_ERRNO_EEXIST:	errMsg = "Directory already exists"; break;
-			case pdFREERTOS_ERRNO_ENOTDIR:	errMsg = "Invalid path"; break;			/* -34 The path of the file was not found. *//*_RB_ As before, what do these negative numbers relate to? */
+			case pdFREERTOS_ERRNO_ENOTDIR:	errMsg = "Invalid path"; break;			/* FR_NO_PATH */
 			case pdFREERTOS_ERRNO_ENOTEMPTY:errMsg = "Dir not empty"; break;
-			case pdFREERTOS_ERRNO_EROFS:	errMsg = "Read-only"; break;			/* -33	Tried to FF_Open() a file marked read only. */
+			case pdFREERTOS_ERRNO_EROFS:	errMsg = "Read-only"; break;			/* FR_WRITE_PROTECTED */
 			default:						errMsg = strerror( iErrorNo ); break;
 		}
 		if( iErrorNo == pdFREERTOS_ERRNO_ENOSPC )
@@ -2519,6 +2922,47 @@ int iErrorNo;
 }
 /*-----------------------------------------------------------*/
 
+static int prvFResultToErrno( FRESULT xResult )
+{
+int iErrorNo;
+
+	switch( xResult )
+	{
+		case FR_OK:					iErrorNo = 0; break;
+		case FR_NO_FILE:			iErrorNo = pdFREERTOS_ERRNO_ENOENT; break;
+		case FR_NO_PATH:			iErrorNo = pdFREERTOS_ERRNO_ENOTDIR; break;
+		case FR_INVALID_NAME:		iErrorNo = pdFREERTOS_ERRNO_EINVAL; break;
+		case FR_DENIED:				iErrorNo = pdFREERTOS_ERRNO_EACCES; break;
+		case FR_EXIST:				iErrorNo = pdFREERTOS_ERRNO_EEXIST; break;
+		case FR_INVALID_OBJECT:		iErrorNo = pdFREERTOS_ERRNO_EBADF; break;
+		case FR_WRITE_PROTECTED:	iErrorNo = pdFREERTOS_ERRNO_EROFS; break;
+		case FR_INVALID_DRIVE:
+		case FR_NOT_ENABLED:
+		case FR_NO_FILESYSTEM:		iErrorNo = pdFREERTOS_ERRNO_ENXIO; break;
+		case FR_TIMEOUT:			iErrorNo = pdFREERTOS_ERRNO_ETIMEDOUT; break;
+		case FR_LOCKED:				iErrorNo = pdFREERTOS_ERRNO_EALREADY; break;
+		case FR_NOT_ENOUGH_CORE:	iErrorNo = pdFREERTOS_ERRNO_ENOMEM; break;
+		case FR_INVALID_PARAMETER:	iErrorNo = pdFREERTOS_ERRNO_EINVAL; break;
+		default:					iErrorNo = pdFREERTOS_ERRNO_EIO; break;	/* FR_DISK_ERR, FR_INT_ERR, FR_NOT_READY, ... */
+	}
+	return iErrorNo;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvDirectoryExists( const char *pcPath )
+{
+DIR xDir;
+BaseType_t xResult = pdFALSE;
+
+	if( f_opendir( &xDir, pcPath ) == FR_OK )
+	{
+		f_closedir( &xDir );
+		xResult = pdTRUE;
+	}
+	return xResult;
+}
+/*-----------------------------------------------------------*/
+
 static portINLINE BaseType_t IsDigit( char cChar )
 {
 BaseType_t xResult;
@@ -2555,7 +2999,7 @@ BaseType_t xResult;
 			last--;
 		}
 		iLength = ( int )( last - pcBuffer );
-		FF_PRINTF( "   %-*.*s", iLength, iLength, pcBuffer );
+		FreeRTOS_printf( ( "   %-*.*s\n", iLength, iLength, pcBuffer ) );
 	}
 	return xResult;
 }
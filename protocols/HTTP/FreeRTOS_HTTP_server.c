@@ -78,6 +78,19 @@
 /* Specifics for the peekpoke server. */
 #include "peekpoke.h"
 
+/* Runtime counters served on GET /metrics. */
+#include "metrics.h"
+
+#if( configUSE_TRACE_RECORDER == 1 )
+	/* Kernel trace image served on GET /trace. */
+	#include "trace.h"
+#endif
+
+#if( configUSE_PROFILER == 1 )
+	/* PC samples served on GET /profile. */
+	#include "prof.h"
+#endif
+
 #ifndef HTTP_SERVER_BACKLOG
 	#define HTTP_SERVER_BACKLOG			( 12 )
 #endif
@@ -86,6 +99,9 @@
 	#define USE_HTML_CHUNKS				( 0 )
 #endif
 
+/* Length passed to prvSendStream() for replies sized only as they are sent. */
+#define httpLENGTH_CHUNKED			( ( size_t ) -1 )
+
 #if !defined( ARRAY_SIZE )
 	#define ARRAY_SIZE(x) ( BaseType_t ) (sizeof( x ) / sizeof( x )[ 0 ] )
 #endif
@@ -143,6 +159,85 @@ static BaseType_t prvSendReply( HTTPClient_t *pxClient, BaseType_t xCode )
 
 /*-----------------------------------------------------------*/
 
+static int prvStreamWrite( void *pvContext, const void *pvData, size_t uxLength )
+{
+	HTTPClient_t *pxClient = ( HTTPClient_t * ) pvContext;
+	const uint8_t *pucData = ( const uint8_t * ) pvData;
+
+	while( uxLength > 0 )
+	{
+		BaseType_t xRc = FreeRTOS_send( pxClient->xSocket, pucData, uxLength, 0 );
+		if( xRc <= 0 )
+		{
+			FreeRTOS_debug_printf(("Error returned from FreeRTOS_send: %d\r\n", xRc));
+			return 1;
+		}
+		pucData += xRc;
+		uxLength -= ( size_t ) xRc;
+	}
+	return 0;
+}
+
+/* Send one piece of a reply in chunked transfer coding. */
+static int prvChunkWrite( void *pvContext, const void *pvData, size_t uxLength )
+{
+	char pcSize[ 12 ];
+	int iLength;
+
+	/* An empty chunk would end the reply. */
+	if( uxLength == 0 )
+	{
+		return 0;
+	}
+	iLength = snprintf( pcSize, sizeof( pcSize ), "%lx\r\n", ( unsigned long ) uxLength );
+	if( ( prvStreamWrite( pvContext, pcSize, ( size_t ) iLength ) != 0 ) ||
+		( prvStreamWrite( pvContext, pvData, uxLength ) != 0 ) )
+	{
+		return 1;
+	}
+	return prvStreamWrite( pvContext, "\r\n", 2 );
+}
+
+/*
+ * The trace and profile dumps are larger than any reply buffer: they are
+ * sized while frozen, then written straight out of their tables. The dump
+ * is always made, as it is what resumes recording. The metrics cannot be
+ * sized before they are formatted, so they pass httpLENGTH_CHUNKED and go
+ * out in chunked transfer coding instead.
+ */
+static BaseType_t prvSendStream( HTTPClient_t *pxClient, const char *pcType, size_t uxLength,
+								 int ( *pxDump )( int ( * )( void *, const void *, size_t ), void * ) )
+{
+	BaseType_t xRc;
+	int ( *pxWrite )( void *, const void *, size_t ) = prvStreamWrite;
+
+	strcpy( pxClient->pxParent->pcContentsType, pcType );
+	if( uxLength == httpLENGTH_CHUNKED )
+	{
+		pxWrite = prvChunkWrite;
+#if !USE_HTML_CHUNKS
+		strcpy( pxClient->pxParent->pcExtraContents, "Transfer-Encoding: chunked\r\n" );
+#endif
+	}
+	else
+	{
+		snprintf( pxClient->pxParent->pcExtraContents, sizeof( pxClient->pxParent->pcExtraContents ),
+				  "Content-Length: %lu\r\n", ( unsigned long ) uxLength );
+	}
+	xRc = prvSendReply( pxClient, WEB_REPLY_OK );
+
+	if( pxDump( pxWrite, pxClient ) != 0 )
+	{
+		xRc = -1;
+	}
+	else if( ( pxWrite == prvChunkWrite ) && ( prvStreamWrite( pxClient, "0\r\n\r\n", 5 ) != 0 ) )
+	{
+		xRc = -1;
+	}
+	return xRc;
+}
+/*-----------------------------------------------------------*/
+
 static BaseType_t prvOpenURL( HTTPClient_t *pxClient, BaseType_t xIndex )
 {
 	BaseType_t xRc;
@@ -157,7 +252,27 @@ static BaseType_t prvOpenURL( HTTPClient_t *pxClient, BaseType_t xIndex )
 	 * but we'll work with it, at least for now.
 	 */
 
-	size_t xResult = peekPokeHandler( pxClient, xIndex, pxClient->pcUrlData, pxClient->pcCurrentFilename, sizeof( pxClient->pcCurrentFilename ) );
+	size_t xResult;
+
+#if( configUSE_TRACE_RECORDER == 1 )
+	if( ( xIndex == ECMD_GET ) && ( strcmp( pxClient->pcUrlData, "/trace" ) == 0 ) )
+	{
+		return prvSendStream( pxClient, "application/octet-stream", trace_freeze(), trace_dump );
+	}
+#endif
+#if( configUSE_PROFILER == 1 )
+	if( ( xIndex == ECMD_GET ) && ( strcmp( pxClient->pcUrlData, "/profile" ) == 0 ) )
+	{
+		return prvSendStream( pxClient, "text/plain", prof_freeze(), prof_dump );
+	}
+#endif
+
+	if( ( xIndex == ECMD_GET ) && ( strcmp( pxClient->pcUrlData, "/metrics" ) == 0 ) )
+	{
+		return prvSendStream( pxClient, "text/plain; version=0.0.4", httpLENGTH_CHUNKED, metricsDump );
+	}
+
+	xResult = peekPokeHandler( pxClient, xIndex, pxClient->pcUrlData, pxClient->pcCurrentFilename, sizeof( pxClient->pcCurrentFilename ) );
 
 	if( xResult > 0 )
 	{
@@ -0,0 +1,298 @@
+/*
+ * metrics.c -- machine-readable runtime counters for the HTTP server
+ *
+ * `GET /metrics` returns the kernel, heap, network and driver counters in the
+ * Prometheus text exposition format. Everything is read straight out of the
+ * kernel and driver structures: no driver mutex is taken and interrupts are
+ * never disabled, so scraping does not stall the workload. The task table is
+ * the only thing copied with the scheduler suspended (which is how
+ * uxTaskGetSystemState() works), and it lands in a static array so scraping
+ * does not touch the heap either. The reply is formatted a buffer at a time
+ * and sent as it goes, so its length is not limited by any reply buffer.
+ */
+
+/* Standard includes. */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* FreeRTOS+TCP includes. */
+#include "FreeRTOS_IP.h"
+#include "FreeRTOS_Sockets.h"
+#include "NetworkBufferManagement.h"
+
+/* BSP includes. */
+#include "bsp.h"
+#if BSP_USE_UART0 || BSP_USE_UART1
+#include "uart.h"
+#endif
+#if BSP_USE_SPI1
+#include "spi.h"
+#endif
+#if BSP_USE_IIC0
+#include "iic.h"
+#endif
+
+#include "metrics.h"
+
+#if( configUSE_TLSF_HEAP == 1 )
+	#include "heap_tlsf.h"
+#endif
+
+#if( mainCREATE_NTP_CLIENT_TASK == 1 ) || ( mainCREATE_NTP_SERVER_TASK == 1 )
+	#include "NTPDemo.h"
+#endif
+
+/* Maximum number of tasks reported; extra tasks are silently dropped. */
+#ifndef metricsMAX_TASKS
+	#define metricsMAX_TASKS	( 32 )
+#endif
+
+/* Lines are gathered in a buffer of this size, and written out each time it
+fills up. No line may be longer. */
+#ifndef metricsBUFFER_SIZE
+	#define metricsBUFFER_SIZE	( 512 )
+#endif
+
+static TaskStatus_t xTaskStatus[ metricsMAX_TASKS ];
+static char pcMetricsBuffer[ metricsBUFFER_SIZE ];
+
+typedef struct xMETRICS_OUTPUT
+{
+	int ( *pxWrite )( void *, const void *, size_t );
+	void *pvContext;
+	size_t uxOffset;
+	int iError;
+} MetricsOutput_t;
+
+static void prvFlush( MetricsOutput_t *pxOutput )
+{
+	if( ( pxOutput->iError == 0 ) && ( pxOutput->uxOffset > 0 ) )
+	{
+		pxOutput->iError = pxOutput->pxWrite( pxOutput->pvContext, pcMetricsBuffer, pxOutput->uxOffset );
+	}
+	pxOutput->uxOffset = 0;
+}
+
+/*
+ * Append one formatted line, writing out the buffer first if it does not
+ * fit. A line longer than the whole buffer is dropped, so the reply stays
+ * well formed. Once a write has failed, everything is dropped.
+ */
+static void prvAppend( MetricsOutput_t *pxOutput, const char *pcFormat, ... )
+{
+	va_list xArgs;
+	int iLength;
+	BaseType_t xAttempt;
+
+	for( xAttempt = 0; ( xAttempt < 2 ) && ( pxOutput->iError == 0 ); xAttempt++ )
+	{
+		va_start( xArgs, pcFormat );
+		iLength = vsnprintf( pcMetricsBuffer + pxOutput->uxOffset, metricsBUFFER_SIZE - pxOutput->uxOffset, pcFormat, xArgs );
+		va_end( xArgs );
+
+		if( ( iLength >= 0 ) && ( ( size_t ) iLength < metricsBUFFER_SIZE - pxOutput->uxOffset ) )
+		{
+			pxOutput->uxOffset += ( size_t ) iLength;
+			return;
+		}
+		if( pxOutput->uxOffset == 0 )
+		{
+			break;
+		}
+		prvFlush( pxOutput );
+	}
+}
+
+#define METRIC( ... )	prvAppend( &xOutput, __VA_ARGS__ )
+
+#if BSP_USE_UART0 || BSP_USE_UART1
+static void prvUartMetrics( MetricsOutput_t *pxOutput, int iIndex, const struct UartStats *pxStats )
+{
+	prvAppend( pxOutput, "uart_received_bytes{uart=\"%d\"} %d\n", iIndex, pxStats->TotalReceivedCount );
+	prvAppend( pxOutput, "uart_sent_bytes{uart=\"%d\"} %d\n", iIndex, pxStats->TotalSentCount );
+	prvAppend( pxOutput, "uart_errors_total{uart=\"%d\"} %d\n", iIndex, pxStats->TotalErrorCount );
+	prvAppend( pxOutput, "uart_last_errors{uart=\"%d\"} %u\n", iIndex, ( unsigned ) pxStats->Errors );
+}
+#endif
+
+int metricsDump( int ( *pxWrite )( void *, const void *, size_t ), void *pvContext )
+{
+	MetricsOutput_t xOutput = { pxWrite, pvContext, 0, 0 };
+	UBaseType_t uxTasks, x;
+	uint32_t ulTotalRunTime = 0;
+
+	/* Kernel */
+	METRIC( "# TYPE freertos_uptime_ticks counter\n" );
+	METRIC( "freertos_uptime_ticks %lu\n", ( unsigned long ) xTaskGetTickCount() );
+	METRIC( "# TYPE freertos_cpu_cycles counter\n" );
+	METRIC( "freertos_cpu_cycles %llu\n", ( unsigned long long ) get_cycle_count() );
+	METRIC( "# TYPE freertos_tasks gauge\n" );
+	METRIC( "freertos_tasks %lu\n", ( unsigned long ) uxTaskGetNumberOfTasks() );
+
+	uxTasks = uxTaskGetSystemState( xTaskStatus, metricsMAX_TASKS, &ulTotalRunTime );
+
+	METRIC( "# TYPE freertos_task_stack_high_water_mark_words gauge\n" );
+	for( x = 0; x < uxTasks; x++ )
+	{
+		METRIC( "freertos_task_stack_high_water_mark_words{task=\"%s\"} %lu\n",
+				xTaskStatus[ x ].pcTaskName, ( unsigned long ) xTaskStatus[ x ].usStackHighWaterMark );
+	}
+
+	METRIC( "# TYPE freertos_task_priority gauge\n" );
+	for( x = 0; x < uxTasks; x++ )
+	{
+		METRIC( "freertos_task_priority{task=\"%s\"} %lu\n",
+				xTaskStatus[ x ].pcTaskName, ( unsigned long ) xTaskStatus[ x ].uxCurrentPriority );
+	}
+
+#if( configGENERATE_RUN_TIME_STATS == 1 )
+	/* Run time counter is port_get_current_mtime(), i.e. microseconds. */
+	METRIC( "# TYPE freertos_task_run_time_us counter\n" );
+	for( x = 0; x < uxTasks; x++ )
+	{
+		METRIC( "freertos_task_run_time_us{task=\"%s\"} %lu\n",
+				xTaskStatus[ x ].pcTaskName, ( unsigned long ) xTaskStatus[ x ].ulRunTimeCounter );
+	}
+	METRIC( "# TYPE freertos_total_run_time_us counter\n" );
+	METRIC( "freertos_total_run_time_us %lu\n", ( unsigned long ) ulTotalRunTime );
+#endif /* configGENERATE_RUN_TIME_STATS */
+
+	/* Heap and ISR stack */
+	METRIC( "# TYPE freertos_heap_size_bytes gauge\n" );
+	METRIC( "freertos_heap_size_bytes %lu\n", ( unsigned long ) configTOTAL_HEAP_SIZE );
+	METRIC( "# TYPE freertos_heap_free_bytes gauge\n" );
+	METRIC( "freertos_heap_free_bytes %lu\n", ( unsigned long ) xPortGetFreeHeapSize() );
+	METRIC( "# TYPE freertos_heap_min_ever_free_bytes gauge\n" );
+	METRIC( "freertos_heap_min_ever_free_bytes %lu\n", ( unsigned long ) xPortGetMinimumEverFreeHeapSize() );
+#if( configUSE_TLSF_HEAP == 1 )
+	{
+		struct heap_stats xHeapStats;
+		struct heap_class_stats xClassStats[ TLSF_FL_COUNT ];
+		size_t uxClasses;
+
+		heap_get_stats( &xHeapStats );
+		METRIC( "# TYPE freertos_heap_largest_free_block_bytes gauge\n" );
+		METRIC( "freertos_heap_largest_free_block_bytes %lu\n", ( unsigned long ) xHeapStats.largest_free_block );
+		METRIC( "# TYPE freertos_heap_free_blocks gauge\n" );
+		METRIC( "freertos_heap_free_blocks %lu\n", ( unsigned long ) xHeapStats.free_blocks );
+		METRIC( "# TYPE freertos_heap_fragmentation_percent gauge\n" );
+		METRIC( "freertos_heap_fragmentation_percent %lu\n", ( unsigned long ) xHeapStats.fragmentation_percent );
+		METRIC( "# TYPE freertos_heap_allocations_total counter\n" );
+		METRIC( "freertos_heap_allocations_total %lu\n", ( unsigned long ) xHeapStats.allocations );
+		METRIC( "# TYPE freertos_heap_frees_total counter\n" );
+		METRIC( "freertos_heap_frees_total %lu\n", ( unsigned long ) xHeapStats.frees );
+		METRIC( "# TYPE freertos_heap_failures_total counter\n" );
+		METRIC( "freertos_heap_failures_total %lu\n", ( unsigned long ) xHeapStats.failures );
+
+		/* Classes that were never used are left out. */
+		uxClasses = heap_get_class_stats( xClassStats, TLSF_FL_COUNT );
+		METRIC( "# TYPE freertos_heap_class_blocks_in_use gauge\n" );
+		for( x = 0; x < uxClasses; x++ )
+		{
+			if( xClassStats[ x ].allocations || xClassStats[ x ].free_blocks )
+			{
+				METRIC( "freertos_heap_class_blocks_in_use{min_size=\"%lu\"} %lu\n",
+						( unsigned long ) xClassStats[ x ].min_size, ( unsigned long ) xClassStats[ x ].in_use );
+			}
+		}
+		METRIC( "# TYPE freertos_heap_class_free_blocks gauge\n" );
+		for( x = 0; x < uxClasses; x++ )
+		{
+			if( xClassStats[ x ].allocations || xClassStats[ x ].free_blocks )
+			{
+				METRIC( "freertos_heap_class_free_blocks{min_size=\"%lu\"} %lu\n",
+						( unsigned long ) xClassStats[ x ].min_size, ( unsigned long ) xClassStats[ x ].free_blocks );
+			}
+		}
+		METRIC( "# TYPE freertos_heap_class_allocations_total counter\n" );
+		for( x = 0; x < uxClasses; x++ )
+		{
+			if( xClassStats[ x ].allocations || xClassStats[ x ].free_blocks )
+			{
+				METRIC( "freertos_heap_class_allocations_total{min_size=\"%lu\"} %lu\n",
+						( unsigned long ) xClassStats[ x ].min_size, ( unsigned long ) xClassStats[ x ].allocations );
+			}
+		}
+	}
+#endif /* configUSE_TLSF_HEAP */
+	METRIC( "# TYPE freertos_isr_stack_utilization_percent gauge\n" );
+	METRIC( "freertos_isr_stack_utilization_percent %u\n", ( unsigned ) isr_stack_utilization() );
+
+	/* Network buffers */
+	METRIC( "# TYPE freertos_network_buffers gauge\n" );
+	METRIC( "freertos_network_buffers %lu\n", ( unsigned long ) ipconfigNUM_NETWORK_BUFFER_DESCRIPTORS );
+	METRIC( "# TYPE freertos_network_buffers_free gauge\n" );
+	METRIC( "freertos_network_buffers_free %lu\n", ( unsigned long ) uxGetNumberOfFreeNetworkBuffers() );
+	METRIC( "# TYPE freertos_network_buffers_min_free gauge\n" );
+	METRIC( "freertos_network_buffers_min_free %lu\n", ( unsigned long ) uxGetMinimumFreeNetworkBuffers() );
+
+#if( mainCREATE_NTP_CLIENT_TASK == 1 )
+	/* Clock */
+	METRIC( "# TYPE ntp_synchronised gauge\n" );
+	METRIC( "ntp_synchronised %d\n", ( int ) xNTPIsSynchronised() );
+	METRIC( "# TYPE ntp_offset_us gauge\n" );
+	METRIC( "ntp_offset_us %ld\n", ( long ) lNTPGetOffsetUs() );
+	METRIC( "# TYPE ntp_jitter_us gauge\n" );
+	METRIC( "ntp_jitter_us %lu\n", ( unsigned long ) ulNTPGetJitterUs() );
+	METRIC( "# TYPE ntp_frequency_ppb gauge\n" );
+	METRIC( "ntp_frequency_ppb %ld\n", ( long ) lNTPGetFrequencyPPB() );
+#endif
+#if( mainCREATE_NTP_SERVER_TASK == 1 )
+	METRIC( "# TYPE ntp_server_requests_total counter\n" );
+	METRIC( "ntp_server_requests_total %lu\n", ( unsigned long ) ulNTPServerGetRequestCount() );
+#endif
+
+	/* Drivers */
+#if BSP_USE_UART0 || BSP_USE_UART1
+	{
+		struct UartStats xUartStats;
+
+		METRIC( "# TYPE uart_errors_total counter\n" );
+	#if BSP_USE_UART0
+		uart0_get_stats( &xUartStats );
+		prvUartMetrics( &xOutput, 0, &xUartStats );
+	#endif
+	#if BSP_USE_UART1
+		uart1_get_stats( &xUartStats );
+		prvUartMetrics( &xOutput, 1, &xUartStats );
+	#endif
+	}
+#endif
+
+#if BSP_USE_SPI1
+	METRIC( "# TYPE spi_errors_total counter\n" );
+	METRIC( "spi_errors_total{spi=\"1\"} %d\n", Spi1.TotalErrorCount );
+	METRIC( "spi_last_transaction_bytes{spi=\"1\"} %d\n", Spi1.TotalTransactiondCount );
+	METRIC( "spi_last_errors{spi=\"1\"} %d\n", Spi1.Errors );
+#endif
+
+#if BSP_USE_IIC0
+	{
+		XIicStats xIicStats;
+
+		/* The device may still be waiting for the BSP's lazy init */
+		bsp_init_wait();
+		XIic_GetStats( &Iic0.Device, &xIicStats );
+		METRIC( "# TYPE iic_errors_total counter\n" );
+		METRIC( "iic_errors_total{iic=\"0\"} %d\n", Iic0.TotalErrorCount );
+		METRIC( "iic_arbitration_lost{iic=\"0\"} %u\n", ( unsigned ) xIicStats.ArbitrationLost );
+		METRIC( "iic_repeated_starts{iic=\"0\"} %u\n", ( unsigned ) xIicStats.RepeatedStarts );
+		METRIC( "iic_bus_busy{iic=\"0\"} %u\n", ( unsigned ) xIicStats.BusBusy );
+		METRIC( "iic_recv_bytes{iic=\"0\"} %u\n", ( unsigned ) xIicStats.RecvBytes );
+		METRIC( "iic_recv_interrupts{iic=\"0\"} %u\n", ( unsigned ) xIicStats.RecvInterrupts );
+		METRIC( "iic_send_bytes{iic=\"0\"} %u\n", ( unsigned ) xIicStats.SendBytes );
+		METRIC( "iic_send_interrupts{iic=\"0\"} %u\n", ( unsigned ) xIicStats.SendInterrupts );
+		METRIC( "iic_tx_errors{iic=\"0\"} %u\n", ( unsigned ) xIicStats.TxErrors );
+		METRIC( "iic_interrupts{iic=\"0\"} %u\n", ( unsigned ) xIicStats.IicInterrupts );
+	}
+#endif
+
+	prvFlush( &xOutput );
+	return xOutput.iError;
+}
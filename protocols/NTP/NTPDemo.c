@@ -58,165 +58,403 @@
 /*
  * NTPDemo.c
  *
- * An example of how to lookup a domain using DNS
- * And also how to send and receive UDP messages to get the NTP time
+ * An NTP client that keeps a disciplined 64-bit clock.
  *
+ * The local timebase is the mcycle counter (get_cycle_count()).  The clock
+ * converts cycles to nanoseconds since 1970 with a rate that includes a
+ * frequency correction, and is slewed (or stepped for large errors) by the
+ * results of the NTP exchanges.
+ *
+ * Each poll round queries every configured server once.  Offset and delay of an
+ * exchange are computed from all four timestamps:
+ *
+ *		offset = ( ( T2 - T1 ) + ( T3 - T4 ) ) / 2
+ *		delay  = ( T4 - T1 ) - ( T3 - T2 )
+ *
+ * Every server keeps the last ntpFILTER_SIZE samples, of which the one with the
+ * lowest delay is used.  The servers that agree with the best one (the lowest
+ * root distance) are averaged, weighted by their root distance, and the result
+ * steers the clock.
  */
 
 /* Standard includes. */
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 /* FreeRTOS includes. */
 #include "FreeRTOS.h"
 #include "task.h"
-#include "semphr.h"
 
 /* FreeRTOS+TCP includes. */
 #include "FreeRTOS_IP.h"
 #include "FreeRTOS_Sockets.h"
 #include "FreeRTOS_DNS.h"
-#include "FreeRTOS_Stream_Buffer.h"
 
-/* Use the date & time functions from +FAT. */
-#include "ff_time.h"
+/* BSP includes. */
+#include "bsp.h"
 
 #include "NTPDemo.h"
-#include "ntpClient.h"
+#include "NTPClient.h"
 
-#include "date_and_time.h"
+/* The servers to use, host names or dotted decimal addresses.  Different names
+are needed to get different servers. */
+#ifndef ntpSERVER_NAMES
+	#define ntpSERVER_NAMES		"0.pool.ntp.org", "1.pool.ntp.org", "2.pool.ntp.org", "3.pool.ntp.org"
+#endif
 
-enum EStatus {
-	EStatusLookup,
-	EStatusAsking,
-	EStatusPause,
-	EStatusFailed,
-};
+/* Number of samples kept per server. */
+#ifndef ntpFILTER_SIZE
+	#define ntpFILTER_SIZE				( 8 )
+#endif
 
-static struct SNtpPacket xNTPPacket;
+/* Poll interval limits, in seconds.  The interval doubles while the clock stays
+within ntpPOLL_ADJUST_US of the servers, and halves otherwise. */
+#ifndef ntpMIN_POLL_SECONDS
+	#define ntpMIN_POLL_SECONDS			( 8 )
+#endif
+#ifndef ntpMAX_POLL_SECONDS
+	#define ntpMAX_POLL_SECONDS			( 64 )
+#endif
+#ifndef ntpPOLL_ADJUST_US
+	#define ntpPOLL_ADJUST_US			( 500 )
+#endif
 
-#if( ipconfigUSE_CALLBACKS == 0 )
-	static char cRecvBuffer[ sizeof( struct SNtpPacket ) + 64 ];
+/* Number of quick exchanges at start-up and after a step, to fill the
+filters. */
+#ifndef ntpBURST_COUNT
+	#define ntpBURST_COUNT				( 4 )
 #endif
+#define ntpBURST_INTERVAL_MS			( 2000 )
 
-static enum EStatus xStatus = EStatusLookup;
+/* How long to wait for an answer from a server. */
+#ifndef ntpRESPONSE_TIMEOUT_MS
+	#define ntpRESPONSE_TIMEOUT_MS		( 1000 )
+#endif
+
+/* Offsets larger than this are corrected by setting the clock, smaller offsets
+are slewed at ntpSLEW_PPM. */
+#ifndef ntpSTEP_THRESHOLD_US
+	#define ntpSTEP_THRESHOLD_US		( 128000 )
+#endif
+#define ntpSLEW_PPM						( 500 )
+
+/* Limit and loop gain of the frequency correction.  Each update adds
+offset / ( interval * ntpFREQUENCY_GAIN ) to the frequency. */
+#define ntpMAX_FREQUENCY_PPB			( 500000 )
+#define ntpFREQUENCY_GAIN				( 4 )
+
+#define ntpNS_PER_SECOND				( 1000000000ULL )
 
-static const char *pcTimeServers[] = {
-	"0.asia.pool.ntp.org",
-	"0.europe.pool.ntp.org",
-	"0.id.pool.ntp.org",
-	"0.south-america.pool.ntp.org",
-	"0.oceania.pool.ntp.org",
-	"0.north-america.pool.ntp.org"
-};
+/* The fraction of the clock rate, in 1/2^24 nanoseconds per cycle. */
+#define ntpRATE_SHIFT					( 24 )
+
+/* Flags of a request: leap indicator 3 (unsynchronised), version 4, mode 3
+(client). */
+#define ntpFLAGS_CLIENT_REQUEST			( 0xE3 )
+#define ntpMODE_MASK					( 0x07 )
+#define ntpMODE_SERVER					( 4 )
+#define ntpLEAP_UNSYNCHRONISED			( 0xC0 )
+
+typedef struct xNTP_CLOCK
+{
+	uint64_t ullBaseCycles;		/* Cycle count at the last update of ullBaseNs. */
+	uint64_t ullBaseNs;			/* Nanoseconds since 1970 at ullBaseCycles. */
+	uint32_t ulBaseFraction;	/* Remainder of ullBaseNs, in 1/2^24 ns. */
+	uint32_t ulRate;			/* Nanoseconds per cycle, 8.24 fixed point. */
+	uint32_t ulSlewRate;		/* Rate used until ullSlewEndCycles. */
+	uint64_t ullSlewEndCycles;
+	BaseType_t xSlewing;
+	BaseType_t xSlewNegative;	/* The slew retards the clock. */
+} NTPClock_t;
+
+typedef struct xNTP_SAMPLE
+{
+	int64_t llOffsetNs;
+	int64_t llDelayNs;
+} NTPSample_t;
 
-static SemaphoreHandle_t xNTPWakeupSem = NULL;
-static uint32_t ulIPAddressFound;
+typedef struct xNTP_PEER
+{
+	const char *pcName;
+	uint32_t ulIPAddress;
+	NTPSample_t xSamples[ ntpFILTER_SIZE ];
+	BaseType_t xSampleCount;
+	BaseType_t xNextSample;
+	int64_t llOffsetNs;			/* Offset of the best sample. */
+	int64_t llDelayNs;			/* Delay of the best sample. */
+	int64_t llJitterNs;			/* RMS of the sample offsets around llOffsetNs. */
+	int64_t llRootDistanceNs;	/* delay / 2 + jitter + the server's root distance. */
+	uint32_t ulRootNs;			/* The server's root delay / 2 + root dispersion. */
+	uint32_t ulRootDelay;		/* As received, in NTP short format. */
+	uint32_t ulRootDispersion;
+	uint8_t ucReach;			/* One bit per poll, set when the server answered. */
+	uint8_t ucStratum;
+} NTPPeer_t;
+
+static const char *pcTimeServers[] = { ntpSERVER_NAMES };
+
+#define ntpPEER_COUNT	( sizeof( pcTimeServers ) / sizeof( pcTimeServers[ 0 ] ) )
+
+static NTPPeer_t xPeers[ ntpPEER_COUNT ];
+static NTPClock_t xClock;
+static struct SNtpPacket xNTPPacket;
 static Socket_t xUDPSocket = NULL;
 static TaskHandle_t xNTPTaskhandle = NULL;
-static TickType_t uxSendTime;
+
+/* Status, as exposed by the public functions. */
+static volatile BaseType_t xSynchronised = pdFALSE;
+static volatile int32_t lLastOffsetUs;
+static volatile uint32_t ulJitterUs;
+static volatile int32_t lFrequencyPPB;
+static uint64_t ullLastUpdateNs;
+static NTPReference_t xReference;
+static uint32_t ulPollSeconds = ntpMIN_POLL_SECONDS;
 
 static void prvNTPTask( void *pvParameters );
 
-static void vSignalTask( void )
+/*-----------------------------------------------------------*/
+
+static uint64_t prvCyclesToNs( uint64_t ullCycles )
 {
-	#if( ipconfigUSE_CALLBACKS == 0 )
-	if( xUDPSocket != NULL )
-	{
-		/* Send a signal to the socket so that the
-		FreeRTOS_recvfrom will get interrupted. */
-		FreeRTOS_SignalSocket( xUDPSocket );
-	}
-	else
-	#endif
-	if( xNTPWakeupSem != NULL )
+	return ( ullCycles / configCPU_CLOCK_HZ ) * ntpNS_PER_SECOND +
+		( ( ullCycles % configCPU_CLOCK_HZ ) * ntpNS_PER_SECOND ) / configCPU_CLOCK_HZ;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvClockRate( int32_t lPPB )
+{
+const uint64_t ullNominal = ( ntpNS_PER_SECOND << ntpRATE_SHIFT ) / configCPU_CLOCK_HZ;
+
+	return ( uint32_t ) ( ( int64_t ) ullNominal + ( ( int64_t ) ullNominal * lPPB ) / ( int64_t ) ntpNS_PER_SECOND );
+}
+/*-----------------------------------------------------------*/
+
+static void prvClockAdvanceTo( uint64_t ullCycles, uint32_t ulRate )
+{
+	/* Advance in steps that can't overflow the 64-bit product. */
+	while( ullCycles > xClock.ullBaseCycles )
 	{
-		xSemaphoreGive( xNTPWakeupSem );
+	uint64_t ullDelta = ullCycles - xClock.ullBaseCycles;
+	uint64_t ullProduct;
+
+		if( ullDelta > 0xFFFFFFFFULL )
+		{
+			ullDelta = 0xFFFFFFFFULL;
+		}
+		ullProduct = ullDelta * ulRate + xClock.ulBaseFraction;
+		xClock.ullBaseNs += ullProduct >> ntpRATE_SHIFT;
+		xClock.ulBaseFraction = ( uint32_t ) ( ullProduct & ( ( 1ULL << ntpRATE_SHIFT ) - 1u ) );
+		xClock.ullBaseCycles += ullDelta;
 	}
 }
+/*-----------------------------------------------------------*/
 
-void vStartNTPTask( uint16_t usTaskStackSize, UBaseType_t uxTaskPriority )
+/* Must be called from within a critical section. */
+static uint64_t prvClockRead( void )
 {
-	/* The only public function in this module: start a task to contact
-	some NTP server. */
+uint64_t ullNow = get_cycle_count();
 
-	if( xNTPTaskhandle != NULL )
+	if( xClock.xSlewing != pdFALSE )
 	{
-		switch( xStatus )
+		if( ullNow < xClock.ullSlewEndCycles )
 		{
-		case EStatusPause:
-			xStatus = EStatusAsking;
-			vSignalTask();
-			break;
-		case EStatusLookup:
-			FreeRTOS_printf( ( "NTP looking up server\n" ) );
-			break;
-		case EStatusAsking:
-			FreeRTOS_printf( ( "NTP still asking\n" ) );
-			break;
-		case EStatusFailed:
-			FreeRTOS_printf( ( "NTP failed somehow\n" ) );
-			ulIPAddressFound = 0ul;
-			xStatus = EStatusLookup;
-			vSignalTask();
-			break;
+			prvClockAdvanceTo( ullNow, xClock.ulSlewRate );
+			return xClock.ullBaseNs;
 		}
+		prvClockAdvanceTo( xClock.ullSlewEndCycles, xClock.ulSlewRate );
+		xClock.xSlewing = pdFALSE;
 	}
-	else
+	prvClockAdvanceTo( ullNow, xClock.ulRate );
+
+	return xClock.ullBaseNs;
+}
+/*-----------------------------------------------------------*/
+
+uint64_t ullNTPGetTimeNs( void )
+{
+uint64_t ullResult;
+
+	if( xClock.ulRate == 0u )
 	{
-		xUDPSocket = FreeRTOS_socket( FREERTOS_AF_INET, FREERTOS_SOCK_DGRAM, FREERTOS_IPPROTO_UDP );
-		if( xUDPSocket != NULL )
-		{
-		struct freertos_sockaddr xAddress;
-		#if( ipconfigUSE_CALLBACKS != 0 )
-			BaseType_t xReceiveTimeOut = pdMS_TO_TICKS( 0 );
-		#else
-			BaseType_t xReceiveTimeOut = pdMS_TO_TICKS( 5000 );
-		#endif
+		/* Not started yet: count from boot. */
+		return prvCyclesToNs( get_cycle_count() );
+	}
 
-			xAddress.sin_addr = 0ul;
-			xAddress.sin_port = FreeRTOS_htons( NTP_PORT );
+	taskENTER_CRITICAL();
+	{
+		ullResult = prvClockRead();
+	}
+	taskEXIT_CRITICAL();
 
-			FreeRTOS_bind( xUDPSocket, &xAddress, sizeof( xAddress ) );
-			FreeRTOS_setsockopt( xUDPSocket, 0, FREERTOS_SO_RCVTIMEO, &xReceiveTimeOut, sizeof( xReceiveTimeOut ) );
-			xTaskCreate( 	prvNTPTask,						/* The function that implements the task. */
-							( const char * ) "NTP client",	/* Just a text name for the task to aid debugging. */
-							usTaskStackSize,				/* The stack size is defined in FreeRTOSIPConfig.h. */
-							NULL,							/* The task parameter, not used in this case. */
-							uxTaskPriority,					/* The priority assigned to the task is defined in FreeRTOSConfig.h. */
-							&xNTPTaskhandle );				/* The task handle. */
-		}
-		else
+	return ullResult;
+}
+/*-----------------------------------------------------------*/
+
+uint64_t ullNTPGetTimeUs( void )
+{
+	return ullNTPGetTimeNs() / 1000u;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t xNTPIsSynchronised( void )
+{
+	return xSynchronised;
+}
+/*-----------------------------------------------------------*/
+
+int32_t lNTPGetOffsetUs( void )
+{
+	return lLastOffsetUs;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulNTPGetJitterUs( void )
+{
+	return ulJitterUs;
+}
+/*-----------------------------------------------------------*/
+
+int32_t lNTPGetFrequencyPPB( void )
+{
+	return lFrequencyPPB;
+}
+/*-----------------------------------------------------------*/
+
+static void prvClockInit( void )
+{
+	taskENTER_CRITICAL();
+	{
+		xClock.ullBaseCycles = get_cycle_count();
+		xClock.ullBaseNs = prvCyclesToNs( xClock.ullBaseCycles );
+		xClock.ulBaseFraction = 0u;
+		xClock.ulRate = prvClockRate( 0 );
+		xClock.xSlewing = pdFALSE;
+	}
+	taskEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
+
+static void prvClockStep( int64_t llOffsetNs )
+{
+	taskENTER_CRITICAL();
+	{
+		( void ) prvClockRead();
+		xClock.ullBaseNs += ( uint64_t ) llOffsetNs;
+		xClock.xSlewing = pdFALSE;
+	}
+	taskEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
+
+static void prvClockSlew( int64_t llOffsetNs, int32_t lPPB )
+{
+int64_t llMagnitude = ( llOffsetNs < 0 ) ? -llOffsetNs : llOffsetNs;
+uint64_t ullSlewCycles;
+
+	/* At ntpSLEW_PPM the offset is gone after 1e6 / ntpSLEW_PPM times the
+	offset. */
+	ullSlewCycles = ( ( uint64_t ) llMagnitude * configCPU_CLOCK_HZ ) / ( ntpSLEW_PPM * 1000u );
+
+	taskENTER_CRITICAL();
+	{
+		( void ) prvClockRead();
+		xClock.ulRate = prvClockRate( lPPB );
+		xClock.ulSlewRate = prvClockRate( lPPB + ( ( llOffsetNs < 0 ) ? -( ntpSLEW_PPM * 1000 ) : ( ntpSLEW_PPM * 1000 ) ) );
+		xClock.ullSlewEndCycles = xClock.ullBaseCycles + ullSlewCycles;
+		xClock.xSlewing = ( ullSlewCycles != 0u );
+		xClock.xSlewNegative = ( llOffsetNs < 0 );
+	}
+	taskEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
+
+/* The part of the last slewed offset that the clock has not caught up
+with yet. */
+static int64_t prvClockSlewRemainingNs( void )
+{
+uint64_t ullCycles = 0u;
+int64_t llRemaining;
+
+	taskENTER_CRITICAL();
+	{
+		( void ) prvClockRead();
+		if( xClock.xSlewing != pdFALSE )
 		{
-			FreeRTOS_printf( ( "Creating socket failed\n" ) );
+			ullCycles = xClock.ullSlewEndCycles - xClock.ullBaseCycles;
 		}
 	}
+	taskEXIT_CRITICAL();
+
+	llRemaining = ( int64_t ) ( ( ullCycles * ( ntpSLEW_PPM * 1000u ) ) / configCPU_CLOCK_HZ );
+
+	return ( xClock.xSlewNegative != pdFALSE ) ? -llRemaining : llRemaining;
+}
+/*-----------------------------------------------------------*/
+
+void vNTPTimeToTimestamp( uint64_t ullNs, SNtpTimestamp *pxTimestamp )
+{
+	pxTimestamp->seconds = ( uint32_t ) ( ullNs / ntpNS_PER_SECOND ) + TIME1970;
+	pxTimestamp->fraction = ( uint32_t ) ( ( ( ullNs % ntpNS_PER_SECOND ) << 32 ) / ntpNS_PER_SECOND );
 }
 /*-----------------------------------------------------------*/
 
-static void vDNS_callback( const char *pcName, void *pvSearchID, uint32_t ulIPAddress )
+static uint64_t prvTimestampToNs( const SNtpTimestamp *pxTimestamp )
 {
-char pcBuf[16];
+	/* Valid until 2106, when the unsigned seconds since 1970 wrap. */
+	return ( uint64_t ) ( uint32_t ) ( pxTimestamp->seconds - TIME1970 ) * ntpNS_PER_SECOND +
+		( ( ( uint64_t ) pxTimestamp->fraction * ntpNS_PER_SECOND ) >> 32 );
+}
+/*-----------------------------------------------------------*/
 
-	/* The DNS lookup has a result, or it has reached the time-out. */
-	FreeRTOS_inet_ntoa( ulIPAddress, pcBuf );
-	FreeRTOS_printf( ( "IP address of %s found: %s\n", pcName, pcBuf ) );
-	if( ulIPAddressFound == 0ul )
+/* NTP short format, 16.16 seconds, to nanoseconds (at most about 4 s). */
+static uint32_t prvShortToNs( uint32_t ulShort )
+{
+uint64_t ullNs = ( ( uint64_t ) ulShort * ntpNS_PER_SECOND ) >> 16;
+
+	return ( ullNs > 0xFFFFFFFFULL ) ? 0xFFFFFFFFul : ( uint32_t ) ullNs;
+}
+/*-----------------------------------------------------------*/
+
+/* The square of a difference, which is clipped at one second so that a bad
+sample can't overflow a sum of squares. */
+static uint64_t prvSquare( int64_t llDiffNs )
+{
+	if( ( llDiffNs > 1000000000LL ) || ( llDiffNs < -1000000000LL ) )
 	{
-		ulIPAddressFound = ulIPAddress;
+		llDiffNs = 1000000000LL;
 	}
-	/* For testing: in case DNS doen't respond, still try some NTP server
-	with a known IP-address. */
-	if( ulIPAddressFound == 0ul )
+
+	return ( uint64_t ) ( llDiffNs * llDiffNs );
+}
+/*-----------------------------------------------------------*/
+
+static int64_t prvSqrt( uint64_t ullValue )
+{
+uint64_t ullResult = 0u;
+uint64_t ullBit = 1ULL << 62;
+
+	while( ullBit > ullValue )
 	{
-		ulIPAddressFound = FreeRTOS_inet_addr_quick( 184, 105, 182, 7 );
-/*		ulIPAddressFound = FreeRTOS_inet_addr_quick( 103, 242,  70, 4 );	*/
+		ullBit >>= 2;
+	}
+	while( ullBit != 0u )
+	{
+		if( ullValue >= ullResult + ullBit )
+		{
+			ullValue -= ullResult + ullBit;
+			ullResult = ( ullResult >> 1 ) + ullBit;
+		}
+		else
+		{
+			ullResult >>= 1;
+		}
+		ullBit >>= 2;
 	}
-	xStatus = EStatusAsking;
 
-	vSignalTask();
+	return ( int64_t ) ullResult;
 }
 /*-----------------------------------------------------------*/
 
@@ -240,233 +478,439 @@ static void prvSwapFields( struct SNtpPacket *pxPacket)
 }
 /*-----------------------------------------------------------*/
 
-static void prvNTPPacketInit( )
+void vStartNTPTask( uint16_t usTaskStackSize, UBaseType_t uxTaskPriority )
 {
-	memset (&xNTPPacket, '\0', sizeof( xNTPPacket ) );
+	/* Start a task that keeps the clock synchronised to the NTP servers. */
+	if( xNTPTaskhandle != NULL )
+	{
+		/* Already running: poll the servers now. */
+		xTaskNotifyGive( xNTPTaskhandle );
+	}
+	else
+	{
+		xUDPSocket = FreeRTOS_socket( FREERTOS_AF_INET, FREERTOS_SOCK_DGRAM, FREERTOS_IPPROTO_UDP );
+		if( xUDPSocket != FREERTOS_INVALID_SOCKET )
+		{
+		struct freertos_sockaddr xAddress;
+		TickType_t xReceiveTimeOut = pdMS_TO_TICKS( ntpRESPONSE_TIMEOUT_MS );
 
-	xNTPPacket.flags = 0xDB;				/* value 0xDB : mode 3 (client), version 3, leap indicator unknown 3 */
-	xNTPPacket.poll = 10;					/* 10 means 1 << 10 = 1024 seconds */
-	xNTPPacket.precision = 0xFA;			/* = 250 = 0.015625 seconds */
-	xNTPPacket.rootDelay = 0x5D2E;			/* 0x5D2E = 23854 or (23854/65535)= 0.3640 sec */
-	xNTPPacket.rootDispersion = 0x0008CAC8;	/* 0x0008CAC8 = 8.7912  seconds */
+			/* Any local port will do. */
+			xAddress.sin_addr = 0ul;
+			xAddress.sin_port = 0u;
 
-	/* use the recorded NTP time */
-	time_t uxSecs = FreeRTOS_time( NULL );/* apTime may be NULL, returns seconds */
+			FreeRTOS_bind( xUDPSocket, &xAddress, sizeof( xAddress ) );
+			FreeRTOS_setsockopt( xUDPSocket, 0, FREERTOS_SO_RCVTIMEO, &xReceiveTimeOut, sizeof( xReceiveTimeOut ) );
 
-	xNTPPacket.referenceTimestamp.seconds = uxSecs;	/* Current time */
-	xNTPPacket.transmitTimestamp.seconds = uxSecs + 3;
+			prvClockInit();
 
-	/* Transform the contents of the fields from native to big endian. */
-	prvSwapFields( &xNTPPacket );
+			xTaskCreate( 	prvNTPTask,						/* The function that implements the task. */
+							( const char * ) "NTP client",	/* Just a text name for the task to aid debugging. */
+							usTaskStackSize,				/* The stack size is defined in FreeRTOSIPConfig.h. */
+							NULL,							/* The task parameter, not used in this case. */
+							uxTaskPriority,					/* High enough to take the receive time promptly. */
+							&xNTPTaskhandle );				/* The task handle. */
+		}
+		else
+		{
+			FreeRTOS_printf( ( "Creating socket failed\n" ) );
+		}
+	}
 }
 /*-----------------------------------------------------------*/
 
-static void prvReadTime( struct SNtpPacket * pxPacket )
+static void prvResolvePeer( NTPPeer_t *pxPeer )
 {
-	FF_TimeStruct_t xTimeStruct;
-	time_t uxPreviousSeconds;
-	time_t uxPreviousMS;
+char pcBuf[ 16 ];
 
-	time_t uxCurrentSeconds;
-	time_t uxCurrentMS;
+	pxPeer->ulIPAddress = FreeRTOS_inet_addr( pxPeer->pcName );
+	if( pxPeer->ulIPAddress == 0ul )
+	{
+		pxPeer->ulIPAddress = FreeRTOS_gethostbyname( pxPeer->pcName );
+	}
+	if( pxPeer->ulIPAddress != 0ul )
+	{
+		FreeRTOS_inet_ntoa( pxPeer->ulIPAddress, pcBuf );
+		FreeRTOS_printf( ( "NTP server %s: %s\n", pxPeer->pcName, pcBuf ) );
+	}
+	else
+	{
+		FreeRTOS_printf( ( "NTP server %s: lookup failed\n", pxPeer->pcName ) );
+	}
+}
+/*-----------------------------------------------------------*/
 
-	const char *pcTimeUnit;
-	int32_t ilDiff;
-	TickType_t uxTravelTime;
+static void prvPeerFilter( NTPPeer_t *pxPeer )
+{
+BaseType_t x, xBest = 0;
+uint64_t ullSum = 0u;
 
-	uxTravelTime = xTaskGetTickCount() - uxSendTime;
+	/* Use the sample with the lowest delay: it has the least queueing, and
+	so the smallest error in its offset. */
+	for( x = 1; x < pxPeer->xSampleCount; x++ )
+	{
+		if( pxPeer->xSamples[ x ].llDelayNs < pxPeer->xSamples[ xBest ].llDelayNs )
+		{
+			xBest = x;
+		}
+	}
+	pxPeer->llOffsetNs = pxPeer->xSamples[ xBest ].llOffsetNs;
+	pxPeer->llDelayNs = pxPeer->xSamples[ xBest ].llDelayNs;
 
-	/* Transform the contents of the fields from big to native endian. */
-	prvSwapFields( pxPacket );
+	for( x = 0; x < pxPeer->xSampleCount; x++ )
+	{
+		ullSum += prvSquare( pxPeer->xSamples[ x ].llOffsetNs - pxPeer->llOffsetNs ) / ( uint64_t ) pxPeer->xSampleCount;
+	}
+	pxPeer->llJitterNs = prvSqrt( ullSum );
+	pxPeer->llRootDistanceNs = pxPeer->llDelayNs / 2 + pxPeer->llJitterNs + pxPeer->ulRootNs;
+}
+/*-----------------------------------------------------------*/
 
-	uxCurrentSeconds = pxPacket->receiveTimestamp.seconds - TIME1970;
-	uxCurrentMS = pxPacket->receiveTimestamp.fraction / 4294967;
-	uxCurrentSeconds += uxCurrentMS / 1000;
-	uxCurrentMS = uxCurrentMS % 1000;
+/* Send a request to one server and wait for the answer.  Returns pdTRUE when a
+valid sample was added to the peer's filter. */
+static BaseType_t prvPollPeer( NTPPeer_t *pxPeer )
+{
+struct freertos_sockaddr xAddress;
+uint32_t ulAddressSize;
+SNtpTimestamp xOriginate;
+uint64_t ullT1, ullT2, ullT3, ullT4;
+TickType_t xStart;
+BaseType_t xReturned;
+NTPSample_t *pxSample;
+
+	memset( &xNTPPacket, '\0', sizeof( xNTPPacket ) );
+	xNTPPacket.flags = ntpFLAGS_CLIENT_REQUEST;
+	xNTPPacket.poll = 6;
+
+	xAddress.sin_addr = pxPeer->ulIPAddress;
+	xAddress.sin_port = FreeRTOS_htons( NTP_PORT );
+
+	/* The server echoes the transmit timestamp as the originate timestamp, which
+	identifies the answer.  Take T1 as late as possible. */
+	ullT1 = ullNTPGetTimeNs();
+	vNTPTimeToTimestamp( ullT1, &xOriginate );
+	xNTPPacket.transmitTimestamp.seconds = FreeRTOS_htonl( xOriginate.seconds );
+	xNTPPacket.transmitTimestamp.fraction = FreeRTOS_htonl( xOriginate.fraction );
+	FreeRTOS_sendto( xUDPSocket, ( void * ) &xNTPPacket, sizeof( xNTPPacket ), 0, &xAddress, sizeof( xAddress ) );
+
+	xStart = xTaskGetTickCount();
+	for( ;; )
+	{
+		ulAddressSize = sizeof( xAddress );
+		xReturned = FreeRTOS_recvfrom( xUDPSocket, ( void * ) &xNTPPacket, sizeof( xNTPPacket ), 0, &xAddress, &ulAddressSize );
+		ullT4 = ullNTPGetTimeNs();
 
-	// Get the last time recorded
-	uxPreviousSeconds = FreeRTOS_get_secs_msec( &uxPreviousMS );
+		if( xReturned == ( BaseType_t ) sizeof( xNTPPacket ) )
+		{
+			prvSwapFields( &xNTPPacket );
+			if( ( xAddress.sin_addr == pxPeer->ulIPAddress ) &&
+				( xNTPPacket.originateTimestamp.seconds == xOriginate.seconds ) &&
+				( xNTPPacket.originateTimestamp.fraction == xOriginate.fraction ) )
+			{
+				break;
+			}
+			/* A late answer to an earlier request, or from another host. */
+		}
+		else if( xReturned > 0 )
+		{
+			FreeRTOS_printf( ( "NTP: unexpected length %ld\n", xReturned ) );
+		}
 
-	// Set the new time with precision in msec. */
-	FreeRTOS_set_secs_msec( &uxCurrentSeconds, &uxCurrentMS );
+		if( ( xTaskGetTickCount() - xStart ) >= pdMS_TO_TICKS( ntpRESPONSE_TIMEOUT_MS ) )
+		{
+			return pdFALSE;
+		}
+	}
 
-	if( uxCurrentSeconds >= uxPreviousSeconds )
+	if( ( ( xNTPPacket.flags & ntpMODE_MASK ) != ntpMODE_SERVER ) ||
+		( ( xNTPPacket.flags & ntpLEAP_UNSYNCHRONISED ) == ntpLEAP_UNSYNCHRONISED ) ||
+		( xNTPPacket.stratum == 0u ) || ( xNTPPacket.stratum >= 16u ) ||
+		( xNTPPacket.transmitTimestamp.seconds == 0ul ) )
 	{
-		ilDiff = ( int32_t ) ( uxCurrentSeconds - uxPreviousSeconds );
+		/* Unsynchronised server, or a kiss-o'-death packet. */
+		FreeRTOS_printf( ( "NTP %s: not usable (flags %02x stratum %u)\n",
+			pxPeer->pcName, xNTPPacket.flags, ( unsigned ) xNTPPacket.stratum ) );
+		return pdFALSE;
 	}
-	else
+
+	ullT2 = prvTimestampToNs( &( xNTPPacket.receiveTimestamp ) );
+	ullT3 = prvTimestampToNs( &( xNTPPacket.transmitTimestamp ) );
+
+	pxSample = &( pxPeer->xSamples[ pxPeer->xNextSample ] );
+	pxSample->llOffsetNs = ( ( int64_t ) ( ullT2 - ullT1 ) + ( int64_t ) ( ullT3 - ullT4 ) ) / 2;
+	pxSample->llDelayNs = ( int64_t ) ( ullT4 - ullT1 ) - ( int64_t ) ( ullT3 - ullT2 );
+	if( pxSample->llDelayNs < 0 )
 	{
-		ilDiff = 0 - ( int32_t ) ( uxPreviousSeconds - uxCurrentSeconds );
+		/* The server's processing time can't exceed the round trip, but a
+		coarse server clock can make it look like that. */
+		pxSample->llDelayNs = 0;
 	}
 
-	if( ( ilDiff < -5 ) || ( ilDiff > 5 ) )
+	if( ++pxPeer->xNextSample >= ntpFILTER_SIZE )
 	{
-		/* More than 5 seconds difference. */
-		pcTimeUnit = "sec";
+		pxPeer->xNextSample = 0;
 	}
-	else
+	if( pxPeer->xSampleCount < ntpFILTER_SIZE )
 	{
-		/* Less than or equal to 5 second difference. */
-		pcTimeUnit = "ms";
-		uint32_t ulLowest = ( uxCurrentSeconds <= uxPreviousSeconds ) ? uxCurrentSeconds : uxPreviousSeconds;
-		int32_t iCurMS = 1000 * ( uxCurrentSeconds - ulLowest ) + uxCurrentMS;
-		int32_t iPrevMS = 1000 * ( uxPreviousSeconds - ulLowest ) + uxPreviousMS;
-		ilDiff = iCurMS - iPrevMS;
-	}
-	uxCurrentSeconds -= iTimeZone;
-
-	FreeRTOS_gmtime_r( &uxCurrentSeconds, &xTimeStruct );
-
-	/*
-		378.067 [NTP client] NTP time: 9/11/2015 16:11:19.559 Diff -20 ms (289 ms)
-		379.441 [NTP client] NTP time: 9/11/2015 16:11:20.933 Diff 0 ms (263 ms)
-	*/
-
-	FreeRTOS_printf( ("NTP time: %d/%d/%02d %2d:%02d:%02d.%03u Diff %d %s (%lu ms)\n",
-		xTimeStruct.tm_mday,
-		xTimeStruct.tm_mon + 1,
-		xTimeStruct.tm_year + 1900,
-		xTimeStruct.tm_hour,
-		xTimeStruct.tm_min,
-		xTimeStruct.tm_sec,
-		( unsigned )uxCurrentMS,
-		( unsigned )ilDiff,
-		pcTimeUnit,
-		uxTravelTime ) );
-
-	/* Remove compiler warnings in case FreeRTOS_printf() is not used. */
-	( void ) pcTimeUnit;
-	( void ) uxTravelTime;
+		pxPeer->xSampleCount++;
+	}
+	pxPeer->ucStratum = xNTPPacket.stratum;
+	pxPeer->ulRootDelay = ( uint32_t ) xNTPPacket.rootDelay;
+	pxPeer->ulRootDispersion = ( uint32_t ) xNTPPacket.rootDispersion;
+	pxPeer->ulRootNs = prvShortToNs( pxPeer->ulRootDelay ) / 2u + prvShortToNs( pxPeer->ulRootDispersion );
+
+	prvPeerFilter( pxPeer );
+
+	return pdTRUE;
 }
 /*-----------------------------------------------------------*/
 
-#if( ipconfigUSE_CALLBACKS != 0 )
+/* Combine the peers into one offset.  Returns pdFALSE when no peer is
+usable. */
+static BaseType_t prvSelectOffset( int64_t *pllOffsetNs, int64_t *pllJitterNs, NTPPeer_t **ppxSystemPeer )
+{
+NTPPeer_t *pxSystemPeer = NULL;
+NTPPeer_t *pxPeer;
+BaseType_t x, xSurvivors = 0;
+int64_t llWeightSum = 0, llOffsetSum = 0;
+uint64_t ullSpread = 0u;
 
-	static BaseType_t xOnUDPReceive( Socket_t xSocket, void * pvData, size_t xLength,
-		const struct freertos_sockaddr *pxFrom, const struct freertos_sockaddr *pxDest )
+	for( x = 0; x < ( BaseType_t ) ntpPEER_COUNT; x++ )
 	{
-		if( xLength >= sizeof( xNTPPacket ) )
+		pxPeer = &( xPeers[ x ] );
+		if( ( pxPeer->xSampleCount != 0 ) && ( pxPeer->ucReach != 0u ) &&
+			( ( pxSystemPeer == NULL ) || ( pxPeer->llRootDistanceNs < pxSystemPeer->llRootDistanceNs ) ) )
 		{
-			prvReadTime( ( struct SNtpPacket *)pvData );
-			if( xStatus != EStatusPause )
-			{
-				xStatus = EStatusPause;
-			}
+			pxSystemPeer = pxPeer;
 		}
-		vSignalTask();
-		/* Tell the driver not to store the RX data */
-		return 1;
 	}
-	/*-----------------------------------------------------------*/
 
-#endif	/* ipconfigUSE_CALLBACKS != 0 */
-
-static void prvNTPTask( void *pvParameters )
-{
-BaseType_t xServerIndex = 3;
-struct freertos_sockaddr xAddress;
-#if( ipconfigUSE_CALLBACKS != 0 )
-	F_TCP_UDP_Handler_t xHandler;
-#endif /* ipconfigUSE_CALLBACKS != 0 */
+	if( pxSystemPeer == NULL )
+	{
+		return pdFALSE;
+	}
+	*ppxSystemPeer = pxSystemPeer;
 
-	xStatus = EStatusLookup;
-	#if( ipconfigSOCKET_HAS_USER_SEMAPHORE != 0 ) || ( ipconfigUSE_CALLBACKS != 0 )
+	if( ( pxSystemPeer->llOffsetNs > ntpSTEP_THRESHOLD_US * 1000LL ) || ( pxSystemPeer->llOffsetNs < -ntpSTEP_THRESHOLD_US * 1000LL ) )
 	{
-		xNTPWakeupSem = xSemaphoreCreateBinary();
+		/* The clock will be stepped, a weighted average is not needed. */
+		*pllOffsetNs = pxSystemPeer->llOffsetNs;
+		*pllJitterNs = pxSystemPeer->llJitterNs;
+		return pdTRUE;
 	}
-	#endif
 
-	#if( ipconfigUSE_CALLBACKS != 0 )
+	/* Average the servers whose error interval overlaps the one of the best
+	server, weighted by their root distance.  The others are considered to be
+	false tickers. */
+	for( x = 0; x < ( BaseType_t ) ntpPEER_COUNT; x++ )
 	{
-		memset( &xHandler, '\0', sizeof( xHandler ) );
-		xHandler.pxOnUDPReceive = xOnUDPReceive;
-		FreeRTOS_setsockopt( xUDPSocket, 0, FREERTOS_SO_UDP_RECV_HANDLER, ( void * ) &xHandler, sizeof( xHandler ) );
+	int64_t llDiff, llWeight;
+
+		pxPeer = &( xPeers[ x ] );
+		if( ( pxPeer->xSampleCount == 0 ) || ( pxPeer->ucReach == 0u ) )
+		{
+			continue;
+		}
+		llDiff = pxPeer->llOffsetNs - pxSystemPeer->llOffsetNs;
+		if( ( llDiff > pxPeer->llRootDistanceNs + pxSystemPeer->llRootDistanceNs ) ||
+			( -llDiff > pxPeer->llRootDistanceNs + pxSystemPeer->llRootDistanceNs ) )
+		{
+			continue;
+		}
+		llWeight = 1000000000LL / ( ( pxPeer->llRootDistanceNs > 1000 ) ? ( pxPeer->llRootDistanceNs / 1000 ) : 1 );
+		llWeightSum += llWeight;
+		llOffsetSum += llWeight * pxPeer->llOffsetNs;
+		ullSpread += prvSquare( llDiff );
+		xSurvivors++;
 	}
-	#endif
-	#if( ipconfigSOCKET_HAS_USER_SEMAPHORE != 0 )
+
+	*pllOffsetNs = llOffsetSum / llWeightSum;
+
+	/* The jitter of the best server, combined with the spread between the
+	survivors. */
+	*pllJitterNs = prvSqrt( prvSquare( pxSystemPeer->llJitterNs ) + ullSpread / ( uint64_t ) xSurvivors );
+
+	return pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+/* Steer the clock by the offset.  Returns pdTRUE if the clock was stepped. */
+static BaseType_t prvClockUpdate( int64_t llOffsetNs, int64_t llJitterNs )
+{
+uint64_t ullNow = ullNTPGetTimeNs();
+int32_t lPPB = lFrequencyPPB;
+BaseType_t x, xStepped = pdFALSE;
+
+	if( ( xSynchronised == pdFALSE ) ||
+		( llOffsetNs > ntpSTEP_THRESHOLD_US * 1000LL ) || ( llOffsetNs < -ntpSTEP_THRESHOLD_US * 1000LL ) )
 	{
-		FreeRTOS_setsockopt( xUDPSocket, 0, FREERTOS_SO_SET_SEMAPHORE, ( void * ) &xNTPWakeupSem, sizeof( xNTPWakeupSem ) );
+	time_t xSeconds;
+	struct tm xTimeStruct;
+
+		prvClockStep( llOffsetNs );
+
+		/* The old samples are relative to the old clock. */
+		for( x = 0; x < ( BaseType_t ) ntpPEER_COUNT; x++ )
+		{
+			xPeers[ x ].xSampleCount = 0;
+			xPeers[ x ].xNextSample = 0;
+		}
+		ullLastUpdateNs = 0u;
+		ulPollSeconds = ntpMIN_POLL_SECONDS;
+
+		xSeconds = ( time_t ) ( ullNTPGetTimeNs() / ntpNS_PER_SECOND );
+		gmtime_r( &xSeconds, &xTimeStruct );
+		FreeRTOS_printf( ( "NTP time: %d/%d/%02d %2d:%02d:%02d UTC, stepped %ld ms\n",
+			xTimeStruct.tm_mday,
+			xTimeStruct.tm_mon + 1,
+			xTimeStruct.tm_year + 1900,
+			xTimeStruct.tm_hour,
+			xTimeStruct.tm_min,
+			xTimeStruct.tm_sec,
+			( long ) ( llOffsetNs / 1000000 ) ) );
+
+		xSynchronised = pdTRUE;
+		xStepped = pdTRUE;
 	}
-	#endif
-	for( ; ; )
+	else
 	{
-		switch( xStatus )
+		/* Frequency: the offset over the interval since the last update is a
+		frequency error, less what is left of the previous offset, which is
+		still being slewed away. */
+		if( ( ullLastUpdateNs != 0u ) && ( ullNow > ullLastUpdateNs ) )
 		{
-		case EStatusLookup:
-			if( ( ulIPAddressFound == 0ul ) || ( ulIPAddressFound == ~0ul ) )
+		int64_t llInterval = ( int64_t ) ( ullNow - ullLastUpdateNs );
+		int64_t llErrorNs = llOffsetNs - prvClockSlewRemainingNs();
+
+			lPPB += ( int32_t ) ( ( llErrorNs * 1000000000LL ) / ( llInterval * ntpFREQUENCY_GAIN ) );
+			if( lPPB > ntpMAX_FREQUENCY_PPB )
 			{
-				if( ++xServerIndex == sizeof( pcTimeServers ) / sizeof( pcTimeServers[ 0 ] ) )
-				{
-					xServerIndex = 0;
-				}
-				FreeRTOS_printf( ( "Looking up server '%s'\n", pcTimeServers[ xServerIndex ] ) );
-				FreeRTOS_gethostbyname_a( pcTimeServers[ xServerIndex ], vDNS_callback, (void *)NULL, 1200 );
+				lPPB = ntpMAX_FREQUENCY_PPB;
 			}
-			else
+			else if( lPPB < -ntpMAX_FREQUENCY_PPB )
 			{
-				xStatus = EStatusAsking;
+				lPPB = -ntpMAX_FREQUENCY_PPB;
 			}
-			break;
+		}
+		ullLastUpdateNs = ullNow;
 
-		case EStatusAsking:
-			{
-			char pcBuf[16];
+		/* Phase: slew the offset away. */
+		prvClockSlew( llOffsetNs, lPPB );
 
-				prvNTPPacketInit( );
-				xAddress.sin_addr = ulIPAddressFound;
-				xAddress.sin_port = FreeRTOS_htons( NTP_PORT );
+		if( ( llOffsetNs < ntpPOLL_ADJUST_US * 1000LL ) && ( llOffsetNs > -ntpPOLL_ADJUST_US * 1000LL ) )
+		{
+			ulPollSeconds = FreeRTOS_min_uint32( ulPollSeconds * 2u, ntpMAX_POLL_SECONDS );
+		}
+		else if( ulPollSeconds > ntpMIN_POLL_SECONDS )
+		{
+			ulPollSeconds /= 2u;
+		}
 
-				FreeRTOS_inet_ntoa( xAddress.sin_addr, pcBuf );
-				FreeRTOS_printf( ( "Sending UDP message to %s:%u\n",
-					pcBuf,
-					FreeRTOS_ntohs( xAddress.sin_port ) ) );
+		FreeRTOS_printf( ( "NTP offset %ld us jitter %lu us freq %ld ppb poll %lu s\n",
+			( long ) ( llOffsetNs / 1000 ), ( unsigned long ) ( llJitterNs / 1000 ),
+			( long ) lPPB, ( unsigned long ) ulPollSeconds ) );
+	}
 
-				uxSendTime = xTaskGetTickCount( );
-				FreeRTOS_sendto( xUDPSocket, ( void * )&xNTPPacket, sizeof( xNTPPacket ), 0, &xAddress, sizeof( xAddress ) );
-			}
-			break;
+	lFrequencyPPB = lPPB;
+	/* After a step, which may be decades from 1970, nothing is left. */
+	lLastOffsetUs = ( xStepped != pdFALSE ) ? 0 : ( int32_t ) ( llOffsetNs / 1000 );
+	ulJitterUs = ( uint32_t ) ( llJitterNs / 1000 );
 
-		case EStatusPause:
-			break;
+	return xStepped;
+}
+/*-----------------------------------------------------------*/
 
-		case EStatusFailed:
-			break;
-		}
+/* Record what a server on this board reports as its reference. */
+static void prvSetReference( const NTPPeer_t *pxSystemPeer, int64_t llJitterNs )
+{
+NTPReference_t xNew;
+uint64_t ullShort;
+
+	/* The IPv4 address of the upstream server identifies it, in network byte
+	order like ulIPAddress. */
+	xNew.ulReferenceID = pxSystemPeer->ulIPAddress;
+	xNew.ucStratum = ( uint8_t ) ( pxSystemPeer->ucStratum + 1u );
+
+	/* Add the path to the upstream server, in NTP short format. */
+	ullShort = pxSystemPeer->ulRootDelay + ( ( ( uint64_t ) pxSystemPeer->llDelayNs << 16 ) / ntpNS_PER_SECOND );
+	xNew.ulRootDelay = ( ullShort > 0xFFFFFFFFULL ) ? 0xFFFFFFFFul : ( uint32_t ) ullShort;
+	ullShort = pxSystemPeer->ulRootDispersion + ( ( ( uint64_t ) llJitterNs << 16 ) / ntpNS_PER_SECOND );
+	xNew.ulRootDispersion = ( ullShort > 0xFFFFFFFFULL ) ? 0xFFFFFFFFul : ( uint32_t ) ullShort;
+	xNew.ullReferenceTimeNs = ullNTPGetTimeNs();
+
+	taskENTER_CRITICAL();
+	{
+		xReference = xNew;
+	}
+	taskEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t xNTPGetReference( NTPReference_t *pxReference )
+{
+	taskENTER_CRITICAL();
+	{
+		*pxReference = xReference;
+	}
+	taskEXIT_CRITICAL();
 
-		#if( ipconfigUSE_CALLBACKS != 0 )
+	return xSynchronised;
+}
+/*-----------------------------------------------------------*/
+
+static void prvNTPTask( void *pvParameters )
+{
+BaseType_t x, xBurst = ntpBURST_COUNT;
+int64_t llOffsetNs, llJitterNs;
+NTPPeer_t *pxSystemPeer;
+
+	( void ) pvParameters;
+
+	for( x = 0; x < ( BaseType_t ) ntpPEER_COUNT; x++ )
+	{
+		xPeers[ x ].pcName = pcTimeServers[ x ];
+	}
+
+	for( ; ; )
+	{
+		for( x = 0; x < ( BaseType_t ) ntpPEER_COUNT; x++ )
 		{
-			xSemaphoreTake( xNTPWakeupSem, 5000 );
+		NTPPeer_t *pxPeer = &( xPeers[ x ] );
+
+			/* Look up again if the server hasn't answered the last 8 polls. */
+			if( ( pxPeer->ulIPAddress == 0ul ) || ( pxPeer->ucReach == 0u ) )
+			{
+				prvResolvePeer( pxPeer );
+			}
+			pxPeer->ucReach <<= 1;
+			if( ( pxPeer->ulIPAddress != 0ul ) && ( prvPollPeer( pxPeer ) != pdFALSE ) )
+			{
+				pxPeer->ucReach |= 1u;
+			}
 		}
-		#else
-		{
-		uint32_t xAddressSize;
-		BaseType_t xReturned;
 
-			xAddressSize = sizeof( xAddress );
-			xReturned = FreeRTOS_recvfrom( xUDPSocket, ( void * ) cRecvBuffer, sizeof( cRecvBuffer ), 0, &xAddress, &xAddressSize );
-			switch( xReturned )
+		if( prvSelectOffset( &llOffsetNs, &llJitterNs, &pxSystemPeer ) != pdFALSE )
+		{
+			/* A burst of exchanges follows a step.  The clock is only updated
+			after the last one, when the filters have a choice of samples. */
+			if( ( xSynchronised == pdFALSE ) || ( xBurst <= 1 ) )
 			{
-			case 0:
-			case -pdFREERTOS_ERRNO_EAGAIN:
-			case -pdFREERTOS_ERRNO_EINTR:
-				break;
-			default:
-				if( xReturned < sizeof( xNTPPacket ) )
+				if( prvClockUpdate( llOffsetNs, llJitterNs ) != pdFALSE )
 				{
-					FreeRTOS_printf( ( "FreeRTOS_recvfrom: returns %ld\n", xReturned ) );
+					xBurst = ntpBURST_COUNT;
 				}
-				else
-				{
-					prvReadTime( ( struct SNtpPacket *)cRecvBuffer );
-					if( xStatus != EStatusPause )
-					{
-						xStatus = EStatusPause;
-					}
-				}
-				break;
+				prvSetReference( pxSystemPeer, llJitterNs );
 			}
 		}
-		#endif
+
+		if( xBurst > 0 )
+		{
+			xBurst--;
+			ulTaskNotifyTake( pdTRUE, pdMS_TO_TICKS( ntpBURST_INTERVAL_MS ) );
+		}
+		else
+		{
+			ulTaskNotifyTake( pdTRUE, pdMS_TO_TICKS( ulPollSeconds * 1000u ) );
+		}
 	}
 }
 /*-----------------------------------------------------------*/
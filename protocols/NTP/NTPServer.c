@@ -0,0 +1,190 @@
+/*
+ * NTPServer.c -- SNTP server for time distribution on the local network
+ *
+ * Answers NTP client requests (mode 3) on port 123 from the clock that the NTP
+ * client in NTPDemo.c keeps, so that one board can serve the time to a whole
+ * rack.  Other boards point ntpSERVER_NAMES at this board's address.
+ *
+ * Requests are received with FREERTOS_ZERO_COPY and the answer is written into
+ * the same network buffer and sent back, so serving does not allocate and does
+ * not copy.  The receive timestamp is taken as soon as the task gets the
+ * packet, and the transmit timestamp just before it is handed back to the IP
+ * task; run the task just below the IP task priority to keep both close to the
+ * driver.
+ *
+ * Until the clock is synchronised to an upstream server, it only counts from
+ * boot, so answers carry leap indicator 3 (alarm) and stratum 16, which
+ * clients ignore.  With ntpSERVE_LOCAL_CLOCK, a board without an upstream
+ * server serves its free-running clock at stratum ntpLOCAL_STRATUM instead,
+ * so that the rack still agrees on one time, if not on the date.
+ */
+
+/* Standard includes. */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* FreeRTOS+TCP includes. */
+#include "FreeRTOS_IP.h"
+#include "FreeRTOS_Sockets.h"
+
+#include "NTPDemo.h"
+#include "NTPClient.h"
+
+/* Serve the local clock as valid time when it is not synchronised to an
+upstream server.  When 0, such answers carry leap indicator 3 (alarm) and are
+ignored by clients. */
+#ifndef ntpSERVE_LOCAL_CLOCK
+	#define ntpSERVE_LOCAL_CLOCK	( 0 )
+#endif
+#ifndef ntpLOCAL_STRATUM
+	#define ntpLOCAL_STRATUM		( 10 )
+#endif
+
+/* Precision of the clock, in log2 seconds: ullNTPGetTimeNs() is read with
+about microsecond precision. */
+#define ntpPRECISION				( -20 )
+
+#define ntpMODE_MASK				( 0x07 )
+#define ntpMODE_CLIENT				( 3 )
+#define ntpMODE_SERVER				( 4 )
+#define ntpVERSION_MASK				( 0x38 )
+#define ntpLEAP_NONE				( 0x00 )
+#define ntpLEAP_UNSYNCHRONISED		( 0xC0 )
+#define ntpSTRATUM_UNSYNCHRONISED	( 16 )
+
+static TaskHandle_t xNTPServerTaskHandle = NULL;
+static volatile uint32_t ulRequestCount;
+
+static void prvNTPServerTask( void *pvParameters );
+
+/*-----------------------------------------------------------*/
+
+void vStartNTPServerTask( uint16_t usTaskStackSize, UBaseType_t uxTaskPriority )
+{
+	if( xNTPServerTaskHandle == NULL )
+	{
+		xTaskCreate( prvNTPServerTask, "NTP server", usTaskStackSize, NULL, uxTaskPriority, &xNTPServerTaskHandle );
+	}
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulNTPServerGetRequestCount( void )
+{
+	return ulRequestCount;
+}
+/*-----------------------------------------------------------*/
+
+static void prvSetTimestamp( SNtpTimestamp *pxField, uint64_t ullNs )
+{
+SNtpTimestamp xTimestamp;
+
+	vNTPTimeToTimestamp( ullNs, &xTimestamp );
+	pxField->seconds = FreeRTOS_htonl( xTimestamp.seconds );
+	pxField->fraction = FreeRTOS_htonl( xTimestamp.fraction );
+}
+/*-----------------------------------------------------------*/
+
+static void prvNTPServerTask( void *pvParameters )
+{
+Socket_t xSocket;
+struct freertos_sockaddr xAddress;
+TickType_t xReceiveTimeOut = portMAX_DELAY;
+
+	( void ) pvParameters;
+
+	xSocket = FreeRTOS_socket( FREERTOS_AF_INET, FREERTOS_SOCK_DGRAM, FREERTOS_IPPROTO_UDP );
+	configASSERT( xSocket != FREERTOS_INVALID_SOCKET );
+
+	xAddress.sin_addr = 0ul;
+	xAddress.sin_port = FreeRTOS_htons( NTP_PORT );
+	FreeRTOS_bind( xSocket, &xAddress, sizeof( xAddress ) );
+	FreeRTOS_setsockopt( xSocket, 0, FREERTOS_SO_RCVTIMEO, &xReceiveTimeOut, sizeof( xReceiveTimeOut ) );
+
+	FreeRTOS_printf( ( "NTP server listening on port %u\n", NTP_PORT ) );
+
+	for( ;; )
+	{
+	uint8_t *pucBuffer;
+	uint32_t ulAddressSize = sizeof( xAddress );
+	int32_t lReceived;
+	uint64_t ullReceiveNs;
+	struct SNtpPacket xPacket;
+	NTPReference_t xReference;
+	BaseType_t xSynchronised;
+
+		lReceived = FreeRTOS_recvfrom( xSocket, &pucBuffer, 0, FREERTOS_ZERO_COPY, &xAddress, &ulAddressSize );
+		ullReceiveNs = ullNTPGetTimeNs();
+
+		if( lReceived <= 0 )
+		{
+			continue;
+		}
+
+		/* The payload may not be aligned, work on a copy of the header. */
+		if( ( size_t ) lReceived < sizeof( xPacket ) )
+		{
+			FreeRTOS_ReleaseUDPPayloadBuffer( pucBuffer );
+			continue;
+		}
+		memcpy( &xPacket, pucBuffer, sizeof( xPacket ) );
+
+		if( ( xPacket.flags & ntpMODE_MASK ) != ntpMODE_CLIENT )
+		{
+			FreeRTOS_ReleaseUDPPayloadBuffer( pucBuffer );
+			continue;
+		}
+
+		xSynchronised = xNTPGetReference( &xReference );
+		if( xSynchronised == pdFALSE )
+		{
+			/* "LOCL": the board's own clock. */
+			memset( &xReference, '\0', sizeof( xReference ) );
+			xReference.ulReferenceID = FreeRTOS_htonl( 0x4C4F434Cul );
+			xReference.ucStratum = ( ntpSERVE_LOCAL_CLOCK != 0 ) ? ntpLOCAL_STRATUM : ntpSTRATUM_UNSYNCHRONISED;
+			xReference.ullReferenceTimeNs = ullReceiveNs;
+		}
+
+		/* Keep the version of the request, answer in server mode. */
+		if( ( xSynchronised != pdFALSE ) || ( ntpSERVE_LOCAL_CLOCK != 0 ) )
+		{
+			xPacket.flags = ( unsigned char ) ( ntpLEAP_NONE | ( xPacket.flags & ntpVERSION_MASK ) | ntpMODE_SERVER );
+		}
+		else
+		{
+			xPacket.flags = ( unsigned char ) ( ntpLEAP_UNSYNCHRONISED | ( xPacket.flags & ntpVERSION_MASK ) | ntpMODE_SERVER );
+		}
+		xPacket.stratum = xReference.ucStratum;
+		/* 'poll' is echoed. */
+		xPacket.precision = ntpPRECISION;
+		xPacket.rootDelay = ( qint32 ) FreeRTOS_htonl( xReference.ulRootDelay );
+		xPacket.rootDispersion = ( qint32 ) FreeRTOS_htonl( xReference.ulRootDispersion );
+		memcpy( xPacket.referenceID, &( xReference.ulReferenceID ), sizeof( xPacket.referenceID ) );
+		prvSetTimestamp( &( xPacket.referenceTimestamp ), xReference.ullReferenceTimeNs );
+
+		/* The client's transmit time becomes the originate time, so that it can
+		match the answer. */
+		xPacket.originateTimestamp = xPacket.transmitTimestamp;
+		prvSetTimestamp( &( xPacket.receiveTimestamp ), ullReceiveNs );
+		prvSetTimestamp( &( xPacket.transmitTimestamp ), ullNTPGetTimeNs() );
+
+		memcpy( pucBuffer, &xPacket, sizeof( xPacket ) );
+
+		/* Send the request's buffer back.  Extension fields, if any, are not
+		answered. */
+		if( FreeRTOS_sendto( xSocket, pucBuffer, sizeof( xPacket ), FREERTOS_ZERO_COPY, &xAddress, sizeof( xAddress ) ) == 0 )
+		{
+			/* Not sent, the buffer is still ours. */
+			FreeRTOS_ReleaseUDPPayloadBuffer( pucBuffer );
+		}
+		else
+		{
+			ulRequestCount++;
+		}
+	}
+}
+/*-----------------------------------------------------------*/
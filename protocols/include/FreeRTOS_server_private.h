@@ -64,8 +64,10 @@
 
 #define FREERTOS_NO_SOCKET		NULL
 
-/* FreeRTOS+FAT */
-// #include "ff_stdio.h"
+/* FatFs, only needed when the FTP server is built. */
+#if( ipconfigUSE_FTP != 0 )
+	#include "ff.h"
+#endif
 
 /* Each HTTP server has 1, at most 2 sockets */
 #define	HTTP_SOCKET_COUNT	2
@@ -88,6 +90,23 @@
 	#define ipconfigTCP_FILE_BUFFER_SIZE	( 2048 )
 #endif
 
+/*
+ * ipconfigFTP_LIST_CACHE_COUNT sets the number of directory listings (LIST or
+ * NLST output) that the FTP server keeps.  A cached listing is sent again as
+ * long as no STOR, DELE, RNTO, MKD or RMD has been done since it was made.
+ * Use 0 to disable the cache.
+ *
+ * ipconfigFTP_LIST_CACHE_MAX_SIZE : listings that grow larger than this are
+ * still sent, but not kept.
+ */
+#ifndef ipconfigFTP_LIST_CACHE_COUNT
+	#define ipconfigFTP_LIST_CACHE_COUNT	( 4 )
+#endif
+
+#ifndef ipconfigFTP_LIST_CACHE_MAX_SIZE
+	#define ipconfigFTP_LIST_CACHE_MAX_SIZE	( 256 * 1024 )
+#endif
+
 struct xTCP_CLIENT;
 
 typedef BaseType_t ( * FTCPWorkFunction ) ( struct xTCP_CLIENT * /* pxClient */ );
@@ -132,6 +151,23 @@ struct xHTTP_CLIENT
 
 typedef struct xHTTP_CLIENT HTTPClient_t;
 
+/* The text of a directory listing, either cached in the server or private to a
+single client. */
+typedef struct xFTP_LIST
+{
+	char *pcPath;			/* Absolute path of the directory, NULL for a free slot. */
+	char *pcText;			/* Formatted listing, allocated with pvPortMalloc(). */
+	size_t uxLength;		/* Number of bytes used in pcText. */
+	size_t uxSize;			/* Number of bytes allocated for pcText. */
+	uint32_t ulModCount;	/* Value of the server's ulModCount when the listing was started. */
+	TickType_t xLastUsed;
+	BaseType_t xEntryCount;
+	UBaseType_t uxUsers;	/* Number of clients building or sending this listing. */
+	uint8_t ucNamesOnly;	/* pdTRUE for NLST output. */
+	uint8_t ucComplete;		/* pdTRUE when the whole directory is in pcText. */
+	uint8_t ucKeep;			/* pdFALSE if the listing will not be cached. */
+} FTPList_t;
+
 struct xFTP_CLIENT
 {
 	/* This define contains fields which must come first within each of the client structs */
@@ -147,9 +183,16 @@ struct xFTP_CLIENT
 	Socket_t xTransferSocket;
 	BaseType_t xTransType;
 	BaseType_t xDirCount;
-	// FF_FindData_t xFindData;
-	// FF_FILE *pxReadHandle;
-	// FF_FILE *pxWriteHandle;
+#if( ipconfigUSE_FTP != 0 )
+	DIR xDir;				/* Directory being listed by LIST/NLST. */
+	FILINFO xFileInfo;		/* Current entry of xDir. */
+	FIL xFile;				/* Only one transfer at a time: either read or write. */
+	FIL *pxReadHandle;		/* Points to xFile while a RETR is in progress. */
+	FIL *pxWriteHandle;		/* Points to xFile while a STOR is in progress. */
+	FTPList_t *pxList;		/* The listing being sent, either cached or xPrivateList. */
+	FTPList_t xPrivateList;	/* Used when no cache slot is available. */
+	size_t uxListOffset;	/* Number of bytes of pxList->pcText sent so far. */
+#endif
 	char pcCurrentDir[ ffconfigMAX_FILENAME ];
 	char pcFileName[ ffconfigMAX_FILENAME ];
 	char pcConnectionAck[ 128 ];
@@ -169,7 +212,8 @@ struct xFTP_CLIENT
 		struct {
 			uint32_t
 				bIsListen : 1,			/* pdTRUE for passive data connections (using list()). */
-				bDirHasEntry : 1,		/* pdTRUE if ff_findfirst() was successful. */
+				bDirHasEntry : 1,		/* pdTRUE while a directory listing is being sent. */
+				bDirIsOpen : 1,			/* pdTRUE while xDir must be closed with f_closedir(). */
 				bClientConnected : 1,	/* pdTRUE after connect() or accept() has succeeded. */
 				bEmptyFile : 1,			/* pdTRUE if a connection-without-data was received. */
 				bHadError : 1;			/* pdTRUE if a transfer got aborted because of an error. */
@@ -199,6 +243,11 @@ struct xTCP_SERVER
 
 	#if( ipconfigUSE_FTP != 0 )
 		char pcNewDir[ ffconfigMAX_FILENAME ];
+		/* Incremented by every command that changes the file system. */
+		uint32_t ulModCount;
+		#if( ipconfigFTP_LIST_CACHE_COUNT > 0 )
+			FTPList_t xListCache[ ipconfigFTP_LIST_CACHE_COUNT ];
+		#endif
 	#endif
 	#if( ipconfigUSE_HTTP != 0 )
 		char pcContentsType[40];	/* Space for the msg: "text/javascript" */
@@ -6,6 +6,49 @@
 
 #define NTPDEMO_H
 
+#include "NTPClient.h"
+
 void vStartNTPTask( uint16_t usTaskStackSize, UBaseType_t uxTaskPriority );
 
-#endif
\ No newline at end of file
+/*
+ * The disciplined clock: time since 1-1-1970 UTC, derived from the mcycle
+ * counter.  It counts from boot until the first NTP answer was received.
+ */
+uint64_t ullNTPGetTimeNs( void );
+uint64_t ullNTPGetTimeUs( void );
+
+/* pdTRUE once the clock has been set from an NTP server. */
+BaseType_t xNTPIsSynchronised( void );
+
+/* Offset of the last update (server time minus local time), and its jitter. */
+int32_t lNTPGetOffsetUs( void );
+uint32_t ulNTPGetJitterUs( void );
+
+/* Frequency correction of the mcycle counter, in parts per billion. */
+int32_t lNTPGetFrequencyPPB( void );
+
+/* Convert a time from ullNTPGetTimeNs() to an NTP timestamp (host order). */
+void vNTPTimeToTimestamp( uint64_t ullNs, SNtpTimestamp *pxTimestamp );
+
+/* What the clock is synchronised to, as reported by the SNTP server. */
+typedef struct xNTP_REFERENCE
+{
+	uint32_t ulReferenceID;		/* IPv4 address of the upstream server. */
+	uint32_t ulRootDelay;		/* NTP short format (16.16 seconds). */
+	uint32_t ulRootDispersion;
+	uint64_t ullReferenceTimeNs;	/* When the clock was last updated. */
+	uint8_t ucStratum;
+} NTPReference_t;
+
+/* Returns pdTRUE, and fills in the reference, if the clock is
+synchronised. */
+BaseType_t xNTPGetReference( NTPReference_t *pxReference );
+
+/*
+ * SNTP server (NTPServer.c): answers requests on port 123 from the clock
+ * above.
+ */
+void vStartNTPServerTask( uint16_t usTaskStackSize, UBaseType_t uxTaskPriority );
+uint32_t ulNTPServerGetRequestCount( void );
+
+#endif
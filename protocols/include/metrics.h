@@ -0,0 +1,10 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+/* Format the metrics, handing them to pxWrite a piece at a time. Returns 0,
+or what pxWrite returned when it failed. */
+extern int metricsDump( int ( *pxWrite )( void *, const void *, size_t ), void *pvContext );
+
+#endif /* METRICS_H */
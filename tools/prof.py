@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""Symbolize PC samples from the tick profiler.
+
+Reads the `prof,...` lines written by bsp/prof.c, either a console log from
+`prof dump` or the reply to GET /profile, and resolves every pc and return
+address against the function symbols of the image.  Symbols come from the
+$(PROG).asm listing the Makefile writes next to the ELF, or from the ELF
+itself with nm.
+
+Prints a flat profile, and with --folded writes `task;caller;function count`
+lines for flamegraph.pl or speedscope.  The caller is the function the
+interrupted code's return address points into.  It is exact for leaf
+functions.  It is left out when it is the function itself, which is what a
+non-leaf function holds once its first call has returned.
+
+    curl -o main_peekpoke.prof http://10.88.88.2/profile
+    tools/prof.py --asm main_peekpoke.asm main_peekpoke.prof --folded out.folded
+"""
+
+import argparse
+import bisect
+import collections
+import re
+import subprocess
+import sys
+
+ASM_LABEL = re.compile(r"^([0-9a-fA-F]+) <([^>]+)>:\s*$")
+
+
+def symbols_from_asm(path):
+    symbols = []
+    with open(path, errors="replace") as f:
+        for line in f:
+            match = ASM_LABEL.match(line)
+            if match:
+                symbols.append((int(match.group(1), 16), match.group(2)))
+    return symbols
+
+
+def symbols_from_elf(path, nm):
+    output = subprocess.run([nm, "--defined-only", path], check=True,
+                            stdout=subprocess.PIPE,
+                            universal_newlines=True).stdout
+    symbols = []
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1] in "tTwW":
+            symbols.append((int(fields[0], 16), fields[2]))
+    return symbols
+
+
+class Symbolizer:
+    def __init__(self, symbols):
+        symbols = sorted(set(symbols))
+        self.addresses = [address for address, _ in symbols]
+        self.names = [name for _, name in symbols]
+
+    def __call__(self, address):
+        index = bisect.bisect_right(self.addresses, address) - 1
+        if address == 0 or index < 0:
+            return "0x%x" % address
+        return self.names[index]
+
+
+def read_samples(path):
+    header = None
+    tasks = {}
+    samples = []
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith("prof,begin,"):
+                # A later dump in the same log replaces an earlier one
+                header = tuple(int(x) for x in line.split(",")[2:5])
+                tasks, samples = {}, []
+            elif line.startswith("prof,task,"):
+                _, _, handle, name = line.split(",", 3)
+                tasks[int(handle, 16)] = name
+            elif line.startswith("prof,sample,"):
+                task, pc, ra, count = line.split(",")[2:6]
+                samples.append((int(task, 16), int(pc, 16), int(ra, 16),
+                                int(count)))
+    if header is None:
+        sys.exit("%s: no profile found" % path)
+    return header, tasks, samples
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("profile", help="console log or GET /profile reply")
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--asm", help="$(PROG).asm listing")
+    source.add_argument("--elf", help="$(PROG).elf, read with nm")
+    parser.add_argument("--nm", default="riscv64-unknown-elf-nm",
+                        help="nm for --elf, default %(default)s")
+    parser.add_argument("--by-task", action="store_true",
+                        help="flat profile per task")
+    parser.add_argument("--folded", help="write folded stacks to this file")
+    parser.add_argument("-n", "--lines", type=int, default=40,
+                        help="functions listed per profile, 0 for all")
+    args = parser.parse_args()
+
+    if args.asm:
+        symbols = symbols_from_asm(args.asm)
+    else:
+        symbols = symbols_from_elf(args.elf, args.nm)
+    if not symbols:
+        sys.exit("no function symbols found")
+    symbolize = Symbolizer(symbols)
+
+    (hz, total, dropped), tasks, samples = read_samples(args.profile)
+
+    def task_name(handle):
+        return tasks.get(handle, "task 0x%x" % handle)
+
+    flat = collections.defaultdict(collections.Counter)
+    folded = collections.Counter()
+    for task, pc, ra, count in samples:
+        function = symbolize(pc)
+        caller = symbolize(ra)
+        name = task_name(task) if args.by_task else "all tasks"
+        flat[name][function] += count
+        stack = [task_name(task)]
+        if ra and caller != function:
+            stack.append(caller)
+        stack.append(function)
+        folded[";".join(stack)] += count
+
+    print("%d samples at %d Hz (%.2f s), %d dropped" %
+          (total, hz, total / hz if hz else 0, dropped))
+    for name in sorted(flat, key=lambda n: -sum(flat[n].values())):
+        counter = flat[name]
+        samples_in = sum(counter.values())
+        print()
+        print("%s: %d samples" % (name, samples_in))
+        print("%8s %7s  %s" % ("samples", "%", "function"))
+        for function, count in counter.most_common(args.lines or None):
+            print("%8d %6.2f%%  %s" %
+                  (count, 100.0 * count / samples_in, function))
+
+    if args.folded:
+        with open(args.folded, "w") as f:
+            for stack, count in sorted(folded.items()):
+                f.write("%s %d\n" % (stack.replace(" ", "_"), count))
+
+
+if __name__ == "__main__":
+    main()
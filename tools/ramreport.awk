@@ -0,0 +1,68 @@
+# Static RAM report, from `objdump -h -t` of the linked image:
+#
+#   $(OBJDUMP) -h -t $(PROG).elf | awk -f tools/ramreport.awk > $(PROG).ram
+#
+# Lists the size of every writable allocated section, then every object in
+# them, largest first. Statically allocated tasks and kernel objects are in
+# .rtos_static (`make STATIC=1`); the heap and the ISR stack are the .heap and
+# .stack sections.
+
+function hex(s,    i, n) {
+    n = 0
+    s = tolower(s)
+    for (i = 1; i <= length(s); i++)
+        n = n * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+    return n
+}
+
+# Section headers: "Idx Name Size VMA LMA File-off Algn", followed by a flags
+# line with GNU objdump, or "Idx Name Size VMA Type" with llvm-objdump
+/^ *[0-9]+ +\./ && NF >= 4 {
+    last = $2
+    sections[++count] = $2
+    size[$2] = hex($3)
+    if (($5 == "DATA" && $2 !~ /^\.s?rodata/) || $5 == "BSS")
+        writable[$2] = 1
+    next
+}
+last != "" && /ALLOC/ {
+    if ($0 !~ /READONLY/ && $0 !~ /CODE/)
+        writable[last] = 1
+    last = ""
+    next
+}
+{ last = "" }
+
+# Symbols: "VMA flags section<TAB>size name", objects only
+/^[0-9a-fA-F]+ / && index($0, "\t") {
+    split($0, parts, "\t")
+    n = split(parts[1], head, " ")
+    if (head[n - 1] !~ /O/)
+        next
+    # "size .hidden name" for hidden symbols: the name is the last field
+    m = split(parts[2], tail, " ")
+    objects[++nobjects] = sprintf("%10d  %-14s %s", hex(tail[1]), head[n], tail[m])
+    object_section[nobjects] = head[n]
+    object_size[nobjects] = hex(tail[1])
+}
+
+END {
+    total = 0
+    print "Static RAM by section (bytes)"
+    for (i = 1; i <= count; i++) {
+        name = sections[i]
+        if (!writable[name] || size[name] == 0)
+            continue
+        printf "%10d  %s\n", size[name], name
+        total += size[name]
+    }
+    printf "%10d  total\n\n", total
+
+    print "Static RAM by object (bytes), largest first"
+    fflush()
+    sort = "sort -rn"
+    for (i = 1; i <= nobjects; i++)
+        if (writable[object_section[i]] && object_size[i] > 0)
+            print objects[i] | sort
+    close(sort)
+}
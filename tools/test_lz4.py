@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+"""Host test of the netboot LZ4 frame decoder.
+
+Builds demo/lz4_stream.c with the host C compiler, against a stub
+FreeRTOS.h that maps the heap to malloc, and feeds it frames made by
+python-lz4 (pip install lz4).  Every frame is written to the decoder whole,
+a byte at a time and in random pieces.  The output must come in order, as
+one contiguous stream, and match the original data byte for byte.
+
+The frames cover the block sizes from 64 KiB to 4 MiB, linked and
+independent blocks, block and content checksums, the content size field,
+uncompressed blocks, skippable and concatenated frames, and data larger
+than the 64 KiB history.  Truncated frames must be reported by
+lz4_stream_finish().
+
+    tools/test_lz4.py [--cc cc] [demo/lz4_stream.c]
+"""
+
+import argparse
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+
+try:
+    import lz4.frame
+except ImportError:
+    sys.exit("tools/test_lz4.py needs python-lz4: pip install lz4")
+
+SKIPPABLE_MAGIC = 0x184D2A50
+CHUNKINGS = 4
+
+STUB_FREERTOS = """\
+#include <stdlib.h>
+#define pvPortMalloc malloc
+#define vPortFree free
+"""
+
+# Usage: driver <input> <output> <seed>.  Seed 0 writes the input whole,
+# seed 1 a byte at a time, others in random pieces of up to 4 KiB.
+DRIVER = r"""
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lz4_stream.h"
+
+static int output(void *ctx, size_t off, const char *data, size_t len)
+{
+	static size_t next;
+
+	if (off != next)
+	{
+		fprintf(stderr, "output at %zu, expected %zu\n", off, next);
+		return 1;
+	}
+	next += len;
+	return fwrite(data, 1, len, ctx) != len;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *in = fopen(argv[1], "rb");
+	FILE *out = fopen(argv[2], "wb");
+	unsigned seed = strtoul(argv[3], NULL, 0);
+	static uint8_t data[16 << 20];
+	size_t len = fread(data, 1, sizeof(data), in);
+	struct lz4_stream stream;
+
+	srand(seed);
+	if (lz4_stream_init(&stream, output, out))
+		return 2;
+	for (size_t off = 0, n; off < len; off += n)
+	{
+		n = seed == 0 ? len : seed == 1 ? 1 : 1 + rand() % 4096;
+		if (n > len - off)
+			n = len - off;
+		if (lz4_stream_write(&stream, data + off, n))
+			return 1;
+	}
+	int err = lz4_stream_finish(&stream);
+	lz4_stream_free(&stream);
+	fclose(out);
+	return err;
+}
+"""
+
+
+def build(cc, source, directory):
+    with open(os.path.join(directory, "FreeRTOS.h"), "w") as f:
+        f.write(STUB_FREERTOS)
+    driver = os.path.join(directory, "driver.c")
+    with open(driver, "w") as f:
+        f.write(DRIVER)
+    program = os.path.join(directory, "driver")
+    subprocess.run([cc, "-std=gnu11", "-O1", "-Wall", "-Werror", "-Wno-format",
+                    "-I", directory, "-I", os.path.dirname(source),
+                    "-o", program, driver, source], check=True)
+    return program
+
+
+def samples():
+    """Named data to compress, from empty to well past the history size"""
+    rng = random.Random(1)
+    text = b"".join(b"%d: the quick brown fox jumps over the lazy dog\n" % i
+                    for i in range(40000))
+    words = [bytes(rng.randbytes(rng.randint(1, 12))) for _ in range(64)]
+    return [
+        ("empty", b""),
+        ("byte", b"x"),
+        ("zeros", bytes(300000)),
+        ("text", text),
+        ("random", rng.randbytes(200000)),
+        ("words", b"".join(rng.choice(words) for _ in range(100000))),
+        ("mixed", rng.randbytes(70000) + bytes(70000) + text[:70000]),
+    ]
+
+
+def frames():
+    """(name, frame, data) for every frame option the decoder must handle"""
+    for name, data in samples():
+        for block_size in (lz4.frame.BLOCKSIZE_MAX64KB, lz4.frame.BLOCKSIZE_MAX256KB,
+                           lz4.frame.BLOCKSIZE_MAX1MB, lz4.frame.BLOCKSIZE_MAX4MB):
+            for linked in (True, False):
+                frame = lz4.frame.compress(data, block_size=block_size, block_linked=linked)
+                yield ("%s block_size=%d linked=%s" % (name, block_size, linked), frame, data)
+        yield (name + " checksums", lz4.frame.compress(
+            data, block_checksum=True, content_checksum=True, store_size=True), data)
+        yield (name + " level=12", lz4.frame.compress(
+            data, compression_level=12), data)
+
+    rng = random.Random(2)
+    first, second = rng.randbytes(100000), b"abc" * 50000
+    skippable = struct.pack("<II", SKIPPABLE_MAGIC + 5, 7) + b"skipped"
+    yield ("concatenated", lz4.frame.compress(first) + lz4.frame.compress(second),
+           first + second)
+    yield ("skippable", skippable + lz4.frame.compress(second) + skippable,
+           second)
+
+
+def decode(program, directory, frame, seed):
+    """Decoder exit status and output for frame written in the seed's pieces"""
+    source = os.path.join(directory, "in.lz4")
+    output = os.path.join(directory, "out")
+    with open(source, "wb") as f:
+        f.write(frame)
+    status = subprocess.run([program, source, output, str(seed)],
+                            stdout=subprocess.DEVNULL).returncode
+    with open(output, "rb") as f:
+        return status, f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", nargs="?",
+                        default=os.path.join(os.path.dirname(__file__), "..", "demo", "lz4_stream.c"))
+    parser.add_argument("--cc", default="cc", help="host C compiler")
+    args = parser.parse_args()
+
+    count = 0
+    failures = 0
+    with tempfile.TemporaryDirectory() as directory:
+        program = build(args.cc, os.path.abspath(args.source), directory)
+        for name, frame, data in frames():
+            for seed in range(CHUNKINGS):
+                status, decoded = decode(program, directory, frame, seed)
+                count += 1
+                if status != 0 or decoded != data:
+                    failures += 1
+                    print("%s, chunking %d: status %d, %d of %d bytes%s" % (
+                        name, seed, status, len(decoded), len(data),
+                        "" if decoded == data[:len(decoded)] else ", wrong data"))
+            if len(frame) > 8:
+                status, _ = decode(program, directory, frame[:-5], 2)
+                count += 1
+                if status == 0:
+                    failures += 1
+                    print("%s: truncated frame accepted" % name)
+    print("%d cases, %d failed" % (count, failures))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
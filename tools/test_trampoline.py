@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+"""Host test of the netboot load trampoline's copy and zero loops.
+
+Preprocesses demo/netboot.S for rv32 and rv64 with the host cpp, and runs
+the load command loop, from its first command to the fences, on a small
+model of the RISC-V instructions it uses.  Every load command copies copysz
+bytes from src to dst and zeroes the zerosz bytes that follow.  The
+resulting memory is compared byte for byte with the expected one, so the
+guard bytes on both sides of each destination are checked too, and every
+word access must be naturally aligned.
+
+The sweep covers src and dst alignments 0..WORD-1, copysz and zerosz of 0,
+1, WORD-1, WORD, UNROLL*WORD-1, UNROLL*WORD, UNROLL*WORD+1 and larger, and
+src == dst, where only the zeroing runs.
+
+    tools/test_trampoline.py [--cpp cpp] [demo/netboot.S]
+"""
+
+import argparse
+import os
+import random
+import re
+import subprocess
+import sys
+
+MEMORY_SIZE = 8192
+SRC_BASE = 256
+DST_BASE = 4096
+COMMANDS_BASE = 7168
+MAX_STEPS = 1000000
+
+LOCAL_LABEL = re.compile(r"^(\d+):\s*(.*)$")
+MEMORY_OPERAND = re.compile(r"^(.*)\((\w+)\)$")
+ACCESS_SIZE = {"lb": 1, "sb": 1, "lw": 4, "sw": 4, "ld": 8, "sd": 8}
+
+
+class TrampolineError(Exception):
+    pass
+
+
+def preprocess(cpp, source, xlen):
+    """The trampoline for one xlen, as a list of (local label, instruction)"""
+    text = subprocess.run([cpp, "-P", "-D__riscv_xlen=%d" % xlen, source],
+                          check=True, capture_output=True, text=True).stdout
+    body = []
+    started = False
+    for line in text.splitlines():
+        line = re.sub(r"/\*.*?\*/", "", line).split("#")[0].strip()
+        label = None
+        match = LOCAL_LABEL.match(line)
+        if match:
+            label, line = match.group(1), match.group(2).strip()
+        if label == "1":
+            started = True
+        if not started:
+            continue
+        body.append((label, line if line and not line.startswith(".") else None))
+        if label == "8":
+            break
+    return body
+
+
+class Program:
+    """Instructions of the command loop, with numeric labels resolved"""
+
+    def __init__(self, body):
+        self.instructions = []
+        self.labels = []
+        for label, instruction in body:
+            if label is not None:
+                self.labels.append((label, len(self.instructions)))
+            if instruction is not None:
+                self.instructions.append(instruction)
+        self.end = dict(self.labels)["8"]
+
+    def target(self, reference, pc):
+        name, direction = reference[:-1], reference[-1]
+        if direction == "f":
+            return min(i for label, i in self.labels if label == name and i > pc)
+        return max(i for label, i in self.labels if label == name and i <= pc)
+
+
+def evaluate(expression):
+    return int(eval(expression.replace("/", "//"), {"__builtins__": {}}))
+
+
+def run(program, xlen, memory, commands):
+    mask = (1 << xlen) - 1
+    registers = {"a3": commands}
+
+    def get(register):
+        return 0 if register == "zero" else registers.get(register, 0)
+
+    def address(operand):
+        match = MEMORY_OPERAND.match(operand)
+        offset = evaluate(match.group(1)) if match.group(1) else 0
+        return (offset + get(match.group(2))) & mask
+
+    pc = 0
+    for _ in range(MAX_STEPS):
+        if pc == program.end:
+            return
+        op, *args = re.split(r"[\s,]+", program.instructions[pc])
+        next_pc = pc + 1
+        if op in ("lb", "lw", "ld"):
+            size = ACCESS_SIZE[op]
+            where = address(args[1])
+            if where % size:
+                raise TrampolineError("misaligned %s at %#x" % (op, where))
+            value = int.from_bytes(memory[where:where + size], "little", signed=True)
+            registers[args[0]] = value & mask
+        elif op in ("sb", "sw", "sd"):
+            size = ACCESS_SIZE[op]
+            where = address(args[1])
+            if where % size:
+                raise TrampolineError("misaligned %s at %#x" % (op, where))
+            value = get(args[0]) & ((1 << (8 * size)) - 1)
+            memory[where:where + size] = value.to_bytes(size, "little")
+        elif op == "li":
+            registers[args[0]] = evaluate(args[1]) & mask
+        elif op == "addi":
+            registers[args[0]] = (get(args[1]) + evaluate(args[2])) & mask
+        elif op == "add":
+            registers[args[0]] = (get(args[1]) + get(args[2])) & mask
+        elif op == "sub":
+            registers[args[0]] = (get(args[1]) - get(args[2])) & mask
+        elif op == "or":
+            registers[args[0]] = get(args[1]) | get(args[2])
+        elif op == "and":
+            registers[args[0]] = get(args[1]) & get(args[2])
+        elif op == "beqz":
+            if get(args[0]) == 0:
+                next_pc = program.target(args[1], pc)
+        elif op == "bne":
+            if get(args[0]) != get(args[1]):
+                next_pc = program.target(args[2], pc)
+        elif op == "bltu":
+            if get(args[0]) < get(args[1]):
+                next_pc = program.target(args[2], pc)
+        elif op == "bleu":
+            if get(args[0]) <= get(args[1]):
+                next_pc = program.target(args[2], pc)
+        elif op == "j":
+            next_pc = program.target(args[0], pc)
+        else:
+            raise TrampolineError("unsupported instruction: %s" % program.instructions[pc])
+        pc = next_pc
+    raise TrampolineError("no end after %d instructions" % MAX_STEPS)
+
+
+def check(program, xlen, loads, seed):
+    """Run the (src, dst, copysz, zerosz) loads, return an error or None"""
+    word = xlen // 8
+    memory = bytearray(random.Random(seed).randbytes(MEMORY_SIZE))
+
+    commands = bytearray()
+    for load in list(loads) + [(0, 0, 0, 0)]:
+        for value in load:
+            commands += value.to_bytes(word, "little")
+    memory[COMMANDS_BASE:COMMANDS_BASE + len(commands)] = commands
+
+    expected = bytearray(memory)
+    for src, dst, copysz, zerosz in loads:
+        expected[dst:dst + copysz] = bytes(expected[src:src + copysz])
+        expected[dst + copysz:dst + copysz + zerosz] = bytes(zerosz)
+
+    try:
+        run(program, xlen, memory, COMMANDS_BASE)
+    except TrampolineError as error:
+        return str(error)
+    if memory != expected:
+        first = next(i for i in range(MEMORY_SIZE) if memory[i] != expected[i])
+        return "wrong byte at %#x: %#04x, expected %#04x" % (first, memory[first], expected[first])
+    return None
+
+
+def unroll(source):
+    """Words moved per iteration of the bulk loops, as defined in the source"""
+    with open(source) as f:
+        return int(re.search(r"^#define UNROLL (\d+)", f.read(), re.M).group(1))
+
+
+def sizes(word, unrolled):
+    block = unrolled * word
+    return [0, 1, word - 1, word, block - 1, block, block + 1,
+            2 * block + word + 1, 5 * block - 1]
+
+
+def cases(word, unrolled):
+    for src_align in range(word):
+        for dst_align in range(word):
+            for copysz in sizes(word, unrolled):
+                for zerosz in sizes(word, unrolled):
+                    yield [(SRC_BASE + src_align, DST_BASE + dst_align, copysz, zerosz)]
+    # Already in place: only the zeroing runs
+    for align in range(word):
+        for copysz in sizes(word, unrolled):
+            for zerosz in sizes(word, unrolled):
+                yield [(DST_BASE + align, DST_BASE + align, copysz, zerosz)]
+    # Several commands in one list
+    yield [(SRC_BASE + 1, DST_BASE, 3 * word, word + 1),
+           (DST_BASE + 1024, DST_BASE + 1024, 17, 40),
+           (SRC_BASE + 512 + 2, DST_BASE + 2048 + 3, 2 * unrolled * word + 5, 0)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", nargs="?",
+                        default=os.path.join(os.path.dirname(__file__), "..", "demo", "netboot.S"))
+    parser.add_argument("--cpp", default="cpp", help="host C preprocessor")
+    args = parser.parse_args()
+
+    unrolled = unroll(args.source)
+    failed = False
+    for xlen in (32, 64):
+        program = Program(preprocess(args.cpp, args.source, xlen))
+        count = 0
+        failures = 0
+        for seed, loads in enumerate(cases(xlen // 8, unrolled)):
+            error = check(program, xlen, loads, seed)
+            count += 1
+            if error:
+                failures += 1
+                print("rv%d %s: %s" % (xlen, loads, error))
+        print("rv%d: %d cases, %d failed" % (xlen, count, failures))
+        failed = failed or failures != 0
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
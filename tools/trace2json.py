@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""Convert a kernel trace image to Chrome trace event JSON.
+
+The image is what bsp/trace.c writes: either the raw bytes, as served on
+GET /trace, or a console log holding the `trace,...` lines printed by
+trace_dump_uart().  Open the output in https://ui.perfetto.dev or
+chrome://tracing.
+
+    curl -o trace.bin http://10.88.88.2/trace
+    tools/trace2json.py trace.bin -o trace.json
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+TRACE_MAGIC = 0x52545246
+HEADER = struct.Struct("<IHHIIII")
+TASK = struct.Struct("<I16s")
+EVENT = struct.Struct("<QII")
+
+# enum trace_event_type in bsp/trace.h
+(TASK_SWITCHED_IN, TASK_SWITCHED_OUT, TASK_CREATE, TASK_DELETE, TASK_DELAY,
+ QUEUE_SEND, QUEUE_SEND_FROM_ISR, QUEUE_SEND_FAILED, QUEUE_RECEIVE,
+ QUEUE_RECEIVE_FROM_ISR, QUEUE_RECEIVE_FAILED, QUEUE_BLOCK_ON_SEND,
+ QUEUE_BLOCK_ON_RECEIVE, ISR_ENTER, ISR_EXIT, IP_TRANSMIT, IP_RECEIVE,
+ IP_EVENT, IP_NO_BUFFER) = range(1, 20)
+
+INSTANTS = {
+    TASK_CREATE: "create",
+    TASK_DELETE: "delete",
+    TASK_DELAY: "delay",
+    QUEUE_SEND: "queue send",
+    QUEUE_SEND_FROM_ISR: "queue send from ISR",
+    QUEUE_SEND_FAILED: "queue send failed",
+    QUEUE_RECEIVE: "queue receive",
+    QUEUE_RECEIVE_FROM_ISR: "queue receive from ISR",
+    QUEUE_RECEIVE_FAILED: "queue receive failed",
+    QUEUE_BLOCK_ON_SEND: "block on queue send",
+    QUEUE_BLOCK_ON_RECEIVE: "block on queue receive",
+    IP_TRANSMIT: "ip transmit",
+    IP_RECEIVE: "ip receive",
+    IP_EVENT: "ip event",
+    IP_NO_BUFFER: "ip no network buffer",
+}
+
+# eIPEvent_t in FreeRTOS_IP_Private.h
+IP_EVENTS = [
+    "eNetworkDownEvent", "eNetworkRxEvent", "eARPTimerEvent",
+    "eStackTxEvent", "eDHCPEvent", "eTCPTimerEvent", "eTCPAcceptEvent",
+    "eTCPNetStat", "eSocketBindEvent", "eSocketCloseEvent",
+    "eSocketSelectEvent", "eSocketSignalEvent",
+]
+
+PID_CPU, PID_TASKS, PID_IRQ = 0, 1, 2
+
+
+def read_image(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) >= 4 and struct.unpack_from("<I", data)[0] == TRACE_MAGIC:
+        return data
+
+    # Console log: hex between "trace,begin" and "trace,end"
+    chunks = []
+    inside = False
+    for line in data.decode("ascii", "replace").splitlines():
+        line = line.strip()
+        if line.startswith("trace,begin"):
+            chunks = []
+            inside = True
+        elif line.startswith("trace,end"):
+            inside = False
+        elif inside and line.startswith("trace,"):
+            chunks.append(bytes.fromhex(line[len("trace,"):]))
+    if not chunks:
+        sys.exit("%s: no trace image found" % path)
+    return b"".join(chunks)
+
+
+def parse(data):
+    magic, version, event_size, hz, ntasks, nevents, lost = \
+        HEADER.unpack_from(data)
+    if magic != TRACE_MAGIC or version != 1 or event_size != EVENT.size:
+        sys.exit("unsupported trace image")
+    offset = HEADER.size
+    tasks = {}
+    for _ in range(ntasks):
+        handle, name = TASK.unpack_from(data, offset)
+        tasks[handle] = name.split(b"\0", 1)[0].decode("ascii", "replace")
+        offset += TASK.size
+    available = (len(data) - offset) // EVENT.size
+    if available < nevents:
+        print("warning: image truncated, %d of %d events" %
+              (available, nevents), file=sys.stderr)
+        nevents = available
+    events = [EVENT.unpack_from(data, offset + i * EVENT.size)
+              for i in range(nevents)]
+    return hz, tasks, events, lost
+
+
+def convert(hz, tasks, events, lost):
+    out = []
+    if not events:
+        return out
+    start = events[0][0]
+
+    def us(cycles):
+        return (cycles - start) * 1e6 / hz
+
+    def task_name(handle):
+        return tasks.get(handle, "task 0x%08x" % handle)
+
+    tids = {}
+
+    def task_tid(handle):
+        if handle not in tids:
+            tids[handle] = len(tids) + 1
+            out.append({"ph": "M", "name": "thread_name", "pid": PID_TASKS,
+                        "tid": tids[handle],
+                        "args": {"name": task_name(handle)}})
+        return tids[handle]
+
+    out.append({"ph": "M", "name": "process_name", "pid": PID_CPU,
+                "args": {"name": "CPU"}})
+    out.append({"ph": "M", "name": "process_name", "pid": PID_TASKS,
+                "args": {"name": "Tasks"}})
+    out.append({"ph": "M", "name": "process_name", "pid": PID_IRQ,
+                "args": {"name": "PLIC sources"}})
+    if lost:
+        out.append({"ph": "i", "s": "g", "name": "%d earlier events lost" %
+                    lost, "pid": PID_CPU, "tid": 0, "ts": 0})
+
+    current = None
+    running_since = None
+    irq_since = {}
+    for cycles, kind, arg in events:
+        ts = us(cycles)
+        if kind == TASK_SWITCHED_IN:
+            current, running_since = arg, ts
+        elif kind == TASK_SWITCHED_OUT:
+            if running_since is not None and current == arg:
+                for pid, tid in ((PID_CPU, 0), (PID_TASKS, task_tid(arg))):
+                    out.append({"ph": "X", "name": task_name(arg), "pid": pid,
+                                "tid": tid, "ts": running_since,
+                                "dur": ts - running_since})
+            current, running_since = None, None
+        elif kind == ISR_ENTER:
+            irq_since[arg] = ts
+        elif kind == ISR_EXIT:
+            if arg in irq_since:
+                since = irq_since.pop(arg)
+                out.append({"ph": "X", "name": "irq %d" % arg, "pid": PID_IRQ,
+                            "tid": arg, "ts": since, "dur": ts - since})
+        elif kind in INSTANTS:
+            name = INSTANTS[kind]
+            args = {}
+            if kind in (TASK_CREATE, TASK_DELETE, TASK_DELAY):
+                name += " " + task_name(arg)
+            elif kind == IP_EVENT:
+                args["event"] = (IP_EVENTS[arg] if arg < len(IP_EVENTS)
+                                 else arg)
+            elif QUEUE_SEND <= kind <= QUEUE_BLOCK_ON_RECEIVE:
+                args["queue"] = "0x%08x" % arg
+            owner = current if current is not None else 0
+            out.append({"ph": "i", "s": "t", "name": name, "pid": PID_TASKS,
+                        "tid": task_tid(owner), "ts": ts, "args": args})
+
+    # The task running at the time of the dump
+    if running_since is not None:
+        end = us(events[-1][0])
+        for pid, tid in ((PID_CPU, 0), (PID_TASKS, task_tid(current))):
+            out.append({"ph": "X", "name": task_name(current), "pid": pid,
+                        "tid": tid, "ts": running_since,
+                        "dur": end - running_since})
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("image", help="raw trace image or console log")
+    parser.add_argument("-o", "--output", help="JSON file, default stdout")
+    args = parser.parse_args()
+
+    hz, tasks, events, lost = parse(read_image(args.image))
+    trace = {"traceEvents": convert(hz, tasks, events, lost),
+             "displayTimeUnit": "ns"}
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+    print("%d events, %d lost, %d Hz" % (len(events), lost, hz),
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()